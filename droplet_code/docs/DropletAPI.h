@@ -65,6 +65,54 @@
 uint8_t ir_send(uint8_t dir_mask, char* data, uint8_t data_length);
 uint8_t ir_targeted_send(uint8_t dir_mask, char *data, uint16_t data_length, id_t target);
 
+/*
+ *      Like ir_send, but instead of a dir_mask you give the direction you want the
+ *  message to go in. The message is sent on the fewest sides needed to cover a cone
+ *  'spread' degrees wide, centered on 'bearing'.
+ *
+ *  bearing: in degrees, measured the same way as last_good_rnb.bearing. So, to send
+ *      toward the Droplet you just measured, pass in last_good_rnb.bearing.
+ *  spread: width of the cone, in degrees. 0 sends on exactly one side; 300 or more
+ *      sends on all of them.
+ */
+uint8_t ir_send_toward(int16_t bearing, uint16_t spread, char* data, uint8_t data_length);
+
+/*
+ *      Like ir_send, with a priority class: IR_PRIO_BULK, IR_PRIO_NORMAL (what ir_send
+ *  uses), or IR_PRIO_CONTROL. If the channels are busy sending something of a lower
+ *  class, that message is cut off and this one goes out about 30ms later instead of
+ *  failing. If something else (RNB, say) still has them then, it keeps trying for up to
+ *  half a second before it's dropped. When a Droplet gets more messages than it can hold, bulk ones are dropped
+ *  first, and handle_msg always gets the highest class first.
+ *      For about a third of a second every 5 seconds, while firefly sync pings, only
+ *  IR_PRIO_CONTROL messages can be sent: ir_send and the rest return '0', just as if
+ *  the channels were busy, so try again a little later.
+ */
+uint8_t ir_send_prio(uint8_t dir_mask, char* data, uint8_t data_length, uint8_t prio);
+
+/*
+ *      Instead of checking the first byte of every message in handle_msg, you can
+ *  register a function for each kind of message your program sends. Call this in
+ *  init() with the first byte your messages of that kind start with, and the
+ *  shortest and longest lengths they can have. Matching messages go to 'handler'
+ *  instead of handle_msg; ones of the wrong length are dropped. Anything else still
+ *  goes to handle_msg. Returns '0' if the type is already taken (mesh and gossip use
+ *  0x1C-0x1F), or there's no room left. See droplet_programs/task_alloc.c.
+ */
+uint8_t register_msg_handler(char type, uint8_t min_length, uint8_t max_length, MsgHandler handler);
+
+/*
+ *      Sends a different message on each side at the same time, which takes as long as
+ *  sending the longest one. Each IrSendVec has a single direction (0-5, not a
+ *  dir_mask), the data, and its length. Each direction may only be used once.
+ *  Returns '0' if nothing was sent.
+ *      Six ir_sends to 1<<dir, made one straight after another, go out together
+ *  too, and take no longer; ir_send_vec's difference is that either every message
+ *  goes or none does. Waiting for each send to finish before the next is what
+ *  takes five or six times as long. See DropletRNBcalib/ir_send_vec_sim.c.
+ */
+uint8_t ir_send_vec(IrSendVec* vecs, uint8_t count);
+
 /*
  * Functions below are used to set the intensity of the red, green, and blue
  * LEDs respectively. Range is 0-255. Setting an LED to 0 turns it off.
@@ -103,9 +151,28 @@ void set_hsv(uint16_t h, uint8_t s, uint8_t v);
  *      uint16_t r,g,b;
  *      get_rgb_sensor(&r, &g, &b);
  *      //use r,g,b as you desire.
+ *  On Droplets without a mic, this doesn't wait on the ADC: the colors are sampled in the
+ *  background every millisecond or so, and this returns the median of the last three. If
+ *  those are more than RGB_SNAPSHOT_MAX_AGE_MS old, because the sampler was stopped for an rnb
+ *  measurement or the like, it measures the colors itself, as it used to.
  */
 void get_rgb(int16_t* r, int16_t* g, int16_t* b);
 
+/*
+ *  The IR sensors are sampled in the background too, whenever nothing else is using them
+ *  (see sensor_snapshot.h). This copies each sensor's latest reading, less its baseline, in to
+ *  output_arr, indexed by direction, without waiting for the ADC. It returns the get_time() at
+ *  which the oldest of them was taken, or 0 if some sensor hasn't been sampled yet:
+ *      int16_t ir[6];
+ *      uint32_t taken = get_ir_snapshots(ir);
+ *      if(taken && get_time()-taken<100){
+ *          //use ir as you desire.
+ *      }
+ *  They're refreshed every millisecond on Droplets with a mic, and every 30ms or so on the
+ *  others, which only have the one ADC channel for all six.
+ */
+uint32_t get_ir_snapshots(int16_t* output_arr);
+
 // Range and Bearing
 /*
  *  'rnb' is short for 'range and bearing', and getting this data is made a little bit more
@@ -122,20 +189,65 @@ void get_rgb(int16_t* r, int16_t* g, int16_t* b);
  *      Periodically have every Droplet call broadcast_rnb_data(). 
  *      You don't want to do this /too/ frequently. Try around every 5 seconds.
  *      In every Droplet's loop(), have:
- *          if(rnb_updated){
- *             //new data in last_good_rnb, ie.:
- *             last_good_rnb.id_number;
- *             last_good_rnb.range;
- *             last_good_rnb.bearing;
- *             last_good_rnb.heading;
- *             rnb_updated = 0; //Note! This line must be included for things to work properly.
+ *          rnb r;
+ *          while(rnb_next(&r)){
+ *             //new data in r, ie.:
+ *             r.id;
+ *             r.range;
+ *             r.bearing;
+ *             r.heading;
+ *             r.confidence; //255 for the best, down to 1.
+ *             r.time; //When the broadcast started, by get_time().
  *          }
  *      So if Droplets A,B,C, and D all have this in their code, and Droplet A
  *      does an rnb broadcast, Droplets B,C, and D will all get new rnb data for Droplet A.
  *
- *  An rnb broadcasto takes ~142ms.
+ *  rnb_next() gives the oldest result you haven't had yet, and holds up to RNB_QUEUE_SIZE of them, so
+ *  none are lost if several neighbours broadcast during one loop(). If you don't keep up, the oldest are
+ *  dropped; rnb_dropped() says how many, since you last asked. rnb_pending() says how many are waiting.
+ *
+ *  Older code checks rnb_updated instead, and reads the latest result out of last_good_rnb:
+ *          if(rnb_updated){
+ *             last_good_rnb.range; //etc.
+ *             rnb_updated = 0; //Note! This line must be included for things to work properly.
+ *          }
+ *  That still works, but if two results come in before you look, you only see the second.
+ *
+ *  Measurements which look wrong (a poor fit, too dim against the noise, saturated sensors, or a big jump
+ *  from the last one from the same Droplet) are thrown out, and don't go in the queue or last_good_rnb.
+ *
+ *  An rnb broadcasto takes ~86ms. broadcast_fast_rnb_data() takes ~74ms, and is a bit less accurate.
+ *  Interrupts stay on while it runs, on both ends, so messages, serial input and scheduled tasks carry on,
+ *  though the IR is tied up.
+ *
+ *  The broadcast always goes out at full IR power (256), since ranges are only calibrated for that. If
+ *  you've lowered it with set_all_ir_powers(), it's put back to what you set once the broadcast is done.
+ *
+ *  If RNB_CODED_BROADCASTS is defined (see rnb_math.h), broadcast_coded_rnb_data() has up to six of
+ *  your neighbours broadcast along with you, so everyone else gets rnb data for all of you at once.
+ *  It takes ~400ms. Neighbours who've lowered their IR power sit it out. They all go in the
+ *  queue; last_good_rnb only holds one, so it gets the brightest.
  */
 broadcast_rnb_data();
+broadcast_fast_rnb_data();
+broadcast_coded_rnb_data();
+rnb_next(rnb* out);
+rnb_pending();
+rnb_dropped();
+
+/*
+ *  Each single rnb result is noisy. The neighbor table also tracks every neighbour across results, and
+ *  across your own walks and spins, and neighbor_track() gives where it thinks that neighbour is now:
+ *      RnbTrackPolar est;
+ *      if(neighbor_track(id, &est)){
+ *          est.range;    est.range_sd;   //mm
+ *          est.bearing;  est.bearing_sd; //degrees
+ *          est.heading;  est.heading_sd;
+ *      }
+ *  The standard deviations grow while you don't hear from it. Your own moves are only accounted for in
+ *  directions with calibrated mm_per_kilostep values.
+ */
+neighbor_track(id_t id, RnbTrackPolar* out);
 
 /* 
  *  IR (Infrared) Directions:
@@ -23,6 +23,9 @@ void init()
 
 	add_group_member ( get_droplet_id() );
 	change_state ( WAITING );
+	
+	register_msg_handler ( '<', 3, 3, handle_heartbeat_msg );
+	register_msg_handler ( 'G', 2, 2, handle_go_msg );
 }
 
 /*
@@ -253,10 +256,10 @@ void change_state ( State new_state )
 
 
 /*
- * After each pass through loop(), the robot checks for all messages it has 
- * received, and calls this function once for each message.
+ * Heartbeats, "<3Y" or "<3N": a group member, and whether it's voted to go.
+ * Registered in init, which has already checked the length.
  */
-void handle_msg(ir_msg* msg_struct)
+void handle_heartbeat_msg(ir_msg* msg_struct)
 {
 	if ( state!=WAITING ) return;
 	
@@ -268,10 +271,29 @@ void handle_msg(ir_msg* msg_struct)
 			yes_count++;
 		}
 	}
-	else if ( strcmp(msg_struct->msg,"GO") == 0 )
+}
+
+/*
+ * "GO": the group's decided, so pass it on and start.
+ */
+void handle_go_msg(ir_msg* msg_struct)
+{
+	if ( state!=WAITING ) return;
+	
+	if ( strcmp(msg_struct->msg,"GO") == 0 )
 	{
 		char *msg = "GO";
 		ir_send ( ALL_DIRS, msg, 2 );
 		change_state ( COLLABORATING );
 	}
+}
+
+/*
+ * After each pass through loop(), the robot checks for all messages it has 
+ * received, and calls this function once for each message. Everything this
+ * program sends goes to the handlers registered in init, so this only sees
+ * messages from other programs.
+ */
+void handle_msg(ir_msg* msg_struct __attribute__ ((unused)))
+{
 }
\ No newline at end of file
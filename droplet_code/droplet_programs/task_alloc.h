@@ -58,6 +58,8 @@ void		add_group_member	( uint16_t	senderID	);
 // Droplet Communication Helper Functions
 void		clear_state			();
 void		change_state		( State		new_state	);
+void		handle_heartbeat_msg( ir_msg*	msg_struct	);
+void		handle_go_msg		( ir_msg*	msg_struct	);
 
 void init();
 void loop();
@@ -44,6 +44,18 @@
 
 typedef uint16_t id_t;
 
+typedef struct ir_msg_struct
+{
+	uint32_t arrival_time;	// Time of message receipt.
+	uint16_t sender_ID;		// ID of sending robot.
+	char* msg;				// The message.
+	uint8_t dir_received;	// Which side was this message received on?
+	uint8_t length;			// Message length.
+	uint8_t wasTargeted;
+	int16_t strength[6];	// How bright the sender looked to each sensor. 0 on sides which didn't get the message.
+	int16_t bearing;		// Rough guess at the sender's bearing, from strength. IR_NO_BEARING if there wasn't enough signal.
+} ir_msg;
+
 //Other Droplet files.
 #include "scheduler.h"
 #include "pc_comm.h"
@@ -56,6 +68,9 @@ typedef uint16_t id_t;
 #include "ir_led.h"
 #include "ir_sensor.h"
 #include "ir_comm.h"
+#include "ir_baud.h"
+#include "neighbors.h"
+#include "msg_dispatch.h"
 #include "speaker.h"
 #include "mic.h"
 #include "motor.h"
@@ -64,16 +79,6 @@ typedef uint16_t id_t;
 #include "serial_handler.h"
 #include "matrix_utils.h"
 
-typedef struct ir_msg_struct
-{
-	uint32_t arrival_time;	// Time of message receipt.
-	uint16_t sender_ID;		// ID of sending robot.
-	char* msg;				// The message.
-	uint8_t dir_received;	// Which side was this message received on?
-	uint8_t length;			// Message length.
-	uint8_t wasTargeted;
-} ir_msg;
-
 extern void init();
 extern void loop();
 extern void handle_msg(ir_msg* msg_struct);
@@ -17,6 +17,13 @@
 #define FFSYNC_D				160
 #define FFSYNC_W				200
 
+//Around each ping, only IR_PRIO_CONTROL sends start (see ir_quiet), so the neighbours' channels are free to hear
+//ours and we can hear theirs. It starts FFSYNC_QUIET_LEAD ms before the counter wraps, longer than any message
+//takes, and ends FFSYNC_QUIET_TAIL ms after our last ping could have gone out: 360ms in every 5153, all told.
+#define FFSYNC_QUIET_LEAD		100
+#define FFSYNC_QUIET_TAIL		100
+#define FFSYNC_QUIET_CC			(FFSYNC_FULL_PERIOD-(uint16_t)(FFSYNC_QUIET_LEAD*FFSYNC_MS_CONVERSION_FACTOR))
+
 void firefly_sync_init();
 
 void set_sync_blink_color(uint8_t r, uint8_t g, uint8_t b);
@@ -0,0 +1,79 @@
+/** \file *********************************************************************
+ * \brief Epidemic dissemination of small items, using Bloom-filter digests.
+ *
+ * Each item has a 16-bit ID chosen by the user and an 8-bit version, which is
+ * bumped every time the item is republished. Every GOSSIP_PERIOD_MS, each
+ * Droplet broadcasts a Bloom filter of the (ID, version) pairs it holds. A
+ * neighbour that holds a pair missing from the filter sends that item back out
+ * the direction the digest came from, after a random delay, unless the filter
+ * shows a newer version of it: then it's our copy that's out of date, and the
+ * neighbour will send us theirs when it hears our digest. Hearing the same
+ * item from someone else during that delay cancels the send, so one digest
+ * normally pulls each missing item once, instead of every Droplet rebroadcasting
+ * everything it hears.
+ *
+ * The service is off until the user calls gossip_init(), and user code needs
+ * to #include "gossip.h" itself. Gossip messages are routed here by
+ * msg_dispatch; new or updated items are passed to user_handle_gossip_item.
+ *****************************************************************************/
+#pragma once
+
+#include <avr/io.h>
+#include "droplet_init.h"
+#include "scheduler.h"
+#include "ir_comm.h"
+#include "msg_dispatch.h"
+
+#define GOSSIP_DIGEST_FLAG		0x1E
+#define GOSSIP_ITEM_FLAG		0x1F
+
+#define GOSSIP_MAX_ITEMS		8
+#define GOSSIP_BLOOM_BYTES		16		//128 bits.
+#define GOSSIP_BLOOM_HASHES		3
+#define GOSSIP_PERIOD_MS		4000
+#define GOSSIP_MAX_PUSH_DELAY	200		//ms
+#define GOSSIP_NEWER_LOOKAHEAD	4		//How many versions past ours to look for in a digest.
+
+#define GOSSIP_DIGEST_LEN		(2+GOSSIP_BLOOM_BYTES)
+#define GOSSIP_ITEM_HEADER_LEN	4
+#define GOSSIP_MAX_ITEM_LEN		(IR_BUFFER_SIZE-GOSSIP_ITEM_HEADER_LEN)
+
+#define GOSSIP_NO_ITEM			0xFF
+
+typedef struct gossip_digest_struct{
+	char	flag;
+	uint8_t	num_items;
+	uint8_t	bloom[GOSSIP_BLOOM_BYTES];
+} GossipDigest;
+
+typedef struct gossip_item_msg_struct{
+	char		flag;
+	uint16_t	id;
+	uint8_t		version;
+	char		data[GOSSIP_MAX_ITEM_LEN];
+} GossipItemMsg;
+
+typedef struct gossip_item_struct{
+	uint32_t	updated;	//When we got (or published) this version. Oldest is evicted first.
+	uint16_t	id;
+	uint8_t		version;
+	uint8_t		length;		//0 if this slot is empty.
+	char		data[GOSSIP_MAX_ITEM_LEN];
+} GossipItem;
+
+typedef struct gossip_stats_struct{
+	uint16_t digests_sent;
+	uint16_t items_sent;
+	uint16_t items_received;
+	uint16_t duplicates;	//Items we already had.
+	uint16_t suppressed;	//Pushes cancelled because a neighbour sent the item first.
+	uint16_t stale;			//Items not pushed because the digest had a newer version.
+} GossipStats;
+
+GossipStats gossip_stats;
+
+void	gossip_init();
+uint8_t	gossip_publish(uint16_t id, char* data, uint8_t data_length);
+uint8_t	gossip_get(uint16_t id, char* data);
+
+extern void user_handle_gossip_item(uint16_t id, char* data, uint8_t data_length);
@@ -0,0 +1,57 @@
+/** \file *********************************************************************
+ * \brief IR link rate negotiation.
+ *
+ * All discovery traffic (broadcasts, rnb, ffsync) goes out at IR_DEFAULT_BAUD.
+ * Two Droplets close to each other can agree to raise the baud rate on the
+ * directions facing each other for a short window. The window is dropped as
+ * soon as a broadcast is sent on one of those directions, when nothing has
+ * been heard from the peer for a while, or when too many receive errors in a
+ * row are seen on it. A rate that fails, on either side, is not tried again,
+ * but the best one that worked can be re-opened.
+ *****************************************************************************/
+#pragma once
+
+#include <avr/io.h>
+#include <stdlib.h>
+#include "droplet_init.h"
+#include "scheduler.h"
+#include "ir_comm.h"
+
+#define IR_BAUD_3200	0	//Upper bound given by the 38KHz carrier; this is the default.
+#define IR_BAUD_4800	1
+#define IR_BAUD_6400	2
+#define IR_BAUD_8000	3
+#define IR_BAUD_9600	4
+#define IR_NUM_BAUDS	5
+
+#define IR_DEFAULT_BAUD				IR_BAUD_3200
+
+#define IR_BAUD_TABLE_SIZE			8
+#define IR_BAUD_WINDOW_MS			2000	//How long a negotiated link stays up without hearing from the peer.
+#define IR_BAUD_ACK_DELAY_MS		40		//How long the target waits to ack, so the prober has switched even if it's a scheduler tick late.
+#define IR_BAUD_ACK_TIMEOUT_MS		250		//From the switch: handling the probe, IR_BAUD_ACK_DELAY_MS, the ack itself, and a tick to spare.
+#define IR_BAUD_MAX_ERRS			2		//Receive errors in a row on a raised dir before we fall back.
+#define IR_BAUD_UPKEEP_PERIOD_MS	100
+
+#define IR_BAUD_PROBE_STR			"baud_p"
+#define IR_BAUD_ACK_STR				"baud_a"
+
+typedef struct ir_baud_link_struct{
+	id_t	id;
+	uint8_t	best;	//highest rate that was acknowledged.
+	uint8_t	fail;	//lowest rate that failed. IR_NUM_BAUDS if none has.
+} IrBaudLink;
+
+void	ir_baud_init();
+void	ir_set_baud(uint8_t dirs, uint8_t baud);
+uint8_t	ir_get_baud(uint8_t dir);
+uint8_t	ir_baud_for(id_t id);
+
+uint8_t	ir_negotiate_baud(uint8_t dirs, id_t target);
+
+void	ir_baud_prepare_send(uint8_t dirs, id_t target);
+void	ir_baud_rx_ok(uint8_t dir, id_t sender);
+void	ir_baud_rx_error(uint8_t dir);
+
+void	handle_baud_probe(char* command_args);
+void	handle_baud_ack(char* command_args);
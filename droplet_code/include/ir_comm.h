@@ -49,6 +49,23 @@
 
 #define IR_STATUS_CRC_BITS_bm			0xC0	// SPECIAL or COMMAND
 
+/*
+ * Priority classes. A send can take channels away from a transmission of a lower class (see all_ir_sends),
+ * and when the queue of received messages is full, the lowest class is dropped first and the highest class
+ * is handed to handle_msg first. Commands (ir_cmd, ir_targeted_cmd) are IR_PRIO_CONTROL.
+ * RNB and firefly sync go through hp_ir_cmd, which already blocks everything else.
+ * Taking our own channels isn't enough for the receiver to hear us, though: it can't while it's sending.
+ * So for the next 'ms' after ir_quiet, only IR_PRIO_CONTROL and hp sends start, and the rest return '0'
+ * as if their channels were busy. Firefly sync goes quiet around each of its pings.
+ */
+#define IR_PRIO_BULK					0
+#define IR_PRIO_NORMAL					1		// ir_send and ir_targeted_send.
+#define IR_PRIO_CONTROL					2
+#define IR_NUM_PRIOS					3
+
+#define IR_PREEMPT_GAP_MS				(IR_MSG_TIMEOUT+10) //Silence after an aborted send, so receivers drop it.
+#define IR_PENDING_MAX_WAIT_MS			500		//How long a preempting send keeps retrying if its channels stay busy.
+
 #define DATA_LEN_VAL_bm		0x3F
 #define DATA_LEN_SPCL_bm	0x40
 #define DATA_LEN_CMD_bm		0x80
@@ -75,32 +92,47 @@
 extern USART_t* channel[6];
 
 
-volatile struct
+volatile struct ir_rxtx_struct
 {	
-	volatile uint32_t last_byte;			// TX time or RX time of last received byte	
+	volatile uint32_t last_byte;			// TX time, or RX time of the last byte of a complete message.
+	volatile uint16_t last_byte_cnt;		// RTC.CNT when the last byte was received. Only used for IR_MSG_TIMEOUT.
 	volatile uint16_t data_crc;
 	volatile id_t sender_ID;
 	volatile id_t target_ID;
 	volatile uint16_t curr_pos;				// Current position in buffer
-	volatile uint16_t calc_crc;
+	volatile int16_t strength;				// Brightest sensor reading while receiving the header. See ir_strength_sample.
 	volatile char buf[IR_BUFFER_SIZE];		// Transmit / receive buffer		
 	volatile uint8_t  data_length;	
 	volatile int8_t inc_dir;
+	volatile uint8_t prio;
 	volatile uint8_t status;		// Transmit:
 } ir_rxtx[6];
 
 #define INC_DIR_KEY 0b11111000
+//Two of the key bits carry the priority. Older code always sends INC_DIR_KEY, which reads as IR_PRIO_NORMAL.
+#define INC_DIR_PRIO_bm			0b00011000
+#define INC_DIR_PRIO_BULK		0b00010000
+#define INC_DIR_PRIO_NORMAL		0b00011000
+#define INC_DIR_PRIO_CONTROL	0b00001000
 
 volatile struct
 {
 	volatile uint32_t	arrival_time;
+	volatile int16_t	strength[6];			// 0 on dirs which didn't receive the message.
 	volatile id_t		sender_ID;
 	volatile char		msg[IR_BUFFER_SIZE];		
 	volatile uint8_t	arrival_dir;
 	volatile uint8_t	msg_length;
 	volatile uint8_t	wasTargeted;
+	volatile uint8_t	prio;
 } msg_node[MAX_USER_FACING_MESSAGES];
 
+typedef struct ir_send_vec_struct{
+	uint8_t	dir;			//A single direction, 0-5. Not a dir_mask!
+	char*	data;
+	uint8_t	data_length;
+} IrSendVec;
+
 volatile uint8_t hp_ir_block_bm;			//can only be set by other high priority ir things!
 volatile uint8_t num_waiting_msgs;
 volatile uint8_t user_facing_messages_ovf;
@@ -118,6 +150,10 @@ uint8_t ir_targeted_cmd(uint8_t dirs, char *data, uint8_t data_length, id_t targ
 uint8_t ir_cmd(uint8_t dirs, char *data, uint8_t data_length);
 uint8_t ir_targeted_send(uint8_t dirs, char *data, uint8_t data_length, id_t target);
 uint8_t ir_send(uint8_t dirs, char *data, uint8_t data_length);
+uint8_t ir_send_prio(uint8_t dirs, char *data, uint8_t data_length, uint8_t prio);
+void	ir_quiet(uint16_t ms);
+uint8_t ir_send_vec(IrSendVec* vecs, uint8_t count);
+uint8_t ir_send_toward(int16_t bearing, uint16_t spread, char *data, uint8_t data_length);
 uint8_t hp_ir_cmd(uint8_t dirs, char *data, uint8_t data_length);
 uint8_t hp_ir_targeted_cmd(uint8_t dirs, char *data, uint8_t data_length, id_t target);
 void waitForTransmission(uint8_t dirs);
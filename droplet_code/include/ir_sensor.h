@@ -10,6 +10,9 @@
 #include "droplet_init.h"
 #include "ir_led.h"
 #include "flash_api.h"
+#include "median.h"
+#include "sensor_snapshot.h"
+#include "rnb_params.h"
 
 /**
  * \brief Can be used to check if object(s) are within 1cm of this Droplet.
@@ -19,7 +22,11 @@
  *
  */
 void ir_sensor_init();
-void get_ir_sensors(int16_t* output_arr, uint8_t meas_per_ch);
+#define IR_SENSOR_CLAIM_TIMEOUT_MS	500U	//An rnb measurement holds the sensors for under 400ms.
+
+uint8_t get_ir_sensors(int16_t* output_arr, uint8_t meas_per_ch);
+uint8_t get_ir_sensors_dirs(int16_t* output_arr, uint8_t dirs, uint8_t meas_per_ch);
+uint32_t get_ir_snapshots(int16_t* output_arr);
 
 void read_ir_coll_baselines();
 void write_ir_coll_baselines();
@@ -27,6 +34,31 @@ void write_ir_coll_baselines();
 void check_collision_values(int16_t meas[6]);
 uint8_t check_collisions();
 void initialize_ir_baselines();
+
+#define IR_STRENGTH_NONE	INT16_MIN
+
+int16_t ir_strength_sample(uint8_t dir, uint8_t start_next);
+void ir_strength_start(uint8_t dir);
+void ir_strength_cancel(uint8_t dir);
+
+//While ticking, event channel 4 carries the peripheral clock divided by 4096, and each event starts a conversion.
+//IR_SENSOR_TICK_vect runs as each one finishes, every IR_SENSOR_TICK_US. See rnb_tick.
+//The rest of the time, it runs every SNAPSHOT_TICK_US instead, for the background sampler; see sensor_snapshot.
+#define IR_SENSOR_TICK_US	RNB_CONVERSION_US
+//A 12-bit conversion with gain takes 8 ADC clocks, 64us at 32MHz/256, and an audio Droplet's sweep of three
+//channels takes 10. At 32MHz/512 a lone conversion took the whole tick, and a sweep overran it.
+#define IR_SENSOR_ADC_PRESCALER		ADC_PRESCALER_DIV256_gc
+#define IR_SENSOR_CONVERSION_US		64U
+
+uint8_t ir_sensor_tick_start();
+void ir_sensor_tick_stop();
+uint8_t ir_sensor_tick_missed();
+uint8_t ir_sensor_ticking();
+void ir_sensor_sample();
+void ir_sensor_select(uint8_t dir);
+int16_t ir_sensor_read(uint8_t dir);
+int16_t ir_sensor_baseline(uint8_t dir);
+int16_t ir_sensor_result(uint8_t dir, int16_t* meas, uint8_t meas_per_ch);
 //void update_ir_baselines();
 
 int16_t ir_coll_baseline[6];
@@ -34,6 +66,8 @@ int16_t ir_coll_baseline[6];
 #ifdef AUDIO_DROPLET
 	inline void ir_sensor_enable(){ ADCA.CTRLA |= ADC_ENABLE_bm; ADCB.CTRLA |= ADC_ENABLE_bm; }
 	inline void ir_sensor_disable(){ ADCA.CTRLA &= ~ADC_ENABLE_bm; ADCB.CTRLA &= ~ADC_ENABLE_bm; }
+
+	#define IR_SENSOR_TICK_vect		ADCB_CH2_vect	//The last of each sweep.
 #else
 	#define IR_SENSOR_PORT PORTB
 
@@ -55,6 +89,8 @@ int16_t ir_coll_baseline[6];
 	#define MUX_IR_SENSOR_5		ADC_CH_MUXPOS_PIN3_gc		// IR5 sensor on PB3
 	#define MUX_SENSOR_CLR		0b00000111
 
+	#define IR_SENSOR_TICK_vect	ADCB_CH0_vect
+
 	inline void ir_sensor_enable(){ ADCB.CTRLA |= ADC_ENABLE_bm; }
 	inline void ir_sensor_disable(){ ADCB.CTRLA &= ~ADC_ENABLE_bm; }
 #endif
\ No newline at end of file
@@ -0,0 +1,23 @@
+/** \file *********************************************************************
+ * \brief Medians of small batches of sensor readings.
+ *
+ * get_red_sensor & co take the median of 3, the IR sensors the median of
+ * 1 to 7 per RNB slot (see rnb_sample), and initialize_ir_baselines the
+ * median of 11, so those sizes get sorting networks: fixed sequences of
+ * branch-free compare-exchanges, rather than the exchange sort this used to
+ * be. Most only find the median, and leave the rest of the array part
+ * sorted. Other sizes still use the exchange sort. Either way the answer
+ * is the same: for an even count it's the mean of the middle two, rounded
+ * toward zero.
+ *
+ * It only needs stdint, so it builds on a PC:
+ * other_code/DropletMotionTracking/DropletRNBcalib/median_check.c checks it
+ * against the old sort, and times both; avr_cycles.c, next to it, counts
+ * their cycles on an AVR in simavr.
+ *****************************************************************************/
+#pragma once
+
+#include <stdint.h>
+
+//WARNING! This function reorders the array.
+int16_t meas_find_median(int16_t* meas, uint8_t arr_len);
@@ -0,0 +1,89 @@
+/** \file *********************************************************************
+ * \brief Multi-hop routing over IR, using distance-vector tables.
+ *
+ * Routes are kept in a table indexed by droplet ordinal (see get_droplet_ord),
+ * so only Droplets in OrderedBotIDs can take part. Every MESH_ADVERT_PERIOD_MS
+ * each Droplet broadcasts part of its table; neighbours learn a route to every
+ * ordinal in the advert through the direction the advert came in on. Routes
+ * are advertised as unreachable out of the direction they were learned from
+ * (split horizon with poisoned reverse), and a route that's lost is held down:
+ * advertised as unreachable, with nothing learned for it, until it ages out.
+ * So a lost route dies instead of counting up to MESH_MAX_HOPS.
+ * Data messages carry a TTL and a (source, sequence) pair which is used to drop
+ * duplicates, so a packet can't circle forever. Routes which aren't refreshed
+ * for MESH_ROUTE_MAX_AGE rounds of adverts are held down, where a round is as many
+ * periods as it takes to advertise a table as big as ours.
+ *
+ * The service is off until the user calls mesh_init() (it costs airtime, and
+ * the route table's MESH_NUM_ORDS*3 bytes of RAM are only allocated then), and
+ * user code needs to #include "mesh.h" itself. Mesh messages are routed here by
+ * msg_dispatch; those addressed to this Droplet are passed to user_handle_mesh_msg.
+ *****************************************************************************/
+#pragma once
+
+#include <avr/io.h>
+#include "droplet_init.h"
+#include "scheduler.h"
+#include "ir_comm.h"
+#include "msg_dispatch.h"
+
+#define MESH_ADVERT_FLAG		0x1C
+#define MESH_DATA_FLAG			0x1D
+
+#define MESH_NUM_ORDS			121		//Length of OrderedBotIDs.
+#define MESH_NO_ROUTE			0xFF
+#define MESH_MAX_HOPS			15
+#define MESH_DEFAULT_TTL		MESH_MAX_HOPS
+#define MESH_ROUTE_MAX_AGE		4		//In rounds of adverts; at most 31 periods, what MESH_AGE_bm holds.
+#define MESH_ADVERT_PERIOD_MS	3000
+#define MESH_SEEN_CACHE_SIZE	8
+
+#define MESH_DIR_bm				0x07
+#define MESH_AGE_bm				0xF8
+#define MESH_AGE_INC			0x08
+
+#define MESH_ADVERT_HEADER_LEN	3
+#define MESH_ADVERT_MAX_ROUTES	((IR_BUFFER_SIZE-MESH_ADVERT_HEADER_LEN)/2)
+#define MESH_ADVERT_MAX_HELD	(MESH_ADVERT_MAX_ROUTES/2)	//Room in each advert for routes that are held down.
+#define MESH_DATA_HEADER_LEN	5
+#define MESH_MAX_DATA_LEN		(IR_BUFFER_SIZE-MESH_DATA_HEADER_LEN)
+
+// 3 bytes per ordinal.
+typedef struct mesh_route_struct{
+	uint8_t hops;		// MESH_NO_ROUTE if we don't have one, MESH_MAX_HOPS while it's held down.
+	uint8_t next;		// Ordinal of the neighbour to hand the packet to.
+	uint8_t dir_age;	// Direction to that neighbour (MESH_DIR_bm), and adverts since last refresh (MESH_AGE_bm).
+} MeshRoute;
+
+typedef struct mesh_advert_struct{
+	char	flag;
+	uint8_t	sender_ord;
+	uint8_t	num_routes;
+	uint8_t	routes[MESH_ADVERT_MAX_ROUTES][2]; // {ordinal, hops}
+} MeshAdvert;
+
+typedef struct mesh_data_struct{
+	char	flag;
+	uint8_t	ttl;
+	uint8_t	src_ord;
+	uint8_t	dest_ord;
+	uint8_t	seq;
+	char	data[MESH_MAX_DATA_LEN];
+} MeshData;
+
+typedef struct mesh_stats_struct{
+	uint16_t adverts_sent;
+	uint16_t data_sent;
+	uint16_t forwarded;
+	uint16_t delivered;
+	uint16_t dropped;
+} MeshStats;
+
+MeshStats mesh_stats;
+
+void	mesh_init();
+uint8_t	mesh_send(id_t dest_id, char* data, uint8_t data_length);
+uint8_t	mesh_hops_to(id_t dest_id);
+void	print_mesh_routes();
+
+extern void user_handle_mesh_msg(id_t src_id, char* data, uint8_t data_length);
@@ -0,0 +1,45 @@
+/** \file *********************************************************************
+ * \brief Routes incoming messages to handlers by their first byte.
+ *
+ * A module calls register_msg_handler once, from its init, with the type byte
+ * its messages start with and the lengths they can have. check_messages then
+ * hands every message whose first byte matches to that handler instead of
+ * handle_msg. A message of a registered type but the wrong length is dropped.
+ * Messages with an unregistered type still go to handle_msg, so older programs
+ * that parse everything themselves keep working.
+ *
+ * Any byte can be a type. A module built in to the firmware takes its types in
+ * every program that runs it (mesh and gossip use 0x1C-0x1F), so a program's
+ * own messages mustn't start with those; msg_types lists what's taken.
+ *
+ * Looking up a type is a scan over at most MSG_DISPATCH_MAX_HANDLERS entries.
+ *****************************************************************************/
+#pragma once
+
+#include <avr/io.h>
+#include "droplet_init.h"
+
+#define MSG_DISPATCH_MAX_HANDLERS	8
+
+typedef void (*MsgHandler)(ir_msg* msg_struct);
+
+typedef struct msg_dispatch_entry_struct{
+	MsgHandler	handler;
+	char		type;
+	uint8_t		min_length;
+	uint8_t		max_length;
+} MsgDispatchEntry;
+
+typedef struct msg_dispatch_stats_struct{
+	uint16_t dispatched;
+	uint16_t bad_length;	//Registered type, but a length outside [min_length, max_length].
+	uint16_t passed_on;		//Nothing registered for its type, so it went to handle_msg.
+} MsgDispatchStats;
+
+MsgDispatchStats msg_dispatch_stats;
+
+void	msg_dispatch_init();
+uint8_t	register_msg_handler(char type, uint8_t min_length, uint8_t max_length, MsgHandler handler);
+void	unregister_msg_handler(char type);
+uint8_t	dispatch_msg(ir_msg* msg_struct);
+void	print_msg_dispatch();
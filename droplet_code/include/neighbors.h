@@ -0,0 +1,55 @@
+/** \file *********************************************************************
+ * \brief Table of nearby Droplets, kept up to date by the IR and RNB layers.
+ *
+ * Every message we receive (including each extra copy heard on another
+ * direction) and every RNB result updates the sender's entry. The table has
+ * NEIGHBOR_TABLE_SIZE slots; when it is full, the entry heard from least
+ * recently is replaced. Entries not heard from for NEIGHBOR_TIMEOUT_MS are
+ * skipped by the lookup and iteration functions.
+ *
+ * Cost: neighbor_get and neighbor_count scan the whole table, so they take
+ * O(NEIGHBOR_TABLE_SIZE). neighbor_at reads a single slot, so iterating with
+ *		for(uint8_t i=0;i<NEIGHBOR_TABLE_SIZE;i++) if(neighbor_at(i, &n)){ ... }
+ * also takes O(NEIGHBOR_TABLE_SIZE). All of them copy the entry with
+ * interrupts disabled, since the table is written from interrupt context.
+ *
+ * range, bearing and heading are the last RNB result as measured. Each entry
+ * also keeps an RnbTrack, which fuses every result for that neighbour along
+ * with our own moves (motor.c reports them through neighbors_moved);
+ * neighbor_track gives its estimate, predicted to now, with standard
+ * deviations. A neighbour with no result for NEIGHBOR_TIMEOUT_MS starts over.
+ *****************************************************************************/
+#pragma once
+
+#include <avr/io.h>
+#include "droplet_init.h"
+#include "scheduler.h"
+#include "rnb_track.h"
+
+#define NEIGHBOR_TABLE_SIZE		12
+#define NEIGHBOR_TIMEOUT_MS		10000
+
+typedef struct neighbor_struct{
+	uint32_t	last_heard;		//Arrival time of the last message (or RNB) from this Droplet.
+	uint32_t	last_rnb;		//When range, bearing, and heading were measured. 0 if they never were.
+	id_t		id;				//0 if this slot is empty.
+	uint16_t	range;
+	int16_t		bearing;
+	int16_t		heading;
+	uint16_t	msg_count;		//Distinct messages received.
+	uint16_t	rnb_count;
+	uint8_t		dir_count[6];	//Copies received on each direction. Saturates at 255.
+	uint8_t		last_dirs;		//Directions the last message was heard on.
+	RnbTrack	track;			//Valid if last_rnb is set.
+} Neighbor;
+
+void	neighbors_init();
+void	neighbor_heard(id_t id, uint8_t dir, uint32_t when, uint8_t is_copy);
+void	neighbor_rnb(id_t id, uint16_t range, int16_t bearing, int16_t heading, uint8_t confidence, uint32_t when);
+void	neighbors_moved(int16_t dx, int16_t dy, int16_t turn);
+
+uint8_t	neighbor_get(id_t id, Neighbor* out);
+uint8_t	neighbor_at(uint8_t idx, Neighbor* out);
+uint8_t	neighbor_track(id_t id, RnbTrackPolar* out);
+uint8_t	neighbor_count();
+void	print_neighbors();
@@ -11,19 +11,24 @@
 #include "ir_comm.h"
 #include "i2c.h"
 #include "delay_x.h"
+#include "rnb_math.h"
+#include "rnb_params.h"
 
 
-
-#define DROPLET_RADIUS 22U  //mm
-#define DROPLET_RADIUS_SQ 484U //mm
-#define DROPLET_DIAMETER 44 //mm
-
 //Synchronization Timing Constants:
 #define POST_BROADCAST_DELAY			30U
 #define TIME_FOR_SET_IR_POWERS			2U
-#define TIME_FOR_IR_MEAS				12U
-#define TIME_FOR_GET_IR_VALS			16U
-#define DELAY_BETWEEN_RB_TRANSMISSIONS	10U
+//The slots that follow, and the conversions in each, are in rnb_params.h.
+
+//The sync message's first byte of data says which schedule follows. If the sender isn't at RNB_FULL_POWER,
+//a second byte says what power it's at, less one. A coded sync always has that byte, then the roster.
+#define RNB_MODE_FULL					'r'
+#define RNB_MODE_FAST					'f'
+#define RNB_MODE_CODED					'c'		//See broadcast_coded_rnb_data.
+#define RNB_SYNC_BYTE_TIME(bytes)		(((bytes)*25U)/8U)	//Each byte past the mode makes the sync 3.125ms longer.
+#define RNB_POWER_SYNC_BYTES(power)		((power)<RNB_FULL_POWER ? 1U : 0U)	//For RNB_MODE_FULL and RNB_MODE_FAST.
+
+#define RNB_FACING_SPREAD				180U	//See rnb_facing_pairs.
 
 //Constants for rnb processing:
 #define MIN_MATRIX_SUM_THRESH	115
@@ -44,33 +49,45 @@ typedef struct rnb_data {
 	int16_t bearing;
 	int16_t heading;
 	id_t id;
+	uint8_t confidence; //From 255 down to 1. See rnb_confidence.
+	uint32_t time;		//When the sender's broadcast started, by get_time().
 } rnb;
 
+//Every good result goes in a queue of RNB_QUEUE_SIZE, for rnb_next. When it's full, the oldest is dropped.
+#define RNB_QUEUE_SIZE			8U
 
+//Only the latest result, for code written before the queue. Results still go in the queue either way.
 rnb last_good_rnb;
 volatile uint8_t rnb_updated;
 volatile id_t rnbCmdID;
 volatile uint32_t rnbCmdSentTime;
+volatile uint16_t rnbCmdPower;		//The sender's IR power; see set_all_ir_powers.
 volatile uint8_t rnbProcessingFlag;
 
 void range_algs_init();
 
-void broadcast_rnb_data(); //takes about 142ms.
+void broadcast_rnb_data(); //takes about 86ms.
+void broadcast_fast_rnb_data(); //takes about 74ms, and is less accurate.
 //void receive_rnb_data();
 void use_rnb_data();
+#ifdef RNB_CODED_BROADCASTS
+void broadcast_coded_rnb_data(); //takes about 400ms, for up to RNB_NUM_CODES Droplets.
+uint8_t ir_range_coded(char* roster, uint8_t roster_len);
+void use_coded_rnb_data();
+#endif
 
 
-void ir_range_meas();
-void ir_range_blast(uint8_t power);
+uint8_t rnb_next(rnb* out);
+uint8_t rnb_pending();
+uint16_t rnb_dropped();
+
+uint8_t ir_range_meas(char mode, int16_t sync_strength[6]);
+void ir_range_blast(uint16_t power, char mode);
 
 inline int8_t sgn(float x){
 	return (0<x)-(x<0);
 }
 
-inline int16_t pretty_angle_deg(int16_t angle){
-	return (angle>=0) ? (( (angle + 180) % 360 ) - 180) : (( (angle - 180) % 360 ) + 180);
-}
-
 inline float pretty_angle(float angle){
 	return (angle>=0.0) ? ( fmodf(angle + M_PI, 2.0*M_PI) - M_PI ) : ( fmodf(angle - M_PI, 2.0*M_PI) + M_PI );
 }
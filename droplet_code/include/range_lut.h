@@ -0,0 +1,49 @@
+/** \file *********************************************************************
+ * \brief The calibrated brightness-to-range curve, as a table.
+ *
+ * GENERATED by other_code/DropletMotionTracking/DropletRNBcalib/gen_range_lut.py.
+ * Don't edit this by hand; change the coefficients there and rerun it.
+ *
+ * Entry (octave*RANGE_LUT_STEPS + j) is the range, in Q4 mm, for
+ * a = 2^octave * (1 + j/RANGE_LUT_STEPS). Linear interpolation between entries
+ * is within 0.04mm of the curve.
+ *
+ * powerGainLUT scales the brightness for senders which weren't at full IR
+ * power, the power the curve was fit at.
+ *****************************************************************************/
+#pragma once
+
+#include <avr/pgmspace.h>
+
+#define RANGE_LUT_STEP_BITS	4
+#define RANGE_LUT_STEPS		(1<<RANGE_LUT_STEP_BITS)
+#define RANGE_LUT_OCTAVES	16
+#define RANGE_LUT_LENGTH	257
+
+static const int16_t rangeLUT[RANGE_LUT_LENGTH] PROGMEM = {
+	 4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,
+	 4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,
+	 4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  4000,  3999,  3999,  3999,  3999,  3999,
+	 3999,  3998,  3998,  3998,  3997,  3996,  3996,  3995,  3994,  3993,  3992,  3991,  3990,  3989,  3988,  3986,
+	 3985,  3982,  3979,  3975,  3972,  3968,  3963,  3959,  3954,  3950,  3945,  3940,  3934,  3929,  3923,  3918,
+	 3912,  3900,  3887,  3874,  3861,  3848,  3835,  3821,  3807,  3793,  3779,  3765,  3751,  3736,  3722,  3708,
+	 3694,  3665,  3637,  3609,  3581,  3554,  3527,  3500,  3474,  3448,  3422,  3397,  3373,  3348,  3324,  3301,
+	 3278,  3233,  3189,  3147,  3107,  3067,  3029,  2993,  2957,  2923,  2889,  2857,  2825,  2795,  2765,  2737,
+	 2709,  2655,  2604,  2556,  2510,  2467,  2425,  2386,  2348,  2311,  2276,  2243,  2211,  2180,  2150,  2122,
+	 2094,  2041,  1992,  1946,  1903,  1862,  1824,  1787,  1753,  1720,  1688,  1659,  1630,  1603,  1577,  1552,
+	 1528,  1482,  1440,  1401,  1364,  1330,  1298,  1268,  1239,  1212,  1186,  1162,  1139,  1117,  1095,  1075,
+	 1056,  1020,   986,   955,   926,   899,   874,   850,   828,   807,   787,   768,   750,   733,   717,   702,
+	  687,   659,   634,   610,   588,   568,   549,   531,   514,   498,   483,   469,   456,   443,   431,   420,
+	  409,   388,   369,   352,   336,   321,   307,   293,   281,   270,   259,   248,   238,   229,   220,   212,
+	  204,   189,   175,   162,   151,   140,   130,   120,   111,   103,    95,    87,    80,    73,    67,    61,
+	   55,    44,    34,    25,    17,     9,     2,    -5,   -12,   -18,   -23,   -29,   -34,   -39,   -43,   -48,
+	  -52
+};
+
+//The emitter's brightness, Q8 of full power's, at every POWER_GAIN_STEP of the IR power setting.
+#define POWER_GAIN_STEP		32
+#define POWER_GAIN_LENGTH	9
+
+static const uint16_t powerGainLUT[POWER_GAIN_LENGTH] PROGMEM = {
+	0, 32, 64, 96, 128, 160, 192, 224, 256
+};
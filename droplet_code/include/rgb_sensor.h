@@ -6,6 +6,8 @@
 #include "rgb_led.h"
 #include "scheduler.h"
 #include "i2c.h"
+#include "median.h"
+#include "sensor_snapshot.h"
 
 void rgb_sensor_init();
 
@@ -16,6 +18,7 @@ void rgb_sensor_init();
 #else
 
 	#define RGB_MEAS_COUNT 5
+	#define RGB_SNAPSHOT_MAX_AGE_MS	50U	//Older than this, get_red_sensor & co measure for themselves.
 
 	#define RGB_SENSOR_PORT PORTA
 	#define RGB_SENSOR_R_PIN_bm PIN5_bm
@@ -25,8 +28,9 @@ void rgb_sensor_init();
 	int16_t get_red_sensor();
 	int16_t get_green_sensor();
 	int16_t get_blue_sensor();
-#endif
 
-	void get_rgb(int16_t *r, int16_t *g, int16_t *b);
+	void rgb_sensor_sample(uint32_t now);
+	void rgb_sensor_sample_restart();
+#endif
 
-	int16_t meas_find_median(int16_t* meas, uint8_t arr_len); // Helper function for getting the middle of the 3 measurements
\ No newline at end of file
+	void get_rgb(int16_t *r, int16_t *g, int16_t *b);
\ No newline at end of file
@@ -0,0 +1,122 @@
+/** \file *********************************************************************
+ * \brief Range, bearing, and heading from an RNB brightness matrix.
+ *
+ * This is the math half of range_algs. It only needs stdint and
+ * avr/pgmspace, so the same source also builds on a PC, into
+ * other_code/DropletMotionTracking/DropletRNBcalib/rnb_replay.c, which replays
+ * the recorded calibration runs through it. Run that before and after changing
+ * anything here.
+ *
+ * It's all fixed point, since soft-float trig was most of the cost of use_rnb_data:
+ *	Unit vectors and the basis tables are Q14 (16384 == 1.0).
+ *	Ranges are Q4 millimeters (16 == 1mm). The emitter and sensor geometry is
+ *	Q8, since the model is sensitive to it when Droplets are close.
+ *	Angles are Q6 degrees (64 == 1 degree).
+ * Replayed over the 6285 usable measurements in DropletRNBcalib's results.csv
+ * and rnbCalibData_*.txt, against the float version this replaced:
+ *	range is within 1.8mm (mean 0.03mm). The worst cases are Droplets nearly
+ *	touching.
+ *	bearing and heading are within 0.13 degrees before being truncated to whole
+ *	degrees, so the reported values are never more than 1 degree apart.
+ *	the error term is within 0.01 (of a possible 2).
+ * rnb_replay's timings are a PC's; avr_cycles.c, next to it, counts each
+ * step's cycles on an AVR in simavr.
+ *****************************************************************************/
+#pragma once
+
+#include <stdint.h>
+
+#define DROPLET_RADIUS 22U  //mm
+#define DROPLET_RADIUS_SQ 484U //mm
+#define DROPLET_DIAMETER 44 //mm
+
+//Refines each closed-form estimate with a few Gauss-Newton iterations over range, bearing, and heading
+//together. More accurate, but costs several times as much as the closed form: 9us against 1.2us an estimate
+//in rnb_replay, on a PC. Most of that is the extra model evaluations, in fixed point, but each iteration's 3x3
+//solve is soft float. avr_cycles.c, built with this on, counts what it costs on an AVR. See refine_rnb.
+//#define RNB_JOINT_SOLVER
+
+//Lets several Droplets broadcast at once, each pulsing its emitters with its own code, and receivers
+//separate them by correlation. See broadcast_coded_rnb_data. Costs RNB_NUM_CODES*72 bytes of RAM.
+//#define RNB_CODED_BROADCASTS
+
+#define IR_NO_BEARING		INT16_MIN
+#define RNB_NO_HEADING		INT16_MIN
+
+#define Q14_ONE				16384
+#define RNB_RANGE_INVALID	INT32_MIN
+#define RNB_FULL_POWER		256U	//The IR power setting the range curve was calibrated at. See rnb_power_gain.
+
+//See rnb_confidence. The weights are Q8 of the error term: 256 weighs as much as an error of 1.0.
+#define RNB_SATURATED				2000	//A reading this bright is at or near the top of the ADC's range.
+#define RNB_CONF_SAT_ALLOWED		3		//How many a neighbour close enough to touch can saturate by itself.
+#define RNB_CONF_SAT_WEIGHT			128		//For each saturated reading past RNB_CONF_SAT_ALLOWED.
+#define RNB_CONF_NOISE_FLOOR		300		//Added to twice the matrix's negTotal, for the noise.
+#define RNB_CONF_NOISE_WEIGHT		128		//For noise equal to the matrix total.
+#define RNB_CONF_RANGE_WEIGHT		128		//For a range change as big as the tolerance. Capped at twice that.
+#define RNB_CONF_BEARING_WEIGHT		64		//Likewise for bearing.
+#define RNB_CONF_MAX_SPEED			5		//mm/s and degrees/s. Added to the tolerances for the prior's age.
+#define RNB_CONF_MAX_PENALTY		768		//rnb_confidence returns 0 at or past this.
+
+#ifdef RNB_CODED_BROADCASTS
+#define RNB_CODE_LENGTH		8	//Chips per emitter slot. A power of two.
+#define RNB_NUM_CODES		(RNB_CODE_LENGTH-1)
+#endif
+
+typedef struct rnb_matrix_sums_struct{
+	int32_t total;
+	int32_t basis[4];	//{bearingX, bearingY, headingX, headingY}
+	int32_t negTotal;	//Sum of the readings below 0, negated. Only noise or a drifting baseline reads below 0.
+	uint8_t zeroCols;	//Bit s is set if sensor s read exactly 0 for every emitter.
+	uint8_t saturated;	//How many readings were RNB_SATURATED or more.
+} RnbMatrixSums;
+
+typedef struct rnb_estimate_struct{
+	int32_t		range;		//Q4 mm.
+	int16_t		bearing;	//Whole degrees, truncated toward zero.
+	int16_t		heading;	//Whole degrees, truncated toward zero.
+	uint16_t	error;		//Q14. See estimate_error.
+} RnbEstimate;
+
+/*
+ * bm is indexed [emitter][sensor], as range_algs measures it.
+ */
+void	rnb_sum_matrix(int16_t bm[6][6], RnbMatrixSums* sums);
+
+/*
+ * sums must be rnb_sum_matrix's, for the same bm. power is the sender's IR power setting, 1 to
+ * RNB_FULL_POWER. Returns '0' if there's no usable measurement.
+ */
+uint8_t	rnb_estimate(int16_t bm[6][6], RnbMatrixSums* sums, uint16_t power, RnbEstimate* est);
+
+/*
+ * How bright an emitter is at an IR power setting, Q8 of how bright it is at RNB_FULL_POWER.
+ */
+uint16_t	rnb_power_gain(uint16_t power);
+
+/*
+ * How far to trust est, from 255 down to 1, or 0 if it shouldn't be used at all. prev is the last estimate
+ * used for the same sender, prev_age_ms ago, or NULL if there isn't one.
+ */
+uint8_t	rnb_confidence(RnbMatrixSums* sums, RnbEstimate* est, RnbEstimate* prev, uint32_t prev_age_ms);
+
+uint8_t	dirs_toward(int16_t bearing, uint16_t spread);
+int16_t	coarse_bearing(int16_t strength[6]);
+void	rnb_facing_pairs(int16_t bearing, int16_t heading, uint16_t spread, uint8_t* emitters, uint8_t* sensors);
+
+#ifdef RNB_CODED_BROADCASTS
+uint8_t	rnb_code_chip(uint8_t code, uint8_t chip);
+void	rnb_correlate_chip(int16_t sums[RNB_NUM_CODES][6][6], uint8_t emitter, uint8_t chip, int16_t meas[6]);
+void	rnb_decode_code(int16_t sums[6][6]);
+#endif
+
+//Fixed point helpers, shared with rnb_track and motor.
+uint16_t	isqrt32(uint32_t x);
+int16_t		atan2_deg(int32_t y, int32_t x);	//Q6 degrees.
+void		sin_cos_deg(int16_t deg, int16_t* c, int16_t* s);	//Q14, of whole degrees.
+
+//Reduces mod 360 first, so adding or subtracting 180 can't overflow an int16_t, whatever 'angle' is.
+inline int16_t pretty_angle_deg(int16_t angle){
+	angle %= 360;
+	return (angle>=0) ? (( (angle + 180) % 360 ) - 180) : (( (angle - 180) % 360 ) + 180);
+}
@@ -0,0 +1,29 @@
+/** \file *********************************************************************
+ * \brief The RNB measurement schedule: slot timing and conversions per sensor.
+ *
+ * range_algs runs the schedule; DropletRNBcalib's rnb_replay.c replays the
+ * calibration logs as if they'd been taken with it. This only needs the
+ * preprocessor, so both include it, and a change here shows up in the replay.
+ *****************************************************************************/
+#pragma once
+
+//Each emitter gets a slot of RNB_SLOT_TIME, one after the other with no gap. The receiver only samples in
+//the middle of the slot, leaving RNB_SLOT_GUARD at each end for sync error and the LEDs switching over.
+#define RNB_SLOT_GUARD					2U
+#define RNB_FULL_MEAS_TIME				5U
+#define RNB_FAST_MEAS_TIME				3U
+#define RNB_SLOT_TIME(meas_time)		(2*RNB_SLOT_GUARD+(meas_time))
+
+//The ir_sensor tick, IR_SENSOR_TICK_US: event channel 4 carries the peripheral clock divided by 4096.
+//rnb_tick takes one conversion every tick; see IR_SENSOR_CONVERSION_US.
+#define RNB_CONVERSION_US				128U
+#define RNB_MIN_MEAS_PER_CH				2U
+#define RNB_MAX_MEAS_PER_CH				9U		//What the DropletRNBcalib logs were taken with.
+#define RNB_SATURATED_MEAS_PER_CH		4U		//What rnb_sample cuts a saturated sensor to. The mux is two ahead.
+
+//Only used with RNB_CODED_BROADCASTS. Each emitter slot is split in to RNB_CODE_LENGTH chips of
+//RNB_SLOT_TIME(RNB_CODED_MEAS_TIME), and every sensor gets an even share of each chip's conversions.
+#define RNB_CODED_MEAS_TIME				3U
+#define RNB_CODED_MEAS_PER_CH			(((RNB_CODED_MEAS_TIME*1000U)/(6*RNB_CONVERSION_US))<RNB_MIN_MEAS_PER_CH ? \
+											RNB_MIN_MEAS_PER_CH : ((RNB_CODED_MEAS_TIME*1000U)/(6*RNB_CONVERSION_US)))
+#define RNB_CODED_MIN_TOTAL				400		//A code's matrix sums to less than this if its sender wasn't there.
@@ -0,0 +1,71 @@
+/** \file *********************************************************************
+ * \brief Tracks one neighbour's position and heading across RNB results.
+ *
+ * A small extended Kalman filter. The state is the neighbour's position in our
+ * frame (x toward bearing 0, y toward bearing 90) and its heading, with a
+ * constant-position motion model: between results, the variances just grow
+ * by RNB_TRACK_POS_DIFFUSION and RNB_TRACK_HEADING_DIFFUSION per second. When
+ * we walk or spin ourselves, rnb_track_move shifts and rotates the state by
+ * our odometry instead, so our own motion isn't mistaken for the neighbour's.
+ *
+ * Each RNB result is a range and a bearing, which are linearized about the
+ * predicted position: the range corrects it along the line toward the
+ * neighbour, and the bearing across that line. Their noise grows with range
+ * and shrinks with confidence (see rnb_confidence). It's worked out at the
+ * predicted range, with the second order terms of the linearization added
+ * in, so the covariance is an honest one: rnb_track_sim fails if its mean
+ * NEES (normalized estimation error squared) strays far from 2. A result
+ * more than RNB_TRACK_GATE variances from the prediction isn't used, but
+ * widens the covariance, so a neighbour which really did move is picked up
+ * again by the next result.
+ *
+ * Like rnb_math, it's all fixed point and builds on a PC:
+ * other_code/DropletMotionTracking/DropletRNBcalib/rnb_track_sim.c checks it
+ * against simulated Droplets moving about. The neighbor table keeps one of
+ * these per neighbour; see neighbor_track.
+ *****************************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include "rnb_math.h"
+
+//Measurement noise, at full confidence. Each standard deviation is the constant plus range/DIV, fit to the
+//DropletRNBcalib logs.
+#define RNB_TRACK_RANGE_SD				10	//mm
+#define RNB_TRACK_RANGE_SD_DIV			5
+#define RNB_TRACK_BEARING_SD			10	//degrees
+#define RNB_TRACK_BEARING_SD_DIV		6
+#define RNB_TRACK_HEADING_SD			25	//degrees
+#define RNB_TRACK_HEADING_SD_DIV		8
+
+#define RNB_TRACK_POS_DIFFUSION			600		//mm^2/s. How fast the neighbour might wander off on its own.
+#define RNB_TRACK_HEADING_DIFFUSION		200		//degrees^2/s.
+#define RNB_TRACK_ODOM_DIV				4		//Our odometry is taken to be off by a quarter of each move.
+#define RNB_TRACK_MAX_VAR				32767	//mm^2, so 181mm. Also keeps the math in 32 bits.
+#define RNB_TRACK_MAX_HEADING_VAR		32400	//180 degrees, squared: we know nothing.
+#define RNB_TRACK_GATE					16		//Normalized innovation squared.
+
+typedef struct rnb_track_struct{
+	int16_t		x;			//Q4 mm, toward bearing 0.
+	int16_t		y;			//Q4 mm, toward bearing 90.
+	int16_t		heading;	//Q6 degrees.
+	uint16_t	phh;		//Heading variance, degrees^2.
+	int32_t		pxx;		//Position covariance, mm^2.
+	int32_t		pxy;
+	int32_t		pyy;
+} RnbTrack;
+
+typedef struct rnb_track_polar_struct{
+	uint16_t	range;		//mm
+	int16_t		bearing;	//degrees
+	int16_t		heading;	//degrees
+	uint16_t	range_sd;	//mm
+	uint16_t	bearing_sd;	//degrees
+	uint16_t	heading_sd;	//degrees
+} RnbTrackPolar;
+
+void	rnb_track_init(RnbTrack* t, uint16_t range, int16_t bearing, int16_t heading, uint8_t confidence);
+void	rnb_track_predict(RnbTrack* t, uint32_t dt_ms);
+void	rnb_track_move(RnbTrack* t, int16_t dx, int16_t dy, int16_t turn);
+uint8_t	rnb_track_update(RnbTrack* t, uint16_t range, int16_t bearing, int16_t heading, uint8_t confidence);
+void	rnb_track_polar(RnbTrack* t, RnbTrackPolar* out);
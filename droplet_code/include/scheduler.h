@@ -25,7 +25,7 @@ inline void myFree(void* ptr){
 }
 
 #define RTC_COMP_INT_LEVEL RTC_COMPINTLVL_LO_gc;
-#define MAX_NUM_SCHEDULED_TASKS 10
+#define MAX_NUM_SCHEDULED_TASKS 12
 #define MIN_TASK_TIME_IN_FUTURE 20
 
 typedef union flex_function
@@ -0,0 +1,51 @@
+/** \file *********************************************************************
+ * \brief The latest filtered reading of each sensor, kept up to date in the
+ * background.
+ *
+ * While nothing else is using the ADCs, ir_sensor starts a conversion every
+ * SNAPSHOT_TICK_US from the event system, and IR_SENSOR_TICK_vect hands each
+ * reading to snapshot_add. Each sensor's snapshot is the median of its last
+ * SNAPSHOT_KEEP readings, with the time the last of them was taken, so
+ * get_ir_snapshots and get_red_sensor & co are just a copy and never wait on
+ * the ADC.
+ *
+ * Audio Droplets have an ADC channel per IR sensor, so all six are read every
+ * tick. Other Droplets only have ADCB.CH0 for all six: it stays on one sensor
+ * until that sensor has a new snapshot, then moves on to the next (see
+ * snapshot_add_muxed), so each one is refreshed every
+ * 6*(SNAPSHOT_SETTLE+SNAPSHOT_KEEP) ticks. Their color sensor has a channel
+ * per color, on ADCA, which is swept on the same tick. The audio Droplets'
+ * color sensor is on I2C, and isn't sampled here.
+ *
+ * The sampler stops while get_ir_sensors, an RNB measurement, or
+ * ir_strength_sample has the IR sensors, and each sensor throws out its next
+ * SNAPSHOT_SETTLE readings when it starts again, since the mux may have moved.
+ *
+ * This file only needs stdint and util/atomic, so it builds on a PC:
+ * other_code/DropletMotionTracking/DropletRNBcalib/snapshot_check.c runs it
+ * against a simulated ADC.
+ *****************************************************************************/
+#pragma once
+
+#include <stdint.h>
+
+#define SNAPSHOT_TICK_US		1024U	//Event channel 4 carries the peripheral clock divided by 32768.
+#define SNAPSHOT_SETTLE			2U		//Readings thrown out after the mux moves, like get_ir_sensors does.
+#define SNAPSHOT_KEEP			3U		//Readings the median is taken over.
+
+//Channels 0 to 5 are the IR sensors, by direction.
+#define SNAPSHOT_RED			6U
+#define SNAPSHOT_GREEN			7U
+#define SNAPSHOT_BLUE			8U
+#ifdef AUDIO_DROPLET
+	#define SNAPSHOT_CHANNELS	6U
+#else
+	#define SNAPSHOT_CHANNELS	9U
+#endif
+
+void		snapshot_init();
+void		snapshot_reset(uint8_t ch);
+uint8_t		snapshot_add(uint8_t ch, int16_t raw, uint32_t now);
+uint8_t		snapshot_add_muxed(int16_t raw, uint32_t now);
+uint8_t		snapshot_muxed_dir();
+uint32_t	snapshot_get(uint8_t ch, int16_t* val);
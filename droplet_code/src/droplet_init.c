@@ -44,6 +44,8 @@ static void init_all_systems(){
 
 	startup_light_sequence();
 	
+	neighbors_init();			INIT_DEBUG_PRINT("NEIGHBORS INIT\r\n");
+	msg_dispatch_init();		INIT_DEBUG_PRINT("MSG DISPATCH INIT\r\n");
 	ir_comm_init();				INIT_DEBUG_PRINT("IR COM INIT\r\n");
 }
 
@@ -66,6 +68,7 @@ int main(){
  * This function loops through all messages this robot has received since the last call
  * to check messages.
  * For each message, it populates an ir_msg struct and calls handle_msg with it.
+ * Messages of a higher priority class go first; within a class, the newest goes first.
  */
 static void check_messages(){
 	ir_msg* msg_struct;	
@@ -76,16 +79,19 @@ static void check_messages(){
 	uint8_t i;
 	
 	if(user_facing_messages_ovf){
-		num_waiting_msgs=MAX_USER_FACING_MESSAGES;
 		user_facing_messages_ovf=0;
 		printf_P(PSTR("Error: Messages overflow. Too many messages received. Try speeding up your loop if you see this a lot.\r\n"));
 	}
 	//if(num_waiting_msgs>0) printf("num_msgs: %hu\r\n",num_waiting_msgs);
 	while(num_waiting_msgs>0){
-		i=num_waiting_msgs-1;
+		uint8_t msg_length;
 		//We don't want this block to be interrupted by perform_ir_upkeep because the 
 		//list of messages could get corrupted.
 		ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+			i=num_waiting_msgs-1;
+			for(int8_t j=num_waiting_msgs-2;j>=0;j--){
+				if(msg_node[j].prio>msg_node[i].prio) i=j;
+			}
 			if(msg_node[i].msg_length==0){
 				printf_P(PSTR("ERROR: Message length 0 for msg_node.\r\n"));
 			}
@@ -95,13 +101,22 @@ static void check_messages(){
 			msg_struct->dir_received					= msg_node[i].arrival_dir;
 			msg_struct->length							= msg_node[i].msg_length;
 			msg_struct->wasTargeted						= msg_node[i].wasTargeted;
+			for(uint8_t dir=0;dir<6;dir++){
+				msg_struct->strength[dir]				= msg_node[i].strength[dir];
+			}
+			msg_length = msg_node[i].msg_length;
+			//Close the gap, so the remaining messages stay oldest-first.
+			if(i<num_waiting_msgs-1){
+				memmove((void*)&(msg_node[i]), (const void*)&(msg_node[i+1]), (num_waiting_msgs-1-i)*sizeof(msg_node[0]));
+			}
 			num_waiting_msgs--;
 		}			
-		msg_struct->msg[msg_node[i].msg_length]	= '\0';		
+		msg_struct->msg[msg_length]	= '\0';		
+		msg_struct->bearing = coarse_bearing(msg_struct->strength);
 
 
 
-		handle_msg(msg_struct);
+		if(!dispatch_msg(msg_struct)) handle_msg(msg_struct);
 	}
 }
 
@@ -26,7 +26,7 @@ void enable_sync_blink(uint16_t phase_offset){
 	uint16_t turn_on_cc = turn_off_cc - (uint16_t)(ffsync_blink_dur*FFSYNC_MS_CONVERSION_FACTOR);
 	TCE0.CCA = turn_on_cc;
 	TCE0.CCB = turn_off_cc;
-	TCE0.INTCTRLB = TC_TC0_CCAINTLVL_HI_gc | TC_TC0_CCBINTLVL_HI_gc;
+	TCE0.INTCTRLB = TC_TC0_CCAINTLVL_HI_gc | TC_TC0_CCBINTLVL_HI_gc | TC_TC0_CCCINTLVL_HI_gc;
 }
 
 uint8_t sync_blink_enabled(){
@@ -34,7 +34,7 @@ uint8_t sync_blink_enabled(){
 }
 
 void disable_sync_blink(){
-	TCE0.INTCTRLB = TC_TC0_CCAINTLVL_OFF_gc | TC_TC0_CCBINTLVL_OFF_gc;
+	TCE0.INTCTRLB = TC_TC0_CCAINTLVL_OFF_gc | TC_TC0_CCBINTLVL_OFF_gc | TC_TC0_CCCINTLVL_HI_gc;
 	TCE0.CCA = 0;
 	TCE0.CCB = 0;
 }
@@ -51,6 +51,11 @@ ISR(TCE0_CCB_vect){
 	set_rgb(ffsync_blink_prev_r, ffsync_blink_prev_g, ffsync_blink_prev_b);	
 }
 
+//Our neighbours' counters wrap about when ours does, so they'll all be pinging soon.
+ISR(TCE0_CCC_vect){
+	ir_quiet(FFSYNC_QUIET_LEAD+FFSYNC_D+FFSYNC_QUIET_TAIL);
+}
+
 void firefly_sync_init()
 {
 	ffsync_blink_r = 255;
@@ -67,10 +72,11 @@ void firefly_sync_init()
 
 	TCE0.PER =  FFSYNC_FULL_PERIOD;
 	TCE0.INTCTRLA = TC_TC0_OVFINTLVL_HI_gc;
-	TCE0.INTCTRLB = TC_TC0_CCAINTLVL_OFF_gc | TC_TC0_CCBINTLVL_OFF_gc;	
+	TCE0.INTCTRLB = TC_TC0_CCAINTLVL_OFF_gc | TC_TC0_CCBINTLVL_OFF_gc | TC_TC0_CCCINTLVL_HI_gc;	
 	TCE0.CNT = 0;
 		TCE0.CCA = 0;
 		TCE0.CCB = 0;
+	TCE0.CCC = FFSYNC_QUIET_CC;
 	
 	obsStart = (ObsQueue*)myMalloc(sizeof(ObsQueue));
 	obsStart->obs = 0;
@@ -79,6 +85,7 @@ void firefly_sync_init()
 }
 
 ISR(TCE0_OVF_vect){
+	ir_quiet(FFSYNC_D+FFSYNC_QUIET_TAIL); //processObsQueue can jump the counter past FFSYNC_QUIET_CC.
 	schedule_task(rand_short()%FFSYNC_D, sendPing, (void*)((uint16_t)(get_time()&0xFFFF)));
 	//sendPing( (void*)((uint16_t)(get_time()&0xFFFF)));
 	updateRTC();
@@ -0,0 +1,243 @@
+#include "gossip.h"
+
+static GossipItem items[GOSSIP_MAX_ITEMS];
+static uint8_t push_idx;	//Item we're waiting to send, or GOSSIP_NO_ITEM.
+static uint8_t push_dir;
+static uint8_t gossip_enabled;
+
+void user_handle_gossip_item(uint16_t id, char* data, uint8_t data_length) __attribute__((weak));
+
+static void gossip_upkeep();
+static void send_digest();
+static void handle_digest_msg(ir_msg* msg_struct);
+static void handle_item_msg(ir_msg* msg_struct);
+static void handle_digest(GossipDigest* digest, uint8_t dir);
+static void handle_item(GossipItemMsg* item_msg, uint8_t length);
+static void send_push();
+static uint16_t bloom_hash(uint16_t id, uint8_t version);
+static void bloom_add(uint8_t* bloom, uint16_t id, uint8_t version);
+static uint8_t bloom_check(uint8_t* bloom, uint16_t id, uint8_t version);
+static uint8_t bloom_has_newer(uint8_t* bloom, uint16_t id, uint8_t version);
+static GossipItem* find_item(uint16_t id);
+static GossipItem* get_free_item();
+
+/*
+ * Turns on gossip. Call this from init().
+ */
+void gossip_init(){
+	if(!register_msg_handler(GOSSIP_DIGEST_FLAG, GOSSIP_DIGEST_LEN, GOSSIP_DIGEST_LEN, handle_digest_msg)) return;
+	if(!register_msg_handler(GOSSIP_ITEM_FLAG, GOSSIP_ITEM_HEADER_LEN+1, IR_BUFFER_SIZE, handle_item_msg)){
+		unregister_msg_handler(GOSSIP_DIGEST_FLAG);
+		return;
+	}
+	for(uint8_t i=0;i<GOSSIP_MAX_ITEMS;i++){
+		items[i].length = 0;
+	}
+	push_idx = GOSSIP_NO_ITEM;
+	gossip_stats.digests_sent	= 0;
+	gossip_stats.items_sent		= 0;
+	gossip_stats.items_received	= 0;
+	gossip_stats.duplicates		= 0;
+	gossip_stats.suppressed		= 0;
+	gossip_stats.stale			= 0;
+	gossip_enabled = 1;
+	schedule_periodic_task(GOSSIP_PERIOD_MS+(rand_byte()%128), gossip_upkeep, NULL);
+}
+
+/*
+ * Adds an item, or replaces our copy of it with a new version. Nothing is sent right away: neighbours pick it
+ * up after our next digest shows it to them. Returns '0' if the item couldn't be stored.
+ */
+uint8_t gossip_publish(uint16_t id, char* data, uint8_t data_length){
+	if(!gossip_enabled) return 0;
+	if(data_length==0 || data_length>GOSSIP_MAX_ITEM_LEN){
+		printf_P(PSTR("ERROR: Gossip item must be 1 to GOSSIP_MAX_ITEM_LEN bytes.\r\n"));
+		return 0;
+	}
+	GossipItem* item = find_item(id);
+	if(item){
+		item->version++;
+	}else{
+		item = get_free_item();
+		item->id = id;
+		item->version = 0;
+	}
+	item->updated = get_time();
+	item->length = data_length;
+	memcpy(item->data, data, data_length);
+	return 1;
+}
+
+/*
+ * Copies our current version of an item in to data, which should have room for GOSSIP_MAX_ITEM_LEN bytes.
+ * Returns the item's length, or '0' if we don't have it.
+ */
+uint8_t gossip_get(uint16_t id, char* data){
+	GossipItem* item = find_item(id);
+	if(!item) return 0;
+	memcpy(data, item->data, item->length);
+	return item->length;
+}
+
+// Registered with msg_dispatch, which has already checked the length.
+static void handle_digest_msg(ir_msg* msg_struct){
+	handle_digest((GossipDigest*)(msg_struct->msg), msg_struct->dir_received);
+}
+
+static void handle_item_msg(ir_msg* msg_struct){
+	handle_item((GossipItemMsg*)(msg_struct->msg), msg_struct->length);
+}
+
+/*
+ * Only one item is pushed per digest; if the neighbour is missing more than that, it'll show up in their
+ * next digest. Which one is picked at random so that two Droplets answering the same digest will usually
+ * send different items.
+ */
+static void handle_digest(GossipDigest* digest, uint8_t dir){
+	if(push_idx!=GOSSIP_NO_ITEM) return;
+	uint8_t missing[GOSSIP_MAX_ITEMS];
+	uint8_t num_missing = 0;
+	for(uint8_t i=0;i<GOSSIP_MAX_ITEMS;i++){
+		if(!items[i].length) continue;
+		if(bloom_check(digest->bloom, items[i].id, items[i].version)) continue;
+		if(bloom_has_newer(digest->bloom, items[i].id, items[i].version)){
+			gossip_stats.stale++;
+			continue;
+		}
+		missing[num_missing++] = i;
+	}
+	if(!num_missing) return;
+	push_idx = missing[rand_byte()%num_missing];
+	push_dir = dir;
+	if(!schedule_task(10+(rand_short()%GOSSIP_MAX_PUSH_DELAY), send_push, NULL)){
+		push_idx = GOSSIP_NO_ITEM;
+	}
+}
+
+static void handle_item(GossipItemMsg* item_msg, uint8_t length){
+	uint8_t data_length = length-GOSSIP_ITEM_HEADER_LEN;
+	GossipItem* item = find_item(item_msg->id);
+	if(item){
+		//Someone else answered the digest we were going to answer.
+		if(push_idx!=GOSSIP_NO_ITEM && items[push_idx].id==item_msg->id && items[push_idx].version==item_msg->version){
+			push_idx = GOSSIP_NO_ITEM;
+			gossip_stats.suppressed++;
+		}
+		//Versions wrap, so compare them by signed difference.
+		if(((int8_t)(item_msg->version-item->version))<=0){
+			gossip_stats.duplicates++;
+			return;
+		}
+	}else{
+		item = get_free_item();
+		item->id = item_msg->id;
+	}
+	item->version = item_msg->version;
+	item->updated = get_time();
+	item->length = data_length;
+	memcpy(item->data, item_msg->data, data_length);
+	gossip_stats.items_received++;
+	if(user_handle_gossip_item){
+		user_handle_gossip_item(item->id, item->data, item->length);
+	}
+}
+
+// The item goes out on the digest's direction only, but isn't targeted, so anyone else on that side can use it.
+static void send_push(){
+	if(push_idx==GOSSIP_NO_ITEM) return;
+	GossipItem* item = &(items[push_idx]);
+	push_idx = GOSSIP_NO_ITEM;
+	if(!item->length) return;
+	GossipItemMsg item_msg;
+	item_msg.flag		= GOSSIP_ITEM_FLAG;
+	item_msg.id			= item->id;
+	item_msg.version	= item->version;
+	memcpy(item_msg.data, item->data, item->length);
+	if(ir_send(1<<push_dir, (char*)(&item_msg), GOSSIP_ITEM_HEADER_LEN+item->length)){
+		gossip_stats.items_sent++;
+	}
+}
+
+static void gossip_upkeep(){
+	send_digest();
+}
+
+static void send_digest(){
+	GossipDigest digest;
+	digest.flag = GOSSIP_DIGEST_FLAG;
+	digest.num_items = 0;
+	for(uint8_t i=0;i<GOSSIP_BLOOM_BYTES;i++){
+		digest.bloom[i] = 0;
+	}
+	for(uint8_t i=0;i<GOSSIP_MAX_ITEMS;i++){
+		if(!items[i].length) continue;
+		bloom_add(digest.bloom, items[i].id, items[i].version);
+		digest.num_items++;
+	}
+	if(ir_send(ALL_DIRS, (char*)(&digest), GOSSIP_DIGEST_LEN)){
+		gossip_stats.digests_sent++;
+	}
+}
+
+static uint16_t bloom_hash(uint16_t id, uint8_t version){
+	uint16_t hash = 0xFFFF;
+	hash = _crc16_update(hash, (uint8_t)(id&0xFF));
+	hash = _crc16_update(hash, (uint8_t)(id>>8));
+	hash = _crc16_update(hash, version);
+	return hash;
+}
+
+/*
+ * Double hashing: bit i is a+i*b (mod 128), where a and b are both taken from a single CRC of the key.
+ * b is forced odd so the GOSSIP_BLOOM_HASHES bits are always distinct.
+ */
+static void bloom_add(uint8_t* bloom, uint16_t id, uint8_t version){
+	uint16_t hash = bloom_hash(id, version);
+	uint8_t a = hash&0x7F;
+	uint8_t b = ((hash>>7)&0x7F)|1;
+	for(uint8_t i=0;i<GOSSIP_BLOOM_HASHES;i++){
+		uint8_t bit = (a+i*b)&0x7F;
+		bloom[bit>>3] |= (1<<(bit&0x07));
+	}
+}
+
+// False positives mean we sometimes don't push an item the neighbour needs. Its next digest will differ.
+static uint8_t bloom_check(uint8_t* bloom, uint16_t id, uint8_t version){
+	uint16_t hash = bloom_hash(id, version);
+	uint8_t a = hash&0x7F;
+	uint8_t b = ((hash>>7)&0x7F)|1;
+	for(uint8_t i=0;i<GOSSIP_BLOOM_HASHES;i++){
+		uint8_t bit = (a+i*b)&0x7F;
+		if(!(bloom[bit>>3]&(1<<(bit&0x07)))) return 0;
+	}
+	return 1;
+}
+
+/*
+ * Whether the filter holds one of the next GOSSIP_NEWER_LOOKAHEAD versions of an item. A false positive here
+ * holds back a push the neighbour needed, just as one in bloom_check does.
+ */
+static uint8_t bloom_has_newer(uint8_t* bloom, uint16_t id, uint8_t version){
+	for(uint8_t i=1;i<=GOSSIP_NEWER_LOOKAHEAD;i++){
+		if(bloom_check(bloom, id, version+i)) return 1;
+	}
+	return 0;
+}
+
+static GossipItem* find_item(uint16_t id){
+	for(uint8_t i=0;i<GOSSIP_MAX_ITEMS;i++){
+		if(items[i].length && items[i].id==id) return &(items[i]);
+	}
+	return NULL;
+}
+
+// Returns an empty slot if there is one, otherwise the least recently updated item.
+static GossipItem* get_free_item(){
+	GossipItem* oldest = &(items[0]);
+	for(uint8_t i=0;i<GOSSIP_MAX_ITEMS;i++){
+		if(!items[i].length) return &(items[i]);
+		if(((int32_t)(items[i].updated-oldest->updated))<0) oldest = &(items[i]);
+	}
+	if(push_idx==(oldest-items)) push_idx = GOSSIP_NO_ITEM;
+	return oldest;
+}
@@ -0,0 +1,268 @@
+#include "ir_baud.h"
+
+/*
+ * BSEL values for each rate, with BSCALE=0: BSEL = 32MHz/(16*baud) - 1
+ * The IR Receiver's data sheet says that the frequency of the data should be a tenth or less than that of
+ * the 38KHz carrier wave, so anything above IR_BAUD_3200 is only expected to work at close range. That's
+ * why the faster rates have to be negotiated, and why we fall back as soon as errors show up.
+ */
+static const uint16_t ir_baud_bsel[IR_NUM_BAUDS] = {624, 416, 311, 249, 207};
+
+static volatile uint8_t		curr_baud[6];
+static volatile id_t		window_peer[6];
+static volatile uint32_t	window_end[6];
+static volatile uint8_t		window_errs[6];
+
+static IrBaudLink links[IR_BAUD_TABLE_SIZE];
+static uint8_t next_link_slot;
+
+static id_t		probe_target;
+static uint8_t	probe_dirs;
+static uint8_t	probe_baud;
+static uint8_t	probe_seq;
+static uint32_t	probe_retry_at;
+
+static id_t		ack_peer;
+static uint8_t	ack_dir;
+static uint8_t	ack_baud;
+
+static void ir_baud_upkeep();
+static void open_window(uint8_t dirs, uint8_t baud, id_t peer);
+static void close_window(uint8_t dirs);
+static void send_ack();
+static void start_probe_window(void* seq);
+static void probe_timeout(void* seq);
+static IrBaudLink* get_link(id_t id, uint8_t add);
+
+void ir_baud_init(){
+	for(uint8_t dir=0;dir<6;dir++){
+		window_peer[dir] = 0;
+		window_end[dir] = 0;
+		window_errs[dir] = 0;
+	}
+	ir_set_baud(ALL_DIRS, IR_DEFAULT_BAUD);
+	for(uint8_t i=0;i<IR_BAUD_TABLE_SIZE;i++){
+		links[i].id = 0;
+		links[i].best = IR_DEFAULT_BAUD;
+		links[i].fail = IR_NUM_BAUDS;
+	}
+	next_link_slot = 0;
+	probe_target = 0;
+	probe_dirs = 0;
+	probe_seq = 0;
+	probe_retry_at = 0;
+	ack_peer = 0;
+	schedule_periodic_task(IR_BAUD_UPKEEP_PERIOD_MS, ir_baud_upkeep, NULL);
+}
+
+void ir_set_baud(uint8_t dirs, uint8_t baud){
+	if(baud>=IR_NUM_BAUDS) return;
+	uint16_t bsel = ir_baud_bsel[baud];
+	for(uint8_t dir=0;dir<6;dir++){
+		if(dirs&(1<<dir)){
+			channel[dir]->BAUDCTRLA = (uint8_t)(bsel&0xFF);
+			channel[dir]->BAUDCTRLB = (uint8_t)((bsel>>8)&0x0F);
+			curr_baud[dir] = baud;
+		}
+	}
+}
+
+uint8_t ir_get_baud(uint8_t dir){
+	return curr_baud[dir];
+}
+
+uint8_t ir_baud_for(id_t id){
+	IrBaudLink* link = get_link(id, 0);
+	return link ? link->best : IR_DEFAULT_BAUD;
+}
+
+/*
+ * Asks 'target' to try the next rate above the best one we know works for it, or if there's none left to try,
+ * to open a window at the best one again. The probe itself goes out at the current rate. Once it has been
+ * sent, we switch 'dirs' to the new rate and wait for the target to ack at that rate. The target holds its ack
+ * back for IR_BAUD_ACK_DELAY_MS, so the switch comes first even if it runs late. If the ack doesn't show up in
+ * time, the rate is marked as failed for this target. Returns '0' if no probe was started.
+ */
+uint8_t ir_negotiate_baud(uint8_t dirs, id_t target){
+	if(probe_dirs || !target || ((int32_t)(get_time()-probe_retry_at))<0) return 0;
+	IrBaudLink* link = get_link(target, 1);
+	uint8_t next = link->best+1;
+	if(next>=link->fail || next>=IR_NUM_BAUDS) next = link->best;
+	if(next==IR_DEFAULT_BAUD) return 0;
+	uint8_t open = 1;
+	for(uint8_t dir=0;dir<6;dir++){
+		if((dirs&(1<<dir)) && (window_peer[dir]!=target || curr_baud[dir]!=next)) open = 0;
+	}
+	if(open) return 0;
+	char msg[10];
+	uint8_t len = sprintf(msg, IR_BAUD_PROBE_STR " %hu", next);
+	if(!ir_targeted_cmd(dirs, msg, len, target)) return 0;
+	probe_target	= target;
+	probe_dirs		= dirs;
+	probe_baud		= next;
+	probe_seq		= (probe_seq==0xFF) ? 1 : probe_seq+1;
+	//Each byte takes a little over 3ms at the default rate; wait for the probe to finish going out.
+	if(!schedule_task(3*(HEADER_LEN+len)+5, start_probe_window, (void*)((uint16_t)probe_seq))){
+		probe_dirs = 0;
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Called by send_msg before every transmission. Anything which isn't targeted at the peer we negotiated
+ * with drops the window, so broadcasts always go out at the default rate. Sending to the peer doesn't keep
+ * the window up, though: if the peer has fallen back, only hearing from it would tell us.
+ */
+void ir_baud_prepare_send(uint8_t dirs, id_t target){
+	for(uint8_t dir=0;dir<6;dir++){
+		if((dirs&(1<<dir)) && curr_baud[dir]!=IR_DEFAULT_BAUD){
+			if(!target || target!=window_peer[dir]){
+				if(probe_dirs&(1<<dir)) probe_dirs &= ~(1<<dir);
+				close_window(1<<dir);
+			}
+		}
+	}
+}
+
+// Only errors in a row count against a rate; a good message clears them.
+void ir_baud_rx_ok(uint8_t dir, id_t sender){
+	if(window_peer[dir] && window_peer[dir]==sender){
+		window_end[dir] = get_time()+IR_BAUD_WINDOW_MS;
+		window_errs[dir] = 0;
+	}
+}
+
+// Called from ir_receive, so keep it short.
+void ir_baud_rx_error(uint8_t dir){
+	if(window_peer[dir]) window_errs[dir]++;
+}
+
+void handle_baud_probe(char* command_args){
+	uint8_t baud = atoi(command_args);
+	if(baud==IR_DEFAULT_BAUD || baud>=IR_NUM_BAUDS || ack_peer) return;
+	IrBaudLink* link = get_link(cmd_sender_id, 0);
+	if(link && baud>=link->fail) return; //We've seen it fail from our side.
+	uint8_t dir_mask = (1<<cmd_arrival_dir);
+	open_window(dir_mask, baud, cmd_sender_id);
+	//Until the prober's first message at the new rate shows it got the ack.
+	window_end[cmd_arrival_dir] = get_time()+IR_BAUD_ACK_DELAY_MS+IR_BAUD_ACK_TIMEOUT_MS;
+	ack_peer = cmd_sender_id;
+	ack_dir = cmd_arrival_dir;
+	ack_baud = baud;
+	if(!schedule_task(IR_BAUD_ACK_DELAY_MS, send_ack, NULL)){
+		ack_peer = 0;
+		close_window(dir_mask);
+	}
+}
+
+void handle_baud_ack(char* command_args){
+	uint8_t baud = atoi(command_args);
+	if(!probe_dirs || cmd_sender_id!=probe_target || baud!=probe_baud) return;
+	IrBaudLink* link = get_link(probe_target, 1);
+	link->best = baud;
+	open_window(probe_dirs, baud, probe_target);
+	probe_dirs = 0;
+}
+
+// Only if the window handle_baud_probe opened is still up; anything else on that dir would have closed it.
+static void send_ack(){
+	id_t peer = ack_peer;
+	ack_peer = 0;
+	uint8_t dir_mask = (1<<ack_dir);
+	if(window_peer[ack_dir]!=peer || curr_baud[ack_dir]!=ack_baud) return;
+	char msg[10];
+	uint8_t len = sprintf(msg, IR_BAUD_ACK_STR " %hu", ack_baud);
+	if(!ir_targeted_cmd(dir_mask, msg, len, peer)){
+		close_window(dir_mask);
+	}
+}
+
+/*
+ * The probe may have gone out late (preempted, or waiting for its channels), and switching rates under it
+ * would garble it, so we wait for it to finish.
+ */
+static void start_probe_window(void* seq){
+	if(((uint8_t)((uint16_t)seq))!=probe_seq || !probe_dirs) return;
+	for(uint8_t dir=0;dir<6;dir++){
+		if((probe_dirs&(1<<dir)) && (ir_rxtx[dir].status&IR_STATUS_TRANSMITTING_bm)){
+			if(!schedule_task(MIN_TASK_TIME_IN_FUTURE, start_probe_window, seq)) probe_dirs = 0;
+			return;
+		}
+	}
+	ir_set_baud(probe_dirs, probe_baud);
+	if(!schedule_task(IR_BAUD_ACK_TIMEOUT_MS, probe_timeout, seq)){
+		probe_timeout(seq);
+	}
+}
+
+/*
+ * Any window we had with the target goes too: the target may have switched, and we can't tell. It'll have
+ * dropped back by probe_retry_at, if so, so no probe goes out before then that it couldn't hear.
+ */
+static void probe_timeout(void* seq){
+	if(((uint8_t)((uint16_t)seq))!=probe_seq || !probe_dirs) return;
+	IrBaudLink* link = get_link(probe_target, 1);
+	link->fail = probe_baud;
+	if(link->best>=link->fail) link->best = link->fail-1;
+	close_window(probe_dirs);
+	probe_retry_at = get_time()+IR_BAUD_ACK_DELAY_MS+IR_BAUD_ACK_TIMEOUT_MS;
+	probe_dirs = 0;
+}
+
+static void ir_baud_upkeep(){
+	uint32_t now = get_time();
+	for(uint8_t dir=0;dir<6;dir++){
+		if(!window_peer[dir]) continue;
+		if(ir_rxtx[dir].status & IR_STATUS_TRANSMITTING_bm) continue;
+		if(window_errs[dir]>=IR_BAUD_MAX_ERRS){
+			IrBaudLink* link = get_link(window_peer[dir], 0);
+			if(link && curr_baud[dir]!=IR_DEFAULT_BAUD){
+				link->fail = curr_baud[dir];
+				if(link->best>=link->fail) link->best = link->fail-1;
+			}
+			close_window(1<<dir);
+		}else if(((int32_t)(now-window_end[dir]))>0){
+			close_window(1<<dir);
+		}
+	}
+}
+
+static void open_window(uint8_t dirs, uint8_t baud, id_t peer){
+	uint32_t end = get_time()+IR_BAUD_WINDOW_MS;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		ir_set_baud(dirs, baud);
+		for(uint8_t dir=0;dir<6;dir++){
+			if(dirs&(1<<dir)){
+				window_peer[dir] = peer;
+				window_end[dir] = end;
+				window_errs[dir] = 0;
+			}
+		}
+	}
+}
+
+static void close_window(uint8_t dirs){
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		ir_set_baud(dirs, IR_DEFAULT_BAUD);
+		for(uint8_t dir=0;dir<6;dir++){
+			if(dirs&(1<<dir)){
+				window_peer[dir] = 0;
+				window_errs[dir] = 0;
+			}
+		}
+	}
+}
+
+static IrBaudLink* get_link(id_t id, uint8_t add){
+	for(uint8_t i=0;i<IR_BAUD_TABLE_SIZE;i++){
+		if(links[i].id==id) return &(links[i]);
+	}
+	if(!add) return NULL;
+	IrBaudLink* link = &(links[next_link_slot]);
+	next_link_slot = (next_link_slot+1)%IR_BAUD_TABLE_SIZE;
+	link->id = id;
+	link->best = IR_DEFAULT_BAUD;
+	link->fail = IR_NUM_BAUDS;
+	return link;
+}
@@ -1,4 +1,5 @@
 #include "ir_comm.h"
+#include "ir_baud.h"
 #include "rgb_led.h"
 
 static volatile uint8_t processing_cmd;
@@ -7,17 +8,45 @@ static volatile uint8_t processing_ffsync;
 static void clear_ir_buffer(uint8_t dir);
 static void perform_ir_upkeep();
 static void ir_receive(uint8_t dir); //Called by Interrupt Handler Only
+static void rx_edge_arm(uint8_t dir, uint8_t on);
+static void rx_start_bit(uint8_t dir); //Called by Interrupt Handler Only
+static uint16_t calc_rx_crc(uint8_t dir);
 static void received_ir_cmd(uint8_t dir);
-static void received_rnb_r(uint8_t delay, id_t senderID, uint32_t last_byte);
+static void received_rnb_r(uint8_t delay, id_t senderID, uint32_t last_byte, char* data, uint8_t data_length);
 static void received_ir_sync(uint8_t delay, id_t senderID);
 static void ir_transmit(uint8_t dir);
 //static void ir_remote_send(uint8_t dir, uint16_t data);
 static void ir_transmit_complete(uint8_t dir);
+static uint16_t calc_tx_crc(uint8_t dir, char* data, uint8_t data_length);
+static void load_tx_buffer(uint8_t dir, char* data, uint8_t data_length, uint16_t crc);
+static void start_tx(uint8_t dirs, uint8_t hp_flag);
+static uint8_t preempt_send(uint8_t dirs, char* data, uint8_t data_length, id_t target, uint8_t cmd_flag, uint8_t prio);
+static void send_pending(void* prio);
+static uint8_t is_quiet(uint8_t prio);
 
+static const uint8_t inc_dir_prio_bits[IR_NUM_PRIOS] = {INC_DIR_PRIO_BULK, INC_DIR_PRIO_NORMAL, INC_DIR_PRIO_CONTROL};
+
+/*
+ * A send which took its channels from a lower priority one waits here for IR_PREEMPT_GAP_MS.
+ * Its dirs stay reserved until then, so nothing of the same or lower priority can grab them in the meantime.
+ * The IR_PRIO_BULK slot is never used, since bulk sends never preempt anything.
+ */
+static struct{
+	char		data[IR_BUFFER_SIZE];
+	uint32_t	since;
+	id_t		target;
+	uint8_t		dirs;		//0 if this slot is free.
+	uint8_t		length;
+	uint8_t		cmd_flag;
+} pending_sends[IR_NUM_PRIOS];
+
+static volatile uint32_t	quiet_until;	//See ir_quiet.
 static volatile uint16_t	cmd_length;
 static volatile char		cmd_buffer[BUFFER_SIZE];
 /* Hardware addresses for the port pins with the carrier wave */
 static uint8_t ir_carrier_bm[] = { PIN0_bm, PIN1_bm, PIN4_bm, PIN5_bm, PIN6_bm, PIN7_bm };
+/* Ports with the RX pins; dirs 1 and 4 are on pin 6 and use the port's INT1, the rest are on pin 2 and use INT0. */
+static PORT_t* const rx_ports[] = { &PORTC, &PORTC, &PORTD, &PORTE, &PORTE, &PORTF };
 
 //#define HARDCORE_DEBUG_DIR 1
 
@@ -33,7 +62,9 @@ static void clear_ir_buffer(uint8_t dir){
 	
 	ir_rxtx[dir].target_ID		= 0;	
 	ir_rxtx[dir].curr_pos		= 0;
-	ir_rxtx[dir].calc_crc		= 0;
+	ir_rxtx[dir].strength		= 0;
+	rx_edge_arm(dir, 0);
+	ir_strength_cancel(dir);
 	ir_rxtx[dir].data_length	= 0;	
 	ir_rxtx[dir].inc_dir 		= 0;
 	
@@ -59,9 +90,6 @@ void ir_comm_init(){
 		channel[i]->CTRLA = (uint8_t) USART_RXCINTLVL_MED_gc | USART_TXCINTLVL_MED_gc;		// Set USART as med-level interrupts
 		channel[i]->CTRLC = (uint8_t) USART_CHSIZE_8BIT_gc | USART_PMODE_DISABLED_gc;		// 8 bits, no parity
 		
-		channel[i]->BAUDCTRLA = 0b01110000; channel[i]->BAUDCTRLB = 0b00000010;	//3200 baud - we have an upper bound of 3800 baud because of the 38KHz carrier wave. The IR Receiver's data sheets say that frequency of the data should be a tenth or less than that of the carrier.
-		//channel[i]->BAUDCTRLA = 0b11000000; channel[i]->BAUDCTRLB = 0b00000100; //9600 baud - this would be the upper bound if we switched to TSDP34156-ND.
-		
 		channel[i]->CTRLB |= USART_RXEN_bm;		// Enable communication
 		channel[i]->CTRLB |= USART_TXEN_bm;
 	}
@@ -78,7 +106,21 @@ void ir_comm_init(){
 		EVSYS.CH5MUX = EVSYS_CHMUX_PORTE_PIN2_gc;
 		EVSYS.CH6MUX = EVSYS_CHMUX_PORTE_PIN6_gc;
 		EVSYS.CH7MUX = EVSYS_CHMUX_PORTF_PIN2_gc;
-	#endif	
+	#else
+		PORTC.PIN2CTRL = PORT_ISC_FALLING_gc;
+		PORTC.PIN6CTRL = PORT_ISC_FALLING_gc;
+		PORTD.PIN2CTRL = PORT_ISC_FALLING_gc;
+		PORTE.PIN2CTRL = PORT_ISC_FALLING_gc;
+		PORTE.PIN6CTRL = PORT_ISC_FALLING_gc;
+		PORTF.PIN2CTRL = PORT_ISC_FALLING_gc;
+	#endif
+	// Start bit interrupts, for ir_strength_start. Nothing fires until rx_edge_arm sets a pin's mask.
+	PORTC.INTCTRL = PORT_INT0LVL_MED_gc | PORT_INT1LVL_MED_gc;
+	PORTD.INTCTRL = PORT_INT0LVL_MED_gc;
+	PORTE.INTCTRL = PORT_INT0LVL_MED_gc | PORT_INT1LVL_MED_gc;
+	PORTF.INTCTRL = PORT_INT0LVL_MED_gc;
+
+	ir_baud_init(); //Sets every channel to IR_DEFAULT_BAUD; see ir_baud.h for faster rates.
 
 	curr_ir_power=0;	
 	for(uint8_t dir=0; dir<6; dir++) clear_ir_buffer(dir); //this initializes the buffer's values to 0.
@@ -87,6 +129,7 @@ void ir_comm_init(){
 	user_facing_messages_ovf=0;
 	processing_cmd = 0;
 	processing_ffsync = 0;
+	for(uint8_t prio=0; prio<IR_NUM_PRIOS; prio++) pending_sends[prio].dirs = 0;
 
 	schedule_periodic_task(1000/IR_UPKEEP_FREQUENCY, perform_ir_upkeep, NULL);
 	
@@ -102,6 +145,7 @@ void handle_cmd_wrapper(){
 	//Nothing should touch the cmd_buffer and stuff as long as processing_cmd is still 1.
 	memcpy(local_msg_copy, (const void*)cmd_buffer, cmd_length+1);
 	local_msg_len = cmd_length;
+	neighbor_heard(cmd_sender_id, cmd_arrival_dir, cmd_arrival_time, 0);
 	handle_serial_command(local_msg_copy, local_msg_len);
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
 		processing_cmd = 0;
@@ -110,34 +154,66 @@ void handle_cmd_wrapper(){
 
 static void perform_ir_upkeep(){
 	uint16_t seen_crcs[6] = {0,0,0,0,0,0};
+	uint8_t seen_nodes[6] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF}; //msg_node index each dir's message went to, if it's still there.
 	uint8_t crc_seen;
 	int8_t check_dir;
 	int8_t dir;
 	for(dir= 0; dir<6; dir++){ //This first loop looks for a channel on which we got a good message.
-		if(ir_rxtx[dir].status&IR_STATUS_COMPLETE_bm){
+		if(ir_rxtx[dir].status&IR_STATUS_COMPLETE_bm){ //ir_receive has already checked the CRC.
 			crc_seen = 0;
-			for(check_dir=(dir-1) ;  check_dir>=0 ; check_dir--)
-				if(seen_crcs[check_dir]==ir_rxtx[dir].data_crc) crc_seen = 1;
+			for(check_dir=(dir-1) ;  check_dir>=0 ; check_dir--){
+				if(seen_crcs[check_dir]==ir_rxtx[dir].data_crc){
+					crc_seen = 1;
+					seen_nodes[dir] = seen_nodes[check_dir];
+				}
+			}
 			seen_crcs[dir] = ir_rxtx[dir].data_crc;
+			neighbor_heard(ir_rxtx[dir].sender_ID, dir, ir_rxtx[dir].last_byte, crc_seen);
 
-			if(crc_seen) clear_ir_buffer(dir);
-			else{ //Normal message; add to message queue.		
-				if(num_waiting_msgs>=MAX_USER_FACING_MESSAGES){
+			if(crc_seen){ //Another copy of a message we just queued; all we want from it is the strength.
+				if(seen_nodes[dir]<num_waiting_msgs) msg_node[seen_nodes[dir]].strength[dir] = ir_rxtx[dir].strength;
+				clear_ir_buffer(dir);
+			}else{ //Normal message; add to message queue.		
+				uint8_t slot = num_waiting_msgs;
+				if(slot>=MAX_USER_FACING_MESSAGES){
+					//Full, so this evicts the oldest message of the lowest priority, unless that's higher than ours.
 					user_facing_messages_ovf = 1;
-					num_waiting_msgs=0;
+					uint8_t evict = 0;
+					for(uint8_t i=1;i<MAX_USER_FACING_MESSAGES;i++){
+						if(msg_node[i].prio<msg_node[evict].prio) evict = i;
+					}
+					if(msg_node[evict].prio>ir_rxtx[dir].prio){
+						clear_ir_buffer(dir);
+						continue;
+					}
+					//check_messages relies on the queue being oldest-first, so close the gap and add ours at the end.
+					ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+						memmove((void*)&(msg_node[evict]), (const void*)&(msg_node[evict+1]), (MAX_USER_FACING_MESSAGES-1-evict)*sizeof(msg_node[0]));
+						num_waiting_msgs--;
+					}
+					for(check_dir=0;check_dir<dir;check_dir++){ //Earlier copies from this pass have moved too.
+						if(seen_nodes[check_dir]==evict)		seen_nodes[check_dir] = 0xFF;
+						else if(seen_nodes[check_dir]>evict)	seen_nodes[check_dir]--;
+					}
+					slot = num_waiting_msgs;
 				}
 				ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+					for(uint8_t i=0;i<6;i++) msg_node[slot].strength[i] = 0;
+					msg_node[slot].strength[dir] = ir_rxtx[dir].strength;
+					msg_node[slot].prio = ir_rxtx[dir].prio;
+					seen_nodes[dir] = slot;
 					if(ir_rxtx[dir].data_length==0){
 						printf_P(PSTR("ERROR: Message length 0 in perform_ir_upkeep.\r\n"));
 					}
-					memcpy((void *)msg_node[num_waiting_msgs].msg, (char*)ir_rxtx[dir].buf, ir_rxtx[dir].data_length);
-					msg_node[num_waiting_msgs].msg[ir_rxtx[dir].data_length]='\0';
-					msg_node[num_waiting_msgs].arrival_time = ir_rxtx[dir].last_byte;
-					msg_node[num_waiting_msgs].arrival_dir = dir;
-					msg_node[num_waiting_msgs].sender_ID = ir_rxtx[dir].sender_ID;
-					msg_node[num_waiting_msgs].msg_length = ir_rxtx[dir].data_length;
-					msg_node[num_waiting_msgs].wasTargeted = !!(ir_rxtx[dir].status&IR_STATUS_TARGETED_bm);
-					if(msg_node[num_waiting_msgs].msg_length > IR_BUFFER_SIZE){
+					memcpy((void *)msg_node[slot].msg, (char*)ir_rxtx[dir].buf, ir_rxtx[dir].data_length);
+					msg_node[slot].msg[ir_rxtx[dir].data_length]='\0';
+					msg_node[slot].arrival_time = ir_rxtx[dir].last_byte;
+					msg_node[slot].arrival_dir = dir;
+					msg_node[slot].sender_ID = ir_rxtx[dir].sender_ID;
+					msg_node[slot].msg_length = ir_rxtx[dir].data_length;
+					msg_node[slot].wasTargeted = !!(ir_rxtx[dir].status&IR_STATUS_TARGETED_bm);
+					ir_baud_rx_ok(dir, ir_rxtx[dir].sender_ID);
+					if(msg_node[slot].msg_length > IR_BUFFER_SIZE){
 						printf_P(PSTR("ERROR! Message too long?\r\n"));
 					}
 					num_waiting_msgs++;
@@ -149,32 +225,25 @@ static void perform_ir_upkeep(){
 	}
 }
 
-void send_msg(uint8_t dirs, char *data, uint8_t data_length, uint8_t hp_flag){
-	if(data_length>IR_BUFFER_SIZE) printf_P(PSTR("ERROR: Message exceeds IR_BUFFER_SIZE.\r\n"));
-	
+static uint16_t calc_tx_crc(uint8_t dir, char* data, uint8_t data_length){
 	uint16_t crc = get_droplet_id();
-	for(uint8_t dir=0; dir<6; dir++){
-		if(dirs&(1<<dir)){			
-			crc = _crc16_update(crc, (ir_rxtx[dir].status & IR_STATUS_CRC_BITS_bm));
-			crc = _crc16_update(crc, ir_rxtx[dir].target_ID);
-			break;
-		}	
-	}
-
+	crc = _crc16_update(crc, (ir_rxtx[dir].status & IR_STATUS_CRC_BITS_bm));
+	crc = _crc16_update(crc, ir_rxtx[dir].target_ID);
 	for(uint8_t i=0; i<data_length; i++) crc = _crc16_update(crc, data[i]); //Calculate CRC of outbound message.
-	
-	for(uint8_t dir=0; dir<6; dir++){
-		if(dirs&(1<<dir)){
-			ir_rxtx[dir].status |= IR_STATUS_TRANSMITTING_bm;
-			ir_rxtx[dir].data_length = data_length;
-			ir_rxtx[dir].data_crc = crc;
-			ir_rxtx[dir].curr_pos = 0;
-			ir_rxtx[dir].sender_ID = get_droplet_id();
-			memcpy((char*)ir_rxtx[dir].buf, data, data_length);
-			TCF2.CTRLB |= ir_carrier_bm[dir];		// Turn on carrier wave on port dir
-		}
-	}
+	return crc;
+}
+
+static void load_tx_buffer(uint8_t dir, char* data, uint8_t data_length, uint16_t crc){
+	ir_rxtx[dir].status |= IR_STATUS_TRANSMITTING_bm;
+	ir_rxtx[dir].data_length = data_length;
+	ir_rxtx[dir].data_crc = crc;
+	ir_rxtx[dir].curr_pos = 0;
+	ir_rxtx[dir].sender_ID = get_droplet_id();
+	memcpy((char*)ir_rxtx[dir].buf, data, data_length);
+	TCF2.CTRLB |= ir_carrier_bm[dir];		// Turn on carrier wave on port dir
+}
 
+static void start_tx(uint8_t dirs, uint8_t hp_flag){
 	for(uint8_t dir=0; dir<6; dir++){
 		if(dirs&(1<<dir)){
 			ir_rxtx[dir].last_byte = 0;
@@ -185,21 +254,48 @@ void send_msg(uint8_t dirs, char *data, uint8_t data_length, uint8_t hp_flag){
 			}
 		}
 	}
-
 	/* The whole transmission will now occur in interrupts. */
 }
 
+void send_msg(uint8_t dirs, char *data, uint8_t data_length, uint8_t hp_flag){
+	if(data_length>IR_BUFFER_SIZE) printf_P(PSTR("ERROR: Message exceeds IR_BUFFER_SIZE.\r\n"));
+	
+	//Every dir has the same status bits and target, so the CRC only needs computing once.
+	uint16_t crc = 0;
+	for(uint8_t dir=0; dir<6; dir++){
+		if(dirs&(1<<dir)){			
+			crc = calc_tx_crc(dir, data, data_length);
+			ir_baud_prepare_send(dirs, ir_rxtx[dir].target_ID);
+			break;
+		}	
+	}
+	
+	for(uint8_t dir=0; dir<6; dir++){
+		if(dirs&(1<<dir)) load_tx_buffer(dir, data, data_length, crc);
+	}
+
+	start_tx(dirs, hp_flag);
+}
+
 /*
  * This function returns '0' if no message was sent because the channels were busy, and '1' if it was successful 
  * in claiming channels and starting the message send process. Note that this function returning '1' doesn't
  * guarantee a successful transmission, as it's still possible for something to go wrong with the send.
  */
-inline uint8_t all_ir_sends(uint8_t dirs_to_go, char* data, uint8_t data_length, id_t target, uint8_t cmd_flag){
+static inline uint8_t all_ir_sends(uint8_t dirs_to_go, char* data, uint8_t data_length, id_t target, uint8_t cmd_flag, uint8_t prio){
 	if(hp_ir_block_bm){
 		printf_P(PSTR("Normal send blocked by hp.\r\n"));
 		return 0;
 	}
+	if(is_quiet(prio)) return 0;
+	for(uint8_t p=prio; p<IR_NUM_PRIOS; p++){
+		if(dirs_to_go&pending_sends[p].dirs){
+			printf_P(PSTR("Send blocked: channels reserved for a priority %hu send.\r\n"), p);
+			return 0;
+		}
+	}
 	if(!ir_is_available(dirs_to_go)){
+		if(preempt_send(dirs_to_go, data, data_length, target, cmd_flag, prio)) return 1;
         printf_P(PSTR("Aborting IR send while trying:\r\n\t"));
 		for(uint8_t i=0;i<data_length;i++){
 			printf("%02hX ",data[i]);
@@ -213,26 +309,153 @@ inline uint8_t all_ir_sends(uint8_t dirs_to_go, char* data, uint8_t data_length,
 			ir_rxtx[dir].status = IR_STATUS_BUSY_bm;
 			if(cmd_flag) ir_rxtx[dir].status |= IR_STATUS_COMMAND_bm;
 			ir_rxtx[dir].target_ID=target;
+			ir_rxtx[dir].prio = prio;
 		}
 	}
 	send_msg(dirs_to_go, data, data_length, 0);
     return 1;
 }
 
+/*
+ * If every busy channel in dirs is sending something of a lower priority than ours, those sends are cut
+ * short and ours goes out IR_PREEMPT_GAP_MS later. Returns '0' if we can't preempt.
+ */
+static uint8_t preempt_send(uint8_t dirs, char* data, uint8_t data_length, id_t target, uint8_t cmd_flag, uint8_t prio){
+	if(prio==IR_PRIO_BULK || pending_sends[prio].dirs || data_length>IR_BUFFER_SIZE) return 0;
+	for(uint8_t dir=0;dir<6;dir++){
+		if((dirs&(1<<dir)) && (ir_rxtx[dir].status&IR_STATUS_TRANSMITTING_bm) && ir_rxtx[dir].prio>=prio) return 0;
+	}
+	if(!schedule_task(IR_PREEMPT_GAP_MS, send_pending, (void*)((uint16_t)prio))) return 0;
+	memcpy(pending_sends[prio].data, data, data_length);
+	pending_sends[prio].length = data_length;
+	pending_sends[prio].target = target;
+	pending_sends[prio].cmd_flag = cmd_flag;
+	pending_sends[prio].since = get_time();
+	pending_sends[prio].dirs = dirs;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		for(uint8_t dir=0;dir<6;dir++){
+			//Stops feeding bytes; ir_transmit_complete will clean up once the current byte is out.
+			if((dirs&(1<<dir)) && (ir_rxtx[dir].status&IR_STATUS_TRANSMITTING_bm)){
+				channel[dir]->CTRLA &= ~USART_DREINTLVL_gm;
+			}
+		}
+	}
+	return 1;
+}
+
+/*
+ * ir_send_prio has already told the caller this went out, so if something still has its channels (an hp send,
+ * say, or a higher priority pending one), it keeps them reserved and tries again at each upkeep, for up to
+ * IR_PENDING_MAX_WAIT_MS.
+ */
+static void send_pending(void* prio){
+	uint8_t p = (uint8_t)((uint16_t)prio);
+	uint8_t dirs = pending_sends[p].dirs;
+	uint8_t blocked = hp_ir_block_bm || is_quiet(p) || !ir_is_available(dirs);
+	for(uint8_t q=p+1; q<IR_NUM_PRIOS; q++) blocked |= !!(dirs&pending_sends[q].dirs);
+	if(blocked){
+		if((get_time()-pending_sends[p].since)<IR_PENDING_MAX_WAIT_MS &&
+			schedule_task(1000/IR_UPKEEP_FREQUENCY, send_pending, prio)) return;
+		printf_P(PSTR("Dropped a priority %hu send: its channels never came free.\r\n"), p);
+		pending_sends[p].dirs = 0;
+		return;
+	}
+	pending_sends[p].dirs = 0;
+	all_ir_sends(dirs, pending_sends[p].data, pending_sends[p].length, pending_sends[p].target, pending_sends[p].cmd_flag, p);
+}
+
+/*
+ * Safe to call from an interrupt. A second call while we're already quiet only ever makes it last longer.
+ */
+void ir_quiet(uint16_t ms){
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		uint32_t until = get_time()+ms;
+		if(((int32_t)(until-quiet_until))>0) quiet_until = until;
+	}
+}
+
+static uint8_t is_quiet(uint8_t prio){
+	if(prio>=IR_PRIO_CONTROL) return 0;
+	uint32_t until;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		until = quiet_until;
+	}
+	return ((int32_t)(until-get_time()))>0;
+}
+
+/*
+ * Sends a different message on each direction, all at once: vecs[i].data goes out on vecs[i].dir. Each
+ * direction gets its own CRC, so receivers can't tell this apart from a normal ir_send. Every direction has
+ * to be free, and each may only appear once. Returns '0' if nothing was sent, just like ir_send.
+ * A round takes no less time than six ir_sends made back to back (see ir_send_vec_sim), but it's all or nothing.
+ */
+uint8_t ir_send_vec(IrSendVec* vecs, uint8_t count){
+	uint8_t dirs = 0;
+	for(uint8_t i=0; i<count; i++){
+		if(vecs[i].dir>=6 || (dirs&(1<<vecs[i].dir)) || vecs[i].data_length>IR_BUFFER_SIZE){
+			printf_P(PSTR("ERROR: Bad vector %hu in ir_send_vec.\r\n"), i);
+			return 0;
+		}
+		dirs |= (1<<vecs[i].dir);
+	}
+	if(!dirs) return 0;
+	if(hp_ir_block_bm){
+		printf_P(PSTR("Normal send blocked by hp.\r\n"));
+		return 0;
+	}
+	if(is_quiet(IR_PRIO_NORMAL)) return 0;
+	if(dirs&(pending_sends[IR_PRIO_NORMAL].dirs|pending_sends[IR_PRIO_CONTROL].dirs)){
+		printf_P(PSTR("Aborting ir_send_vec: channels reserved for a higher priority send.\r\n"));
+		return 0;
+	}
+	if(!ir_is_available(dirs)){
+		printf_P(PSTR("Aborting ir_send_vec: channels are probably blocked by your previous message.\r\n"));
+		return 0;
+	}
+	for(uint8_t dir=0;dir<6;dir++){
+		if(dirs&(1<<dir)){		
+			channel[dir]->CTRLB &= ~USART_RXEN_bm;
+			ir_rxtx[dir].status = IR_STATUS_BUSY_bm;
+			ir_rxtx[dir].target_ID = 0;
+			ir_rxtx[dir].prio = IR_PRIO_NORMAL;
+		}
+	}
+	ir_baud_prepare_send(dirs, 0);
+	for(uint8_t i=0; i<count; i++){
+		uint8_t dir = vecs[i].dir;
+		load_tx_buffer(dir, vecs[i].data, vecs[i].data_length, calc_tx_crc(dir, vecs[i].data, vecs[i].data_length));
+	}
+	start_tx(dirs, 0);
+	return 1;
+}
+
 uint8_t ir_targeted_cmd(uint8_t dirs, char *data, uint8_t data_length, id_t target){
-	return all_ir_sends(dirs, data, data_length, target, 1);
+	return all_ir_sends(dirs, data, data_length, target, 1, IR_PRIO_CONTROL);
 }
 
 uint8_t ir_cmd(uint8_t dirs, char *data, uint8_t data_length){	
-	return all_ir_sends(dirs, data, data_length, 0, 1);
+	return all_ir_sends(dirs, data, data_length, 0, 1, IR_PRIO_CONTROL);
 }
 
 uint8_t ir_targeted_send(uint8_t dirs, char *data, uint8_t data_length, id_t target){
-	return all_ir_sends(dirs, data, data_length, target, 0);
+	return all_ir_sends(dirs, data, data_length, target, 0, IR_PRIO_NORMAL);
 }
 
 uint8_t ir_send(uint8_t dirs, char *data, uint8_t data_length){
-	return all_ir_sends(dirs, data, data_length, 0, 0);
+	return all_ir_sends(dirs, data, data_length, 0, 0, IR_PRIO_NORMAL);
+}
+
+uint8_t ir_send_prio(uint8_t dirs, char *data, uint8_t data_length, uint8_t prio){
+	if(prio>=IR_NUM_PRIOS) prio = IR_PRIO_CONTROL;
+	return all_ir_sends(dirs, data, data_length, 0, 0, prio);
+}
+
+/*
+ * Sends on whichever emitters face the cone 'spread' degrees wide around 'bearing'; see dirs_toward.
+ * Bearing uses the same frame as last_good_rnb, so last_good_rnb.bearing can be passed in directly.
+ */
+uint8_t ir_send_toward(int16_t bearing, uint16_t spread, char* data, uint8_t data_length){
+	return ir_send(dirs_toward(bearing, spread), data, data_length);
 }
 
 static inline uint8_t all_hp_ir_cmds(uint8_t dirs, char* data, uint8_t data_length, id_t target){
@@ -252,6 +475,7 @@ static inline uint8_t all_hp_ir_cmds(uint8_t dirs, char* data, uint8_t data_leng
 				ir_rxtx[dir].status = IR_STATUS_BUSY_bm | IR_STATUS_COMMAND_bm;
 				ir_rxtx[dir].status |= (timed ? IR_STATUS_TIMED_bm : 0);
 				ir_rxtx[dir].target_ID=target;
+				ir_rxtx[dir].prio = IR_PRIO_CONTROL;
 				hp_ir_block_bm |= (1<<dir);
 			}
 		}
@@ -285,74 +509,132 @@ void waitForTransmission(uint8_t dirs){
 
 
 
-// To be called from interrupt handler only. Do not call.
+/*
+ * Computes the CRC of the message in ir_rxtx[dir], the same way calc_tx_crc does. Checking this is left until
+ * the whole message is in (and, for normal messages, until perform_ir_upkeep) so that ir_receive doesn't
+ * pay for a CRC update on every byte.
+ */
+static uint16_t calc_rx_crc(uint8_t dir){
+	uint16_t crc = _crc16_update(ir_rxtx[dir].sender_ID, ir_rxtx[dir].status & IR_STATUS_CRC_BITS_bm);
+	crc = _crc16_update(crc, ir_rxtx[dir].target_ID);
+	for(uint8_t i=0; i<ir_rxtx[dir].data_length; i++) crc = _crc16_update(crc, ir_rxtx[dir].buf[i]);
+	return crc;
+}
+
+/*
+ * Turns the falling edge interrupt on this dir's RX pin on or off. It's only on between a header byte and
+ * the next, so the pin doesn't interrupt on every bit of every message.
+ */
+static void rx_edge_arm(uint8_t dir, uint8_t on){
+	PORT_t* port = rx_ports[dir];
+	if(dir==1 || dir==4){
+		port->INTFLAGS = PORT_INT1IF_bm;
+		port->INT1MASK = on ? PIN6_bm : 0;
+	}else{
+		port->INTFLAGS = PORT_INT0IF_bm;
+		port->INT0MASK = on ? PIN2_bm : 0;
+	}
+}
+
+/*
+ * To be called from interrupt handler only. Do not call.
+ * The receiver only pulls its pin low while the sender's carrier is on, so this is when to measure it.
+ */
+static void rx_start_bit(uint8_t dir){
+	rx_edge_arm(dir, 0);
+	ir_strength_start(dir);
+}
+
+/*
+ * To be called from interrupt handler only. Do not call.
+ * This runs for every byte on all six channels, so the common case (a payload byte) is handled first and
+ * touches as little as possible: the timeout check uses the 16-bit RTC count rather than get_time(), and
+ * the CRC isn't checked until the message is complete.
+ */
 static void ir_receive(uint8_t dir){
 	uint8_t in_byte = channel[dir]->DATA;				// Some data just came in
+	volatile struct ir_rxtx_struct* rx = &(ir_rxtx[dir]);
 	#ifdef AUDIO_DROPLET
 		//ir_sense_channels[dir]->INTCTRL = ADC_CH_INTLVL_HI_gc;
 	#endif	
 	
-	uint32_t now = get_time();
-	if(now-ir_rxtx[dir].last_byte > IR_MSG_TIMEOUT)	clear_ir_buffer(dir);	
-	ir_rxtx[dir].last_byte = now;
+	uint16_t now = RTC.CNT; //RTC.PER is 0xFFFF, so this wraps cleanly.
+	if((uint16_t)(now-rx->last_byte_cnt) > IR_MSG_TIMEOUT) clear_ir_buffer(dir);
+	rx->last_byte_cnt = now;
 	#ifdef HARDCORE_DEBUG_DIR
 		if(dir==HARDCORE_DEBUG_DIR) printf("%02hx ", in_byte); //Used for debugging - prints raw bytes as we get them.
 	#endif	
-	switch(ir_rxtx[dir].curr_pos){
-		case HEADER_POS_SENDER_ID_LOW:	ir_rxtx[dir].sender_ID		= (uint16_t)in_byte;		break;
-		case HEADER_POS_SENDER_ID_HIGH:	ir_rxtx[dir].sender_ID	   |= (((uint16_t)in_byte)<<8);	break;
-		case HEADER_POS_CRC_LOW:		ir_rxtx[dir].data_crc		= (uint16_t)in_byte;		break;
-		case HEADER_POS_CRC_HIGH:		ir_rxtx[dir].data_crc	   |= (((uint16_t)in_byte)<<8); break;																								
-		case HEADER_POS_MSG_LENGTH:
-										ir_rxtx[dir].status		   |= (in_byte&DATA_LEN_STATUS_BITS_bm);
-										ir_rxtx[dir].calc_crc		= _crc16_update(ir_rxtx[dir].sender_ID, ir_rxtx[dir].status & IR_STATUS_CRC_BITS_bm);
-										ir_rxtx[dir].data_length	= in_byte&DATA_LEN_VAL_bm;
-										if(ir_rxtx[dir].data_length>IR_BUFFER_SIZE) ir_rxtx[dir].data_length=1; //basically, this will cause the message to get aborted.
-																								break;
-		case HEADER_POS_TARGET_ID_LOW:  ir_rxtx[dir].target_ID		= (uint16_t)in_byte;		break;
-		case HEADER_POS_TARGET_ID_HIGH:
-										ir_rxtx[dir].target_ID	   |= (((uint16_t)in_byte)<<8);
-										ir_rxtx[dir].calc_crc		= _crc16_update(ir_rxtx[dir].calc_crc, ir_rxtx[dir].target_ID);
-										break;
-		case HEADER_POS_SOURCE_DIR:		ir_rxtx[dir].inc_dir		= in_byte;				break;										
-		default:
-			ir_rxtx[dir].buf[ir_rxtx[dir].curr_pos-HEADER_LEN] = in_byte;
-			ir_rxtx[dir].calc_crc = _crc16_update(ir_rxtx[dir].calc_crc, in_byte);
+	uint8_t pos = rx->curr_pos;
+	if(pos>=HEADER_LEN){
+		rx->buf[pos-HEADER_LEN] = in_byte;
+	}else{
+		switch(pos){
+			case HEADER_POS_SENDER_ID_LOW:	rx->sender_ID		= (uint16_t)in_byte;		break;
+			case HEADER_POS_SENDER_ID_HIGH:	rx->sender_ID	   |= (((uint16_t)in_byte)<<8);	break;
+			case HEADER_POS_CRC_LOW:		rx->data_crc		= (uint16_t)in_byte;		break;
+			case HEADER_POS_CRC_HIGH:		rx->data_crc	   |= (((uint16_t)in_byte)<<8); break;
+			case HEADER_POS_MSG_LENGTH:
+											rx->status		   |= (in_byte&DATA_LEN_STATUS_BITS_bm);
+											rx->data_length		= in_byte&DATA_LEN_VAL_bm;
+											if(rx->data_length>IR_BUFFER_SIZE) rx->data_length=1; //basically, this will cause the message to get aborted.
+																									break;
+			case HEADER_POS_TARGET_ID_LOW:  rx->target_ID		= (uint16_t)in_byte;		break;
+			case HEADER_POS_TARGET_ID_HIGH: rx->target_ID	   |= (((uint16_t)in_byte)<<8);	break;
+			case HEADER_POS_SOURCE_DIR:		rx->inc_dir			= in_byte;					break;
+		}
+		const uint8_t start_next = pos<(HEADER_LEN-1);
+		int16_t strength = ir_strength_sample(dir, start_next);
+		if(strength>rx->strength) rx->strength = strength;
+		rx_edge_arm(dir, start_next); //We're in the stop bit, so the next falling edge is the next byte's start bit.
 	}
-	ir_rxtx[dir].curr_pos++;
-	if(ir_rxtx[dir].curr_pos>=(ir_rxtx[dir].data_length+HEADER_LEN)){
-		ir_rxtx[dir].status |= ir_rxtx[dir].target_ID ? IR_STATUS_TARGETED_bm : 0;
-		//pre checks.
-		const uint8_t crcMismatch = ir_rxtx[dir].calc_crc!=ir_rxtx[dir].data_crc;
-		const uint8_t nullCrc	  = ir_rxtx[dir].calc_crc==0;
-		const uint8_t selfSender  = ir_rxtx[dir].sender_ID == get_droplet_id();
-		const uint8_t notTimed	  = !(ir_rxtx[dir].status & IR_STATUS_TIMED_bm);
-		const uint8_t wrongTarget = (notTimed && ir_rxtx[dir].target_ID && ir_rxtx[dir].target_ID!=get_droplet_id());
-		const uint8_t incDirErr	= 0;//(notTimed && (ir_rxtx[dir].inc_dir&INC_DIR_KEY)!=INC_DIR_KEY);
-		if(!((crcMismatch||nullCrc)||(selfSender||wrongTarget)||incDirErr)){
-			if(notTimed){
-				ir_rxtx[dir].inc_dir = ir_rxtx[dir].inc_dir&(~INC_DIR_KEY); //remove key bits.							
-			}
-			if(ir_rxtx[dir].status & IR_STATUS_COMMAND_bm){
-				if(notTimed){
-					received_ir_cmd(dir);
-				}else{
-					switch(ir_rxtx[dir].data_length){
-						case 0: received_ir_sync(ir_rxtx[dir].inc_dir, ir_rxtx[dir].sender_ID); break;
-						case 1: received_rnb_r(ir_rxtx[dir].inc_dir, ir_rxtx[dir].sender_ID, ir_rxtx[dir].last_byte); break;
-					}			
-				}			
-			}else{
-				ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
-					ir_rxtx[dir].status |= IR_STATUS_COMPLETE_bm;
-					ir_rxtx[dir].status |= IR_STATUS_BUSY_bm; //mark as busy so we don't overwrite it.
-					channel[dir]->CTRLB &= ~USART_RXEN_bm; //Disable receiving messages on this channel until the message has been processed.
-					if(ir_rxtx[dir].data_length==22) printf("%hu %04X\r\n", dir, ir_rxtx[dir].sender_ID);
-				}
-			}
-			//printf("\r\n");
+	pos++;
+	rx->curr_pos = pos;
+	if(pos<(rx->data_length+HEADER_LEN)) return;
+
+	rx->last_byte = get_time();
+	rx->status |= rx->target_ID ? IR_STATUS_TARGETED_bm : 0;
+	//pre checks.
+	const uint8_t selfSender  = rx->sender_ID == get_droplet_id();
+	const uint8_t notTimed	  = !(rx->status & IR_STATUS_TIMED_bm);
+	const uint8_t wrongTarget = (notTimed && rx->target_ID && rx->target_ID!=get_droplet_id());
+	const uint8_t incDirErr	= 0;//(notTimed && (rx->inc_dir&INC_DIR_KEY)!=INC_DIR_KEY);
+	if(selfSender||wrongTarget||incDirErr){
+		clear_ir_buffer(dir);
+		return;
+	}
+	if(notTimed){
+		switch(rx->inc_dir&INC_DIR_PRIO_bm){
+			case INC_DIR_PRIO_BULK:		rx->prio = IR_PRIO_BULK;	break;
+			case INC_DIR_PRIO_CONTROL:	rx->prio = IR_PRIO_CONTROL;	break;
+			default:					rx->prio = IR_PRIO_NORMAL;
+		}
+		rx->inc_dir = rx->inc_dir&(~INC_DIR_KEY); //remove key bits.							
+	}
+	/*
+	 * Checked here, once, so a corrupt message frees its channel straight away instead of holding it until
+	 * perform_ir_upkeep. It's one _crc16_update a byte, inside the receive interrupt; the USARTs' second
+	 * receive buffer covers the other channels meanwhile. Nobody has timed it on a Droplet yet.
+	 */
+	uint16_t crc = calc_rx_crc(dir);
+	if(crc!=rx->data_crc || crc==0){
+		ir_baud_rx_error(dir);
+		clear_ir_buffer(dir);
+		return;
+	}
+	if(rx->status & IR_STATUS_COMMAND_bm){
+		if(notTimed){
+			received_ir_cmd(dir);
 		}else{
-			clear_ir_buffer(dir);
+			switch(rx->data_length){
+				case 0: received_ir_sync(rx->inc_dir, rx->sender_ID); break;
+				default: received_rnb_r(rx->inc_dir, rx->sender_ID, rx->last_byte, (char*)rx->buf, rx->data_length); break;
+			}			
+		}			
+	}else{
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+			rx->status |= IR_STATUS_COMPLETE_bm;
+			rx->status |= IR_STATUS_BUSY_bm; //mark as busy so we don't overwrite it.
+			channel[dir]->CTRLB &= ~USART_RXEN_bm; //Disable receiving messages on this channel until the message has been processed.
 		}
 	}
 }
@@ -408,12 +690,27 @@ static void received_ir_sync(uint8_t delay, id_t senderID){
 	}
 }
 
-static void received_rnb_r(uint8_t delay, id_t senderID, uint32_t last_byte){
+//'data' is the mode, then the sender's power less one if it isn't RNB_FULL_POWER, then for RNB_MODE_CODED,
+//the roster.
+static void received_rnb_r(uint8_t delay, id_t senderID, uint32_t last_byte, char* data, uint8_t data_length){
 	uint8_t processThisRNB = 0;
+	char mode = data[0];
+	uint16_t power = (data_length>1) ? 1+(uint8_t)data[1] : RNB_FULL_POWER;
+	#ifdef RNB_CODED_BROADCASTS
+		char roster[RNB_NUM_CODES-1];
+		uint8_t rosterLen = data_length-2;
+		if(mode==RNB_MODE_CODED){
+			if(data_length<2 || rosterLen>(RNB_NUM_CODES-1)) return;
+			memcpy(roster, data+2, rosterLen);
+		}else if(data_length>2) return;
+	#else
+		if(data_length>2) return;
+	#endif
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
 		if(!rnbProcessingFlag && !hp_ir_block_bm){
 			if(delay!=0xFF){
 				rnbCmdID = senderID;
+				rnbCmdPower = power;
 				//printf("%04X: %hu\r\n", rnbCmdID, delay+5);			
 				if(delay<5) delay = 20-delay;
 				rnbCmdSentTime = last_byte-(delay+5);
@@ -425,19 +722,31 @@ static void received_rnb_r(uint8_t delay, id_t senderID, uint32_t last_byte){
 		}
 	}
 	if(processThisRNB){
+		int16_t syncStrength[6] = {0};
 		ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
 			for(uint8_t dir=0;dir<6;dir++){
 				if(ir_rxtx[dir].sender_ID==senderID){
+					syncStrength[dir] = ir_rxtx[dir].strength;
 					clear_ir_buffer(dir);
 				}
 			}
 		}
 		rnbCmdSentTime-= (processThisRNB>1) ? (20-delay) : 0;
-		ir_range_meas();	
-		ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
-			hp_ir_block_bm = 0;
+		rnbCmdSentTime -= RNB_SYNC_BYTE_TIME(data_length-1); //Every byte past the mode made the sync that much longer.
+		//The measurement runs from the ADC's interrupt, which hands the IR back and schedules use_rnb_data.
+		uint8_t started;
+		#ifdef RNB_CODED_BROADCASTS
+			if(mode==RNB_MODE_CODED){
+				started = ir_range_coded(roster, rosterLen);
+			}else
+		#endif
+		started = ir_range_meas(mode, syncStrength);	
+		if(!started){
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+				hp_ir_block_bm = 0;
+				rnbProcessingFlag = 0;
+			}
 		}
-		schedule_task(5, use_rnb_data, NULL);
 	}
 }
 
@@ -457,7 +766,7 @@ static void ir_transmit(uint8_t dir){
 		case HEADER_POS_TARGET_ID_HIGH:	next_byte  = (uint8_t)((ir_rxtx[dir].target_ID>>8)&0xFF);	break;
 		case HEADER_POS_SOURCE_DIR:	
 									if(!(ir_rxtx[dir].status&IR_STATUS_TIMED_bm)){
-										next_byte  = INC_DIR_KEY|dir;								
+										next_byte  = (INC_DIR_KEY&~INC_DIR_PRIO_bm)|inc_dir_prio_bits[ir_rxtx[dir].prio]|dir;
 									}else{
 										uint16_t diff = ((uint16_t)(get_time()&0xFFFF))-ir_rxtx[dir].target_ID;
 										//if(dir==0||dir==5) printf("(%hu) T: %u\r\n",dir, diff);
@@ -591,4 +900,12 @@ ISR( USARTE1_DRE_vect ) { ir_transmit(4); }
 // ISRs for IR channel 5
 ISR( USARTF0_RXC_vect ) { ir_receive(5); }
 ISR( USARTF0_TXC_vect ) { ir_transmit_complete(5); }
-ISR( USARTF0_DRE_vect ) { ir_transmit(5); }
\ No newline at end of file
+ISR( USARTF0_DRE_vect ) { ir_transmit(5); }
+
+// Start bit ISRs for the IR channels' strength samples
+ISR( PORTC_INT0_vect ) { rx_start_bit(0); }
+ISR( PORTC_INT1_vect ) { rx_start_bit(1); }
+ISR( PORTD_INT0_vect ) { rx_start_bit(2); }
+ISR( PORTE_INT0_vect ) { rx_start_bit(3); }
+ISR( PORTE_INT1_vect ) { rx_start_bit(4); }
+ISR( PORTF_INT0_vect ) { rx_start_bit(5); }
\ No newline at end of file
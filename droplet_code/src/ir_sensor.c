@@ -7,6 +7,22 @@
 #endif
 
 static int16_t ir_sense_baseline[6];
+static volatile uint8_t ir_sensors_in_use; //1 for get_ir_sensors_dirs, IR_SENSORS_TICKING for ir_sensor_tick_start.
+#ifdef AUDIO_DROPLET
+	static volatile uint8_t strength_pending; //bitmask of dirs with a conversion started by ir_strength_sample.
+#else
+	static volatile uint8_t strength_dir;	  //The one dir which owns ADCB.CH0 for ir_strength_sample, or 0xFF.
+#endif
+
+#define IR_SENSORS_TICKING	2
+
+static volatile uint8_t sampler_running;
+
+static void ir_sensor_events(uint8_t prescaler, uint8_t level);
+static void ir_sensor_events_off();
+static void ir_sampler_start();
+static void ir_sampler_stop();
+static void ir_strength_drop();
 
 // IR sensors use ADCB channel 0, all the time
 void ir_sensor_init(){
@@ -28,13 +44,13 @@ void ir_sensor_init(){
 	
 		ADCA.REFCTRL = ADC_REFSEL_AREFA_gc;
 		ADCA.CTRLB = ADC_RESOLUTION_12BIT_gc | ADC_CONMODE_bm/* | ADC_FREERUN_bm*/;
-		ADCA.PRESCALER = ADC_PRESCALER_DIV512_gc;
+		ADCA.PRESCALER = IR_SENSOR_ADC_PRESCALER;
 		ADCA.CALL = PRODSIGNATURES_ADCACAL0;
 		ADCA.CALH = PRODSIGNATURES_ADCACAL1;
 	
 		ADCB.REFCTRL = ADC_REFSEL_AREFA_gc;
 		ADCB.CTRLB = ADC_RESOLUTION_12BIT_gc | ADC_CONMODE_bm/* | ADC_FREERUN_bm*/; //12bit resolution, and sets it to signed mode.	
-		ADCB.PRESCALER = ADC_PRESCALER_DIV512_gc;
+		ADCB.PRESCALER = IR_SENSOR_ADC_PRESCALER;
 		ADCB.CALL = PRODSIGNATURES_ADCBCAL0;
 		ADCB.CALH = PRODSIGNATURES_ADCBCAL1;
 	
@@ -71,7 +87,7 @@ void ir_sensor_init(){
 
 		ADCB.REFCTRL = ADC_REFSEL_AREFA_gc;
 		ADCB.CTRLB = ADC_RESOLUTION_12BIT_gc | ADC_CONMODE_bm; //12bit resolution, and sets it to signed mode.
-		ADCB.PRESCALER = ADC_PRESCALER_DIV512_gc;
+		ADCB.PRESCALER = IR_SENSOR_ADC_PRESCALER;
 		ADCB.CH0.CTRL = ADC_CH_INPUTMODE_DIFFWGAIN_gc | ADC_CH_GAIN2_bm;	// differential input. requires signed mode (see sec. 28.6 in manual)
 		ADCB.CH0.MUXCTRL = ADC_CH_MUXNEG_INTGND_MODE4_gc;	// use VREF_IN for the negative input (0.54 V)
 		ADCB.CALL = PRODSIGNATURES_ADCBCAL0;
@@ -85,12 +101,21 @@ void ir_sensor_init(){
 	for(uint8_t dir=0;dir<6;dir++){
 		ir_sense_baseline[dir]=0;
 	}
+	ir_sensors_in_use = 0;
+	#ifdef AUDIO_DROPLET
+		strength_pending = 0;
+	#else
+		strength_dir = 0xFF;
+	#endif
+	sampler_running = 0;
+	snapshot_init();
+	ir_sampler_start();
 	schedule_task(1000,initialize_ir_baselines,NULL);
 	//schedule_periodic_task(63311, update_ir_baselines, NULL);
 }
 
 void initialize_ir_baselines(){
-	get_ir_sensors(ir_sense_baseline, 13);
+	if(!get_ir_sensors(ir_sense_baseline, 13)) schedule_task(1000,initialize_ir_baselines,NULL);
 	//printf("Baselines:");
 	//for(uint8_t dir=0;dir<6;dir++){
 		//printf(" %4d", ir_sense_baseline[dir]);
@@ -120,48 +145,324 @@ void initialize_ir_baselines(){
 //
 //}
 
-void get_ir_sensors(int16_t* output_arr, uint8_t meas_per_ch){			
+uint8_t get_ir_sensors(int16_t* output_arr, uint8_t meas_per_ch){
+	return get_ir_sensors_dirs(output_arr, ALL_DIRS, meas_per_ch);
+}
+
+/*
+ * Like get_ir_sensors, but only measures the sensors in 'dirs'. The others are left alone. On non-audio
+ * Droplets, which only have the one ADC channel, this takes time in proportion to the number of dirs.
+ * This waits on every conversion; get_ir_snapshots doesn't, if the background sampler's readings will do.
+ * Interrupts stay on throughout: claiming the sensors is enough to keep ir_strength_sample and the
+ * sampler off the ADC.
+ * Returns '0', leaving output_arr alone, if an RNB measurement still had the sensors after
+ * IR_SENSOR_CLAIM_TIMEOUT_MS.
+ */
+uint8_t get_ir_sensors_dirs(int16_t* output_arr, uint8_t dirs, uint8_t meas_per_ch){			
 	int16_t meas[6][meas_per_ch];	
+	uint8_t claimed = 0;
+	uint32_t giveUp = get_time()+IR_SENSOR_CLAIM_TIMEOUT_MS;
+	while(!claimed){
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+			if(ir_sensors_in_use!=IR_SENSORS_TICKING){
+				ir_sensors_in_use = 1;
+				ir_strength_drop();
+				ir_sampler_stop();
+				claimed = 1;
+			}
+		}
+		if(!claimed && ((int32_t)(get_time()-giveUp))>=0) return 0;
+	}
 	#ifdef AUDIO_DROPLET
 		for(uint8_t meas_count=0;meas_count<meas_per_ch;meas_count++){
 			for(uint8_t dir=0;dir<6;dir++){	
-				ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
-					ir_sense_channels[dir]->CTRL |= ADC_CH_START_bm;
-					while(ir_sense_channels[dir]->INTFLAGS==0);
-					meas[dir][meas_count] = (ir_sense_channels[dir]->RES);
-					ir_sense_channels[dir]->INTFLAGS=1;
-				}
+				if(!(dirs&(1<<dir))) continue;
+				ir_sense_channels[dir]->CTRL |= ADC_CH_START_bm;
+				while(ir_sense_channels[dir]->INTFLAGS==0);
+				meas[dir][meas_count] = (ir_sense_channels[dir]->RES);
+				ir_sense_channels[dir]->INTFLAGS=1;
 			}
 		}
 	#else
 		for(uint8_t dir=0;dir<6;dir++){
-			ADCB.CH0.MUXCTRL &= MUX_SENSOR_CLR; //clear previous sensor selection
-			ADCB.CH0.MUXCTRL |= mux_sensor_selectors[dir];			
+			if(!(dirs&(1<<dir))) continue;
+			ir_sensor_select(dir);
 			for(uint8_t meas_count=0; meas_count<meas_per_ch; meas_count++){
-				ATOMIC_BLOCK(ATOMIC_RESTORESTATE){		
-					ADCB.CH0.CTRL |= ADC_CH_START_bm;
-					while (ADCB.CH0.INTFLAGS==0){};		// wait for measurement to complete
-					meas[dir][meas_count] = ADCB.CH0RES;
-					ADCB.CH0.INTFLAGS=1; // clear the complete flag					
-				}
+				ADCB.CH0.CTRL |= ADC_CH_START_bm;
+				while (ADCB.CH0.INTFLAGS==0){};		// wait for measurement to complete
+				meas[dir][meas_count] = ADCB.CH0RES;
+				ADCB.CH0.INTFLAGS=1; // clear the complete flag					
 			}			
 		}
 	#endif	
 	
 	
 	for(uint8_t dir=0;dir<6;dir++){
-		if(meas_per_ch>2){
-			int16_t median = meas_find_median(&(meas[dir][2]),meas_per_ch-2);
-			//printf("%d ",median);
-			output_arr[dir] = median-ir_sense_baseline[dir];
-		}			
-		else if(meas_per_ch==2)
-			output_arr[dir] = meas_find_median(&(meas[dir][1]),meas_per_ch-1)-ir_sense_baseline[dir];
-		else
-			output_arr[dir] = meas[dir][0];
+		if(!(dirs&(1<<dir))) continue;
+		output_arr[dir] = ir_sensor_result(dir, meas[dir], meas_per_ch);
 	}
 	//for(uint8_t i=0;i<6;i++) printf("%d ", output_arr[i]);
 	//printf("\r\n");	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		ir_sensors_in_use = 0;
+		ir_sampler_start();
+	}
+	return 1;
+}
+
+/*
+ * The background sampler's latest reading from each sensor, less its baseline, without waiting on the ADC.
+ * Returns when the oldest of them was taken (see get_time), or 0 if some sensor hasn't been sampled yet.
+ */
+uint32_t get_ir_snapshots(int16_t* output_arr){
+	uint32_t oldest = UINT32_MAX;
+	for(uint8_t dir=0;dir<6;dir++){
+		int16_t val;
+		uint32_t time = snapshot_get(dir, &val);
+		output_arr[dir] = val-ir_sense_baseline[dir];
+		if(time<oldest) oldest = time;
+	}
+	return oldest;
+}
+
+int16_t ir_sensor_baseline(uint8_t dir){
+	return ir_sense_baseline[dir];
+}
+
+/*
+ * Boils meas_per_ch raw readings from one sensor down to one value, less the baseline. The first two are
+ * thrown out, since the sensor (or the mux) is still settling. Modifies meas.
+ */
+int16_t ir_sensor_result(uint8_t dir, int16_t* meas, uint8_t meas_per_ch){
+	if(meas_per_ch>2)
+		return meas_find_median(&(meas[2]),meas_per_ch-2)-ir_sense_baseline[dir];
+	else if(meas_per_ch==2)
+		return meas_find_median(&(meas[1]),meas_per_ch-1)-ir_sense_baseline[dir];
+	else
+		return meas[0];
+}
+
+/*
+ * Starts a conversion every IR_SENSOR_TICK_US, from the event system, so the samples are timed by the
+ * hardware however busy the CPU is. Every timer is already taken (motors, RGB LED, IR carrier and firefly
+ * sync), but the event system's clock prescaler is free, and runs in step with the ADC's own clock.
+ * Non-audio Droplets convert whichever sensor ir_sensor_select last picked; audio Droplets sweep all six.
+ * Returns '0', and does nothing, if something else is using the sensors.
+ */
+uint8_t ir_sensor_tick_start(){
+	uint8_t claimed = 0;
+	//All at once, so IR_SENSOR_TICK_vect never sees us ticking with the sampler's settings.
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(!ir_sensors_in_use){
+			ir_sensors_in_use = IR_SENSORS_TICKING;
+			ir_strength_drop();
+			ir_sampler_stop();
+			ir_sensor_events(EVSYS_CHMUX_PRESCALER_4096_gc, ADC_CH_INTLVL_HI_gc);
+			claimed = 1;
+		}
+	}
+	return claimed;
+}
+
+void ir_sensor_tick_stop(){
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		ir_sensor_events_off();
+		ir_sensors_in_use = 0;
+		ir_sampler_start();
+	}
+}
+
+uint8_t ir_sensor_ticking(){
+	return ir_sensors_in_use==IR_SENSORS_TICKING;
+}
+
+/*
+ * Has event channel 4 start a conversion (or, on audio Droplets, a sweep of all six sensors) at the rate of
+ * 'prescaler', with IR_SENSOR_TICK_vect at 'level' as each one finishes.
+ */
+static void ir_sensor_events(uint8_t prescaler, uint8_t level){
+	EVSYS.CH4MUX = prescaler;
+	#ifdef AUDIO_DROPLET
+		for(uint8_t dir=0;dir<6;dir++) ir_sense_channels[dir]->INTFLAGS = 1;
+		ADCB.CH2.INTCTRL = ADC_CH_INTMODE_COMPLETE_gc | level;
+		ADCA.EVCTRL = ADC_SWEEP_012_gc | ADC_EVSEL_4567_gc | ADC_EVACT_SWEEP_gc;
+		ADCB.EVCTRL = ADC_SWEEP_012_gc | ADC_EVSEL_4567_gc | ADC_EVACT_SWEEP_gc;
+	#else
+		ADCB.CH0.INTFLAGS = 1;
+		ADCB.CH0.INTCTRL = ADC_CH_INTMODE_COMPLETE_gc | level;
+		ADCB.EVCTRL = ADC_EVSEL_4567_gc | ADC_EVACT_CH0_gc;
+	#endif
+}
+
+static void ir_sensor_events_off(){
+	#ifdef AUDIO_DROPLET
+		ADCA.EVCTRL = ADC_EVACT_NONE_gc;
+		ADCB.EVCTRL = ADC_EVACT_NONE_gc;
+		ADCB.CH2.INTCTRL = ADC_CH_INTLVL_OFF_gc;
+		for(uint8_t dir=0;dir<6;dir++) ir_sense_channels[dir]->INTFLAGS = 1;
+	#else
+		ADCB.EVCTRL = ADC_EVACT_NONE_gc;
+		ADCB.CH0.INTCTRL = ADC_CH_INTLVL_OFF_gc;
+		ADCB.CH0.INTFLAGS = 1;
+	#endif
+}
+
+/*
+ * The background sampler runs whenever nothing else has the IR sensors: it's stopped by get_ir_sensors,
+ * ir_sensor_tick_start and ir_strength_sample, and started again when they're done. Both need interrupts
+ * off, or to be called from an interrupt, and do nothing if the sampler's already started or stopped.
+ */
+static void ir_sampler_start(){
+	if(sampler_running || ir_sensors_in_use) return;
+	#ifdef AUDIO_DROPLET
+		if(strength_pending) return;
+		for(uint8_t dir=0;dir<6;dir++) snapshot_reset(dir);
+	#else
+		if(strength_dir!=0xFF) return;
+		snapshot_reset(snapshot_muxed_dir());
+		ir_sensor_select(snapshot_muxed_dir());
+		rgb_sensor_sample_restart();
+	#endif
+	ir_sensor_events(EVSYS_CHMUX_PRESCALER_32768_gc, ADC_CH_INTLVL_LO_gc);
+	sampler_running = 1;
+}
+
+static void ir_sampler_stop(){
+	if(!sampler_running) return;
+	ir_sensor_events_off();
+	sampler_running = 0;
+}
+
+/*
+ * Called by IR_SENSOR_TICK_vect when we aren't ticking for an RNB measurement, every SNAPSHOT_TICK_US.
+ * Non-audio Droplets move the mux on to whichever sensor snapshot_add_muxed wants next, and sample the color
+ * sensor too. This is a low level interrupt, so ir_strength_sample could stop the sampler part way
+ * through; keeping interrupts off makes sure we don't move the mux out from under it.
+ */
+void ir_sensor_sample(){
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(!sampler_running) return;
+		uint32_t now = get_time();
+		#ifdef AUDIO_DROPLET
+			for(uint8_t dir=0;dir<6;dir++) snapshot_add(dir, ir_sense_channels[dir]->RES, now);
+		#else
+			ir_sensor_select(snapshot_add_muxed(ADCB.CH0RES, now));
+			rgb_sensor_sample(now);
+		#endif
+	}
+}
+
+/*
+ * Call at the end of IR_SENSOR_TICK_vect. Returns '1' if the next conversion finished while it was running,
+ * which means the handler started a whole tick late and a reading was lost.
+ */
+uint8_t ir_sensor_tick_missed(){
+	#ifdef AUDIO_DROPLET
+		ADC_CH_t* ch = &(ADCB.CH2);
+	#else
+		ADC_CH_t* ch = &(ADCB.CH0);
+	#endif
+	if(!(ch->INTFLAGS)) return 0;
+	ch->INTFLAGS = 1;
+	return 1;
+}
+
+//Points the ADC at this sensor. Audio Droplets have a channel per sensor, so there's nothing to do.
+void ir_sensor_select(uint8_t dir __attribute__ ((unused))){
+	#ifndef AUDIO_DROPLET
+		ADCB.CH0.MUXCTRL = (ADCB.CH0.MUXCTRL & MUX_SENSOR_CLR) | mux_sensor_selectors[dir];
+	#endif
+}
+
+//The last conversion's raw reading for this sensor.
+int16_t ir_sensor_read(uint8_t dir __attribute__ ((unused))){
+	#ifdef AUDIO_DROPLET
+		return ir_sense_channels[dir]->RES;
+	#else
+		return ADCB.CH0RES;
+	#endif
+}
+
+/*
+ * Called by ir_receive for each header byte. Returns the reading (less the baseline) from the conversion
+ * started on this dir's previous byte, or IR_STRENGTH_NONE if there wasn't one. If start_next is set, it
+ * gets the ADC ready for this dir, and ir_strength_start begins the conversion on the next byte's start bit.
+ * A conversion takes IR_SENSOR_CONVERSION_US, and a byte about 3ms, so it's always done by the next byte.
+ * The sensor only sees the sender's LED while the carrier is on, so callers should keep the largest value.
+ * Non-audio Droplets only have one ADC channel for all six sensors, so only one dir can be sampled at a
+ * time. Since every copy of a message arrives at about the same time, the dirs end up taking turns.
+ */
+int16_t ir_strength_sample(uint8_t dir, uint8_t start_next){
+	int16_t val = IR_STRENGTH_NONE;
+	if(ir_sensors_in_use) return val;
+	#ifdef AUDIO_DROPLET
+		ADC_CH_t* ch = ir_sense_channels[dir];
+		if(strength_pending&(1<<dir)){
+			if(ch->INTFLAGS){
+				val = ch->RES - ir_sense_baseline[dir];
+				ch->INTFLAGS = 1;
+			}
+			strength_pending &= ~(1<<dir);
+		}
+		if(start_next){
+			ir_sampler_stop();
+			ch->INTFLAGS = 1;
+			strength_pending |= (1<<dir);
+		}
+	#else
+		if(strength_dir==dir){
+			//get_ir_sensors could have moved the mux since we started.
+			if(ADCB.CH0.INTFLAGS && (ADCB.CH0.MUXCTRL&~MUX_SENSOR_CLR)==mux_sensor_selectors[dir]){
+				val = ADCB.CH0RES - ir_sense_baseline[dir];
+				ADCB.CH0.INTFLAGS = 1;
+			}
+			strength_dir = 0xFF;
+		}
+		if(start_next && strength_dir==0xFF){
+			ir_sampler_stop();
+			ADCB.CH0.MUXCTRL &= MUX_SENSOR_CLR;
+			ADCB.CH0.MUXCTRL |= mux_sensor_selectors[dir];
+			ADCB.CH0.INTFLAGS = 1;
+			strength_dir = dir;
+		}
+	#endif
+	ir_sampler_start();
+	return val;
+}
+
+/*
+ * Called from the interrupt on the falling edge of a byte's start bit, once ir_strength_sample has got the
+ * ADC ready for this dir. The receive-complete interrupt comes in the stop bit, when the sender's carrier is
+ * off; the receiver only pulls its pin low once the carrier has come on, and holds it low for at least a bit.
+ */
+void ir_strength_start(uint8_t dir){
+	if(ir_sensors_in_use) return;
+	#ifdef AUDIO_DROPLET
+		if(strength_pending&(1<<dir)) ir_sense_channels[dir]->CTRL |= ADC_CH_START_bm;
+	#else
+		if(strength_dir==dir) ADCB.CH0.CTRL |= ADC_CH_START_bm;
+	#endif
+}
+
+// Drops any conversion ir_strength_sample started for this dir. Called when a message is aborted.
+void ir_strength_cancel(uint8_t dir){
+	#ifdef AUDIO_DROPLET
+		strength_pending &= ~(1<<dir);
+	#else
+		if(strength_dir==dir) strength_dir = 0xFF;
+	#endif
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		ir_sampler_start();
+	}
+}
+
+//Forgets every conversion ir_strength_sample started; whoever's claiming the sensors is about to clobber them.
+static void ir_strength_drop(){
+	#ifdef AUDIO_DROPLET
+		strength_pending = 0;
+	#else
+		strength_dir = 0xFF;
+	#endif
 }
 
 void read_ir_coll_baselines(){
@@ -199,18 +500,25 @@ void check_collision_values(int16_t meas[6]){
 	for(uint8_t i=0;i<6;i++) ir_rxtx[i].status = IR_STATUS_BUSY_bm;	
 	uint16_t curr_power = get_all_ir_powers();
 	set_all_ir_powers(256);
-	get_ir_sensors(baseline_meas, 5);
+	uint8_t measured = get_ir_sensors(baseline_meas, 5);
 	//printf("Coll    base: ");
 	//for(uint8_t i=0;i<6;i++) printf("%4d ", baseline_meas[i]);
 	//printf("\r\n");
-	for(uint8_t i=0;i<6;i++) ir_led_on(i);
-	busy_delay_us(250);	
-	get_ir_sensors(measured_vals, 5);
-	//printf("Coll results: ");
-	//for(uint8_t i=0;i<6;i++) printf("%4d ", measured_vals[i]);
-	//printf("\r\n");
-	for(uint8_t i=0;i<6;i++) ir_led_off(i);
+	if(measured){
+		for(uint8_t i=0;i<6;i++) ir_led_on(i);
+		busy_delay_us(250);	
+		measured = get_ir_sensors(measured_vals, 5);
+		//printf("Coll results: ");
+		//for(uint8_t i=0;i<6;i++) printf("%4d ", measured_vals[i]);
+		//printf("\r\n");
+		for(uint8_t i=0;i<6;i++) ir_led_off(i);
+	}
+	if(!measured) printf_P(PSTR("IR sensors busy with an rnb measurement. Can't check collisions.\r\n"));
 	for(uint8_t i=0;i<6;i++){
+		if(!measured){
+			meas[i] = 0;
+			continue;
+		}
 		meas[i] = (measured_vals[i]-baseline_meas[i]);
 		meas[i] = meas[i] - ir_coll_baseline[i];
 	}
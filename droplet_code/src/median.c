@@ -0,0 +1,81 @@
+#include "median.h"
+
+//Leaves the smaller of a and b in a. m is all ones when they're out of order, so x is either a^b or 0, and
+//xoring it in to both swaps them or does nothing, with no branch. Unlike subtracting, this can't overflow.
+#define CMP_SWAP(a, b) do{						\
+		int16_t m = -(int16_t)((b)<(a));		\
+		int16_t x = ((a)^(b))&m;				\
+		(a) ^= x;								\
+		(b) ^= x;								\
+	}while(0)
+
+static int16_t median_sort(int16_t* meas, uint8_t arr_len);
+
+int16_t meas_find_median(int16_t* meas, uint8_t arr_len){
+	int16_t* p = meas;
+	switch(arr_len){
+		case 1:
+			return p[0];
+		case 2:
+			return (p[0]+p[1])/2;
+		case 3:
+			CMP_SWAP(p[0], p[1]);
+			CMP_SWAP(p[1], p[2]);
+			CMP_SWAP(p[0], p[1]);
+			return p[1];
+		case 4: //Smallest to p[0], largest to p[3]; the middle two are left in p[1] and p[2], in either order.
+			CMP_SWAP(p[0], p[1]); CMP_SWAP(p[2], p[3]);
+			CMP_SWAP(p[0], p[2]); CMP_SWAP(p[1], p[3]);
+			return (p[1]+p[2])/2;
+		case 5:
+			CMP_SWAP(p[0], p[1]); CMP_SWAP(p[3], p[4]);
+			CMP_SWAP(p[0], p[3]); CMP_SWAP(p[1], p[4]);
+			CMP_SWAP(p[1], p[2]);
+			CMP_SWAP(p[2], p[3]);
+			CMP_SWAP(p[1], p[2]);
+			return p[2];
+		case 6: //A full sort; the median network isn't much shorter.
+			CMP_SWAP(p[0], p[5]); CMP_SWAP(p[1], p[3]); CMP_SWAP(p[2], p[4]);
+			CMP_SWAP(p[1], p[2]); CMP_SWAP(p[3], p[4]);
+			CMP_SWAP(p[0], p[3]); CMP_SWAP(p[2], p[5]);
+			CMP_SWAP(p[0], p[1]); CMP_SWAP(p[2], p[3]); CMP_SWAP(p[4], p[5]);
+			CMP_SWAP(p[1], p[2]); CMP_SWAP(p[3], p[4]);
+			return (p[2]+p[3])/2;
+		case 7:
+			CMP_SWAP(p[0], p[5]); CMP_SWAP(p[0], p[3]); CMP_SWAP(p[1], p[6]);
+			CMP_SWAP(p[2], p[4]); CMP_SWAP(p[0], p[1]); CMP_SWAP(p[3], p[5]);
+			CMP_SWAP(p[2], p[6]); CMP_SWAP(p[2], p[3]); CMP_SWAP(p[3], p[6]);
+			CMP_SWAP(p[4], p[5]); CMP_SWAP(p[1], p[4]); CMP_SWAP(p[1], p[3]);
+			CMP_SWAP(p[3], p[4]);
+			return p[3];
+		case 11: //Batcher's network for 16 cut down to 11, less every exchange which can't reach p[5].
+			CMP_SWAP(p[0], p[1]); CMP_SWAP(p[2], p[3]); CMP_SWAP(p[4], p[5]);
+			CMP_SWAP(p[6], p[7]); CMP_SWAP(p[8], p[9]); CMP_SWAP(p[0], p[2]);
+			CMP_SWAP(p[1], p[3]); CMP_SWAP(p[4], p[6]); CMP_SWAP(p[5], p[7]);
+			CMP_SWAP(p[8], p[10]); CMP_SWAP(p[1], p[2]); CMP_SWAP(p[5], p[6]);
+			CMP_SWAP(p[0], p[4]); CMP_SWAP(p[1], p[5]); CMP_SWAP(p[2], p[6]);
+			CMP_SWAP(p[3], p[7]); CMP_SWAP(p[2], p[4]); CMP_SWAP(p[3], p[5]);
+			CMP_SWAP(p[1], p[2]); CMP_SWAP(p[3], p[4]); CMP_SWAP(p[9], p[10]);
+			CMP_SWAP(p[2], p[10]); CMP_SWAP(p[4], p[8]); CMP_SWAP(p[5], p[9]);
+			CMP_SWAP(p[6], p[10]); CMP_SWAP(p[3], p[5]); CMP_SWAP(p[6], p[8]);
+			CMP_SWAP(p[5], p[6]);
+			return p[5];
+		default:
+			return median_sort(meas, arr_len);
+	}
+}
+
+//The original: sorts the whole array with an exchange sort.
+static int16_t median_sort(int16_t* meas, uint8_t arr_len){
+	for(uint8_t i=0; i<arr_len ; i++){
+		for(uint8_t j=i+1 ; j<arr_len ; j++){
+			if(meas[j] < meas[i]){
+				int16_t temp = meas[i];
+				meas[i] = meas[j];
+				meas[j] = temp;
+			}
+		}
+	}
+	if(arr_len%2==0) return (meas[arr_len/2-1]+meas[arr_len/2])/2;
+	else return meas[arr_len/2];
+}
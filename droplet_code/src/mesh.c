@@ -0,0 +1,286 @@
+#include "mesh.h"
+
+static MeshRoute* routes; // MESH_NUM_ORDS of them, allocated by mesh_init.
+static uint8_t seen_cache[MESH_SEEN_CACHE_SIZE][2]; // {src_ord, seq}
+static uint8_t seen_idx;
+static uint8_t my_ord;
+static uint8_t my_seq;
+static uint8_t advert_cursor;
+static uint8_t mesh_enabled;
+
+void user_handle_mesh_msg(id_t src_id, char* data, uint8_t data_length) __attribute__((weak));
+
+static void mesh_upkeep();
+static void send_advert();
+static void handle_advert_msg(ir_msg* msg_struct);
+static void handle_data_msg(ir_msg* msg_struct);
+static void handle_advert(MeshAdvert* advert, uint8_t length, uint8_t dir);
+static void handle_data(MeshData* packet, uint8_t length, uint8_t sender_ord, uint8_t dir);
+static void update_route(uint8_t ord, uint8_t hops, uint8_t next, uint8_t dir);
+static void hold_down(uint8_t ord);
+static uint8_t check_seen(uint8_t src_ord, uint8_t seq);
+static uint8_t send_packet(MeshData* packet, uint8_t length, uint8_t avoid_dir);
+
+/*
+ * Turns on routing. Call this from init(). Droplets whose ID isn't in OrderedBotIDs can't take part.
+ */
+void mesh_init(){
+	if(mesh_enabled) return;
+	my_ord = get_droplet_ord(get_droplet_id());
+	if(my_ord==0xFF){
+		printf_P(PSTR("ERROR: %04X has no ordinal, so it can't use mesh routing.\r\n"), get_droplet_id());
+		return;
+	}
+	if(!register_msg_handler(MESH_ADVERT_FLAG, MESH_ADVERT_HEADER_LEN, IR_BUFFER_SIZE, handle_advert_msg)) return;
+	if(!register_msg_handler(MESH_DATA_FLAG, MESH_DATA_HEADER_LEN, IR_BUFFER_SIZE, handle_data_msg)){
+		unregister_msg_handler(MESH_ADVERT_FLAG);
+		return;
+	}
+	if(!routes) routes = (MeshRoute*)myMalloc(MESH_NUM_ORDS*sizeof(MeshRoute));
+	if(!routes){
+		printf_P(PSTR("ERROR: No room for the mesh route table.\r\n"));
+		unregister_msg_handler(MESH_ADVERT_FLAG);
+		unregister_msg_handler(MESH_DATA_FLAG);
+		return;
+	}
+	for(uint8_t i=0;i<MESH_NUM_ORDS;i++){
+		routes[i].hops = MESH_NO_ROUTE;
+		routes[i].next = 0;
+		routes[i].dir_age = 0;
+	}
+	for(uint8_t i=0;i<MESH_SEEN_CACHE_SIZE;i++){
+		seen_cache[i][0] = 0xFF;
+		seen_cache[i][1] = 0;
+	}
+	seen_idx = 0;
+	my_seq = 0;
+	advert_cursor = 0;
+	mesh_stats.adverts_sent = 0;
+	mesh_stats.data_sent	= 0;
+	mesh_stats.forwarded	= 0;
+	mesh_stats.delivered	= 0;
+	mesh_stats.dropped		= 0;
+	mesh_enabled = 1;
+	schedule_periodic_task(MESH_ADVERT_PERIOD_MS+(rand_byte()%64), mesh_upkeep, NULL);
+}
+
+/*
+ * Sends data_length bytes to dest_id, through the best known neighbour. If we don't know a route yet the
+ * packet is flooded, and its TTL keeps the flood bounded. Returns '0' if nothing was sent.
+ */
+uint8_t mesh_send(id_t dest_id, char* data, uint8_t data_length){
+	if(!mesh_enabled) return 0;
+	uint8_t dest_ord = get_droplet_ord(dest_id);
+	if(dest_ord==0xFF || dest_ord==my_ord) return 0;
+	if(data_length>MESH_MAX_DATA_LEN){
+		printf_P(PSTR("ERROR: Mesh message exceeds MESH_MAX_DATA_LEN.\r\n"));
+		return 0;
+	}
+	MeshData packet;
+	packet.flag		= MESH_DATA_FLAG;
+	packet.ttl		= MESH_DEFAULT_TTL;
+	packet.src_ord	= my_ord;
+	packet.dest_ord	= dest_ord;
+	packet.seq		= my_seq++;
+	memcpy(packet.data, data, data_length);
+	check_seen(packet.src_ord, packet.seq);
+	uint8_t result = send_packet(&packet, MESH_DATA_HEADER_LEN+data_length, 0xFF);
+	if(result) mesh_stats.data_sent++;
+	return result;
+}
+
+uint8_t mesh_hops_to(id_t dest_id){
+	if(!mesh_enabled) return MESH_NO_ROUTE;
+	uint8_t ord = get_droplet_ord(dest_id);
+	if(ord==0xFF || routes[ord].hops>=MESH_MAX_HOPS) return MESH_NO_ROUTE;
+	return routes[ord].hops;
+}
+
+// Registered with msg_dispatch, which has already checked the length.
+static void handle_advert_msg(ir_msg* msg_struct){
+	handle_advert((MeshAdvert*)(msg_struct->msg), msg_struct->length, msg_struct->dir_received);
+}
+
+static void handle_data_msg(ir_msg* msg_struct){
+	uint8_t sender_ord = get_droplet_ord(msg_struct->sender_ID);
+	if(sender_ord==0xFF) return;
+	handle_data((MeshData*)(msg_struct->msg), msg_struct->length, sender_ord, msg_struct->dir_received);
+}
+
+static void handle_advert(MeshAdvert* advert, uint8_t length, uint8_t dir){
+	uint8_t sender = advert->sender_ord;
+	if(sender>=MESH_NUM_ORDS || sender==my_ord) return;
+	update_route(sender, 1, sender, dir);
+	uint8_t num = advert->num_routes;
+	if(num>(length-MESH_ADVERT_HEADER_LEN)/2) num = (length-MESH_ADVERT_HEADER_LEN)/2;
+	for(uint8_t i=0;i<num;i++){
+		uint8_t ord  = advert->routes[i][0];
+		uint8_t hops = advert->routes[i][1];
+		if(ord>=MESH_NUM_ORDS || ord==my_ord) continue;
+		if(hops>=MESH_MAX_HOPS){ //Poisoned: the sender can't get there, or only through our side.
+			if(routes[ord].hops<MESH_MAX_HOPS && routes[ord].next==sender) hold_down(ord);
+			continue;
+		}
+		update_route(ord, hops+1, sender, dir);
+	}
+}
+
+static void handle_data(MeshData* packet, uint8_t length, uint8_t sender_ord, uint8_t dir){
+	if(packet->src_ord>=MESH_NUM_ORDS || packet->dest_ord>=MESH_NUM_ORDS) return;
+	if(packet->src_ord==my_ord || check_seen(packet->src_ord, packet->seq)) return;
+	//Every packet starts with MESH_DEFAULT_TTL, so the TTL also tells us how far away the source is.
+	if(packet->ttl<=MESH_DEFAULT_TTL){
+		update_route(packet->src_ord, MESH_DEFAULT_TTL-packet->ttl+1, sender_ord, dir);
+	}
+	if(packet->dest_ord==my_ord){
+		mesh_stats.delivered++;
+		if(user_handle_mesh_msg){
+			user_handle_mesh_msg(get_id_from_ord(packet->src_ord), packet->data, length-MESH_DATA_HEADER_LEN);
+		}
+		return;
+	}
+	if(packet->ttl<=1){
+		mesh_stats.dropped++;
+		return;
+	}
+	packet->ttl--;
+	if(send_packet(packet, length, dir)) mesh_stats.forwarded++;
+	else								 mesh_stats.dropped++;
+}
+
+/*
+ * Distance-vector update: a route through the neighbour we already use is always taken (so bad news gets
+ * through), otherwise only one at least as short is. Taking equal ones means any neighbour on a shortest path
+ * keeps the route alive, not just the one we happened to hear first. Nothing is taken for a route that's
+ * held down.
+ */
+static void update_route(uint8_t ord, uint8_t hops, uint8_t next, uint8_t dir){
+	if(hops>=MESH_MAX_HOPS) return;
+	MeshRoute* route = &(routes[ord]);
+	if(route->hops==MESH_MAX_HOPS) return;
+	if(route->hops==MESH_NO_ROUTE || route->next==next || hops<=route->hops){
+		route->hops		= hops;
+		route->next		= next;
+		route->dir_age	= dir&MESH_DIR_bm;
+	}
+}
+
+/*
+ * Marks a route we've lost as unreachable. It's advertised that way, so the Droplets that were using it
+ * through us drop it too, and until it ages out nobody can sell it back to us: whoever still has it is
+ * only going to have it through someone who's about to hear the bad news.
+ */
+static void hold_down(uint8_t ord){
+	routes[ord].hops = MESH_MAX_HOPS;
+	routes[ord].dir_age &= MESH_DIR_bm;
+}
+
+// Returns '1' if we've already seen this packet. Otherwise, remembers it and returns '0'.
+static uint8_t check_seen(uint8_t src_ord, uint8_t seq){
+	for(uint8_t i=0;i<MESH_SEEN_CACHE_SIZE;i++){
+		if(seen_cache[i][0]==src_ord && seen_cache[i][1]==seq) return 1;
+	}
+	seen_cache[seen_idx][0] = src_ord;
+	seen_cache[seen_idx][1] = seq;
+	seen_idx = (seen_idx+1)%MESH_SEEN_CACHE_SIZE;
+	return 0;
+}
+
+// Never sends back out the direction the packet arrived on (avoid_dir), which would just bounce it.
+static uint8_t send_packet(MeshData* packet, uint8_t length, uint8_t avoid_dir){
+	uint8_t dirs;
+	MeshRoute* route = &(routes[packet->dest_ord]);
+	if(route->hops<MESH_MAX_HOPS){
+		dirs = 1<<(route->dir_age&MESH_DIR_bm);
+	}else{
+		dirs = ALL_DIRS;
+	}
+	if(avoid_dir<6) dirs &= ~(1<<avoid_dir);
+	if(!dirs) return 0;
+	return ir_send(dirs, (char*)packet, length);
+}
+
+/*
+ * A neighbour gets round to re-advertising each of its routes once every ceil(routes/MESH_ADVERT_MAX_ROUTES)
+ * periods, so that's how much longer a route gets before it's held down, and then how long it's held
+ * down for. We can't see their tables, but in a connected swarm they know about as many Droplets as we do.
+ */
+static void mesh_upkeep(){
+	uint8_t known = 0;
+	for(uint8_t i=0;i<MESH_NUM_ORDS;i++){
+		if(routes[i].hops!=MESH_NO_ROUTE) known++;
+	}
+	uint8_t rounds = known ? (known+MESH_ADVERT_MAX_ROUTES-1)/MESH_ADVERT_MAX_ROUTES : 1;
+	uint8_t max_age = MESH_ROUTE_MAX_AGE*rounds;
+	if(max_age>(MESH_AGE_bm/MESH_AGE_INC)) max_age = MESH_AGE_bm/MESH_AGE_INC;
+	for(uint8_t i=0;i<MESH_NUM_ORDS;i++){
+		if(routes[i].hops==MESH_NO_ROUTE) continue;
+		if((routes[i].dir_age&MESH_AGE_bm)>=(max_age*MESH_AGE_INC)){
+			if(routes[i].hops==MESH_MAX_HOPS)	routes[i].hops = MESH_NO_ROUTE;
+			else								hold_down(i);
+		}else{
+			routes[i].dir_age += MESH_AGE_INC;
+		}
+	}
+	//The period is fixed, so without this two neighbours which picked the same one could talk over each other forever.
+	if(!schedule_task(rand_byte(), send_advert, NULL)) send_advert();
+}
+
+/*
+ * Adverts don't have room for the whole table, so each one picks up where the last left off.
+ * A route's age is reset whenever it's re-learned, so this is also what keeps routes alive.
+ * Routes that are held down go first, so the bad news spreads faster than whoever's still got the route can
+ * sell it on. Each direction gets its own send, in which the routes we learned from that direction are poisoned;
+ * ir_send copies the advert out, so the one buffer does for all six. A direction that's busy misses this one.
+ */
+static void send_advert(){
+	MeshAdvert advert;
+	uint8_t route_dirs[MESH_ADVERT_MAX_ROUTES];
+	uint8_t route_hops[MESH_ADVERT_MAX_ROUTES];
+	advert.flag = MESH_ADVERT_FLAG;
+	advert.sender_ord = my_ord;
+	advert.num_routes = 0;
+	for(uint8_t ord=0; ord<MESH_NUM_ORDS && advert.num_routes<MESH_ADVERT_MAX_HELD; ord++){
+		if(routes[ord].hops!=MESH_MAX_HOPS) continue;
+		advert.routes[advert.num_routes][0] = ord;
+		route_hops[advert.num_routes] = MESH_MAX_HOPS;
+		route_dirs[advert.num_routes] = routes[ord].dir_age&MESH_DIR_bm;
+		advert.num_routes++;
+	}
+	uint8_t cursor = advert_cursor;
+	for(uint8_t checked=0; checked<MESH_NUM_ORDS && advert.num_routes<MESH_ADVERT_MAX_ROUTES; checked++){
+		uint8_t ord = advert_cursor;
+		advert_cursor = (advert_cursor+1)%MESH_NUM_ORDS;
+		if(routes[ord].hops>=MESH_MAX_HOPS) continue;
+		advert.routes[advert.num_routes][0] = ord;
+		route_hops[advert.num_routes] = routes[ord].hops;
+		route_dirs[advert.num_routes] = routes[ord].dir_age&MESH_DIR_bm;
+		advert.num_routes++;
+	}
+	uint8_t length = MESH_ADVERT_HEADER_LEN+2*advert.num_routes;
+	uint8_t sent = 0;
+	for(uint8_t dir=0;dir<6;dir++){
+		for(uint8_t i=0;i<advert.num_routes;i++){
+			advert.routes[i][1] = (route_dirs[i]==dir) ? MESH_MAX_HOPS : route_hops[i];
+		}
+		sent |= ir_send(1<<dir, (char*)(&advert), length);
+	}
+	if(sent){
+		mesh_stats.adverts_sent++;
+	}else{
+		advert_cursor = cursor; //So these routes don't miss a whole round.
+	}
+}
+
+void print_mesh_routes(){
+	if(!mesh_enabled){
+		printf_P(PSTR("Mesh routing is off.\r\n"));
+		return;
+	}
+	printf_P(PSTR("Mesh routes from %hu (adv: %u, sent: %u, fwd: %u, rcvd: %u, drop: %u):\r\n"), my_ord,
+		mesh_stats.adverts_sent, mesh_stats.data_sent, mesh_stats.forwarded, mesh_stats.delivered, mesh_stats.dropped);
+	for(uint8_t i=0;i<MESH_NUM_ORDS;i++){
+		if(routes[i].hops>=MESH_MAX_HOPS) continue;
+		printf_P(PSTR("\t%04X: %hu hops via %04X (dir %hu)\r\n"), get_id_from_ord(i), routes[i].hops, get_id_from_ord(routes[i].next), routes[i].dir_age&MESH_DIR_bm);
+	}
+}
@@ -6,6 +6,13 @@ static volatile Task_t* current_motor_task;
 static int16_t motor_on_time;
 static int16_t motor_off_time;
 
+//For working out how far the last move got, when it stops.
+static uint32_t move_start;
+static uint16_t move_step_time; //1/32 ms
+static uint16_t move_num_steps;
+
+static void report_move(uint8_t direction);
+
 static inline void motor_forward(uint8_t num)
 {
 	switch(num)
@@ -149,6 +156,9 @@ uint8_t move_steps(uint8_t direction, uint16_t num_steps)
 		else if(mot_dirs[mot]>0)	motor_forward(mot);
 	}
 	uint32_t total_movement_duration = (((uint32_t)total_time)*((uint32_t)num_steps))/32;
+	move_start = get_time();
+	move_step_time = total_time;
+	move_num_steps = num_steps;
 	//printf("Total duration: %lu ms.\r\n\n",total_movement_duration);
 	current_motor_task = schedule_task(total_movement_duration, stop_move, NULL);
 	if(current_motor_task==NULL) printf_P(PSTR("Error! Failed to schedule stop_move task."));
@@ -194,9 +204,33 @@ void stop_move()
 	#endif	
 	PORTD.OUTCLR = PIN0_bm | PIN1_bm; 
 	
+	uint8_t status = motor_status;
 	motor_status = 0;
 	remove_task((Task_t*)current_motor_task);
 	current_motor_task = NULL;
+	if(status & MOTOR_STATUS_ON) report_move(status & MOTOR_STATUS_DIRECTION);
+}
+
+/*
+ * Tells the neighbor table how far we just went, from how many steps we got through and the calibration.
+ * Nothing is reported for an uncalibrated direction.
+ */
+static void report_move(uint8_t direction)
+{
+	uint16_t per_kilostep = get_mm_per_kilostep(direction);
+	if(!move_step_time || !per_kilostep || per_kilostep>(0xFFFF-1000)) return;
+	uint32_t steps = ((get_time()-move_start)*32)/move_step_time;
+	if(steps>move_num_steps) steps = move_num_steps;
+	int16_t amount = (int16_t)((steps*per_kilostep)/1000);
+	if(direction==CLOCKWISE){
+		neighbors_moved(0, 0, -amount);
+	}else if(direction==COUNTERCLOCKWISE){
+		neighbors_moved(0, 0, amount);
+	}else{
+		int16_t c, s;
+		sin_cos_deg(-60*(int16_t)direction, &c, &s); //NORTH is bearing 0, and the directions go clockwise.
+		neighbors_moved((int16_t)(((int32_t)amount*c)>>14), (int16_t)(((int32_t)amount*s)>>14), 0);
+	}
 }
 
 int8_t is_moving() // returns -1 if droplet is not moving, movement dir otherwise.
@@ -0,0 +1,75 @@
+#include "msg_dispatch.h"
+
+static MsgDispatchEntry handlers[MSG_DISPATCH_MAX_HANDLERS];
+static uint8_t num_handlers;
+
+void msg_dispatch_init(){
+	num_handlers = 0;
+	msg_dispatch_stats.dispatched	= 0;
+	msg_dispatch_stats.bad_length	= 0;
+	msg_dispatch_stats.passed_on	= 0;
+}
+
+/*
+ * Returns '0' if the table is full or 'type' already has a handler; two protocols can't share a type byte.
+ */
+uint8_t register_msg_handler(char type, uint8_t min_length, uint8_t max_length, MsgHandler handler){
+	if(!handler || min_length==0 || min_length>max_length) return 0;
+	for(uint8_t i=0;i<num_handlers;i++){
+		if(handlers[i].type==type){
+			printf_P(PSTR("ERROR: Message type %02hX already has a handler.\r\n"), (uint8_t)type);
+			return 0;
+		}
+	}
+	if(num_handlers>=MSG_DISPATCH_MAX_HANDLERS){
+		printf_P(PSTR("ERROR: No room to register message type %02hX.\r\n"), (uint8_t)type);
+		return 0;
+	}
+	handlers[num_handlers].type			= type;
+	handlers[num_handlers].min_length	= min_length;
+	handlers[num_handlers].max_length	= max_length;
+	handlers[num_handlers].handler		= handler;
+	num_handlers++;
+	return 1;
+}
+
+/*
+ * For a module whose init fails partway through, so it doesn't leave half its handlers registered.
+ */
+void unregister_msg_handler(char type){
+	for(uint8_t i=0;i<num_handlers;i++){
+		if(handlers[i].type!=type) continue;
+		num_handlers--;
+		for(;i<num_handlers;i++){
+			handlers[i] = handlers[i+1];
+		}
+		return;
+	}
+}
+
+/*
+ * Called by check_messages for every incoming message. Returns '0' if nothing is registered for the message's
+ * type, in which case it should go to handle_msg.
+ */
+uint8_t dispatch_msg(ir_msg* msg_struct){
+	for(uint8_t i=0;msg_struct->length && i<num_handlers;i++){
+		if(handlers[i].type!=msg_struct->msg[0]) continue;
+		if(msg_struct->length<handlers[i].min_length || msg_struct->length>handlers[i].max_length){
+			msg_dispatch_stats.bad_length++;
+		}else{
+			msg_dispatch_stats.dispatched++;
+			handlers[i].handler(msg_struct);
+		}
+		return 1;
+	}
+	msg_dispatch_stats.passed_on++;
+	return 0;
+}
+
+void print_msg_dispatch(){
+	printf_P(PSTR("Message types (dispatched: %u, bad length: %u, to handle_msg: %u):\r\n"),
+		msg_dispatch_stats.dispatched, msg_dispatch_stats.bad_length, msg_dispatch_stats.passed_on);
+	for(uint8_t i=0;i<num_handlers;i++){
+		printf_P(PSTR("\t%02hX: %hu-%hu bytes\r\n"), (uint8_t)handlers[i].type, handlers[i].min_length, handlers[i].max_length);
+	}
+}
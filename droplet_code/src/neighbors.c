@@ -0,0 +1,194 @@
+#include "neighbors.h"
+
+static Neighbor neighbors[NEIGHBOR_TABLE_SIZE];
+
+static Neighbor* find_neighbor(id_t id, uint32_t now);
+static uint8_t is_current(Neighbor* nbr, uint32_t now);
+
+void neighbors_init(){
+	for(uint8_t i=0;i<NEIGHBOR_TABLE_SIZE;i++){
+		neighbors[i].id = 0;
+	}
+}
+
+/*
+ * Called by perform_ir_upkeep for every complete message, and by handle_cmd_wrapper for commands.
+ * A message heard on more than one direction is passed in once per direction, with is_copy set on all
+ * but the first, so msg_count only counts it once while dir_count shows every side that heard it.
+ */
+void neighbor_heard(id_t id, uint8_t dir, uint32_t when, uint8_t is_copy){
+	if(!id || id==get_droplet_id() || dir>=6) return;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		Neighbor* nbr = find_neighbor(id, when);
+		if(is_copy){
+			nbr->last_dirs |= (1<<dir);
+		}else{
+			nbr->last_dirs = (1<<dir);
+			if(nbr->msg_count<0xFFFF) nbr->msg_count++;
+		}
+		if(nbr->dir_count[dir]<0xFF) nbr->dir_count[dir]++;
+		nbr->last_heard = when;
+	}
+}
+
+/*
+ * Called by use_rnb_data and use_coded_rnb_data with each new result. The tracker math is done on a copy,
+ * with interrupts on, since it takes a while; a move reported in the meantime is lost for this neighbour.
+ * While we're moving, the result is only used to start a track: stop_move doesn't pass the move on till
+ * it's over, so the track and the result would disagree about where we are.
+ */
+void neighbor_rnb(id_t id, uint16_t range, int16_t bearing, int16_t heading, uint8_t confidence, uint32_t when){
+	if(!id || id==get_droplet_id()) return;
+	RnbTrack track;
+	uint32_t lastRnb;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		Neighbor* nbr = find_neighbor(id, when);
+		track	= nbr->track;
+		lastRnb	= nbr->last_rnb;
+	}
+	if(lastRnb && ((int32_t)(when-lastRnb))<NEIGHBOR_TIMEOUT_MS){
+		rnb_track_predict(&track, when-lastRnb);
+		if(is_moving()<0) rnb_track_update(&track, range, bearing, heading, confidence);
+	}else{
+		rnb_track_init(&track, range, bearing, heading, confidence);
+	}
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		Neighbor* nbr = find_neighbor(id, when);
+		nbr->range		= range;
+		nbr->bearing	= bearing;
+		nbr->heading	= heading;
+		nbr->track		= track;
+		nbr->last_rnb	= when ? when : 1;
+		if(nbr->rnb_count<0xFFFF) nbr->rnb_count++;
+		nbr->last_heard = when;
+	}
+}
+
+/*
+ * Called by stop_move with how far we went: dx and dy mm, toward bearing 0 and 90, then 'turn' degrees
+ * counter-clockwise. Shifts every neighbour's track to match, so our moves don't look like theirs.
+ */
+void neighbors_moved(int16_t dx, int16_t dy, int16_t turn){
+	uint32_t now = get_time();
+	for(uint8_t i=0;i<NEIGHBOR_TABLE_SIZE;i++){
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+			if(is_current(&(neighbors[i]), now) && neighbors[i].last_rnb){
+				rnb_track_move(&(neighbors[i].track), dx, dy, turn);
+			}
+		}
+	}
+}
+
+/*
+ * Copies the entry for 'id' in to out. Returns '0' if we haven't heard from id recently.
+ */
+uint8_t neighbor_get(id_t id, Neighbor* out){
+	uint32_t now = get_time();
+	uint8_t found = 0;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		for(uint8_t i=0;i<NEIGHBOR_TABLE_SIZE;i++){
+			if(neighbors[i].id==id && is_current(&(neighbors[i]), now)){
+				*out = neighbors[i];
+				found = 1;
+				break;
+			}
+		}
+	}
+	return found;
+}
+
+/*
+ * Copies slot 'idx' in to out. Returns '0' if that slot is empty or stale, so callers can just loop
+ * over every idx below NEIGHBOR_TABLE_SIZE. Slots don't move, but an entry can be replaced between calls.
+ */
+uint8_t neighbor_at(uint8_t idx, Neighbor* out){
+	if(idx>=NEIGHBOR_TABLE_SIZE) return 0;
+	uint32_t now = get_time();
+	uint8_t found = 0;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(is_current(&(neighbors[idx]), now)){
+			*out = neighbors[idx];
+			found = 1;
+		}
+	}
+	return found;
+}
+
+/*
+ * Where the tracker thinks 'id' is now, with standard deviations. Returns '0' if we haven't heard from id
+ * recently, or have no RNB result for it.
+ */
+uint8_t neighbor_track(id_t id, RnbTrackPolar* out){
+	Neighbor nbr;
+	if(!neighbor_get(id, &nbr) || !nbr.last_rnb) return 0;
+	rnb_track_predict(&(nbr.track), get_time()-nbr.last_rnb);
+	rnb_track_polar(&(nbr.track), out);
+	return 1;
+}
+
+uint8_t neighbor_count(){
+	uint32_t now = get_time();
+	uint8_t count = 0;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		for(uint8_t i=0;i<NEIGHBOR_TABLE_SIZE;i++){
+			if(is_current(&(neighbors[i]), now)) count++;
+		}
+	}
+	return count;
+}
+
+void print_neighbors(){
+	Neighbor nbr;
+	uint32_t now = get_time();
+	printf_P(PSTR("Neighbors (%hu):\r\n"), neighbor_count());
+	for(uint8_t i=0;i<NEIGHBOR_TABLE_SIZE;i++){
+		if(!neighbor_at(i, &nbr)) continue;
+		printf_P(PSTR("\t%04X: %lums ago, %u msgs, dirs {"), nbr.id, now-nbr.last_heard, nbr.msg_count);
+		for(uint8_t dir=0;dir<6;dir++){
+			printf_P(PSTR(" %3hu"), nbr.dir_count[dir]);
+		}
+		printf_P(PSTR(" }"));
+		if(nbr.last_rnb){
+			printf_P(PSTR(", rnb {%u, % 4d, % 4d} x%u"), nbr.range, nbr.bearing, nbr.heading, nbr.rnb_count);
+			RnbTrackPolar est;
+			rnb_track_predict(&(nbr.track), now-nbr.last_rnb);
+			rnb_track_polar(&(nbr.track), &est);
+			printf_P(PSTR(", track {%u+-%u, % 4d+-%u, % 4d+-%u}"), est.range, est.range_sd, est.bearing, est.bearing_sd,
+				est.heading, est.heading_sd);
+		}
+		printf_P(PSTR("\r\n"));
+	}
+}
+
+/*
+ * Returns the entry for 'id', adding it if needed. New entries go in an empty or stale slot if there is
+ * one, otherwise they replace whichever entry was heard from least recently.
+ * Must be called with interrupts disabled.
+ */
+static Neighbor* find_neighbor(id_t id, uint32_t now){
+	Neighbor* empty = NULL;
+	Neighbor* oldest = &(neighbors[0]);
+	for(uint8_t i=0;i<NEIGHBOR_TABLE_SIZE;i++){
+		if(neighbors[i].id==id) return &(neighbors[i]);
+		if(!is_current(&(neighbors[i]), now)){
+			if(!empty) empty = &(neighbors[i]);
+		}else if(((int32_t)(neighbors[i].last_heard-oldest->last_heard))<0){
+			oldest = &(neighbors[i]);
+		}
+	}
+	if(empty) oldest = empty;
+	oldest->id			= id;
+	oldest->last_heard	= now;
+	oldest->last_rnb	= 0;
+	oldest->msg_count	= 0;
+	oldest->rnb_count	= 0;
+	oldest->last_dirs	= 0;
+	for(uint8_t dir=0;dir<6;dir++){
+		oldest->dir_count[dir] = 0;
+	}
+	return oldest;
+}
+
+static uint8_t is_current(Neighbor* nbr, uint32_t now){
+	return nbr->id && ((int32_t)(now-nbr->last_heard))<NEIGHBOR_TIMEOUT_MS;
+}
@@ -14,61 +14,66 @@
 // of a message sent from dir N, and when the TXing droplet finishes on its last channel.
 static const uint8_t txDirOffset[6] = {7, 6, 3, 5, 4, 2};
 
-static const float bearingBasis[6][2]=	{
-	{SQRT3_OVER2 , -0.5},
-	{0           , -1  },
-	{-SQRT3_OVER2, -0.5},
-	{-SQRT3_OVER2,  0.5},
-	{0           ,  1  },
-	{SQRT3_OVER2 ,  0.5}
-};
-
-static const float hats[6][2]={
-	{11, ELEVEN_SQRT3},
-	{22, 0},
-	{11, -ELEVEN_SQRT3},
-	{-11, -ELEVEN_SQRT3},
-	{-22, 0},
-	{-11, ELEVEN_SQRT3}
-};
-
-static const float headingBasis[6][2]={
-	{-1          ,  0  },
-	{-0.5,  SQRT3_OVER2},
-	{ 0.5,  SQRT3_OVER2},
-	{ 1          ,  0  },
-	{ 0.5, -SQRT3_OVER2},
-	{-0.5, -SQRT3_OVER2}
-};
-
-static const float basis_angle[6] = {-(M_PI/6.0), -M_PI_2, -((5.0*M_PI)/6.0), ((5.0*M_PI)/6.0), M_PI_2, (M_PI/6.0)};
 static uint32_t sensorHealthHistory;
 static int16_t brightMeas[6][6];
+static uint8_t measuredSensors; //Which columns of brightMeas ir_range_meas actually measured.
+static rnb rnbQueue[RNB_QUEUE_SIZE];
+static uint8_t rnbQueueStart;		//The oldest result.
+static volatile uint8_t rnbQueueCount;
+static uint16_t rnbQueueDropped;
 
-static inline float getCosBearingBasis(uint8_t i __attribute__ ((unused)), uint8_t j){
-	return bearingBasis[j][0];
-}
-
-static inline float getSinBearingBasis(uint8_t i __attribute__ ((unused)), uint8_t j){
-	return bearingBasis[j][1];
-}
-
-static inline float getCosHeadingBasis(uint8_t i, uint8_t j){
-	return headingBasis[(j+(6-i))%6][0];
-}
-
-static inline float getSinHeadingBasis(uint8_t i, uint8_t j){
-	return headingBasis[(j+(6-i))%6][1];
-}
+//The schedule rnb_tick is running, set up by rnb_start.
+#define RNB_IDLE			0
+#define RNB_BLAST			1
+#define RNB_MEAS			2
+#define RNB_CODED_BLAST		3
+#define RNB_CODED_MEAS		4
+#define RNB_GUARD_TICKS		((RNB_SLOT_GUARD*1000U+IR_SENSOR_TICK_US-1)/IR_SENSOR_TICK_US)
 
-void calculate_bearing_and_heading(float* bearing, float* heading);
-float calculate_range(float iRange, float bearing, float heading);
-float calculate_error(float r, float b, float h);
+static volatile uint8_t rnbState;
+static uint16_t rnbWait;			//Ticks left before the first slot.
+static uint16_t rnbTick;			//Since the first slot started.
+static uint16_t rnbSlotStart;		//Tick the current slot started on.
+static uint16_t rnbSlotEnd;
+static uint16_t rnbSlotTicks;		//Q8, since slots aren't a whole number of ticks.
+static uint8_t rnbSlot;
+static uint8_t rnbNumSlots;
+static uint8_t rnbChips;			//Slots per emitter.
+static uint8_t rnbLit;				//The emitter that's on, or 0xFF.
+static uint8_t rnbEmitters;			//Which emitters' slots to measure.
+static uint8_t rnbSensorList[6];	//Dimmest first, for ir_range_meas. See rnb_sample.
+static uint8_t rnbNumSensors;
+static uint8_t rnbMeasPerCh;		//The most conversions any one sensor gets in a slot.
+static uint8_t rnbSlotConversions;	//Conversions in each measured slot, between the guards.
+static uint8_t rnbMeasCount[6];		//What each sensor in rnbSensorList gets in this slot.
+static uint8_t rnbConversionsLeft;	//Not yet given to a sensor, this slot.
+static uint8_t rnbReadSensor;		//Index in rnbSensorList of the conversion being read,
+static uint8_t rnbReadPos;			//and which of that sensor's it is.
+static uint8_t rnbSelSensor;		//Likewise for the next conversion the mux is set up for.
+static uint8_t rnbSelPos;
+static uint8_t rnbLate;				//A reading was lost, so the measurement is no good.
+static int16_t rnbSamples[6][RNB_MAX_MEAS_PER_CH];
 
-static int16_t processBrightMeas();
+static void push_rnb(rnb* r);
+static void broadcast_rnb(char mode);
+static uint8_t rnb_start(uint8_t state, uint16_t wait_ms, uint8_t meas_time, uint8_t chips);
+static void rnb_tick();
+static void rnb_slot_started();
+static void rnb_sample();
+static void rnb_plan_sensor(uint8_t k);
+static void rnb_sensor_done(uint8_t emitter, uint8_t dir, uint8_t meas_per_ch);
+static void rnb_finish();
+static void choose_rnb_pairs(int16_t sync_strength[6], uint8_t* emitters, uint8_t* sensors);
+static void processBrightMeas(RnbMatrixSums* sums);
+static uint8_t rnb_confidence_for(id_t id, RnbMatrixSums* sums, RnbEstimate* est);
 
-static float magicRangeFunc(float a);
-//static float invMagicRangeFunc(float r);
+#ifdef RNB_CODED_BROADCASTS
+static id_t codedRoster[RNB_NUM_CODES];	//Who has each code. The broadcast's initiator is always code 0.
+static uint8_t codedRosterLen;			//Not counting the initiator.
+static int16_t codedMeas[RNB_NUM_CODES][6][6];
+static int16_t codedChipMeas[6];
+static uint8_t rnbCode;				//What we're blasting, for RNB_CODED_BLAST.
+#endif
 
 //static void print_brightMeas();
 												
@@ -79,13 +84,76 @@ void range_algs_init(){
 			brightMeas[i][j] = 0;
 		}
 	}
+	measuredSensors = ALL_DIRS;
 	rnbCmdID=0;
+	rnbCmdPower=RNB_FULL_POWER;
 	rnbProcessingFlag=0;
+	rnbState = RNB_IDLE;
+	rnbQueueStart = 0;
+	rnbQueueCount = 0;
+	rnbQueueDropped = 0;
+}
+
+/*
+ * Takes the oldest result out of the queue and puts it in 'out'. Returns '0' if there weren't any. So, in loop():
+ *   rnb r;
+ *   while(rnb_next(&r)){ ... }
+ */
+uint8_t rnb_next(rnb* out){
+	uint8_t found = 0;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(rnbQueueCount){
+			*out = rnbQueue[rnbQueueStart];
+			rnbQueueStart = (rnbQueueStart+1)%RNB_QUEUE_SIZE;
+			rnbQueueCount--;
+			found = 1;
+		}
+	}
+	return found;
+}
+
+uint8_t rnb_pending(){
+	return rnbQueueCount;
+}
+
+/*
+ * How many results fell off the front of a full queue since this was last called.
+ */
+uint16_t rnb_dropped(){
+	uint16_t dropped;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		dropped = rnbQueueDropped;
+		rnbQueueDropped = 0;
+	}
+	return dropped;
+}
+
+static void push_rnb(rnb* r){
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(rnbQueueCount==RNB_QUEUE_SIZE){
+			rnbQueueStart = (rnbQueueStart+1)%RNB_QUEUE_SIZE;
+			rnbQueueCount--;
+			if(rnbQueueDropped<0xFFFF) rnbQueueDropped++;
+		}
+		rnbQueue[(rnbQueueStart+rnbQueueCount)%RNB_QUEUE_SIZE] = *r;
+		rnbQueueCount++;
+	}
 }
 
-//TODO: handle variable power.
 void broadcast_rnb_data(){
-	uint8_t power = 255;
+	broadcast_rnb(RNB_MODE_FULL);
+}
+
+/*
+ * Samples each emitter for RNB_FAST_MEAS_TIME instead of RNB_FULL_MEAS_TIME. Replayed over the
+ * DropletRNBcalib logs, that costs about 0.5mm of median range error and 2 degrees of bearing and heading;
+ * see plot_rnb_schedules.py.
+ */
+void broadcast_fast_rnb_data(){
+	broadcast_rnb(RNB_MODE_FAST);
+}
+
+static void broadcast_rnb(char mode){
 	uint8_t goAhead =0;
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
 		if(!rnbProcessingFlag){
@@ -95,13 +163,13 @@ void broadcast_rnb_data(){
 	}
 	if(goAhead){
 		rnbCmdSentTime = get_time();
-		char c = 'r';
+		char c = mode;
 		uint8_t result = hp_ir_targeted_cmd(ALL_DIRS, &c, 65, (uint16_t)(rnbCmdSentTime&0xFFFF));
 		if(result){
 			ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
 				hp_ir_block_bm = 0xFF;
 			}		
-			ir_range_blast(power);
+			ir_range_blast(RNB_FULL_POWER, mode);
 			ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
 				hp_ir_block_bm = 0;
 			}
@@ -115,145 +183,56 @@ void broadcast_rnb_data(){
 
 void use_rnb_data(){
 	//uint32_t start = get_time();
-	int16_t matrixSum = processBrightMeas();
 	//if(rand_byte()%2) broadcastBrightMeas();
-	float bearing, heading;
-	float error;
-	calculate_bearing_and_heading(&bearing, &heading);
-	float initialRange = magicRangeFunc(matrixSum/2.0739212652);
-	if(initialRange!=0&&!isnanf(initialRange)){	
-		float range = calculate_range(initialRange, bearing, heading);
-		if(!isnanf(range)){
-			if(range<2*DROPLET_RADIUS) range=46;
-			error = calculate_error(range, bearing, heading);
-			//printf("ID: %04X, R: %4u, B: % 4d, H: % 4d | %f\r\n", rnbCmdID, (uint16_t)range, (int16_t)rad_to_deg(bearing), (int16_t)rad_to_deg(heading), error);
-			//if(error>1.1 && range<140){
-			//	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
-			//		rnbProcessingFlag=0;
-			//	}
-			//	return;
-			//}
-			
-			last_good_rnb.id = rnbCmdID;
-			last_good_rnb.range		= (uint16_t)(range);
-			last_good_rnb.bearing	= (int16_t)rad_to_deg(bearing);
-			last_good_rnb.heading	= (int16_t)rad_to_deg(heading);
-			//print_brightMeas();
-			rnb_updated=1;
-		}
+	RnbMatrixSums sums;
+	RnbEstimate est;
+	uint8_t conf = 0;
+	processBrightMeas(&sums);
+	if(rnb_estimate(brightMeas, &sums, rnbCmdPower, &est)) conf = rnb_confidence_for(rnbCmdID, &sums, &est);
+	if(conf){
+		//printf("ID: %04X, R: %4u, B: % 4d, H: % 4d | %u %hu\r\n", rnbCmdID, (uint16_t)(est.range>>4), est.bearing, est.heading, est.error, conf);
+		rnb r;
+		r.id			= rnbCmdID;
+		r.range			= (uint16_t)(est.range>>4);
+		r.bearing		= est.bearing;
+		r.heading		= est.heading;
+		r.confidence	= conf;
+		r.time			= rnbCmdSentTime;
+		//print_brightMeas();
+		neighbor_rnb(r.id, r.range, r.bearing, r.heading, conf, r.time);
+		push_rnb(&r);
+		last_good_rnb = r;
+		rnb_updated=1;
 	}
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
 		rnbProcessingFlag=0;
 	}
 }
 
-float calculate_range(float iRange, float bearing, float heading){
-	float bigR[2] = {-iRange*sin(bearing), iRange*cos(bearing)};
-	float txHats[6][2];
-	for(uint8_t i=0;i<6;i++){
-		txHats[i][0] = hats[i][0]*cos(heading) - hats[i][1]*sin(heading);
-		txHats[i][1] = hats[i][0]*sin(heading) + hats[i][1]*cos(heading);
-	}
-	float rij[2];
-	float rijMagSq;
-	float alphaDotP, betaDotP;
-	float cosAcosB;
-	float total = 0;
-	int16_t* fast_bm = (int16_t*)brightMeas;
-	for(uint8_t i=0;i<36;i++){
-		uint8_t rx = i%6;
-		uint8_t tx = i/6;
-		rij[0] = bigR[0] + txHats[tx][0] - hats[rx][0];
-		rij[1] = bigR[1] + txHats[tx][1] - hats[rx][1];
-		alphaDotP = rij[0]*hats[rx][0] + rij[1]*hats[rx][1];
-		alphaDotP = rij[0]*hats[rx][0] + rij[1]*hats[rx][1];
-		betaDotP = (-rij[0])*txHats[tx][0] + (-rij[1])*txHats[tx][1];
-		betaDotP = betaDotP < 0 ? 0 : betaDotP;
-		rijMagSq = rij[0]*rij[0] + rij[1]*rij[1];
-		cosAcosB = (alphaDotP*betaDotP)/(rijMagSq*DROPLET_RADIUS_SQ);
-
-		total += fast_bm[i]*cosAcosB;
-	}
-
-	return magicRangeFunc(total);
-}
-
-float calculate_error(float r, float b, float h){
-	r = r<46 ? 46 : r;
-	float bigR[2] = {-r*sin(b), r*cos(b)};
-	float txHats[6][2];
-	for(uint8_t i=0;i<6;i++){
-		txHats[i][0] = hats[i][0]*cos(h) - hats[i][1]*sin(h);
-		txHats[i][1] = hats[i][0]*sin(h) + hats[i][1]*cos(h);
-	}
-	float rij[2];
-	float rijMagSq;
-	float alphaDotP, betaDotP;
-	float measTotal = 0;
-	float cosAcosBTotal = 0;
-	float cosAcosB[36];
-	int16_t* fast_bm = (int16_t*)brightMeas;
-	for(uint8_t i=0;i<36;i++){
-		uint8_t rx = i%6;
-		uint8_t tx = i/6;
-		rij[0] = bigR[0] + txHats[tx][0] - hats[rx][0];
-		rij[1] = bigR[1] + txHats[tx][1] - hats[rx][1];
-		alphaDotP = rij[0]*hats[rx][0] + rij[1]*hats[rx][1];
-		alphaDotP = alphaDotP < 0 ? 0 : alphaDotP;
-		betaDotP = (-rij[0])*txHats[tx][0] + (-rij[1])*txHats[tx][1];
-		betaDotP = betaDotP < 0 ? 0 : betaDotP;
-		rijMagSq = rij[0]*rij[0] + rij[1]*rij[1];
-		
-		measTotal += fast_bm[i];
-		cosAcosB[i] = (alphaDotP*betaDotP)/(rijMagSq*DROPLET_RADIUS_SQ);
-		cosAcosBTotal += cosAcosB[i];
-	}
-
-	float conf = 0;
-	for(uint8_t i=0;i<36;i++){
-		conf += fabsf( (fast_bm[i]/measTotal) - (cosAcosB[i]/cosAcosBTotal) );
-	}
-	
-	return conf;
-}
-
-void calculate_bearing_and_heading(float* bearing, float* heading){
-	int16_t* fast_bm = (int16_t*)brightMeas;
-	
-	float bearingX = 0;
-	float bearingY = 0;
-	float headingX = 0;
-	float headingY = 0;
-
-	for(uint8_t i=0;i<36;i++){
-		
-		bearingX+=fast_bm[i]*getCosBearingBasis(i/6,i%6);
-		bearingY+=fast_bm[i]*getSinBearingBasis(i/6,i%6);
-		headingX+=fast_bm[i]*getCosHeadingBasis(i/6,i%6);
-		headingY+=fast_bm[i]*getSinHeadingBasis(i/6,i%6);
-	}
-	
-	*bearing = atan2f(bearingY, bearingX);	
-	*heading = atan2f(headingY, headingX);
+/*
+ * rnb_confidence, with the last result we used for this sender from the neighbor table as the prior.
+ * Rejected results never make it in to the table, so one bad measurement can't drag the next good one down.
+ */
+static uint8_t rnb_confidence_for(id_t id, RnbMatrixSums* sums, RnbEstimate* est){
+	Neighbor nbr;
+	RnbEstimate prev;
+	if(neighbor_get(id, &nbr) && nbr.last_rnb && (get_time()-nbr.last_rnb)<NEIGHBOR_TIMEOUT_MS){
+		prev.range		= ((int32_t)nbr.range)<<4;
+		prev.bearing	= nbr.bearing;
+		prev.heading	= nbr.heading;
+		return rnb_confidence(sums, est, &prev, get_time()-nbr.last_rnb);
+	}
+	return rnb_confidence(sums, est, NULL, 0);
 }
 
-static int16_t processBrightMeas(){
-	int16_t val;
-	int16_t valSum=0;
-	uint8_t allColZeroCheck = 0b00111111;
-
-	for(uint8_t e = 0; e < 6; e++){
-		for(uint8_t s = 0; s < 6; s++){
-			val = brightMeas[e][s];
-			allColZeroCheck &= ~((!!val)<<s);	
-			//val=val*(val>0);
-			brightMeas[e][s] = val;
-			valSum+=val;	
-		}
-	}
+//Keeps track of sensors which keep reading nothing at all.
+static void processBrightMeas(RnbMatrixSums* sums){
+	rnb_sum_matrix(brightMeas, sums);
+	uint8_t allColZeroCheck = sums->zeroCols;
 
 	uint8_t problem = 0;
 	for(uint8_t i = 0; i<6; i++){
+		if(!(measuredSensors&(1<<i))) continue; //Skipped this time, so it says nothing about the sensor.
 		if(allColZeroCheck&(1<<i)){
 			sensorHealthHistory+=(1<<(4*i));
 		}else{
@@ -268,78 +247,381 @@ static int16_t processBrightMeas(){
 	if(problem){
 		startup_light_sequence();
 	}	
-	return valSum;
 }
 
-void ir_range_meas(){
-	//int32_t times[16] = {0};
-	cmd_arrival_dir;
-	cmd_sender_dir;
-	//times[0] = get_time();
-	while((get_time()-rnbCmdSentTime+8)<POST_BROADCAST_DELAY);
-	//times[1] = get_time();
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){		
-		uint32_t pre_sync_op = get_time();
-		while((get_time() - pre_sync_op) < TIME_FOR_SET_IR_POWERS) delay_us(500);
-		//times[2] = get_time();
-		for(uint8_t emitter_dir = 0; emitter_dir < 6; emitter_dir++){
-			pre_sync_op = get_time();
-			//times[2*emitter_dir+3] = pre_sync_op;
-			while((get_time() - pre_sync_op) < (TIME_FOR_GET_IR_VALS-TIME_FOR_IR_MEAS)/2) delay_us(500);
-			get_ir_sensors(brightMeas[emitter_dir] , 9); //11
-			//times[2*emitter_dir+4] = get_time();			
-			while((get_time() - pre_sync_op) < TIME_FOR_GET_IR_VALS) delay_us(500);		
-			delay_ms(DELAY_BETWEEN_RB_TRANSMISSIONS);
+/*
+ * The receiving half of an rnb broadcast; see ir_range_blast for the schedule. Only the pairs
+ * choose_rnb_pairs picks are measured, and the rest of brightMeas is zeroed, so the sensors we do measure
+ * get as many conversions as fit in the sampling time. They're measured dimmest first, by the sync
+ * message's strength, so the brighter ones get whatever the dimmer ones leave; see rnb_sample.
+ * This only sets the measurement up: rnb_tick does it, and schedules use_rnb_data when it's done. Returns
+ * '0' if it couldn't be started.
+ */
+uint8_t ir_range_meas(char mode, int16_t sync_strength[6]){
+	uint8_t measTime = (mode==RNB_MODE_FAST) ? RNB_FAST_MEAS_TIME : RNB_FULL_MEAS_TIME;
+	uint8_t emitters, sensors;
+	choose_rnb_pairs(sync_strength, &emitters, &sensors);
+	rnbNumSensors = 0;
+	for(uint8_t dir=0;dir<6;dir++){
+		for(uint8_t i=0;i<6;i++) brightMeas[dir][i] = 0;
+		if(!(sensors&(1<<dir))) continue;
+		uint8_t k = rnbNumSensors++;
+		while(k>0 && sync_strength[rnbSensorList[k-1]]>sync_strength[dir]){
+			rnbSensorList[k] = rnbSensorList[k-1];
+			k--;
 		}
+		rnbSensorList[k] = dir;
+	}
+	rnbMeasPerCh = RNB_MAX_MEAS_PER_CH;
+	rnbEmitters = emitters;
+	measuredSensors = sensors;
+
+	int32_t wait = (int32_t)(rnbCmdSentTime+POST_BROADCAST_DELAY+RNB_SYNC_BYTE_TIME(RNB_POWER_SYNC_BYTES(rnbCmdPower))-8-get_time());
+	return rnb_start(RNB_MEAS, (wait>0 ? wait : 0)+TIME_FOR_SET_IR_POWERS, measTime, 1);
+}
+
+/*
+ * Lights each emitter for one slot, back to back. The sender has no idea where its neighbours are, so it
+ * always lights all six; it's the receivers which skip what they can't use.
+ * Returns once it's done, about 60ms after the sync message, but rnb_tick does the blasting, so interrupts
+ * stay on throughout. The IR power is put back to whatever it was.
+ * Our broadcasts always blast at RNB_FULL_POWER: powerGainLUT is a placeholder until the lower powers are
+ * calibrated, so a dimmer blast would only make our neighbours' ranges worse.
+ */
+void ir_range_blast(uint16_t power, char mode){
+	uint8_t measTime = (mode==RNB_MODE_FAST) ? RNB_FAST_MEAS_TIME : RNB_FULL_MEAS_TIME;
+	uint16_t callerPower = get_all_ir_powers();
+	while((get_time() - rnbCmdSentTime) < (POST_BROADCAST_DELAY+RNB_SYNC_BYTE_TIME(RNB_POWER_SYNC_BYTES(power)))) delay_us(500);
+	set_all_ir_powers(power);
+	if(rnb_start(RNB_BLAST, TIME_FOR_SET_IR_POWERS, measTime, 1)){
+		while(rnbState!=RNB_IDLE);
 	}
+	if(callerPower!=power) set_all_ir_powers(callerPower);
 }
 
-void ir_range_blast(uint8_t power __attribute__ ((unused))){
-	//int32_t times[16] = {0};
-	//times[0] = get_time();
-	while((get_time() - rnbCmdSentTime) < POST_BROADCAST_DELAY) delay_us(500);
-	//times[1] = get_time();
-	uint32_t pre_sync_op = get_time();
-	set_all_ir_powers(256);	
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){		
-		while((get_time() - pre_sync_op) < TIME_FOR_SET_IR_POWERS) delay_us(500);
-		//times[2] = get_time();
-		for(uint8_t dir = 0; dir < 6; dir++){
-			pre_sync_op = get_time();
-			//set_red_led(255);
-			//times[2*dir+3] = pre_sync_op;			
-			ir_led_on(dir);
-			while((get_time() - pre_sync_op) < TIME_FOR_GET_IR_VALS) delay_us(500);
-			ir_led_off(dir);
-			//times[2*dir+4] = get_time();				
-			//set_red_led(0);					
-			delay_ms(DELAY_BETWEEN_RB_TRANSMISSIONS);
+#ifdef RNB_CODED_BROADCASTS
+/*
+ * Up to RNB_NUM_CODES-1 of our neighbours broadcast along with us, each with its own code. The sync message
+ * carries our IR power, always RNB_FULL_POWER as in ir_range_blast, and the roster, as ordinals: code i+1 goes
+ * to the i'th. Neighbours at another power sit theirs out, since they can't change it from the sync's
+ * interrupt. Everyone else measures every chip of every slot, and separates out each code's brightness matrix
+ * with rnb_correlate_chip. Neighbours who miss the sync just don't light up, and use_coded_rnb_data drops
+ * their empty matrices.
+ * The chips take 6*RNB_CODE_LENGTH*RNB_SLOT_TIME(RNB_CODED_MEAS_TIME), 336ms. Interrupts stay on.
+ */
+void broadcast_coded_rnb_data(){
+	uint8_t goAhead =0;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		if(!rnbProcessingFlag){
+			rnbProcessingFlag = 1;
+			goAhead = 1;
 		}
 	}
+	if(goAhead){
+		char msg[1+RNB_NUM_CODES];
+		Neighbor nbr;
+		msg[0] = RNB_MODE_CODED;
+		msg[1] = (char)(RNB_FULL_POWER-1);
+		codedRoster[0] = get_droplet_id();
+		codedRosterLen = 0;
+		for(uint8_t i=0;i<NEIGHBOR_TABLE_SIZE && codedRosterLen<(RNB_NUM_CODES-1);i++){
+			if(!neighbor_at(i, &nbr)) continue;
+			uint8_t ord = get_droplet_ord(nbr.id);
+			if(ord==0xFF) continue;
+			msg[2+codedRosterLen] = (char)ord;
+			codedRoster[1+codedRosterLen] = nbr.id;
+			codedRosterLen++;
+		}
+		rnbCmdSentTime = get_time();
+		uint8_t result = hp_ir_targeted_cmd(ALL_DIRS, msg, 66+codedRosterLen, (uint16_t)(rnbCmdSentTime&0xFFFF));
+		if(result){
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+				hp_ir_block_bm = 0xFF;
+			}
+			uint16_t callerPower = get_all_ir_powers();
+			while((get_time()-rnbCmdSentTime) < (POST_BROADCAST_DELAY+RNB_SYNC_BYTE_TIME(1+codedRosterLen))) delay_us(500);
+			set_all_ir_powers(RNB_FULL_POWER);
+			rnbCode = 0;
+			if(rnb_start(RNB_CODED_BLAST, TIME_FOR_SET_IR_POWERS, RNB_CODED_MEAS_TIME, RNB_CODE_LENGTH)){
+				while(rnbState!=RNB_IDLE);
+			}
+			if(callerPower!=RNB_FULL_POWER) set_all_ir_powers(callerPower);
+			ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+				hp_ir_block_bm = 0;
+			}
+		}
+	}
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		rnbProcessingFlag = 0;
+	}
 }
 
+/*
+ * The receiving half of broadcast_coded_rnb_data. If we're on the roster we broadcast our code. Otherwise
+ * we measure, and use_coded_rnb_data is scheduled when we're done. Either way, rnb_tick does the work, and
+ * this returns '0' if it couldn't be started.
+ */
+uint8_t ir_range_coded(char* roster, uint8_t roster_len){
+	uint8_t myCode = 0;
+	if(roster_len>(RNB_NUM_CODES-1)) roster_len = RNB_NUM_CODES-1;
+	codedRoster[0] = rnbCmdID;
+	codedRosterLen = roster_len;
+	for(uint8_t i=0;i<roster_len;i++){
+		uint8_t ord = (uint8_t)roster[i];
+		codedRoster[1+i] = (ord<(sizeof(OrderedBotIDs)/sizeof(id_t))) ? get_id_from_ord(ord) : 0;
+		if(codedRoster[1+i]==get_droplet_id()) myCode = 1+i;
+	}
+	int32_t wait = (int32_t)(rnbCmdSentTime+POST_BROADCAST_DELAY+RNB_SYNC_BYTE_TIME(1+codedRosterLen)-8-get_time());
+	if(wait<0) wait = 0;
+	//Our rnbCmdSentTime is off by as much as ir_range_meas's, hence the 8. If we aren't at the sender's power,
+	//we measure instead, and our code's matrix comes up empty.
+	if(myCode && get_all_ir_powers()==rnbCmdPower){
+		rnbCode = myCode;
+		return rnb_start(RNB_CODED_BLAST, wait+TIME_FOR_SET_IR_POWERS, RNB_CODED_MEAS_TIME, RNB_CODE_LENGTH);
+	}
+	//Every pair this time, since each emitter is lit by a different sender. Each sensor gets the same, so
+	//every chip is measured alike.
+	rnbMeasPerCh = RNB_CODED_MEAS_PER_CH;
+	rnbEmitters = ALL_DIRS;
+	rnbNumSensors = 6;
+	for(uint8_t dir=0;dir<6;dir++) rnbSensorList[dir] = dir;
+	memset(codedMeas, 0, sizeof(codedMeas));
+	measuredSensors = ALL_DIRS;
+	return rnb_start(RNB_CODED_MEAS, wait+TIME_FOR_SET_IR_POWERS, RNB_CODED_MEAS_TIME, RNB_CODE_LENGTH);
+}
 
-static float magicRangeFunc(float a){
-	if(a<=0){
-		return NAN;
-		}else{
-		float result = -24.3675811184*(0.0259969683 + powf(a, -0.5));
-		result = 1 + exp(result);
-		result = (778.0270114700/result) - 528.0270114700;
-		return result;
+void use_coded_rnb_data(){
+	RnbMatrixSums sums;
+	RnbEstimate est;
+	int32_t bestTotal = 0;
+	for(uint8_t code=0;code<=codedRosterLen;code++){
+		id_t id = codedRoster[code];
+		if(!id || id==get_droplet_id()) continue;
+		rnb_decode_code(codedMeas[code]);
+		rnb_sum_matrix(codedMeas[code], &sums);
+		if(sums.total<RNB_CODED_MIN_TOTAL) continue;
+		if(!rnb_estimate(codedMeas[code], &sums, rnbCmdPower, &est)) continue;
+		uint8_t conf = rnb_confidence_for(id, &sums, &est);
+		if(!conf) continue;
+		rnb r;
+		r.id			= id;
+		r.range			= (uint16_t)(est.range>>4);
+		r.bearing		= est.bearing;
+		r.heading		= est.heading;
+		r.confidence	= conf;
+		r.time			= rnbCmdSentTime;
+		neighbor_rnb(id, r.range, r.bearing, r.heading, conf, r.time);
+		push_rnb(&r);
+		if(sums.total>bestTotal){ //last_good_rnb only has room for one, so it gets the brightest.
+			bestTotal = sums.total;
+			last_good_rnb = r;
+			rnb_updated=1;
+		}
+	}
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		rnbProcessingFlag=0;
+	}
+}
+
+#endif
+
+/*
+ * Sets up 'state' to start wait_ms from now: rnbNumSlots slots of RNB_SLOT_TIME(meas_time), 'chips' for
+ * each emitter in turn. The ir_sensor tick runs the rest. Returns '0' if the sensors were busy.
+ */
+static uint8_t rnb_start(uint8_t state, uint16_t wait_ms, uint8_t meas_time, uint8_t chips){
+	if(rnbState!=RNB_IDLE) return 0;
+	rnbWait			= (uint16_t)(((uint32_t)wait_ms*1000U)/IR_SENSOR_TICK_US);
+	if(!rnbWait) rnbWait = 1;
+	rnbChips		= chips;
+	rnbNumSlots		= 6*chips;
+	rnbSlotTicks	= (uint16_t)((RNB_SLOT_TIME(meas_time)*1000UL*256)/IR_SENSOR_TICK_US);
+	rnbSlotConversions = (uint8_t)((meas_time*1000U)/IR_SENSOR_TICK_US);
+	rnbLate			= 0;
+	rnbLit			= 0xFF;
+	rnbState		= state;
+	if(!ir_sensor_tick_start()){
+		rnbState = RNB_IDLE;
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Runs each time a conversion finishes, every IR_SENSOR_TICK_US, with the slots counted in ticks instead of
+ * get_time()'s milliseconds. The conversions are started by an event, not by us, so however late this
+ * runs the samples are evenly spaced; it just has to read each one before the next is done.
+ * Between measurements it's ir_sensor's background sampler instead.
+ */
+ISR(IR_SENSOR_TICK_vect){
+	if(!ir_sensor_ticking()){
+		ir_sensor_sample();
+		return;
+	}
+	rnb_tick();
+	while(rnbState!=RNB_IDLE && ir_sensor_tick_missed()){
+		rnbLate = 1;
+		rnb_tick();
+	}
+}
+
+static void rnb_tick(){
+	if(rnbState==RNB_IDLE) return;
+	if(rnbWait){
+		if(--rnbWait) return;
+		rnbTick = 0;
+		rnbSlot = 0;
+		rnbSlotStart = 0;
+		rnbSlotEnd = rnbSlotTicks>>8;
+		rnb_slot_started();
+	}else if(++rnbTick==rnbSlotEnd){
+		if(++rnbSlot==rnbNumSlots){
+			rnb_finish();
+			return;
+		}
+		rnbSlotStart = rnbSlotEnd;
+		rnbSlotEnd = (uint16_t)((((uint32_t)rnbSlot+1)*rnbSlotTicks)>>8);
+		rnb_slot_started();
+	}
+	if(rnbState==RNB_MEAS || rnbState==RNB_CODED_MEAS) rnb_sample();
+}
+
+//Switches the emitters over for a blast. The chips of a coded blast turn the same emitter on and off.
+static void rnb_slot_started(){
+	uint8_t dir = rnbSlot/rnbChips;
+	uint8_t on = (rnbState==RNB_BLAST);
+	#ifdef RNB_CODED_BROADCASTS
+		if(rnbState==RNB_CODED_BLAST) on = rnb_code_chip(rnbCode, rnbSlot%rnbChips);
+	#endif
+	if(rnbState!=RNB_BLAST && rnbState!=RNB_CODED_BLAST) return;
+	if(rnbLit!=0xFF && (rnbLit!=dir || !on)){
+		ir_led_off(rnbLit);
+		rnbLit = 0xFF;
+	}
+	if(on && rnbLit==0xFF){
+		ir_led_on(dir);
+		rnbLit = dir;
+	}
+}
+
+/*
+ * Each measured slot skips RNB_GUARD_TICKS, then shares its rnbSlotConversions out between the sensors in
+ * rnbSensorList, one after the other; see rnb_plan_sensor. A conversion has already started by the time
+ * we read the last one, so the mux is set two ahead, by rnbSelSensor, while rnbReadSensor trails it.
+ * Audio Droplets convert every sensor at once, so they all just get as many as fit.
+ */
+static void rnb_sample(){
+	uint8_t emitter = rnbSlot/rnbChips;
+	if(!(rnbEmitters&(1<<emitter))) return;
+	int16_t i = (int16_t)(rnbTick-rnbSlotStart)-RNB_GUARD_TICKS;
+	#ifdef AUDIO_DROPLET
+		uint8_t measPerCh = rnbMeasPerCh<rnbSlotConversions ? rnbMeasPerCh : rnbSlotConversions;
+		if(i<0 || i>=measPerCh) return;
+		for(uint8_t k=0;k<rnbNumSensors;k++){
+			uint8_t dir = rnbSensorList[k];
+			rnbSamples[dir][i] = ir_sensor_read(dir);
+			if(i==(measPerCh-1)) rnb_sensor_done(emitter, dir, measPerCh);
+		}
+	#else
+		if(i<-2) return;
+		if(i==-2){
+			rnbConversionsLeft = rnbSlotConversions;
+			rnbReadSensor = rnbSelSensor = 0;
+			rnbReadPos = rnbSelPos = 0;
+			rnb_plan_sensor(0);
+		}
+		if(i>=0 && rnbReadSensor<rnbNumSensors){
+			uint8_t dir = rnbSensorList[rnbReadSensor];
+			int16_t val = ir_sensor_read(dir);
+			rnbSamples[dir][rnbReadPos] = val;
+			//The first reading past the settling ones. If it's saturated, more won't tell us anything.
+			if(rnbReadPos==2 && rnbMeasCount[rnbReadSensor]>RNB_SATURATED_MEAS_PER_CH &&
+					(val-ir_sensor_baseline(dir))>=RNB_SATURATED){
+				rnbConversionsLeft += rnbMeasCount[rnbReadSensor]-RNB_SATURATED_MEAS_PER_CH;
+				rnbMeasCount[rnbReadSensor] = RNB_SATURATED_MEAS_PER_CH;
+			}
+			if(++rnbReadPos==rnbMeasCount[rnbReadSensor]){
+				rnb_sensor_done(emitter, dir, rnbReadPos);
+				rnbReadSensor++;
+				rnbReadPos = 0;
+			}
+		}
+		if(rnbSelSensor<rnbNumSensors && rnbSelPos==rnbMeasCount[rnbSelSensor]){
+			rnbSelPos = 0;
+			if(++rnbSelSensor<rnbNumSensors) rnb_plan_sensor(rnbSelSensor);
+		}
+		if(rnbSelSensor<rnbNumSensors){
+			ir_sensor_select(rnbSensorList[rnbSelSensor]);
+			rnbSelPos++;
+		}
+	#endif
+}
+
+/*
+ * Gives the k'th sensor an even share of what's left of the slot, up to rnbMeasPerCh. Sensors before it
+ * which needed fewer (those rnb_sample cut short, and rounding) leave it more.
+ */
+static void rnb_plan_sensor(uint8_t k){
+	uint8_t count = rnbConversionsLeft/(rnbNumSensors-k);
+	if(count>rnbMeasPerCh) count = rnbMeasPerCh;
+	if(count<RNB_MIN_MEAS_PER_CH) count = RNB_MIN_MEAS_PER_CH;
+	rnbConversionsLeft -= (count<rnbConversionsLeft) ? count : rnbConversionsLeft;
+	rnbMeasCount[k] = count;
+}
+
+static void rnb_sensor_done(uint8_t emitter, uint8_t dir, uint8_t meas_per_ch){
+	int16_t val = ir_sensor_result(dir, rnbSamples[dir], meas_per_ch);
+	if(rnbState==RNB_MEAS){
+		brightMeas[emitter][dir] = val;
+	}
+	#ifdef RNB_CODED_BROADCASTS
+	else{
+		codedChipMeas[dir] = val;
+		if(dir==rnbSensorList[rnbNumSensors-1]){
+			rnb_correlate_chip(codedMeas, emitter, rnbSlot%rnbChips, codedChipMeas);
+		}
+	}
+	#endif
+}
+
+/*
+ * Hands the IR back, and a measurement on to use_rnb_data or use_coded_rnb_data. Those clear
+ * rnbProcessingFlag when they're done; a blast, or a measurement which lost a reading, clears it now.
+ */
+static void rnb_finish(){
+	uint8_t state = rnbState;
+	if(rnbLit!=0xFF) ir_led_off(rnbLit);
+	ir_sensor_tick_stop();
+	rnbState = RNB_IDLE;
+	hp_ir_block_bm = 0;
+	if(state==RNB_MEAS && !rnbLate){
+		schedule_task(5, use_rnb_data, NULL);
+	}
+	#ifdef RNB_CODED_BROADCASTS
+	else if(state==RNB_CODED_MEAS && !rnbLate){
+		schedule_task(5, use_coded_rnb_data, NULL);
+	}
+	#endif
+	else{
+		rnbProcessingFlag = 0;
+	}
+}
+
+/*
+ * If we've measured this sender recently, only the pairs facing each other at that bearing and heading are
+ * worth measuring. Otherwise, the sync message's strength gives a rough bearing for the sensors, and we
+ * measure every emitter. Replayed over the DropletRNBcalib logs, skipping the rest this way is slightly
+ * more accurate than measuring everything, since those pairs only ever see noise.
+ */
+static void choose_rnb_pairs(int16_t sync_strength[6], uint8_t* emitters, uint8_t* sensors){
+	Neighbor nbr;
+	if(neighbor_get(rnbCmdID, &nbr) && nbr.last_rnb && (get_time()-nbr.last_rnb)<NEIGHBOR_TIMEOUT_MS){
+		rnb_facing_pairs(nbr.bearing, nbr.heading, RNB_FACING_SPREAD, emitters, sensors);
+	}else{
+		rnb_facing_pairs(coarse_bearing(sync_strength), RNB_NO_HEADING, RNB_FACING_SPREAD, emitters, sensors);
 	}
 }
 
-//static float invMagicRangeFunc(float r){
-	//if(r>250){
-		//return 0;
-	//}else{
-		//float logTerm = log((778.0270114700331/(r + 528.0270114700331)) - 1);
-		//float result = 3367.2274479842324/(2.2757149424086466 + logTerm*(7.184767720344338 + logTerm*5.670842845179211));
-		//return result;
-	//}
-//}
-//
 //static void print_brightMeas(){
 	//printf("{\"%04X\", \"%04X\", {", rnbCmdID, get_droplet_id());
 	//for(uint8_t emitter_num=0 ; emitter_num<6 ; emitter_num++){
@@ -83,54 +83,74 @@ void rgb_sensor_init()
 
 #ifndef AUDIO_DROPLET
 
+static int16_t rgb_sensor_get(uint8_t ch, ADC_CH_t* adc);
+static int16_t rgb_sensor_measure(ADC_CH_t* adc);
+static inline int16_t rgb_sensor_read(ADC_CH_t* adc){
+	return ((((int16_t)(adc->RESH))<<8)|((int16_t)adc->RESL))>>4;
+}
+
+//These return the background sampler's latest median, if it's recent enough; see sensor_snapshot.
 int16_t get_red_sensor(){
-	int16_t meas[RGB_MEAS_COUNT];
-	int16_t red_val;
-	//printf("R: ");
-	for(uint8_t meas_count=0; meas_count<RGB_MEAS_COUNT; meas_count++){
-		ADCA.CH0.CTRL |= ADC_CH_START_bm;
-		while (ADCA.CH0.INTFLAGS==0){};		// wait for measurement to complete
-		meas[meas_count] = ((((int16_t)(ADCA.CH0.RESH))<<8)|((int16_t)ADCA.CH0.RESL))>>4;	
-		ADCA.CH0.INTFLAGS=1; // clear the complete flag				
-		//printf("%6d ", meas[meas_count]);
-	}
-	//printf("\r\n");
-	red_val=meas_find_median(&meas[2], RGB_MEAS_COUNT-2);
-	return red_val;
+	return rgb_sensor_get(SNAPSHOT_RED, &(ADCA.CH0));
 }
 
 int16_t get_green_sensor(){
+	return rgb_sensor_get(SNAPSHOT_GREEN, &(ADCA.CH1));
+}
+
+int16_t get_blue_sensor(){
+	return rgb_sensor_get(SNAPSHOT_BLUE, &(ADCA.CH2));
+}
+
+/*
+ * If the sampler has no snapshot, as in rgb_sensor_init, or its last is more than RGB_SNAPSHOT_MAX_AGE_MS
+ * old, because it's been stopped for an rnb measurement or the like, this measures the color itself.
+ */
+static int16_t rgb_sensor_get(uint8_t ch, ADC_CH_t* adc){
+	int16_t val;
+	uint32_t time = snapshot_get(ch, &val);
+	if(time && (get_time()-time)<=RGB_SNAPSHOT_MAX_AGE_MS) return val;
+	return rgb_sensor_measure(adc);
+}
+
+static int16_t rgb_sensor_measure(ADC_CH_t* adc){
 	int16_t meas[RGB_MEAS_COUNT];
-	int16_t green_val;		
-	//printf("G: ");
-	for(uint8_t meas_count=0; meas_count<RGB_MEAS_COUNT; meas_count++)	{
-		ADCA.CH1.CTRL |= ADC_CH_START_bm;
-		while (ADCA.CH1.INTFLAGS==0){};		// wait for measurement to complete
-		meas[meas_count] = ((((int16_t)(ADCA.CH1.RESH))<<8)|((int16_t)ADCA.CH1.RESL))>>4;		
-		ADCA.CH1.INTFLAGS=1; // clear the complete flag	
+	for(uint8_t meas_count=0; meas_count<RGB_MEAS_COUNT; meas_count++){
+		adc->CTRL |= ADC_CH_START_bm;
+		while (adc->INTFLAGS==0){};		// wait for measurement to complete
+		meas[meas_count] = rgb_sensor_read(adc);
+		adc->INTFLAGS=1; // clear the complete flag				
 		//printf("%6d ", meas[meas_count]);
 	}
 	//printf("\r\n");
-	green_val=meas_find_median(&meas[2], RGB_MEAS_COUNT-2);
+	return meas_find_median(&meas[2], RGB_MEAS_COUNT-2);
+}
 
-	return green_val;
+/*
+ * Called by ir_sensor's background sampler each tick: hands the last sweep's readings to the snapshots, and
+ * starts the next one. The three channels are converted in turn, well within a tick.
+ */
+void rgb_sensor_sample(uint32_t now){
+	if(ADCA.CH0.INTFLAGS && ADCA.CH1.INTFLAGS && ADCA.CH2.INTFLAGS){
+		snapshot_add(SNAPSHOT_RED, rgb_sensor_read(&(ADCA.CH0)), now);
+		snapshot_add(SNAPSHOT_GREEN, rgb_sensor_read(&(ADCA.CH1)), now);
+		snapshot_add(SNAPSHOT_BLUE, rgb_sensor_read(&(ADCA.CH2)), now);
+		ADCA.CH0.INTFLAGS = 1;
+		ADCA.CH1.INTFLAGS = 1;
+		ADCA.CH2.INTFLAGS = 1;
+	}
+	ADCA.CTRLA |= ADC_CH0START_bm | ADC_CH1START_bm | ADC_CH2START_bm;
 }
 
-int16_t get_blue_sensor(){
-	int16_t meas[RGB_MEAS_COUNT];
-	int16_t blue_val;
-	//printf("B: ");
-	for(uint8_t meas_count=0; meas_count<RGB_MEAS_COUNT; meas_count++)	{
-		ADCA.CH2.CTRL |= ADC_CH_START_bm;
-		while (ADCA.CH2.INTFLAGS==0){};		// wait for measurement to complete
-		meas[meas_count] = ((((int16_t)(ADCA.CH2.RESH))<<8)|((int16_t)ADCA.CH2.RESL))>>4;
-		ADCA.CH2.INTFLAGS=1; // clear the complete flag		
-		//printf("%6d ", meas[meas_count]);
-	}		
-	//printf("\r\n");
-	blue_val=meas_find_median(&meas[2], RGB_MEAS_COUNT-2);
-		
-	return blue_val;
+//Called when the sampler starts again, after something else had the sensors for a while.
+void rgb_sensor_sample_restart(){
+	snapshot_reset(SNAPSHOT_RED);
+	snapshot_reset(SNAPSHOT_GREEN);
+	snapshot_reset(SNAPSHOT_BLUE);
+	ADCA.CH0.INTFLAGS = 1;
+	ADCA.CH1.INTFLAGS = 1;
+	ADCA.CH2.INTFLAGS = 1;
+	ADCA.CTRLA |= ADC_CH0START_bm | ADC_CH1START_bm | ADC_CH2START_bm;
 }
 
 #endif
@@ -167,22 +187,3 @@ void get_rgb(int16_t *r, int16_t *g, int16_t *b)
 		if(b!=NULL) *b = bTemp;
 	#endif
 }
-
-// Finds the median of arr_len numbers by finding the max, finding the min, and returning the other value
-// WARNING! This function modifies the array!
-int16_t meas_find_median(int16_t* meas, uint8_t arr_len){
-	if(arr_len==1) return meas[0];
-	else if(arr_len==2) return (meas[0]+meas[1])/2;
-	
-	for(uint8_t i=0; i<arr_len ; i++){
-		for(uint8_t j=i+1 ; j<arr_len ; j++){
-			if(meas[j] < meas[i]){
-				int16_t temp = meas[i];
-				meas[i] = meas[j];
-				meas[j] = temp;
-			}
-		}
-	}
-	if(arr_len%2==0) return (meas[arr_len/2-1]+meas[arr_len/2])/2;
-	else return meas[arr_len/2];
-}
\ No newline at end of file
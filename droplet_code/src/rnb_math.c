@@ -0,0 +1,672 @@
+/*
+*	README:
+*	For consistencies sake, any time you loop through the brightness matrix, it should look like this:
+*		for(emitter){
+*			for(sensor){
+*				brightness_matrix[emitter][sensor] ...
+*			}
+*		}
+*/
+#include <stddef.h>
+#include <avr/pgmspace.h>
+#include "rnb_math.h"
+#include "range_lut.h"
+
+/*
+ * With u the unit vector toward the sender, a sensor at s and an emitter at t (each DROPLET_RADIUS from its
+ * Droplet's center, t already rotated by the heading), the vector from sensor to emitter at range R is
+ * rij = R*u + t - s. So:
+ *	alpha	= rij.s		= R*(u.s) + k
+ *	beta	= -rij.t	= -R*(u.t) + k
+ *	|rij|^2	= R^2 + 2R*(u.t - u.s) - 2k
+ * where k = t.s - DROPLET_RADIUS^2. The directions are 60 degrees apart, so k only depends on how many
+ * directions the emitter is around from the sensor. Everything the model needs at any R is in these 18 terms.
+ */
+typedef struct rnb_geometry_struct{
+	int16_t uDotRx[6];	//u.s for each sensor, Q8 mm.
+	int16_t uDotTx[6];	//u.t for each emitter, Q8 mm.
+	int32_t k[6];		//Indexed by (emitter-sensor+6)%6, Q12 mm^2.
+} RnbGeometry;
+
+typedef struct rnb_pose_struct{
+	int32_t range;			//Q4 mm.
+	int16_t cos_b, sin_b;	//Q14 unit vector, at the bearing.
+	int16_t cos_h, sin_h;	//Q14 unit vector, at the heading.
+} RnbPose;
+
+#ifdef RNB_JOINT_SOLVER
+#define RNB_SOLVER_ITERATIONS	3
+#define RNB_SOLVER_RESIDUALS	37		//One per emitter/sensor pair, plus one for the range.
+#define RNB_SOLVER_MAX_STEP_MM	50
+#define RNB_SOLVER_MAX_STEP_DEG	28
+#define ROT_1DEG_COS			16382	//Q14.
+#define ROT_1DEG_SIN			286		//Q14.
+
+static int16_t solverResid[4][RNB_SOLVER_RESIDUALS]; //At the current pose, then with each of range, bearing, heading nudged.
+#endif
+
+static const int16_t bearingBasis[6][2] PROGMEM =	{
+	{ 14189, -8192 },
+	{     0, -16384},
+	{-14189, -8192 },
+	{-14189,  8192 },
+	{     0,  16384},
+	{ 14189,  8192 }
+};
+
+//Position of each emitter/sensor relative to the Droplet's center. Q8 mm.
+static const int16_t hats[6][2] PROGMEM ={
+	{ 2816,  4877},
+	{ 5632,     0},
+	{ 2816, -4877},
+	{-2816, -4877},
+	{-5632,     0},
+	{-2816,  4877}
+};
+
+static const int16_t headingBasis[6][2] PROGMEM ={
+	{-16384,      0},
+	{ -8192,  14189},
+	{  8192,  14189},
+	{ 16384,      0},
+	{  8192, -14189},
+	{ -8192, -14189}
+};
+
+static const int16_t basis_angle_deg[6] PROGMEM = {-30, -90, -150, 150, 90, 30}; //Angle of each direction, in degrees.
+
+//sin of 0 to 90 degrees, Q14.
+static const int16_t sinTable[91] PROGMEM = {
+	    0,   286,   572,   857,  1143,  1428,  1713,  1997,  2280,  2563,
+	 2845,  3126,  3406,  3686,  3964,  4240,  4516,  4790,  5063,  5334,
+	 5604,  5872,  6138,  6402,  6664,  6924,  7182,  7438,  7692,  7943,
+	 8192,  8438,  8682,  8923,  9162,  9397,  9630,  9860, 10087, 10311,
+	10531, 10749, 10963, 11174, 11381, 11585, 11786, 11982, 12176, 12365,
+	12551, 12733, 12911, 13085, 13255, 13421, 13583, 13741, 13894, 14044,
+	14189, 14330, 14466, 14598, 14726, 14849, 14968, 15082, 15191, 15296,
+	15396, 15491, 15582, 15668, 15749, 15826, 15897, 15964, 16026, 16083,
+	16135, 16182, 16225, 16262, 16294, 16322, 16344, 16362, 16374, 16382,
+	16384
+};
+
+static int16_t* fast_bm; //The matrix rnb_estimate was handed, flattened.
+static uint16_t powerGain; //rnb_power_gain of the sender's power, for the matrix rnb_estimate was handed.
+
+static void build_geometry(RnbGeometry* geom, RnbPose* pose);
+#ifdef RNB_JOINT_SOLVER
+static void refine_rnb(RnbPose* pose, int32_t measTotal);
+static uint32_t solver_residuals(RnbPose* pose, int32_t measTotal, int16_t* resid);
+static uint8_t solve3(float A[3][3], float b[3], float x[3]);
+static void rotate_unit_vector(int16_t* c, int16_t* s, int16_t rotCos, int16_t rotSin);
+static void rotate_by_deg(int16_t* c, int16_t* s, int16_t angle);
+#endif
+static int32_t evaluate_model(RnbGeometry* geom, int32_t r, int16_t* cosAcosB, uint8_t clampAlpha);
+static uint16_t estimate_error(RnbGeometry* geom, int32_t r, int32_t measTotal);
+static int16_t cos_a_cos_b(int32_t alphaDotP, int32_t betaDotP, int32_t rijMagSq);
+
+static int32_t brightness_to_range(int32_t a);
+static int32_t magicRangeFunc(int32_t a);
+//static float invMagicRangeFunc(float r);
+
+static uint8_t unit_vector(int32_t x, int32_t y, int16_t* c, int16_t* s);
+
+/*
+ * The pass over the matrix everything else starts from: its total, its sums against the bearing and
+ * heading bases, and which sensors read zero for every emitter.
+ */
+void rnb_sum_matrix(int16_t bm[6][6], RnbMatrixSums* sums){
+	int16_t val;
+	sums->total = 0;
+	sums->negTotal = 0;
+	sums->zeroCols = 0b00111111;
+	sums->saturated = 0;
+	for(uint8_t i=0;i<4;i++) sums->basis[i] = 0;
+	for(uint8_t e = 0; e < 6; e++){
+		for(uint8_t s = 0; s < 6; s++){
+			val = bm[e][s];
+			sums->zeroCols &= ~((!!val)<<s);
+			sums->total += val;
+			if(val<0) sums->negTotal -= val;
+			if(val>=RNB_SATURATED) sums->saturated++;
+			uint8_t h = s>=e ? s-e : s+6-e;
+			sums->basis[0] += (int32_t)val*(int16_t)pgm_read_word(&bearingBasis[s][0]);
+			sums->basis[1] += (int32_t)val*(int16_t)pgm_read_word(&bearingBasis[s][1]);
+			sums->basis[2] += (int32_t)val*(int16_t)pgm_read_word(&headingBasis[h][0]);
+			sums->basis[3] += (int32_t)val*(int16_t)pgm_read_word(&headingBasis[h][1]);
+		}
+	}
+}
+
+/*
+ * The bearing and heading sums and the matrix total all come from rnb_sum_matrix's one pass over the
+ * matrix. The model is then evaluated at the initial range (to fit the range) and at the fitted range (for
+ * the error), sharing the geometry in RnbGeometry.
+ */
+uint8_t rnb_estimate(int16_t bm[6][6], RnbMatrixSums* sums, uint16_t power, RnbEstimate* est){
+	fast_bm = (int16_t*)bm;
+	powerGain = rnb_power_gain(power);
+	if(!powerGain) return 0;
+	int32_t* basisSums = sums->basis;
+	int32_t matrixSum = sums->total;
+	RnbPose pose;
+	if(!unit_vector(basisSums[0], basisSums[1], &(pose.cos_b), &(pose.sin_b))) return 0;
+	if(!unit_vector(basisSums[2], basisSums[3], &(pose.cos_h), &(pose.sin_h))) return 0;
+	est->bearing = atan2_deg(basisSums[1], basisSums[0])/64;
+	est->heading = atan2_deg(basisSums[3], basisSums[2])/64;
+	//matrixSum/2.0739212652, as Q8.
+	pose.range = brightness_to_range((matrixSum*15800)>>7);
+	if(pose.range==0 || pose.range==RNB_RANGE_INVALID) return 0;
+
+	RnbGeometry geom;
+	build_geometry(&geom, &pose);
+	pose.range = brightness_to_range(evaluate_model(&geom, pose.range, NULL, 0)>>6);
+	if(pose.range==RNB_RANGE_INVALID) return 0;
+	if(pose.range<(int32_t)(2*DROPLET_RADIUS*16)) pose.range = 46*16;
+#ifdef RNB_JOINT_SOLVER
+	refine_rnb(&pose, matrixSum);
+	build_geometry(&geom, &pose);
+	est->bearing = atan2_deg(pose.sin_b, pose.cos_b)/64;
+	est->heading = atan2_deg(pose.sin_h, pose.cos_h)/64;
+#endif
+	est->range = pose.range;
+	est->error = estimate_error(&geom, est->range<46*16 ? 46*16 : est->range, matrixSum);
+	return 1;
+}
+
+/*
+ * Adds up penalties for everything which made the estimates replayed from the DropletRNBcalib logs go
+ * wrong, in Q8 of the error term:
+ *	the error term itself.
+ *	noise against signal. The noise is twice the readings below 0 (which are noise's negative half) plus
+ *	RNB_CONF_NOISE_FLOOR, so a dim matrix is penalized even if it happens not to read below 0.
+ *	saturated readings, past the few which a neighbour close enough to touch causes. A sensor saturated by
+ *	ambient light is saturated for all six emitters.
+ *	how far range and bearing have moved from prev, against a tolerance which grows with prev's age.
+ * Confidence falls from 255 to 0 as that goes from 0 to RNB_CONF_MAX_PENALTY. See rnb_replay's -g.
+ */
+uint8_t rnb_confidence(RnbMatrixSums* sums, RnbEstimate* est, RnbEstimate* prev, uint32_t prev_age_ms){
+	if(sums->total<=0) return 0;
+	int32_t penalty = est->error>>6;
+	penalty += ((2*sums->negTotal+RNB_CONF_NOISE_FLOOR)*RNB_CONF_NOISE_WEIGHT)/sums->total;
+	if(sums->saturated>RNB_CONF_SAT_ALLOWED) penalty += (sums->saturated-RNB_CONF_SAT_ALLOWED)*RNB_CONF_SAT_WEIGHT;
+	if(prev){
+		int32_t moved = (RNB_CONF_MAX_SPEED*(prev_age_ms>60000 ? 60000 : prev_age_ms))/1000;
+		int32_t rangeTol = 20*16 + est->range/4 + moved*16; //Q4 mm
+		int32_t rangeDiff = est->range - prev->range;
+		if(rangeDiff<0) rangeDiff = -rangeDiff;
+		rangeDiff = (rangeDiff*RNB_CONF_RANGE_WEIGHT)/rangeTol;
+		penalty += rangeDiff>2*RNB_CONF_RANGE_WEIGHT ? 2*RNB_CONF_RANGE_WEIGHT : rangeDiff;
+		int32_t bearingDiff = pretty_angle_deg(est->bearing - prev->bearing);
+		if(bearingDiff<0) bearingDiff = -bearingDiff;
+		bearingDiff = (bearingDiff*RNB_CONF_BEARING_WEIGHT)/(30 + moved);
+		penalty += bearingDiff>2*RNB_CONF_BEARING_WEIGHT ? 2*RNB_CONF_BEARING_WEIGHT : bearingDiff;
+	}
+	if(penalty>=RNB_CONF_MAX_PENALTY) return 0;
+	return 255 - (uint8_t)((penalty*255)/RNB_CONF_MAX_PENALTY);
+}
+
+/*
+ * Returns the smallest set of directions which covers the cone 'spread' degrees wide around 'bearing'.
+ * Bearing is in the same frame as last_good_rnb.bearing. Each emitter is taken to cover the 60 degrees
+ * centered on its basis_angle_deg (the lower edge belongs to it, the upper edge to its neighbour), so a spread
+ * of 0 always gives exactly one direction, and a spread of 300 or more gives ALL_DIRS. Any int16_t bearing
+ * works; other_code/DropletMotionTracking/DropletRNBcalib/dirs_toward_check.c checks every one of them.
+ */
+uint8_t dirs_toward(int16_t bearing, uint16_t spread){
+	if(spread>=300) return 0x3F; //ALL_DIRS
+	int16_t half = spread/2;
+	uint8_t dirs = 0;
+	bearing = pretty_angle_deg(bearing); //So subtracting a basis angle below can't overflow.
+	for(uint8_t dir=0;dir<6;dir++){
+		int16_t diff = pretty_angle_deg(bearing-(int16_t)pgm_read_word(&basis_angle_deg[dir]));
+		if(diff>=(-30-half) && diff<(30+half)) dirs |= (1<<dir);
+	}
+	return dirs;
+}
+
+/*
+ * A cheap bearing estimate from one brightness value per sensor, such as ir_msg.strength: the centroid of
+ * the brightest sensor and the two on either side of it, so it can't be off by more than 30 degrees from
+ * that sensor's basis_angle_deg. Returns IR_NO_BEARING if no sensor saw anything.
+ * Checked against the rnbCalibData logs, summing each sensor's column of the brightness matrix, by
+ * DropletRNBcalib/coarse_bearing_check.c: the median difference from rnb_estimate's bearing is 7 degrees,
+ * or 5 degrees when the brightest sensor's sum is at least 200.
+ */
+int16_t coarse_bearing(int16_t strength[6]){
+	uint8_t max_dir = 0;
+	for(uint8_t dir=1;dir<6;dir++){
+		if(strength[dir]>strength[max_dir]) max_dir = dir;
+	}
+	int16_t mid = strength[max_dir];
+	if(mid<=0) return IR_NO_BEARING;
+	int16_t prev = strength[(max_dir+5)%6]; //basis_angle_deg 60 degrees above max_dir's.
+	int16_t next = strength[(max_dir+1)%6]; //basis_angle_deg 60 degrees below max_dir's.
+	if(prev<0) prev = 0;
+	if(next<0) next = 0;
+	int16_t offset = (int16_t)((60*((int32_t)prev-next))/(prev+mid+next));
+	if(offset>30)	offset = 30;
+	if(offset<-30)	offset = -30;
+	return pretty_angle_deg((int16_t)pgm_read_word(&basis_angle_deg[max_dir])+offset);
+}
+
+/*
+ * Which emitter/sensor pairs can see each other, for a sender at 'bearing' with 'heading': the sensors
+ * facing within the cone 'spread' degrees wide around the sender, and the sender's emitters facing within
+ * the same cone around us. A sensor or emitter more than 90 degrees off that line is behind the Droplet's
+ * own body, so the model has it at zero and it only adds noise. With IR_NO_BEARING, every sensor counts,
+ * and with RNB_NO_HEADING, every emitter does.
+ */
+void rnb_facing_pairs(int16_t bearing, int16_t heading, uint16_t spread, uint8_t* emitters, uint8_t* sensors){
+	if(bearing==IR_NO_BEARING){
+		*sensors	= 0x3F;
+		*emitters	= 0x3F;
+		return;
+	}
+	*sensors	= dirs_toward(bearing, spread);
+	*emitters	= heading==RNB_NO_HEADING ? 0x3F : dirs_toward(pretty_angle_deg(bearing)+180-pretty_angle_deg(heading), spread);
+}
+
+#ifdef RNB_CODED_BROADCASTS
+/*
+ * Code 'code' (0 to RNB_NUM_CODES-1) is row code+1 of the RNB_CODE_LENGTH Walsh-Hadamard matrix, with the
+ * emitter on for +1 and off for -1. Those rows are orthogonal to each other and each is on for exactly half
+ * of its chips, so correlating against one cancels the ambient light and every other code.
+ * Returns '1' if the emitter should be on for this chip.
+ */
+uint8_t rnb_code_chip(uint8_t code, uint8_t chip){
+	uint8_t bits = (code+1)&chip;
+	bits ^= bits>>4;
+	bits ^= bits>>2;
+	bits ^= bits>>1;
+	return !(bits&1);
+}
+
+/*
+ * Adds one chip's worth of readings from each sensor, for emitter slot 'emitter', to every code's sums.
+ */
+void rnb_correlate_chip(int16_t sums[RNB_NUM_CODES][6][6], uint8_t emitter, uint8_t chip, int16_t meas[6]){
+	for(uint8_t code=0;code<RNB_NUM_CODES;code++){
+		uint8_t on = rnb_code_chip(code, chip);
+		for(uint8_t s=0;s<6;s++){
+			sums[code][emitter][s] += on ? meas[s] : -meas[s];
+		}
+	}
+}
+
+/*
+ * Turns one code's sums from rnb_correlate_chip in to brightnesses. The sender's light was in half the
+ * chips' readings, and counted against the other half, so the sum is RNB_CODE_LENGTH/2 times it.
+ */
+void rnb_decode_code(int16_t sums[6][6]){
+	for(uint8_t e=0;e<6;e++){
+		for(uint8_t s=0;s<6;s++){
+			sums[e][s] /= (RNB_CODE_LENGTH/2);
+		}
+	}
+}
+#endif
+
+static void build_geometry(RnbGeometry* geom, RnbPose* pose){
+	int16_t hat0[2] = {pgm_read_word(&hats[0][0]), pgm_read_word(&hats[0][1])};
+	for(uint8_t i=0;i<6;i++){
+		int16_t hat[2] = {pgm_read_word(&hats[i][0]), pgm_read_word(&hats[i][1])};
+		int16_t txHat[2];
+		txHat[0] = ((int32_t)hat[0]*pose->cos_h - (int32_t)hat[1]*pose->sin_h)>>14;
+		txHat[1] = ((int32_t)hat[0]*pose->sin_h + (int32_t)hat[1]*pose->cos_h)>>14;
+		geom->uDotRx[i]	= (-(int32_t)hat[0]*pose->sin_b + (int32_t)hat[1]*pose->cos_b)>>14;
+		geom->uDotTx[i]	= (-(int32_t)txHat[0]*pose->sin_b + (int32_t)txHat[1]*pose->cos_b)>>14;
+		geom->k[i]		= (((int32_t)txHat[0]*hat0[0] + (int32_t)txHat[1]*hat0[1])>>4) - DROPLET_RADIUS_SQ*4096L;
+	}
+}
+
+#ifdef RNB_JOINT_SOLVER
+/*
+ * Gauss-Newton over (range, bearing, heading) together, starting from the closed-form estimate. The
+ * residuals are the same normalized brightness differences estimate_error sums up, plus one for how far
+ * the range is from what magicRangeFunc makes of the brightness at this pose. Steps are capped, and the
+ * lowest-residual pose seen is the one kept, so this can't make the estimate worse by its own measure.
+ * Replayed over the DropletRNBcalib logs (Droplets within 300mm, against the camera's poses), median errors
+ * went from 20.1mm/19.5deg/26.6deg (range/bearing/heading) to 14.9mm/15.3deg/25.5deg. It makes 13 more
+ * evaluate_model calls than the closed form's two, and took about 8 times as long in the replay. The steps
+ * are turned with sin_cos_deg, but solve3 is still soft float on a Droplet: three 3x3 solves an estimate.
+ */
+static void refine_rnb(RnbPose* pose, int32_t measTotal){
+	RnbPose best = *pose;
+	uint32_t bestCost = UINT32_MAX;
+	for(uint8_t iter=0;iter<RNB_SOLVER_ITERATIONS;iter++){
+		uint32_t cost = solver_residuals(pose, measTotal, solverResid[0]);
+		if(cost<bestCost){
+			bestCost = cost;
+			best = *pose;
+		}
+		RnbPose nudged = *pose;
+		nudged.range += 16;
+		solver_residuals(&nudged, measTotal, solverResid[1]);
+		nudged = *pose;
+		rotate_unit_vector(&(nudged.cos_b), &(nudged.sin_b), ROT_1DEG_COS, ROT_1DEG_SIN);
+		solver_residuals(&nudged, measTotal, solverResid[2]);
+		nudged = *pose;
+		rotate_unit_vector(&(nudged.cos_h), &(nudged.sin_h), ROT_1DEG_COS, ROT_1DEG_SIN);
+		solver_residuals(&nudged, measTotal, solverResid[3]);
+
+		//Normal equations, with the Jacobian in residual per mm and per degree. Products are scaled down by
+		//2^6 so 37 of them fit in an int32.
+		int32_t jtj[3][3] = {{0}};
+		int32_t jte[3] = {0};
+		for(uint8_t n=0;n<RNB_SOLVER_RESIDUALS;n++){
+			int16_t jac[3];
+			for(uint8_t i=0;i<3;i++){
+				jac[i] = solverResid[i+1][n] - solverResid[0][n];
+			}
+			for(uint8_t i=0;i<3;i++){
+				for(uint8_t j=i;j<3;j++){
+					jtj[i][j] += ((int32_t)jac[i]*jac[j])>>6;
+				}
+				jte[i] -= ((int32_t)jac[i]*solverResid[0][n])>>6;
+			}
+		}
+		float A[3][3];
+		float g[3], step[3];
+		for(uint8_t i=0;i<3;i++){
+			for(uint8_t j=i;j<3;j++){
+				A[i][j] = jtj[i][j];
+				A[j][i] = jtj[i][j];
+			}
+			A[i][i] = A[i][i]*1.01 + 1; //A little damping keeps a flat direction from running off.
+			g[i] = jte[i];
+		}
+		if(!solve3(A, g, step)) break;
+		if(step[0]>RNB_SOLVER_MAX_STEP_MM)		step[0] = RNB_SOLVER_MAX_STEP_MM;
+		if(step[0]<-RNB_SOLVER_MAX_STEP_MM)		step[0] = -RNB_SOLVER_MAX_STEP_MM;
+		for(uint8_t i=1;i<3;i++){
+			if(step[i]>RNB_SOLVER_MAX_STEP_DEG)		step[i] = RNB_SOLVER_MAX_STEP_DEG;
+			if(step[i]<-RNB_SOLVER_MAX_STEP_DEG)	step[i] = -RNB_SOLVER_MAX_STEP_DEG;
+		}
+		pose->range += (int32_t)(step[0]*16);
+		if(pose->range<46*16) pose->range = 46*16;
+		rotate_by_deg(&(pose->cos_b), &(pose->sin_b), (int16_t)(step[1]*64));
+		rotate_by_deg(&(pose->cos_h), &(pose->sin_h), (int16_t)(step[2]*64));
+	}
+	if(solver_residuals(pose, measTotal, solverResid[0])>=bestCost) *pose = best;
+}
+
+/*
+ * Fills resid with the solver's residuals at pose (Q14), and returns their sum of squares.
+ */
+static uint32_t solver_residuals(RnbPose* pose, int32_t measTotal, int16_t* resid){
+	RnbGeometry geom;
+	int16_t cosAcosB[36];
+	build_geometry(&geom, pose);
+	int32_t total = evaluate_model(&geom, pose->range, cosAcosB, 1);
+	int32_t cosAcosBTotal = 0;
+	for(uint8_t i=0;i<36;i++){
+		cosAcosBTotal += cosAcosB[i];
+	}
+	uint32_t cost = 0;
+	for(uint8_t i=0;i<36;i++){
+		resid[i] = cosAcosBTotal>0 ? ((int32_t)fast_bm[i]*Q14_ONE)/measTotal - ((int32_t)cosAcosB[i]*Q14_ONE)/cosAcosBTotal : 0;
+		cost += ((int32_t)resid[i]*resid[i])>>8;
+	}
+	//How far range is from the brightness's range, with 100mm weighted like a whole residual of 1.0.
+	int32_t fitRange = brightness_to_range(total>>6);
+	int32_t rangeDiff = fitRange==RNB_RANGE_INVALID ? 0 : pose->range - fitRange;
+	rangeDiff = (rangeDiff*Q14_ONE)/1600;
+	if(rangeDiff>INT16_MAX) rangeDiff = INT16_MAX;
+	if(rangeDiff<-INT16_MAX) rangeDiff = -INT16_MAX;
+	resid[36] = rangeDiff;
+	cost += ((int32_t)resid[36]*resid[36])>>8;
+	return cost;
+}
+
+/*
+ * Solves Ax=b by Cramer's rule. Returns '0' if A is singular or not positive definite. (matrix_utils would
+ * do this too, but it needs droplet_init.h, and this file has to build on a PC.)
+ */
+static uint8_t solve3(float A[3][3], float b[3], float x[3]){
+	float det = A[0][0]*(A[1][1]*A[2][2] - A[1][2]*A[2][1])
+			  - A[0][1]*(A[1][0]*A[2][2] - A[1][2]*A[2][0])
+			  + A[0][2]*(A[1][0]*A[2][1] - A[1][1]*A[2][0]);
+	if(!(det>0)) return 0;
+	for(uint8_t col=0;col<3;col++){
+		float M[3][3];
+		for(uint8_t i=0;i<3;i++){
+			for(uint8_t j=0;j<3;j++){
+				M[i][j] = (j==col) ? b[i] : A[i][j];
+			}
+		}
+		x[col] = (M[0][0]*(M[1][1]*M[2][2] - M[1][2]*M[2][1])
+				- M[0][1]*(M[1][0]*M[2][2] - M[1][2]*M[2][0])
+				+ M[0][2]*(M[1][0]*M[2][1] - M[1][1]*M[2][0]))/det;
+	}
+	return 1;
+}
+
+//Rotates the Q14 unit vector (c,s) by the angle whose Q14 cos and sin are rotCos and rotSin.
+static void rotate_unit_vector(int16_t* c, int16_t* s, int16_t rotCos, int16_t rotSin){
+	int32_t x = ((int32_t)(*c)*rotCos - (int32_t)(*s)*rotSin)>>14;
+	int32_t y = ((int32_t)(*c)*rotSin + (int32_t)(*s)*rotCos)>>14;
+	unit_vector(x, y, c, s);
+}
+
+/*
+ * Rotates the Q14 unit vector (c,s) by 'angle', Q6 degrees: the whole degrees from sin_cos_deg, and the rest
+ * as a small angle, whose sin is near enough proportional to it, and whose cos is 1 - sin^2/2.
+ */
+static void rotate_by_deg(int16_t* c, int16_t* s, int16_t angle){
+	int16_t wholeCos, wholeSin;
+	sin_cos_deg(angle>>6, &wholeCos, &wholeSin);
+	int16_t fracSin = ((angle&63)*ROT_1DEG_SIN)>>6;
+	int16_t fracCos = Q14_ONE - (((int32_t)fracSin*fracSin)>>15);
+	int16_t rotCos = ((int32_t)wholeCos*fracCos - (int32_t)wholeSin*fracSin)>>14;
+	int16_t rotSin = ((int32_t)wholeSin*fracCos + (int32_t)wholeCos*fracSin)>>14;
+	rotate_unit_vector(c, s, rotCos, rotSin);
+}
+#endif
+
+/*
+ * Returns the sum of the brightness matrix weighted by the model's cosAcosB (Q14) for each pair at range r (Q4 mm), and
+ * fills in cosAcosB if it isn't NULL. The range fit has never clamped alpha, so only the error term sets
+ * clampAlpha.
+ */
+static int32_t evaluate_model(RnbGeometry* geom, int32_t r, int16_t* cosAcosB, uint8_t clampAlpha){
+	int32_t rSq = (r*r)<<4;
+	int32_t rDotRx[6];
+	for(uint8_t rx=0;rx<6;rx++){
+		rDotRx[rx] = r*geom->uDotRx[rx];
+	}
+	int32_t total = 0;
+	uint8_t i = 0;
+	for(uint8_t tx=0;tx<6;tx++){
+		int32_t rDotTx = r*geom->uDotTx[tx];
+		for(uint8_t rx=0;rx<6;rx++){
+			int32_t k = geom->k[tx>=rx ? tx-rx : tx+6-rx];
+			int32_t alphaDotP = rDotRx[rx] + k;
+			int32_t betaDotP = k - rDotTx;
+			int32_t rijMagSq = rSq + 2*(rDotTx-rDotRx[rx]) - 2*k;
+			if(clampAlpha && alphaDotP<0) alphaDotP = 0;
+			if(betaDotP<0) betaDotP = 0;
+			int16_t c = cos_a_cos_b(alphaDotP>>10, betaDotP>>10, rijMagSq>>8);
+			if(cosAcosB) cosAcosB[i] = c;
+			total += (int32_t)fast_bm[i]*c;
+			i++;
+		}
+	}
+	return total;
+}
+
+/*
+ * Sum of the differences between the measured brightnesses and those the model predicts at range r, each
+ * normalized by its total. Q14, so 0 is a perfect fit and 2*Q14_ONE is as bad as it gets. Returns UINT16_MAX
+ * if either total is zero or less.
+ */
+static uint16_t estimate_error(RnbGeometry* geom, int32_t r, int32_t measTotal){
+	int16_t cosAcosB[36];
+	evaluate_model(geom, r, cosAcosB, 1);
+	int32_t cosAcosBTotal = 0;
+	for(uint8_t i=0;i<36;i++){
+		cosAcosBTotal += cosAcosB[i];
+	}
+	if(measTotal<=0 || cosAcosBTotal<=0) return UINT16_MAX;
+
+	uint32_t conf = 0;
+	for(uint8_t i=0;i<36;i++){
+		int32_t diff = ((int32_t)fast_bm[i]*Q14_ONE)/measTotal - ((int32_t)cosAcosB[i]*Q14_ONE)/cosAcosBTotal;
+		conf += diff<0 ? -diff : diff;
+	}
+	
+	return conf>UINT16_MAX ? UINT16_MAX : (uint16_t)conf;
+}
+
+/*
+ * alphaDotP and betaDotP are Q2 mm^2, and rijMagSq is Q4 mm^2. Returns (alphaDotP*betaDotP)/(rijMagSq*DROPLET_RADIUS_SQ)
+ * as Q14. Both sides of the division are shifted down together until the numerator fits in 16 bits, which
+ * keeps it to a single 32-bit division.
+ */
+static int16_t cos_a_cos_b(int32_t alphaDotP, int32_t betaDotP, int32_t rijMagSq){
+	int32_t num = alphaDotP*betaDotP;
+	int32_t den = rijMagSq*DROPLET_RADIUS_SQ;
+	while(num>=65536 || num<=-65536){
+		num>>=1;
+		den>>=1;
+	}
+	if(den<=0) return 0;
+	return (int16_t)((num*Q14_ONE)/den);
+}
+
+/*
+ * Interpolated from powerGainLUT (see range_lut.h). Settings past RNB_FULL_POWER are taken as full power.
+ */
+uint16_t rnb_power_gain(uint16_t power){
+	if(power>=RNB_FULL_POWER) return 256;
+	uint8_t idx = power/POWER_GAIN_STEP;
+	uint8_t frac = power%POWER_GAIN_STEP;
+	uint16_t lo = pgm_read_word(&powerGainLUT[idx]);
+	uint16_t hi = pgm_read_word(&powerGainLUT[idx+1]);
+	return lo + (((int16_t)(hi-lo)*frac)/POWER_GAIN_STEP);
+}
+
+/*
+ * magicRangeFunc was fit at full power, so a dimmer sender's brightness 'a' (Q8) is scaled up by powerGain
+ * to what it would have been at full power first.
+ */
+static int32_t brightness_to_range(int32_t a){
+	if(powerGain<256 && a>0 && a<(256L<<RANGE_LUT_OCTAVES)){
+		uint32_t scaled = ((uint32_t)a<<8)/powerGain;
+		a = scaled>=(256UL<<RANGE_LUT_OCTAVES) ? (int32_t)(256L<<RANGE_LUT_OCTAVES) : (int32_t)scaled;
+	}
+	return magicRangeFunc(a);
+}
+
+/*
+ * The calibrated brightness-to-range curve, from rangeLUT (see range_lut.h). 'a' is Q8 and the result is Q4 mm.
+ * Returns RNB_RANGE_INVALID if a<=0.
+ */
+static int32_t magicRangeFunc(int32_t a){
+	if(a<=0){
+		return RNB_RANGE_INVALID;
+	}else if(a<256){
+		return (int16_t)pgm_read_word(&rangeLUT[0]);
+	}else if(a>=(256L<<RANGE_LUT_OCTAVES)){
+		return (int16_t)pgm_read_word(&rangeLUT[RANGE_LUT_LENGTH-1]);
+	}else{
+		//Shift a up until it's in the top octave, counting down to the one it started in.
+		uint8_t octave = RANGE_LUT_OCTAVES-1;
+		uint32_t scaled = a;
+		while(scaled<(128UL<<RANGE_LUT_OCTAVES)){
+			scaled<<=1;
+			octave--;
+		}
+		//The bits under the leading one pick the segment, and the rest are how far along it we are.
+		uint16_t mantissa = scaled>>(RANGE_LUT_OCTAVES-8);
+		uint16_t idx = octave*RANGE_LUT_STEPS + ((mantissa>>(15-RANGE_LUT_STEP_BITS))&(RANGE_LUT_STEPS-1));
+		uint16_t frac = mantissa&((1<<(15-RANGE_LUT_STEP_BITS))-1);
+		int16_t lo = pgm_read_word(&rangeLUT[idx]);
+		int16_t hi = pgm_read_word(&rangeLUT[idx+1]);
+		return lo + (((int32_t)(hi-lo)*frac)>>(15-RANGE_LUT_STEP_BITS));
+	}
+}
+
+//static float invMagicRangeFunc(float r){
+	//if(r>250){
+		//return 0;
+	//}else{
+		//float logTerm = log((778.0270114700331/(r + 528.0270114700331)) - 1);
+		//float result = 3367.2274479842324/(2.2757149424086466 + logTerm*(7.184767720344338 + logTerm*5.670842845179211));
+		//return result;
+	//}
+//}
+
+uint16_t isqrt32(uint32_t x){
+	uint32_t root = 0;
+	uint32_t bit = 1UL<<30;
+	while(bit>x) bit>>=2;
+	while(bit){
+		if(x>=root+bit){
+			x -= root+bit;
+			root = (root>>1)+bit;
+		}else{
+			root>>=1;
+		}
+		bit>>=2;
+	}
+	return (uint16_t)root;
+}
+
+//Q14 cos and sin of a whole number of degrees.
+void sin_cos_deg(int16_t deg, int16_t* c, int16_t* s){
+	int16_t d = deg%360;
+	if(d<0) d += 360;
+	uint8_t quadrant = d/90;
+	uint8_t a = d%90;
+	int16_t sinA = (int16_t)pgm_read_word(&sinTable[a]);
+	int16_t cosA = (int16_t)pgm_read_word(&sinTable[90-a]);
+	switch(quadrant){
+		case 0: *c =  cosA; *s =  sinA; break;
+		case 1: *c = -sinA; *s =  cosA; break;
+		case 2: *c = -cosA; *s = -sinA; break;
+		default: *c =  sinA; *s = -cosA; break;
+	}
+}
+
+/*
+ * Angle of (x,y) in Q6 degrees, in [-180, 180]. Uses atan(z) ~= 45z + z(1-z)(14.02+3.80z) on the first
+ * octant, which is within 0.09 degrees.
+ */
+int16_t atan2_deg(int32_t y, int32_t x){
+	uint32_t ax = x<0 ? -x : x;
+	uint32_t ay = y<0 ? -y : y;
+	if(!ax && !ay) return 0;
+	uint8_t swap = ay>ax;
+	uint32_t num = swap ? ax : ay;
+	uint32_t den = swap ? ay : ax;
+	while(den>=(1UL<<17)){
+		num>>=1;
+		den>>=1;
+	}
+	int32_t z = (num*Q14_ONE)/den;
+	int32_t angle = (z*2880)>>14;
+	angle += ((((z*(Q14_ONE-z))>>14)*(897+((z*243)>>14)))>>14);
+	if(swap)	angle = 90*64 - angle;
+	if(x<0)		angle = 180*64 - angle;
+	if(y<0)		angle = -angle;
+	return (int16_t)angle;
+}
+
+/*
+ * Normalizes (x,y) to a Q14 unit vector. Returns '0' if it's the zero vector.
+ */
+static uint8_t unit_vector(int32_t x, int32_t y, int16_t* c, int16_t* s){
+	if(!x && !y) return 0;
+	while(x>=Q14_ONE || x<=-Q14_ONE || y>=Q14_ONE || y<=-Q14_ONE){
+		x>>=1;
+		y>>=1;
+	}
+	while(x<(Q14_ONE/2) && x>-(Q14_ONE/2) && y<(Q14_ONE/2) && y>-(Q14_ONE/2)){
+		x<<=1;
+		y<<=1;
+	}
+	uint16_t mag = isqrt32((uint32_t)(x*x + y*y));
+	*c = (int16_t)((x*Q14_ONE)/mag);
+	*s = (int16_t)((y*Q14_ONE)/mag);
+	return 1;
+}
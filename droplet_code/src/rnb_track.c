@@ -0,0 +1,283 @@
+#include <avr/pgmspace.h>
+#include "rnb_track.h"
+
+//e^(-sd^2/2), Q14, for a bearing sd of 0, 5, ... 180 degrees: the mean of cos(error), if the error's normal.
+static const int16_t cosMeanTable[37] PROGMEM = {
+	16384, 16322, 16136, 15832, 15416, 14896, 14285, 13595, 12841, 12036,
+	11196, 10335,  9469,  8609,  7768,  6956,  6181,  5451,  4771,  4144,
+	 3572,  3056,  2594,  2186,  1828,  1517,  1249,  1021,   828,   666,
+	  532,   422,   332,   259,   201,   154,   118
+};
+
+#define RNB_TRACK_MAX_R_VAR		(1L<<20)	//Past this a result says nothing, and the math stays in 32 bits.
+#define DEG_TO_RAD_Q13			143			//pi/180, Q13.
+
+static int32_t	scaled_var(int32_t sd, uint8_t confidence);
+static int32_t	tangential_sd(int32_t range, int16_t bearing_sd);
+static int32_t	cos_mean(int32_t bearingVar);
+static void		polar_var(int32_t range, int32_t rangeVar, int32_t bearingVar, int32_t* radial, int32_t* tangential);
+static void		set_rotated_cov(RnbTrack* t, int16_t c, int16_t s, int32_t radial, int32_t tangential);
+static void		apply_update(RnbTrack* t, int16_t hx, int16_t hy, int32_t innovation, int32_t var);
+static void		clamp_cov(RnbTrack* t);
+static int16_t	clamp_q4(int32_t v);
+static int16_t	wrap_q6(int32_t a);
+
+static inline int16_t range_sd(uint16_t range){ return RNB_TRACK_RANGE_SD + range/RNB_TRACK_RANGE_SD_DIV; }
+static inline int16_t bearing_sd(uint16_t range){ return RNB_TRACK_BEARING_SD + range/RNB_TRACK_BEARING_SD_DIV; }
+static inline int16_t heading_sd(uint16_t range){ return RNB_TRACK_HEADING_SD + range/RNB_TRACK_HEADING_SD_DIV; }
+
+/*
+ * Starts the track at a single result, with that result's noise as the covariance.
+ */
+void rnb_track_init(RnbTrack* t, uint16_t range, int16_t bearing, int16_t heading, uint8_t confidence){
+	int16_t c, s;
+	if(range>2000) range = 2000;
+	sin_cos_deg(bearing, &c, &s);
+	t->x = clamp_q4(((int32_t)range*16*c)>>14);
+	t->y = clamp_q4(((int32_t)range*16*s)>>14);
+	t->heading = wrap_q6((int32_t)heading*64);
+	//The noise grows with the real range, which this result could be short of; a standard deviation further
+	//out keeps it from claiming to be more precise than it is.
+	uint16_t far = range + range_sd(range);
+	int32_t radial, tangential;
+	polar_var(far, scaled_var(range_sd(far), confidence), scaled_var(bearing_sd(far), confidence), &radial, &tangential);
+	set_rotated_cov(t, c, s, radial, tangential);
+	int32_t hVar = scaled_var(heading_sd(far), confidence);
+	t->phh = hVar>RNB_TRACK_MAX_HEADING_VAR ? RNB_TRACK_MAX_HEADING_VAR : (uint16_t)hVar;
+}
+
+//Constant position: the neighbour could have wandered anywhere nearby, so the variances grow.
+void rnb_track_predict(RnbTrack* t, uint32_t dt_ms){
+	if(dt_ms>60000) dt_ms = 60000;
+	int32_t q = ((int32_t)RNB_TRACK_POS_DIFFUSION*dt_ms)/1000;
+	t->pxx += q;
+	t->pyy += q;
+	int32_t phh = t->phh + ((int32_t)RNB_TRACK_HEADING_DIFFUSION*dt_ms)/1000;
+	t->phh = phh>RNB_TRACK_MAX_HEADING_VAR ? RNB_TRACK_MAX_HEADING_VAR : (uint16_t)phh;
+	clamp_cov(t);
+}
+
+/*
+ * We moved dx and dy mm (in our frame, before turning), then turned 'turn' degrees counter-clockwise, the
+ * same direction bearings increase in. See neighbors_moved.
+ */
+void rnb_track_move(RnbTrack* t, int16_t dx, int16_t dy, int16_t turn){
+	int32_t x = clamp_q4((int32_t)t->x - (int32_t)dx*16);
+	int32_t y = clamp_q4((int32_t)t->y - (int32_t)dy*16);
+	int16_t c, s;
+	sin_cos_deg(-turn, &c, &s);
+	t->x = clamp_q4((c*x - s*y)>>14);
+	t->y = clamp_q4((s*x + c*y)>>14);
+	t->heading = wrap_q6((int32_t)t->heading - (int32_t)turn*64);
+
+	//P = R*P*R^T.
+	int32_t a11 = (c*t->pxx - s*t->pxy)>>14;
+	int32_t a12 = (c*t->pxy - s*t->pyy)>>14;
+	int32_t a21 = (s*t->pxx + c*t->pxy)>>14;
+	int32_t a22 = (s*t->pxy + c*t->pyy)>>14;
+	t->pxx = (a11*c - a12*s)>>14;
+	t->pxy = (a11*s + a12*c)>>14;
+	t->pyy = (a21*s + a22*c)>>14;
+
+	//Odometry error: the distance itself, and the turn swinging the neighbour about us.
+	int32_t distSd = isqrt32((int32_t)dx*dx + (int32_t)dy*dy)/RNB_TRACK_ODOM_DIV;
+	int16_t turnSd = (turn<0 ? -turn : turn)/RNB_TRACK_ODOM_DIV;
+	int32_t swingSd = tangential_sd(isqrt32((uint32_t)((int32_t)t->x*t->x + (int32_t)t->y*t->y))>>4, turnSd);
+	int32_t q = distSd*distSd + swingSd*swingSd;
+	if(q>RNB_TRACK_MAX_VAR) q = RNB_TRACK_MAX_VAR;
+	t->pxx += q;
+	t->pyy += q;
+	int32_t phh = t->phh + (int32_t)turnSd*turnSd;
+	t->phh = phh>RNB_TRACK_MAX_HEADING_VAR ? RNB_TRACK_MAX_HEADING_VAR : (uint16_t)phh;
+	clamp_cov(t);
+}
+
+/*
+ * Folds in one RNB result. Range and bearing are linearized about the predicted position: range is a
+ * measurement along u, the unit vector toward the neighbour, and bearing is one across it, in mm at the
+ * predicted range. Their noise is independent, so the two are applied one after the other. Without the
+ * second order terms and cos_mean below, rnb_track_sim found the covariance four times too small.
+ * Returns '0' if the position was too far off to use. Heading is gated separately.
+ */
+uint8_t rnb_track_update(RnbTrack* t, uint16_t range, int16_t bearing, int16_t heading, uint8_t confidence){
+	if(range>2000) range = 2000;
+	int32_t x = t->x, y = t->y;
+	int32_t rHat = isqrt32((uint32_t)(x*x + y*y)); //Q4
+	if(rHat<16){
+		rnb_track_init(t, range, bearing, heading, confidence);
+		return 1;
+	}
+	int16_t ux = (int16_t)((x<<14)/rHat);
+	int16_t uy = (int16_t)((y<<14)/rHat);
+	int16_t c, s;
+	sin_cos_deg(bearing, &c, &s);
+	int32_t cosDiff = ((int32_t)c*ux + (int32_t)s*uy)>>14;
+	int32_t sinDiff = ((int32_t)s*ux - (int32_t)c*uy)>>14;
+	if(cosDiff<0) sinDiff = sinDiff<0 ? -Q14_ONE : Q14_ONE; //More than 90 degrees off.
+
+	int32_t radialInnov = (int32_t)range*16 - rHat;		//Q4 mm
+	int32_t tangentialInnov = (rHat*sinDiff)>>14;		//Q4 mm
+	//The noise is worked out at the predicted range: at the measured one, a result which came up short would
+	//also claim to be more precise than it is.
+	uint16_t rMm = (uint16_t)(rHat>>4);
+	int32_t radialVar, tangentialVar, unused;
+	int32_t bearingVar = scaled_var(bearing_sd(rMm), confidence);
+	radialVar = scaled_var(range_sd(rMm), confidence);
+	polar_var(rMm, 0, bearingVar, &unused, &tangentialVar);
+	//A noisy bearing lands, on average, only cos_mean of the way across, so the bearing measures m times as much.
+	int16_t m = cos_mean(bearingVar);
+	int16_t tx = (int16_t)(((int32_t)-uy*m)>>14);
+	int16_t ty = (int16_t)(((int32_t)ux*m)>>14);
+
+	int32_t radialP = (((t->pxx*ux + t->pxy*uy)>>14)*ux + ((t->pxy*ux + t->pyy*uy)>>14)*uy)>>14;
+	int32_t tangentialP = (((t->pxx*uy - t->pxy*ux)>>14)*uy - ((t->pxy*uy - t->pyy*ux)>>14)*ux)>>14;
+	int32_t tangentialPm = (((tangentialP*m)>>14)*m)>>14;
+	//What the straight line misses: sideways uncertainty in our own estimate bends the range, and makes the
+	//bearing's mm depend on the range. Second order terms, taken as extra noise.
+	int32_t rSq = (int32_t)rMm*rMm + 1;
+	radialVar += ((tangentialP*tangentialP)/2)/rSq;
+	tangentialVar += (tangentialP*radialP)/rSq;
+	int32_t radialS = radialP + radialVar;
+	int32_t tangentialS = tangentialPm + tangentialVar;
+	//Normalized innovation squared, Q8.
+	int32_t nis = (radialInnov*radialInnov)/radialS + (tangentialInnov*tangentialInnov)/tangentialS;
+	uint8_t used = nis<=((int32_t)RNB_TRACK_GATE<<8);
+	if(used){
+		apply_update(t, ux, uy, radialInnov, radialVar);
+		apply_update(t, tx, ty, tangentialInnov, tangentialVar);
+	}else{
+		int32_t widen = ((radialInnov*radialInnov)>>8) + ((tangentialInnov*tangentialInnov)>>8);
+		if(widen>RNB_TRACK_MAX_VAR) widen = RNB_TRACK_MAX_VAR;
+		t->pxx += widen;
+		t->pyy += widen;
+		clamp_cov(t);
+	}
+
+	int32_t headingInnov = wrap_q6((int32_t)heading*64 - t->heading); //Q6 degrees
+	int32_t headingS = t->phh + scaled_var(heading_sd(rMm), confidence);
+	if((headingInnov*headingInnov)/headingS <= ((int32_t)RNB_TRACK_GATE<<12)){
+		int32_t k = ((int32_t)t->phh<<12)/headingS; //Q12
+		t->heading = wrap_q6(t->heading + ((k*headingInnov)>>12));
+		t->phh -= (uint16_t)((k*t->phh)>>12);
+		if(!t->phh) t->phh = 1;
+	}else{
+		int32_t phh = t->phh + ((headingInnov*headingInnov)>>12);
+		t->phh = phh>RNB_TRACK_MAX_HEADING_VAR ? RNB_TRACK_MAX_HEADING_VAR : (uint16_t)phh;
+	}
+	return used;
+}
+
+void rnb_track_polar(RnbTrack* t, RnbTrackPolar* out){
+	int32_t x = t->x, y = t->y;
+	int32_t r = isqrt32((uint32_t)(x*x + y*y)); //Q4
+	out->range		= (uint16_t)((r+8)>>4);
+	out->bearing	= atan2_deg(y, x)/64;
+	out->heading	= t->heading/64;
+	out->heading_sd	= isqrt32(t->phh);
+	if(r<16){
+		out->range_sd	= isqrt32((uint32_t)(t->pxx + t->pyy));
+		out->bearing_sd	= 180;
+		return;
+	}
+	int32_t ux = (x<<14)/r;
+	int32_t uy = (y<<14)/r;
+	int32_t radialVar = ((((t->pxx*ux + t->pxy*uy)>>14)*ux + ((t->pxy*ux + t->pyy*uy)>>14)*uy)>>14);
+	int32_t tangentialVar = ((((t->pxx*uy - t->pxy*ux)>>14)*uy - ((t->pxy*uy - t->pyy*ux)>>14)*ux)>>14);
+	out->range_sd = isqrt32(radialVar>0 ? radialVar : 0);
+	//Across the line of sight, sd/range radians. 3667 is 180/pi, Q6.
+	int32_t bearingSd = ((int32_t)isqrt32(tangentialVar>0 ? tangentialVar : 0)*3667)/(r>>4 ? r<<2 : 64);
+	out->bearing_sd = bearingSd>180 ? 180 : (uint16_t)bearingSd;
+}
+
+//sd^2, scaled up for a low confidence. Neither sd nor the result are allowed past RNB_TRACK_MAX_R_VAR.
+static int32_t scaled_var(int32_t sd, uint8_t confidence){
+	if(!confidence) confidence = 1;
+	if(sd>1024) return RNB_TRACK_MAX_R_VAR;
+	int32_t var = ((sd*sd)*255)/confidence;
+	return var>RNB_TRACK_MAX_R_VAR ? RNB_TRACK_MAX_R_VAR : var;
+}
+
+//e^(-var/2), Q14, with the variance in degrees^2.
+static int32_t cos_mean(int32_t bearingVar){
+	uint16_t sd = isqrt32(bearingVar);
+	if(sd>=180) return 0;
+	int32_t lo = (int16_t)pgm_read_word(&cosMeanTable[sd/5]);
+	int32_t hi = (int16_t)pgm_read_word(&cosMeanTable[sd/5+1]);
+	return lo + ((hi-lo)*(sd%5))/5;
+}
+
+/*
+ * How far off, in mm^2, a point 'range' mm away is along and across the line to it, when its range and
+ * bearing (degrees^2) have these variances. Not just range*bearing_sd across: a bearing error of a radian or
+ * more, which a low confidence result can have, swings the point round toward us as much as sideways.
+ */
+static void polar_var(int32_t range, int32_t rangeVar, int32_t bearingVar, int32_t* radial, int32_t* tangential){
+	int32_t m = cos_mean(bearingVar);
+	int32_t m4 = (m*m)>>14;
+	m4 = (m4*m4)>>14;
+	int32_t sinSq = (Q14_ONE-m4)/2;					//Mean of sin(error)^2, Q14.
+	int32_t cosGap = Q14_ONE - 2*m + (Q14_ONE+m4)/2;	//Mean of (1-cos(error))^2, Q14.
+	*radial		= ((((range*cosGap)>>7)*range)>>7) + rangeVar;
+	*tangential	= ((((range*sinSq)>>7)*range)>>7) + ((rangeVar*sinSq)>>14);
+}
+
+//How far, in mm, 'bearing_sd' degrees moves something 'range' mm away.
+static int32_t tangential_sd(int32_t range, int16_t bearing_sd){
+	return (range*bearing_sd*DEG_TO_RAD_Q13)>>13;
+}
+
+//Covariance with variance 'radial' along (c,s) and 'tangential' across it.
+static void set_rotated_cov(RnbTrack* t, int16_t c, int16_t s, int32_t radial, int32_t tangential){
+	if(radial>RNB_TRACK_MAX_VAR) radial = RNB_TRACK_MAX_VAR;
+	if(tangential>RNB_TRACK_MAX_VAR) tangential = RNB_TRACK_MAX_VAR;
+	int32_t cc = ((int32_t)c*c)>>14;
+	int32_t ss = ((int32_t)s*s)>>14;
+	int32_t cs = ((int32_t)c*s)>>14;
+	t->pxx = (cc*radial + ss*tangential)>>14;
+	t->pyy = (ss*radial + cc*tangential)>>14;
+	t->pxy = (cs*(radial-tangential))>>14;
+	clamp_cov(t);
+}
+
+/*
+ * A scalar Kalman update, for a measurement of the position along the Q14 unit vector (hx,hy), 'innovation'
+ * (Q4 mm) from the prediction, with variance 'var' (mm^2).
+ */
+static void apply_update(RnbTrack* t, int16_t hx, int16_t hy, int32_t innovation, int32_t var){
+	int32_t phx = (t->pxx*hx + t->pxy*hy)>>14;
+	int32_t phy = (t->pxy*hx + t->pyy*hy)>>14;
+	int32_t sVar = ((phx*hx + phy*hy)>>14) + var;
+	if(sVar<=0) return;
+	int32_t kx = (phx<<12)/sVar; //Q12
+	int32_t ky = (phy<<12)/sVar;
+	t->x = clamp_q4(t->x + ((kx*innovation)>>12));
+	t->y = clamp_q4(t->y + ((ky*innovation)>>12));
+	t->pxx -= (kx*phx)>>12;
+	t->pxy -= (kx*phy)>>12;
+	t->pyy -= (ky*phy)>>12;
+	clamp_cov(t);
+}
+
+//Keeps the covariance positive definite and under RNB_TRACK_MAX_VAR, which rounding can take it out of.
+static void clamp_cov(RnbTrack* t){
+	if(t->pxx<1) t->pxx = 1;
+	if(t->pyy<1) t->pyy = 1;
+	if(t->pxx>RNB_TRACK_MAX_VAR) t->pxx = RNB_TRACK_MAX_VAR;
+	if(t->pyy>RNB_TRACK_MAX_VAR) t->pyy = RNB_TRACK_MAX_VAR;
+	int32_t maxXY = isqrt32((uint32_t)(t->pxx*t->pyy));
+	if(maxXY) maxXY--;
+	if(t->pxy>maxXY) t->pxy = maxXY;
+	if(t->pxy<-maxXY) t->pxy = -maxXY;
+}
+
+static int16_t clamp_q4(int32_t v){
+	if(v>INT16_MAX) return INT16_MAX;
+	if(v<-INT16_MAX) return -INT16_MAX;
+	return (int16_t)v;
+}
+
+static int16_t wrap_q6(int32_t a){
+	while(a>180*64) a -= 360*64;
+	while(a<=-180*64) a += 360*64;
+	return (int16_t)a;
+}
@@ -0,0 +1,80 @@
+#include <util/atomic.h>
+#include "sensor_snapshot.h"
+#include "median.h"
+
+typedef struct snapshot_filter_struct{
+	int16_t		readings[SNAPSHOT_KEEP];	//A ring; the oldest is overwritten.
+	uint8_t		pos;
+	uint8_t		count;		//Readings since the last reset, settling ones included, up to SETTLE+KEEP.
+} SnapshotFilter;
+
+static SnapshotFilter filters[SNAPSHOT_CHANNELS];
+static volatile int16_t snapVals[SNAPSHOT_CHANNELS];
+static volatile uint32_t snapTimes[SNAPSHOT_CHANNELS];	//0 until the channel's first snapshot.
+static uint8_t muxedDir;
+
+void snapshot_init(){
+	for(uint8_t ch=0;ch<SNAPSHOT_CHANNELS;ch++){
+		snapshot_reset(ch);
+		snapVals[ch] = 0;
+		snapTimes[ch] = 0;
+	}
+	muxedDir = 0;
+}
+
+//The next SNAPSHOT_SETTLE readings on this channel are thrown out. Its current snapshot is kept.
+void snapshot_reset(uint8_t ch){
+	filters[ch].pos = 0;
+	filters[ch].count = 0;
+}
+
+/*
+ * Adds a raw reading to this channel, taken at 'now'. Once the channel has settled and has SNAPSHOT_KEEP
+ * readings, every reading updates the snapshot to their median; returns '1' when it does.
+ */
+uint8_t snapshot_add(uint8_t ch, int16_t raw, uint32_t now){
+	SnapshotFilter* f = &(filters[ch]);
+	if(f->count<SNAPSHOT_SETTLE){
+		f->count++;
+		return 0;
+	}
+	f->readings[f->pos] = raw;
+	if(++(f->pos)==SNAPSHOT_KEEP) f->pos = 0;
+	if(f->count<(SNAPSHOT_SETTLE+SNAPSHOT_KEEP)) f->count++;
+	if(f->count<(SNAPSHOT_SETTLE+SNAPSHOT_KEEP)) return 0;
+	int16_t tmp[SNAPSHOT_KEEP];
+	for(uint8_t i=0;i<SNAPSHOT_KEEP;i++) tmp[i] = f->readings[i];
+	int16_t val = meas_find_median(tmp, SNAPSHOT_KEEP);
+	if(!now) now = 1; //0 means 'never'.
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		snapVals[ch] = val;
+		snapTimes[ch] = now;
+	}
+	return 1;
+}
+
+/*
+ * For one ADC channel shared by all six IR sensors: adds a reading from snapshot_muxed_dir(), and once that
+ * has a new snapshot moves on to the next dir. Returns the dir the next conversion should be on.
+ */
+uint8_t snapshot_add_muxed(int16_t raw, uint32_t now){
+	if(snapshot_add(muxedDir, raw, now)){
+		muxedDir = (muxedDir+1)%6;
+		snapshot_reset(muxedDir);
+	}
+	return muxedDir;
+}
+
+uint8_t snapshot_muxed_dir(){
+	return muxedDir;
+}
+
+//Puts this channel's latest snapshot in val, and returns when it was taken, or 0 if it hasn't been yet.
+uint32_t snapshot_get(uint8_t ch, int16_t* val){
+	uint32_t time;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		*val = snapVals[ch];
+		time = snapTimes[ch];
+	}
+	return time;
+}
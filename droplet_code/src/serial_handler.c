@@ -1,4 +1,5 @@
 #include "serial_handler.h"
+#include "mesh.h"
 
 static const char CMD_NOT_RECOGNIZED_STR[] PROGMEM = "\tCommand ( %s ) not recognized.\r\n";
 
@@ -51,7 +52,12 @@ void handle_serial_command(char* command, uint16_t command_length){
 		else if(strcmp_P(command_word,PSTR("msg_tst"))==0)				handle_msg_test(command_args);
 		else if(strcmp_P(command_word,PSTR("tgt"))==0)					handle_target(command_args);
 		else if(strcmp_P(command_word,PSTR("tasks"))==0)				print_task_queue();
+		else if(strcmp_P(command_word,PSTR("mesh"))==0)					print_mesh_routes();
+		else if(strcmp_P(command_word,PSTR("nbrs"))==0)					print_neighbors();
+		else if(strcmp_P(command_word,PSTR("msg_types"))==0)			print_msg_dispatch();
 		else if(strcmp_P(command_word,PSTR("reset"))==0)				handle_reset();
+		else if(strcmp_P(command_word,PSTR(IR_BAUD_PROBE_STR))==0)		handle_baud_probe(command_args);
+		else if(strcmp_P(command_word,PSTR(IR_BAUD_ACK_STR))==0)		handle_baud_ack(command_args);
 		else if(strcmp_P(command_word,PSTR("write_motor_settings"))==0)	write_motor_settings();
 		else if(strcmp_P(command_word,PSTR("print_motor_settings"))==0){
 																		print_motor_values();
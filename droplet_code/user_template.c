@@ -11,9 +11,9 @@ void init(){
  * The code in this function will be called repeatedly, as fast as it can execute.
  */
 void loop(){
-
-	if(rnb_updated){
-		rnb_updated = 0;
+	rnb r;
+	while(rnb_next(&r)){
+		
 	}
 }
 
@@ -0,0 +1,222 @@
+/*
+ * Counts AVR cycles, in simavr, for droplet_code/src/median.c against the exchange sort it replaced, and for
+ * each step of the fixed point RNB pipeline in droplet_code/src/rnb_math.c, both unmodified. The host checks
+ * (median_check.c, rnb_replay.c) only say which is faster on a PC, and nothing about soft float.
+ *
+ * Build and run, from this directory:
+ *   avr-gcc -mmcu=atmega1284p -Os -std=gnu99 -DF_CPU=16000000UL -I ../../../droplet_code/include avr_cycles.c ../../../droplet_code/src/median.c ../../../droplet_code/src/rnb_math.c -lm -o avr_cycles.elf
+ *   simavr -m atmega1284p -f 16000000 avr_cycles.elf
+ * (add -DRNB_JOINT_SOLVER to count rnb_estimate with the joint solver's refinement on.)
+ *
+ * simavr can't run an xmega, so this is an atmega1284p, built for size as AVR code usually is. It's the same
+ * AVR core; the xmega only saves a cycle on some stores and bit instructions, so the counts are close to a
+ * Droplet's, a little high, and the comparison between them holds. At 32MHz, a Droplet does 32 a microsecond.
+ * Timer1 counts every clock, and its overflows are counted too, so a call can take as long as it likes; the
+ * cost of reading it is taken off. Each case runs RUNS times and prints the least, mean and most cycles, over
+ * UART0, which simavr prints. The medians are of 12-bit readings like the ADCs give, from a fixed seed. The
+ * RNB steps cycle through the matrices in recorded[], real ones from rnbCalibData_21112016_141153.txt at
+ * ranges from 51 to 272mm. At the end it sleeps with interrupts off, which stops simavr.
+ */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "median.h"
+#include "rnb_math.h"
+
+#define RUNS		200
+#define MAX_LEN		11
+
+static volatile uint16_t overflows;
+
+ISR(TIMER1_OVF_vect){
+	overflows++;
+}
+
+static uint32_t cycles_now(){
+	uint32_t now;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		uint16_t lo = TCNT1;
+		uint16_t hi = overflows;
+		if((TIFR1&_BV(TOV1)) && lo<0x8000) hi++; //Wrapped after we turned interrupts off.
+		now = ((uint32_t)hi<<16)|lo;
+	}
+	return now;
+}
+
+static int uart_putchar(char c, FILE* stream){
+	(void)stream;
+	if(c=='\n') uart_putchar('\r', stream);
+	loop_until_bit_is_set(UCSR0A, UDRE0);
+	UDR0 = c;
+	return 0;
+}
+
+static FILE uart_out = FDEV_SETUP_STREAM(uart_putchar, NULL, _FDEV_SETUP_WRITE);
+
+//The old meas_find_median, from rgb_sensor.c.
+static int16_t reference_median(int16_t* meas, uint8_t arr_len){
+	if(arr_len==1) return meas[0];
+	else if(arr_len==2) return (meas[0]+meas[1])/2;
+
+	for(uint8_t i=0; i<arr_len ; i++){
+		for(uint8_t j=i+1 ; j<arr_len ; j++){
+			if(meas[j] < meas[i]){
+				int16_t temp = meas[i];
+				meas[i] = meas[j];
+				meas[j] = temp;
+			}
+		}
+	}
+	if(arr_len%2==0) return (meas[arr_len/2-1]+meas[arr_len/2])/2;
+	else return meas[arr_len/2];
+}
+
+static uint32_t lcg = 1;
+
+static int16_t random_reading(){
+	lcg = lcg*1664525UL+1013904223UL;
+	return (int16_t)((lcg>>16)&0xFFF) - 2048;
+}
+
+//Brightness matrices, [emitter][sensor], at 51, 80, 102, 126, 157, 190, 233 and 272mm.
+static const int16_t recorded[8][6][6] = {
+	{{30,2,9,24,5,12},{38,-6,2,-28,-11,-37},{27,-17,44,10,-28,-33},{778,-13,-30,-10,-31,19},{74,1,20,22,13,2296},{10,23,7,36,222,177}},
+	{{1218,24,17,-2,-7,106},{250,2,17,11,1,66},{49,-17,-11,-6,-5,-63},{42,-4,15,18,5,-61},{65,6,17,3,1,-74},{81,-7,42,10,-18,-60}},
+	{{3,39,-21,494,160,29},{-1,9,26,87,12,-1},{-13,-2,-55,55,14,20},{-10,24,-22,50,29,11},{2,22,-16,35,20,-2},{9,-5,-12,71,222,37}},
+	{{-27,5,6,17,-64,195},{-28,-7,-3,6,-47,180},{-44,24,27,-13,-67,196},{-33,-6,25,18,-61,182},{-21,3,10,37,-73,197},{-20,7,-9,10,-58,177}},
+	{{19,18,48,-10,-3,-26},{5,9,16,27,10,-20},{35,14,243,111,23,-9},{21,-28,206,35,30,-11},{44,11,28,5,14,-7},{12,-16,79,-2,6,-28}},
+	{{6,-41,8,5,83,-35},{10,-10,1,26,40,-37},{22,-26,22,-4,2,-44},{11,-12,13,29,1,-62},{-6,2,-14,-10,8,-60},{6,-3,10,-2,10,-53}},
+	{{61,30,23,17,-6,-132},{51,10,1,20,-45,-98},{43,-48,29,26,-51,-132},{24,-20,-2,-18,-53,-123},{39,0,-19,-7,-43,-116},{40,2,-12,11,-5,-127}},
+	{{-54,-7,24,19,-27,-40},{-5,29,18,-12,-24,-27},{14,34,13,-32,-19,-48},{-15,-12,-6,6,-11,-37},{-14,21,11,18,-24,-44},{-27,22,15,15,-31,-38}}
+};
+
+static uint32_t overhead;
+static volatile int16_t sink;
+
+typedef struct{
+	uint32_t least, most, total;
+} Cycles;
+
+static void count(Cycles* c, uint32_t start, uint32_t end){
+	uint32_t n = end-start-overhead;
+	if(n<c->least) c->least = n;
+	if(n>c->most) c->most = n;
+	c->total += n;
+}
+
+static void print_cycles(const char* what, Cycles* c){
+	printf("%-25s %7lu %7lu %7lu\n", what, c->least, c->total/RUNS, c->most);
+}
+
+static void time_median(int16_t (*f)(int16_t*, uint8_t), uint8_t n, const char* what){
+	int16_t in[MAX_LEN], a[MAX_LEN];
+	Cycles c = {UINT32_MAX, 0, 0};
+	lcg = 1;
+	for(uint16_t r=0;r<RUNS;r++){
+		for(uint8_t i=0;i<n;i++) in[i] = random_reading();
+		memcpy(a, in, n*sizeof(int16_t));
+		uint32_t start = cycles_now();
+		sink = f(a, n);
+		uint32_t end = cycles_now();
+		count(&c, start, end);
+	}
+	char label[24];
+	snprintf(label, sizeof(label), "%s %u", what, n);
+	print_cycles(label, &c);
+}
+
+/*
+ * Each step of use_rnb_data's path, on its own and then all together: rnb_sum_matrix, rnb_estimate at full
+ * power and at a quarter, rnb_confidence with a previous estimate to check against, and coarse_bearing of the
+ * column sums, which is what the sync message's strength stands in for.
+ */
+static void time_rnb(){
+	int16_t bm[6][6];
+	RnbMatrixSums sums;
+	RnbEstimate est, prev, dim;
+	Cycles sum = {UINT32_MAX, 0, 0}, full = sum, quarter = sum, conf = sum, coarse = sum, all = sum;
+	uint16_t valid = 0;
+	for(uint16_t r=0;r<RUNS;r++){
+		memcpy(bm, recorded[r&7], sizeof(bm));
+		int16_t strength[6];
+		for(uint8_t s=0;s<6;s++){
+			strength[s] = 0;
+			for(uint8_t e=0;e<6;e++) strength[s] += bm[e][s];
+		}
+		uint32_t start = cycles_now();
+		rnb_sum_matrix(bm, &sums);
+		uint32_t end = cycles_now();
+		count(&sum, start, end);
+
+		start = cycles_now();
+		uint8_t ok = rnb_estimate(bm, &sums, RNB_FULL_POWER, &est);
+		end = cycles_now();
+		count(&full, start, end);
+		valid += ok;
+
+		start = cycles_now();
+		sink = rnb_estimate(bm, &sums, RNB_FULL_POWER/4, &dim);
+		end = cycles_now();
+		count(&quarter, start, end);
+
+		prev = est;
+		start = cycles_now();
+		sink = rnb_confidence(&sums, &est, ok ? &prev : NULL, 1000);
+		end = cycles_now();
+		count(&conf, start, end);
+
+		start = cycles_now();
+		sink = coarse_bearing(strength);
+		end = cycles_now();
+		count(&coarse, start, end);
+
+		memcpy(bm, recorded[r&7], sizeof(bm));
+		start = cycles_now();
+		rnb_sum_matrix(bm, &sums);
+		if(rnb_estimate(bm, &sums, RNB_FULL_POWER, &est)) sink = rnb_confidence(&sums, &est, NULL, 0);
+		end = cycles_now();
+		count(&all, start, end);
+	}
+	print_cycles("rnb_sum_matrix", &sum);
+	print_cycles("rnb_estimate", &full);
+	print_cycles("rnb_estimate, 1/4 power", &quarter);
+	print_cycles("rnb_confidence", &conf);
+	print_cycles("coarse_bearing", &coarse);
+	print_cycles("sum, estimate, confidence", &all);
+	printf("%u of %u estimates valid.\n", valid, RUNS);
+}
+
+int main(){
+	UBRR0 = 0;
+	UCSR0B = _BV(TXEN0);
+	stdout = &uart_out;
+	TCCR1A = 0;
+	TCCR1B = _BV(CS10);
+	TIMSK1 = _BV(TOIE1);
+	sei();
+
+	uint32_t least = UINT32_MAX;
+	for(uint8_t i=0;i<16;i++){
+		uint32_t start = cycles_now();
+		uint32_t end = cycles_now();
+		if(end-start<least) least = end-start;
+	}
+	overhead = least;
+
+	printf("%-25s %7s %7s %7s\n", "cycles", "least", "mean", "most");
+	const uint8_t sizes[] = {3, 5, 7, 11};
+	for(uint8_t s=0;s<sizeof(sizes);s++){
+		time_median(reference_median, sizes[s], "exchange sort");
+		time_median(meas_find_median, sizes[s], "meas_find_median");
+	}
+	time_rnb();
+
+	cli();
+	sleep_enable();
+	sleep_cpu();
+	return 0;
+}
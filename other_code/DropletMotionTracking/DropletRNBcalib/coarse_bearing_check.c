@@ -0,0 +1,250 @@
+/*
+ * Checks coarse_bearing from droplet_code/src/rnb_math.c, unmodified, against the full RNB bearing and the
+ * camera's, over the brightness matrices in rnbCalibData_*.txt.
+ *
+ * Build, from this directory:
+ *   gcc -O2 -std=gnu99 -Wall -Wextra -I host -I ../../../droplet_code/include coarse_bearing_check.c ../../../droplet_code/src/rnb_math.c -lm -o coarse_bearing_check
+ *
+ * Usage:
+ *   ./coarse_bearing_check [-p peak] [-d max range] [-b max median difference] rnbCalibData_*.txt
+ *
+ * A message's strength[6] is the brightest each sensor saw while the header came in, from whichever of the
+ * sender's emitters it was sent on. The nearest thing in the logs is each sensor's column of the brightness
+ * matrix, summed over the emitters, so that's what coarse_bearing is given here. Its answer is compared with
+ * rnb_estimate's bearing for the same matrix, and both with the camera's. The differences are also given for
+ * just the records whose brightest sensor's sum is at least 'peak' (default 200), which is where coarse_bearing
+ * is meant to be trusted. Records are parsed as in rnb_replay.c: those where either ID shows up more than once
+ * in the poses are skipped, and so are those more than 'max range' mm apart (default 300).
+ * If -b is given and the median difference from rnb_estimate, over every file and every record, is more than
+ * that many degrees, it says so and exits with 1.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "rnb_math.h"
+
+typedef struct check_record_struct{
+	char	txID[5];
+	char	rxID[5];
+	int16_t	bm[6][6];
+	double	range;		//mm
+	double	bearing;	//degrees
+} CheckRecord;
+
+typedef struct check_stats_struct{
+	uint32_t	records;
+	uint32_t	coarse;		//coarse_bearing gave a bearing.
+	uint32_t	both;		//So did rnb_estimate.
+	uint32_t	bright;		//Of those, how many had a peak of at least 'peak'.
+	double*		vsRnb;		//|coarse - rnb|, for each of 'both'.
+	double*		vsRnbBright;
+	double*		coarseVsCam;
+	double*		rnbVsCam;
+} CheckStats;
+
+static double maxRange = 300.0;
+
+static double wrap_deg(double a){
+	a = fmod(a+180.0, 360.0);
+	if(a<0) a += 360.0;
+	return a-180.0;
+}
+
+static int cmp_double(const void* a, const void* b){
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x>y) - (x<y);
+}
+
+//q in [0,1]. Sorts v.
+static double percentile(double* v, uint32_t n, double q){
+	if(!n) return NAN;
+	qsort(v, n, sizeof(double), cmp_double);
+	uint32_t i = (uint32_t)(q*n);
+	return v[i<n ? i : n-1];
+}
+
+/*
+ * Reads the next record from *pos into rec. Returns 1 if rec is usable, 0 if the record was skipped, and
+ * -1 at the end of the file. See rnb_replay.c's parse_record.
+ */
+static int8_t parse_record(char** pos, CheckRecord* rec){
+	char* txID = rec->txID;
+	char* rxID = rec->rxID;
+	char* p = strstr(*pos, "{\"");
+	if(!p) return -1;
+	if(sscanf(p, "{\"%4[0-9A-F]\", \"%4[0-9A-F]\", {{", txID, rxID)!=2){
+		*pos = p+2;
+		return 0;
+	}
+	p = strstr(p, "{{")+1;
+	for(uint8_t e=0;e<6;e++){
+		int v[6];
+		if(sscanf(p, "{%d,%d,%d,%d,%d,%d}", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5])!=6){
+			*pos = p;
+			return 0;
+		}
+		for(uint8_t s=0;s<6;s++) rec->bm[e][s] = (int16_t)v[s];
+		p = strchr(p, '}')+1;
+		if(*p==',') p++;
+	}
+	char* end = strstr(p, "}},");
+	if(!end) end = strstr(p, "}}");
+	if(!end) return -1;
+	*pos = end+2;
+
+	uint8_t txCount = 0, rxCount = 0;
+	double tx[3] = {0}, rx[3] = {0};
+	for(char* q = strchr(p, '"'); q && q<end; q = strchr(q, '"')){
+		char id[5];
+		double pose[3];
+		if(sscanf(q, "\"%4[0-9A-F]\"->{%lf, %lf, %lf}", id, &pose[0], &pose[1], &pose[2])!=4) return 0;
+		if(!strcmp(id, txID)){
+			txCount++;
+			memcpy(tx, pose, sizeof(pose));
+		}
+		if(!strcmp(id, rxID)){
+			rxCount++;
+			memcpy(rx, pose, sizeof(pose));
+		}
+		q = strchr(q, '}');
+		if(!q) break;
+	}
+	if(txCount!=1 || rxCount!=1) return 0;
+	double dX = tx[0]-rx[0];
+	double dY = tx[1]-rx[1];
+	rec->range		= hypot(dX, dY);
+	rec->bearing	= wrap_deg(atan2(dY, dX)*180.0/M_PI - rx[2] + 180.0);
+	return rec->range<maxRange;
+}
+
+static char* read_file(const char* path){
+	FILE* f = fopen(path, "rb");
+	if(!f) return NULL;
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char* buf = malloc(len+1);
+	if(buf){
+		buf[fread(buf, 1, len, f)] = '\0';
+	}
+	fclose(f);
+	return buf;
+}
+
+static void check_record(CheckRecord* rec, int16_t peak, CheckStats* stats){
+	int16_t strength[6];
+	int16_t brightest = INT16_MIN;
+	for(uint8_t s=0;s<6;s++){
+		int32_t sum = 0;
+		for(uint8_t e=0;e<6;e++) sum += rec->bm[e][s];
+		strength[s] = sum>INT16_MAX ? INT16_MAX : (sum<INT16_MIN ? INT16_MIN : (int16_t)sum);
+		if(strength[s]>brightest) brightest = strength[s];
+	}
+	stats->records++;
+	int16_t coarse = coarse_bearing(strength);
+	if(coarse==IR_NO_BEARING) return;
+	stats->coarse++;
+	RnbMatrixSums sums;
+	RnbEstimate est;
+	rnb_sum_matrix(rec->bm, &sums);
+	if(!rnb_estimate(rec->bm, &sums, RNB_FULL_POWER, &est)) return;
+	double diff = fabs(wrap_deg(coarse-est.bearing));
+	stats->vsRnb[stats->both]		= diff;
+	stats->coarseVsCam[stats->both]	= fabs(wrap_deg(coarse-rec->bearing));
+	stats->rnbVsCam[stats->both]	= fabs(wrap_deg(est.bearing-rec->bearing));
+	stats->both++;
+	if(brightest>=peak) stats->vsRnbBright[stats->bright++] = diff;
+}
+
+static void print_stats(const char* name, CheckStats* stats, int16_t peak){
+	printf("%s\n", name);
+	printf("\t%u records, %u with a coarse bearing, %u of those with an RNB estimate too.\n",
+		stats->records, stats->coarse, stats->both);
+	printf("\tcoarse vs RNB (deg):           median %5.1f  p90 %5.1f\n",
+		percentile(stats->vsRnb, stats->both, 0.5), percentile(stats->vsRnb, stats->both, 0.9));
+	printf("\tcoarse vs RNB, bright (deg):   median %5.1f  p90 %5.1f  (%u with a peak of %d or more)\n",
+		percentile(stats->vsRnbBright, stats->bright, 0.5), percentile(stats->vsRnbBright, stats->bright, 0.9),
+		stats->bright, peak);
+	printf("\tcoarse vs camera (deg):        median %5.1f  p90 %5.1f\n",
+		percentile(stats->coarseVsCam, stats->both, 0.5), percentile(stats->coarseVsCam, stats->both, 0.9));
+	printf("\tRNB vs camera (deg):           median %5.1f  p90 %5.1f\n",
+		percentile(stats->rnbVsCam, stats->both, 0.5), percentile(stats->rnbVsCam, stats->both, 0.9));
+}
+
+static void alloc_stats(CheckStats* stats, size_t n){
+	stats->vsRnb		= realloc(stats->vsRnb, n*sizeof(double));
+	stats->vsRnbBright	= realloc(stats->vsRnbBright, n*sizeof(double));
+	stats->coarseVsCam	= realloc(stats->coarseVsCam, n*sizeof(double));
+	stats->rnbVsCam		= realloc(stats->rnbVsCam, n*sizeof(double));
+}
+
+static void append_stats(CheckStats* total, CheckStats* part){
+	memcpy(total->vsRnb+total->both, part->vsRnb, part->both*sizeof(double));
+	memcpy(total->vsRnbBright+total->bright, part->vsRnbBright, part->bright*sizeof(double));
+	memcpy(total->coarseVsCam+total->both, part->coarseVsCam, part->both*sizeof(double));
+	memcpy(total->rnbVsCam+total->both, part->rnbVsCam, part->both*sizeof(double));
+	total->records	+= part->records;
+	total->coarse	+= part->coarse;
+	total->both		+= part->both;
+	total->bright	+= part->bright;
+}
+
+int main(int argc, char** argv){
+	int16_t peak = 200;
+	double maxMedian = INFINITY;
+	int opt;
+	while((opt = getopt(argc, argv, "p:d:b:"))!=-1){
+		switch(opt){
+			case 'p': peak		= atoi(optarg); break;
+			case 'd': maxRange	= atof(optarg); break;
+			case 'b': maxMedian	= atof(optarg); break;
+			default:
+				fprintf(stderr, "Usage: %s [-p peak] [-d max range] [-b max median difference] rnbCalibData_*.txt\n", argv[0]);
+				return 2;
+		}
+	}
+	if(optind>=argc){
+		fprintf(stderr, "No logs given.\n");
+		return 2;
+	}
+	CheckStats total = {0};
+	size_t totalRoom = 0;
+	for(int i=optind;i<argc;i++){
+		char* buf = read_file(argv[i]);
+		if(!buf){
+			fprintf(stderr, "Couldn't read %s.\n", argv[i]);
+			return 2;
+		}
+		//Records are one to a line.
+		size_t maxRecords = 1;
+		for(char* c = buf; *c; c++) maxRecords += (*c=='\n');
+		CheckStats file = {0};
+		alloc_stats(&file, maxRecords);
+		totalRoom += maxRecords;
+		alloc_stats(&total, totalRoom);
+		char* pos = buf;
+		CheckRecord rec;
+		int8_t got;
+		while((got = parse_record(&pos, &rec))>=0){
+			if(got) check_record(&rec, peak, &file);
+		}
+		print_stats(argv[i], &file, peak);
+		append_stats(&total, &file);
+		free(file.vsRnb);
+		free(file.vsRnbBright);
+		free(file.coarseVsCam);
+		free(file.rnbVsCam);
+		free(buf);
+	}
+	double median = percentile(total.vsRnb, total.both, 0.5);
+	print_stats("Total", &total, peak);
+	if(isfinite(maxMedian) && !(median<=maxMedian)){
+		printf("FAIL: median difference from the RNB bearing is %.1f degrees, over %.1f.\n", median, maxMedian);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * Checks dirs_toward, rnb_facing_pairs and pretty_angle_deg from droplet_code/src/rnb_math.c, unmodified,
+ * against a brute force reference, for every int16_t bearing.
+ *
+ * Build, from this directory:
+ *   gcc -O2 -std=gnu99 -Wall -Wextra -I host -I ../../../droplet_code/include dirs_toward_check.c ../../../droplet_code/src/rnb_math.c -lm -o dirs_toward_check
+ *
+ * Usage:
+ *   ./dirs_toward_check [-n pairs] [-r seed]
+ *
+ * The reference takes every whole degree in the cone and asks which emitter's 60 degrees it falls in, working
+ * in 32 bits. dirs_toward is checked for every bearing from INT16_MIN to INT16_MAX, not just -180 to 179: at
+ * every spread from 0 to 360 within 1000 of either end or of 0, and at those within a degree of a multiple of
+ * 60 (where a spread reaches another emitter) everywhere else. Then rnb_facing_pairs for 'pairs' (default 1000000) random bearings and
+ * headings, a quarter of them near the ends of the int16_t range.
+ * An int is 32 bits here and 16 on a Droplet, so sums of two int16_ts that would overflow there don't here;
+ * but passing one back as an int16_t wraps it just as the xmega would, so a bearing minus a basis angle that
+ * overflows still shows up as a wrong answer.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "rnb_math.h"
+
+static const int16_t basis[6] = {-30, -90, -150, 150, 90, 30};
+
+static int32_t mod360(int32_t a){
+	return ((a%360)+360)%360;
+}
+
+//Which emitter's 60 degrees 'a' falls in; each owns [basis-30, basis+30).
+static uint8_t owner(int32_t a){
+	for(uint8_t dir=0;dir<6;dir++){
+		if(mod360(a-basis[dir]+30)<60) return dir;
+	}
+	return 255;
+}
+
+static uint8_t reference_dirs(int32_t bearing, uint16_t spread){
+	if(spread>=300) return 0x3F;
+	int32_t half = spread/2;
+	uint8_t dirs = 0;
+	for(int32_t a=bearing-half;a<=bearing+half;a++) dirs |= 1<<owner(a);
+	return dirs;
+}
+
+static uint32_t checked, failed;
+
+static void report(const char* what, int32_t a, int32_t b, int32_t c, int32_t got, int32_t want){
+	checked++;
+	if(got==want) return;
+	if(failed++<10) printf("%s(%d, %d, %d): got 0x%X, want 0x%X\n", what, a, b, c, got, want);
+}
+
+static int16_t random_angle(uint32_t i){
+	if(i%4) return (int16_t)(rand()%720) - 360;
+	int16_t a = (int16_t)(rand()%400);
+	return (rand()&1) ? INT16_MAX-a : INT16_MIN+a;
+}
+
+int main(int argc, char** argv){
+	uint32_t pairs = 1000000;
+	unsigned seed = 1;
+	int opt;
+	while((opt = getopt(argc, argv, "n:r:"))!=-1){
+		switch(opt){
+			case 'n': pairs	= atoi(optarg); break;
+			case 'r': seed	= atoi(optarg); break;
+			default:
+				fprintf(stderr, "Usage: %s [-n pairs] [-r seed]\n", argv[0]);
+				return 2;
+		}
+	}
+	srand(seed);
+
+	uint32_t before = failed;
+	for(int32_t a=INT16_MIN;a<=INT16_MAX;a++){
+		int32_t want = mod360(a+180)-180;
+		if(a<0 && want==-180) want = 180; //It's always sent the half-turn the other way from negative angles.
+		report("pretty_angle_deg", a, 0, 0, pretty_angle_deg((int16_t)a), want);
+	}
+	printf("pretty_angle_deg:  %s\n", failed==before ? "ok" : "MISMATCH");
+
+	before = failed;
+	uint32_t notOne = 0;
+	for(int32_t b=INT16_MIN;b<=INT16_MAX;b++){
+		//Every spread near the ends of the range and around 0, and the ones at the edges of the sectors elsewhere.
+		uint8_t all = (b<INT16_MIN+1000 || b>INT16_MAX-1000 || (b>-1000 && b<1000));
+		for(uint16_t spread=0;spread<=360;spread++){
+			if(!all && spread%60>1 && spread%60<59 && spread!=299) continue;
+			uint8_t got = dirs_toward((int16_t)b, spread);
+			report("dirs_toward", b, spread, 0, got, reference_dirs(b, spread));
+			if(spread==0 && __builtin_popcount(got)!=1) notOne++;
+		}
+	}
+	printf("dirs_toward:       %s, %u bearings with a spread of 0 got other than one direction\n",
+		failed==before ? "ok" : "MISMATCH", notOne);
+
+	before = failed;
+	for(uint32_t i=0;i<pairs;i++){
+		int16_t bearing = random_angle(i), heading = random_angle(i);
+		uint16_t spread = rand()%361;
+		if(bearing==IR_NO_BEARING) continue;
+		uint8_t emitters, sensors;
+		rnb_facing_pairs(bearing, heading, spread, &emitters, &sensors);
+		uint8_t wantEmitters = heading==RNB_NO_HEADING ? 0x3F : reference_dirs((int32_t)bearing+180-heading, spread);
+		report("rnb_facing_pairs sensors", bearing, heading, spread, sensors, reference_dirs(bearing, spread));
+		report("rnb_facing_pairs emitters", bearing, heading, spread, emitters, wantEmitters);
+	}
+	printf("rnb_facing_pairs:  %s\n", failed==before ? "ok" : "MISMATCH");
+	printf("%u cases checked, %u mismatches.\n", checked, failed);
+	return failed!=0 || notOne!=0;
+}
@@ -0,0 +1,285 @@
+/*
+ * Simulates a swarm of Droplets running firefly sync (droplet_code/src/firefly_sync.c) while every IR channel
+ * is kept busy with user messages, to check the sync error stays bounded however heavy that traffic gets.
+ *
+ * Build, from this directory:
+ *   gcc -O2 -std=gnu99 -Wall -Wextra ffsync_sim.c -lm -o ffsync_sim
+ *
+ * Usage:
+ *   ./ffsync_sim [-n droplets] [-s seconds] [-l load] [-p ppm] [-b bound] [-r seed]
+ *
+ * firefly_sync.c drives TCE0 and the LEDs, so it can't be built here; this follows it step for step instead,
+ * with its constants: each Droplet's counter wraps every FFSYNC_FULL_PERIOD_MS, it pings its neighbours a
+ * random 0 to FFSYNC_D ms later, stamped with how late that is, and FFSYNC_W ms after that it jumps forward by
+ * the running average (over FFSYNC_EPSILON) of what its counter read when each neighbour's wrapped. Each
+ * Droplet's clock is off by up to 'ppm' (default 500) parts per million.
+ * The 'droplets' (default 100) sit on a hexagonal grid, so each has up to six neighbours, one per direction.
+ * Each link between two neighbours carries user messages of 15 to 80ms, either way at random, and is busy
+ * 'load' (default: each of 0, 0.5, 0.8, 0.9, 0.95 and 0.99) of the time. sendPing's hp_ir_targeted_cmd takes
+ * every channel at once, cutting short whatever we were sending, but the ping is only heard on a link that
+ * was idle: if we were sending on it, the ping runs into the end of that message, and if the neighbour was,
+ * its receiver is off. Two swarms are compared:
+ *	none:	user messages go out whenever, as they did before ir_quiet.
+ *	quiet:	each Droplet's TCE0_CCC_vect and TCE0_OVF_vect call ir_quiet, so it starts no user message from
+ *			FFSYNC_QUIET_LEAD ms before its counter wraps to FFSYNC_QUIET_TAIL ms after its last ping could go
+ *			out. Those held up go out as soon as it's over, as a program retrying ir_send would.
+ * The error between two neighbours is how far apart their counters are, in ms; if they were never synced at
+ * all, the median would be a quarter period, about 1290ms. It prints how many pings got through, and the
+ * median, 99th percentile and largest neighbour error over the second half of each run of 'seconds' (default
+ * 1800). The tail is mostly places where the grid has settled with a phase slip between two neighbours, which
+ * this algorithm can take a long time to get out of even with no traffic.
+ * It fails if any 'quiet' run has a median worse than 'bound' ms (default 500), whatever the load.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+//As in firefly_sync.h.
+#define FFSYNC_FULL_PERIOD_MS		5153
+#define FFSYNC_MS_CONVERSION_FACTOR	7.8125
+#define FFSYNC_FULL_PERIOD			(uint16_t)(FFSYNC_FULL_PERIOD_MS*FFSYNC_MS_CONVERSION_FACTOR)
+#define FFSYNC_EPSILON				60.0
+#define FFSYNC_D					160
+#define FFSYNC_W					200
+#define FFSYNC_QUIET_LEAD			100
+#define FFSYNC_QUIET_TAIL			100
+#define FFSYNC_QUIET_CC				(FFSYNC_FULL_PERIOD-(uint16_t)(FFSYNC_QUIET_LEAD*FFSYNC_MS_CONVERSION_FACTOR))
+
+#define MAX_DROPLETS	400
+#define MAX_OBS			32		//myMalloc would run out well before this.
+#define MAX_EVENTS		4
+#define MIN_FRAME		15		//ms
+#define MAX_FRAME		80
+#define SAMPLE_MS		50
+
+typedef struct link_struct{
+	double		start, end;	//The message on this link; start>t means it's idle.
+	uint32_t	from;		//Which end is sending it.
+	uint32_t	ends[2];
+} Link;
+
+typedef struct droplet_struct{
+	double		count;		//TCE0.CNT.
+	double		rate;		//Counts per ms.
+	int32_t		neighbour[6];
+	Link*		link[6];
+	double		quietFrom, quietUntil;
+	uint16_t	obs[MAX_OBS];
+	uint8_t		numObs;
+	uint32_t	pingAt[MAX_EVENTS], pingOvf[MAX_EVENTS], processAt[MAX_EVENTS];
+	uint8_t		numPings, numProcesses;
+} Droplet;
+
+static Droplet drops[MAX_DROPLETS];
+static Link links[MAX_DROPLETS*3];
+static uint32_t numDrops;
+static double load, ppm = 500;
+static uint32_t pingsTried, pingsHeard;
+
+static double uniform(){
+	return rand()/(double)RAND_MAX;
+}
+
+/*
+ * Moves the link's traffic on until the message it's on (if any) hasn't finished by 't'. A message whose
+ * sender went quiet before it started waits for the end of that, as ir_send's caller would have to.
+ */
+static Link* traffic(Link* l, double t){
+	for(;;){
+		while(l->end<=t){
+			double gap = -log(1-uniform())*((MIN_FRAME+MAX_FRAME)/2.0)*(1-load)/load;
+			l->start	= l->end+gap;
+			l->end		= l->start+MIN_FRAME+uniform()*(MAX_FRAME-MIN_FRAME);
+			l->from		= l->ends[rand()&1];
+		}
+		Droplet* d = &(drops[l->from]);
+		if(l->start<d->quietFrom || l->start>=d->quietUntil) return l;
+		l->end		+= d->quietUntil-l->start;
+		l->start	= d->quietUntil;
+	}
+}
+
+static void build_grid(){
+	static const int8_t dq[6] = {1, 1, 0, -1, -1, 0}, dr[6] = {0, -1, -1, 0, 1, 1};
+	uint32_t cols = (uint32_t)ceil(sqrt(numDrops));
+	uint32_t numLinks = 0;
+	for(uint32_t i=0;i<numDrops;i++){
+		int32_t q = i%cols, r = i/cols;
+		for(uint8_t k=0;k<6;k++){
+			int32_t nq = q+dq[k], nr = r+dr[k];
+			int32_t j = nr*(int32_t)cols+nq;
+			drops[i].neighbour[k] = (nq>=0 && nq<(int32_t)cols && nr>=0 && j<(int32_t)numDrops) ? j : -1;
+		}
+	}
+	for(uint32_t i=0;i<numDrops;i++){
+		for(uint8_t k=0;k<3;k++){ //Each link once: the neighbour's end is on k+3.
+			int32_t j = drops[i].neighbour[k];
+			if(j<0) continue;
+			Link* l = &(links[numLinks++]);
+			l->ends[0] = i;
+			l->ends[1] = j;
+			drops[i].link[k] = drops[j].link[k+3] = l;
+		}
+	}
+}
+
+//The sync window: from FFSYNC_QUIET_LEAD ms before the counter wraps until the last ping could go out.
+static void go_quiet(Droplet* d, double t, double ms){
+	if(t>=d->quietUntil) d->quietFrom = t;
+	if(t+ms>d->quietUntil) d->quietUntil = t+ms;
+}
+
+//update_firefly_counter: what our counter read when the sender's wrapped, kept in order.
+static void hear_ping(Droplet* d, uint8_t delay){
+	uint16_t theDelay = (delay+2)*FFSYNC_MS_CONVERSION_FACTOR;
+	uint16_t count = (uint16_t)d->count+(uint16_t)(2*FFSYNC_MS_CONVERSION_FACTOR); //It's 2ms in the air.
+	uint16_t obs = (count<=theDelay) ? count+(FFSYNC_FULL_PERIOD-theDelay) : count-theDelay;
+	if(d->numObs>=MAX_OBS) return;
+	uint8_t i = d->numObs++;
+	while(i>0 && obs<d->obs[i-1]){
+		d->obs[i] = d->obs[i-1];
+		i--;
+	}
+	d->obs[i] = obs;
+}
+
+/*
+ * sendPing: hp_ir_targeted_cmd takes every channel, cutting short whatever we were sending. A neighbour
+ * hears it if the link between us was idle. If we were sending on it, the ping runs into the end of the
+ * message the neighbour was receiving, and both are lost; if the neighbour was, its receiver is off.
+ */
+static void send_ping(uint32_t from, uint32_t t, uint32_t ovf){
+	Droplet* d = &(drops[from]);
+	uint8_t delay = (uint8_t)(t-ovf);
+	if(d->numProcesses<MAX_EVENTS) d->processAt[d->numProcesses++] = t+FFSYNC_W;
+	for(uint8_t k=0;k<6;k++){
+		if(d->neighbour[k]<0) continue;
+		Link* l = traffic(d->link[k], t);
+		pingsTried++;
+		if(l->start<=t){
+			if(l->from==from) l->end = t; //Cut short.
+			continue;
+		}
+		pingsHeard++;
+		hear_ping(&(drops[d->neighbour[k]]), delay);
+	}
+}
+
+//processObsQueue.
+static void process_obs(Droplet* d){
+	double newStart = 0;
+	for(uint8_t i=0;i<d->numObs;i++) newStart += (d->obs[i]-newStart)/FFSYNC_EPSILON;
+	d->numObs = 0;
+	uint16_t theCount = (uint16_t)d->count;
+	if((theCount+(uint16_t)newStart)>=FFSYNC_FULL_PERIOD)	d->count = FFSYNC_FULL_PERIOD-1;
+	else													d->count += (uint16_t)newStart;
+}
+
+//Returns the first of 'events' due by 't', or 0 if none are. 'tags' go along with them.
+static uint32_t take_event(uint32_t* events, uint32_t* tags, uint8_t* num, uint32_t t){
+	for(uint8_t i=0;i<*num;i++){
+		if(events[i]<=t){
+			uint32_t tag = tags ? tags[i] : 1;
+			(*num)--;
+			events[i] = events[*num];
+			if(tags) tags[i] = tags[*num];
+			return tag;
+		}
+	}
+	return 0;
+}
+
+static int cmp_double(const void* a, const void* b){
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x>y)-(x<y);
+}
+
+static double run(double seconds, uint8_t quiet){
+	memset(drops, 0, sizeof(drops));
+	memset(links, 0, sizeof(links));
+	build_grid();
+	for(uint32_t i=0;i<numDrops;i++){
+		drops[i].count = uniform()*FFSYNC_FULL_PERIOD;
+		drops[i].rate = FFSYNC_MS_CONVERSION_FACTOR*(1+(2*uniform()-1)*ppm*1e-6);
+	}
+	pingsTried = pingsHeard = 0;
+	uint32_t ms = (uint32_t)(seconds*1000);
+	size_t maxErrs = (size_t)(ms/2/SAMPLE_MS+1)*numDrops*3, numErrs = 0;
+	double* errs = malloc(maxErrs*sizeof(double));
+	for(uint32_t t=1;t<=ms;t++){
+		for(uint32_t i=0;i<numDrops;i++){
+			Droplet* d = &(drops[i]);
+			double before = d->count;
+			d->count += d->rate;
+			if(quiet && before<FFSYNC_QUIET_CC && d->count>=FFSYNC_QUIET_CC){ //TCE0_CCC_vect.
+				go_quiet(d, t, FFSYNC_QUIET_LEAD+FFSYNC_D+FFSYNC_QUIET_TAIL);
+			}
+			if(d->count>FFSYNC_FULL_PERIOD){ //TCE0_OVF_vect.
+				d->count -= FFSYNC_FULL_PERIOD+1;
+				if(quiet) go_quiet(d, t, FFSYNC_D+FFSYNC_QUIET_TAIL);
+				if(d->numPings<MAX_EVENTS){
+					d->pingOvf[d->numPings] = t;
+					d->pingAt[d->numPings++] = t+rand()%FFSYNC_D;
+				}
+			}
+			uint32_t ovf;
+			while((ovf = take_event(d->pingAt, d->pingOvf, &(d->numPings), t))) send_ping(i, t, ovf);
+			while(take_event(d->processAt, NULL, &(d->numProcesses), t)) process_obs(d);
+		}
+		if(t<ms/2 || t%SAMPLE_MS) continue;
+		for(uint32_t i=0;i<numDrops;i++){
+			for(uint8_t k=0;k<3;k++){ //Each link once.
+				int32_t j = drops[i].neighbour[k];
+				if(j<0 || numErrs>=maxErrs) continue;
+				double diff = fmod(drops[i].count-drops[j].count+1.5*(FFSYNC_FULL_PERIOD+1), FFSYNC_FULL_PERIOD+1);
+				errs[numErrs++] = fabs(diff-(FFSYNC_FULL_PERIOD+1)/2.0)/FFSYNC_MS_CONVERSION_FACTOR;
+			}
+		}
+	}
+	qsort(errs, numErrs, sizeof(double), cmp_double);
+	double median = numErrs ? errs[numErrs/2] : 0;
+	printf("%5.2f  %-6s %7.1f%% %9.1f %9.1f %9.1f\n", load, quiet ? "quiet" : "none",
+		pingsTried ? 100.0*pingsHeard/pingsTried : 0.0, median, numErrs ? errs[(size_t)(0.99*(numErrs-1))] : 0.0,
+		numErrs ? errs[numErrs-1] : 0.0);
+	free(errs);
+	return median;
+}
+
+int main(int argc, char** argv){
+	double seconds = 1800, bound = 500, onlyLoad = -1;
+	unsigned seed = 1;
+	numDrops = 100;
+	int opt;
+	while((opt = getopt(argc, argv, "n:s:l:p:b:r:"))!=-1){
+		switch(opt){
+			case 'n': numDrops	= atoi(optarg); break;
+			case 's': seconds	= atof(optarg); break;
+			case 'l': onlyLoad	= atof(optarg); break;
+			case 'p': ppm		= atof(optarg); break;
+			case 'b': bound		= atof(optarg); break;
+			case 'r': seed		= atoi(optarg); break;
+			default:
+				fprintf(stderr, "Usage: %s [-n droplets] [-s seconds] [-l load] [-p ppm] [-b bound] [-r seed]\n", argv[0]);
+				return 2;
+		}
+	}
+	if(numDrops<2 || numDrops>MAX_DROPLETS || onlyLoad>=1){
+		fprintf(stderr, "Need 2 to %u droplets, and a load under 1.\n", MAX_DROPLETS);
+		return 2;
+	}
+	srand(seed);
+	const double loads[] = {0, 0.5, 0.8, 0.9, 0.95, 0.99};
+	uint8_t numLoads = onlyLoad>=0 ? 1 : sizeof(loads)/sizeof(loads[0]);
+	printf("%u Droplets for %.0fs, clocks off by up to %.0fppm.\n", numDrops, seconds, ppm);
+	printf(" load  window  heard   median(ms)  p99(ms)   max(ms)\n");
+	uint8_t failed = 0;
+	for(uint8_t i=0;i<numLoads;i++){
+		load = onlyLoad>=0 ? onlyLoad : loads[i];
+		run(seconds, 0);
+		if(run(seconds, 1)>bound) failed = 1;
+	}
+	return failed;
+}
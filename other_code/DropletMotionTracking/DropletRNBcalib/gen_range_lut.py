@@ -0,0 +1,98 @@
+from __future__ import print_function
+import math
+import sys
+
+# Generates droplet_code/include/range_lut.h, the table range_algs.c uses in place of the calibrated
+# brightness-to-range curve. Rerun this after recalibrating:
+#   python gen_range_lut.py ../../../droplet_code/include/range_lut.h
+
+# Fit to the DropletRNBcalib data: range = A/(1+exp(-B*(C + a^-0.5))) - D, in mm.
+A = 778.0270114700
+B = 24.3675811184
+C = 0.0259969683
+D = 528.0270114700
+
+# The emitter's brightness at each IR power setting (set_all_ir_powers, 0 to 256), relative to full power,
+# which is what the curve above was fit at. The range curve at any other power is the same curve, with the
+# brightness scaled up by 1/gain first. These are for POWER_STEP apart, and are taken to be linear in the
+# setting until they've been measured: rerun DropletRNBcalib with the sender at each setting, and fit each
+# one's gain against the full power curve. Till then, ir_range_blast always broadcasts at full power.
+POWER_STEP = 32
+POWER_GAIN = [0.0, 0.125, 0.25, 0.375, 0.5, 0.625, 0.75, 0.875, 1.0]
+
+STEP_BITS = 4    # Each doubling of 'a' is split into 2^STEP_BITS linear segments.
+NUM_OCTAVES = 16 # 'a' from 1 to 2^16. Past that the curve is well under DROPLET_DIAMETER.
+RANGE_SCALE = 16 # Entries are Q4 mm.
+
+def magicRangeFunc(a):
+    return A/(1+math.exp(-B*(C + a**-0.5))) - D
+
+def build_lut():
+    steps = 1 << STEP_BITS
+    lut = []
+    for octave in range(NUM_OCTAVES):
+        for j in range(steps):
+            lut.append(int(round(RANGE_SCALE*magicRangeFunc((2**octave)*(1 + j/float(steps))))))
+    lut.append(int(round(RANGE_SCALE*magicRangeFunc(2**NUM_OCTAVES))))
+    return lut
+
+def lookup(lut, a):
+    steps = 1 << STEP_BITS
+    octave = int(math.floor(math.log(a, 2)))
+    pos = (a/(2**octave) - 1)*steps
+    j = int(pos)
+    i = octave*steps + j
+    return (lut[i] + (lut[i+1]-lut[i])*(pos-j))/RANGE_SCALE
+
+def max_error(lut):
+    worst = 0
+    a = 1.0
+    while a < 2**NUM_OCTAVES:
+        worst = max(worst, abs(lookup(lut, a) - magicRangeFunc(a)))
+        a *= 1.001
+    return worst
+
+def write_header(file, lut):
+    file.write('/** \\file *********************************************************************\n')
+    file.write(' * \\brief The calibrated brightness-to-range curve, as a table.\n')
+    file.write(' *\n')
+    file.write(' * GENERATED by other_code/DropletMotionTracking/DropletRNBcalib/gen_range_lut.py.\n')
+    file.write(' * Don\'t edit this by hand; change the coefficients there and rerun it.\n')
+    file.write(' *\n')
+    file.write(' * Entry (octave*RANGE_LUT_STEPS + j) is the range, in Q4 mm, for\n')
+    file.write(' * a = 2^octave * (1 + j/RANGE_LUT_STEPS). Linear interpolation between entries\n')
+    file.write(' * is within {0:.2f}mm of the curve.\n'.format(max_error(lut)))
+    file.write(' *\n')
+    file.write(' * powerGainLUT scales the brightness for senders which weren\'t at full IR\n')
+    file.write(' * power, the power the curve was fit at.\n')
+    file.write(' *****************************************************************************/\n')
+    file.write('#pragma once\n\n')
+    file.write('#include <avr/pgmspace.h>\n\n')
+    file.write('#define RANGE_LUT_STEP_BITS\t{0}\n'.format(STEP_BITS))
+    file.write('#define RANGE_LUT_STEPS\t\t(1<<RANGE_LUT_STEP_BITS)\n')
+    file.write('#define RANGE_LUT_OCTAVES\t{0}\n'.format(NUM_OCTAVES))
+    file.write('#define RANGE_LUT_LENGTH\t{0}\n\n'.format(len(lut)))
+    file.write('static const int16_t rangeLUT[RANGE_LUT_LENGTH] PROGMEM = {\n')
+    per_line = 1 << STEP_BITS
+    for start in range(0, len(lut), per_line):
+        row = ', '.join('{0:5d}'.format(v) for v in lut[start:start+per_line])
+        file.write('\t' + row + (',' if start+per_line < len(lut) else '') + '\n')
+    file.write('};\n\n')
+    file.write('//The emitter\'s brightness, Q8 of full power\'s, at every POWER_GAIN_STEP of the IR power setting.\n')
+    file.write('#define POWER_GAIN_STEP\t\t{0}\n'.format(POWER_STEP))
+    file.write('#define POWER_GAIN_LENGTH\t{0}\n\n'.format(len(POWER_GAIN)))
+    file.write('static const uint16_t powerGainLUT[POWER_GAIN_LENGTH] PROGMEM = {\n')
+    file.write('\t' + ', '.join('{0:d}'.format(int(round(256*g))) for g in POWER_GAIN) + '\n')
+    file.write('};\n')
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        print('Usage: python gen_range_lut.py <output header>')
+        sys.exit(1)
+    if len(POWER_GAIN) != 256//POWER_STEP + 1 or POWER_GAIN[-1] != 1.0:
+        print('POWER_GAIN needs an entry for every POWER_STEP from 0 to 256, ending with 1.0 at full power.')
+        sys.exit(1)
+    lut = build_lut()
+    with open(sys.argv[1], 'w') as file:
+        write_header(file, lut)
+    print('Wrote {0} entries, max interpolation error {1:.3f}mm.'.format(len(lut), max_error(lut)))
@@ -0,0 +1,411 @@
+/*
+ * Simulates a swarm of Droplets spreading a few items of shared state, with droplet_code/src/gossip.c's digests
+ * and with the flooding it replaces, and compares how fast each gets an update everywhere against the airtime
+ * it costs.
+ *
+ * Build, from this directory:
+ *   gcc -O2 -std=gnu99 -Wall -Wextra gossip_sim.c -lm -o gossip_sim
+ *
+ * Usage:
+ *   ./gossip_sim [-n droplets] [-s seconds] [-i items] [-u update period] [-q loss] [-o off] [-r seed]
+ *
+ * gossip.c sits on ir_send and the scheduler, so it can't be built here; this follows it step for step, with
+ * the same Bloom filter, push delays and suppression. The 'droplets' (default 100) sit on a hexagonal grid, so
+ * each has up to six neighbours, one per direction. There are 'items' (default 4) items of 16 bytes, each
+ * written by one Droplet, and every 'update period' seconds (default 30) one of them gets a new version.
+ * Frames take 3.125ms a byte, header included, as they do at 3200 baud. A frame is lost if the receiver is
+ * sending, or is already hearing another frame on that side (which is then lost too), and otherwise with
+ * chance 'loss' (default 0.2). A send fails if the Droplet is still sending its last one, as ir_send does.
+ * Droplets get switched off now and then, for 20s at a time, 'off' (default 0.05) of the time all told;
+ * meanwhile they hear nothing and send nothing, but keep what they had.
+ * The senders compared:
+ *	flood:	each Droplet rebroadcasts every new version it hears, once, 10 to 200ms later.
+ *	repeat:	each Droplet rebroadcasts everything it has every period, the way programs share state today,
+ *			as many items to a frame as fit in IR_BUFFER_SIZE.
+ *	gossip:	gossip.c, with a digest every period.
+ *	stale:	gossip.c as it was, pushing whatever isn't in the digest even if the digest has a newer version.
+ * Each row is one sender and period: the mean share of its time a Droplet spends sending, what share of the
+ * Droplets have each new version 2, 5, 10 and 30 seconds after it's written, and how many pushes carried an
+ * older version than the receiver already had. Sweeping the period traces out coverage against airtime.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+//As in ir_comm.h and gossip.h.
+#define HEADER_LEN				8
+#define IR_BUFFER_SIZE			40
+#define GOSSIP_BLOOM_BYTES		16
+#define GOSSIP_BLOOM_HASHES		3
+#define GOSSIP_MAX_PUSH_DELAY	200
+#define GOSSIP_NEWER_LOOKAHEAD	4
+#define GOSSIP_DIGEST_LEN		(2+GOSSIP_BLOOM_BYTES)
+#define GOSSIP_ITEM_HEADER_LEN	4
+
+#define ITEM_LEN		16
+#define MAX_ITEMS		8
+#define MAX_DROPLETS	400
+#define MS_PER_BYTE		3.125
+#define NUM_MARKS		4
+#define OFF_MS			20000	//How long a Droplet is off for, each time.
+#define ITEMS_PER_FRAME	(IR_BUFFER_SIZE/(GOSSIP_ITEM_HEADER_LEN+ITEM_LEN))
+
+enum{ FLOOD, REPEAT, GOSSIP, STALE };
+static const char* mode_names[] = {"flood", "repeat", "gossip", "stale"};
+enum{ EV_PUBLISH, EV_PERIOD, EV_REPEAT, EV_PUSH, EV_FLOOD, EV_RX_END, EV_MARK };
+
+typedef struct event_struct{
+	double		t;
+	uint8_t		type;
+	uint32_t	node, arg;
+} Event;
+
+typedef struct frame_struct{	//One frame, as one neighbour hears it.
+	uint32_t	to;
+	uint8_t		dir;		//Which of the receiver's sides it arrives on.
+	uint8_t		lost;
+	uint8_t		isDigest;
+	uint8_t		bloom[GOSSIP_BLOOM_BYTES];
+	uint8_t		numItems;
+	uint8_t		ids[MAX_ITEMS];
+	uint8_t		versions[MAX_ITEMS];
+} Frame;
+
+typedef struct droplet_struct{
+	int32_t		neighbour[6];
+	uint8_t		has[MAX_ITEMS];
+	uint8_t		version[MAX_ITEMS];
+	uint8_t		pushIdx, pushDir;
+	uint8_t		floodPending;
+	double		txEnd;
+	double		offStart, offEnd;
+	double		rxEnd[6];
+	int32_t		rxFrame[6];
+} Droplet;
+
+static Droplet drops[MAX_DROPLETS];
+static uint32_t numDrops, numItems = 4;
+static double loss = 0.2, offFraction = 0.05;
+
+static Event* heap;
+static size_t heapLen, heapCap;
+static Frame* frames;
+static size_t numFrames, framesCap;
+
+static uint8_t latest[MAX_ITEMS];
+static uint32_t writer[MAX_ITEMS];
+static double txTime;
+static uint32_t stalePushes, updates;
+static double coverage[NUM_MARKS];
+static const double marks[NUM_MARKS] = {2, 5, 10, 30};
+
+static double uniform(){
+	return rand()/(double)RAND_MAX;
+}
+
+static void push_event(double t, uint8_t type, uint32_t node, uint32_t arg){
+	if(heapLen==heapCap){
+		heapCap = heapCap ? 2*heapCap : 1024;
+		heap = realloc(heap, heapCap*sizeof(Event));
+	}
+	size_t i = heapLen++;
+	while(i>0 && heap[(i-1)/2].t>t){
+		heap[i] = heap[(i-1)/2];
+		i = (i-1)/2;
+	}
+	heap[i] = (Event){t, type, node, arg};
+}
+
+static Event pop_event(){
+	Event top = heap[0], last = heap[--heapLen];
+	size_t i = 0;
+	for(;;){
+		size_t c = 2*i+1;
+		if(c>=heapLen) break;
+		if(c+1<heapLen && heap[c+1].t<heap[c].t) c++;
+		if(heap[c].t>=last.t) break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	heap[i] = last;
+	return top;
+}
+
+static void build_grid(){
+	static const int8_t dq[6] = {1, 1, 0, -1, -1, 0}, dr[6] = {0, -1, -1, 0, 1, 1};
+	uint32_t cols = (uint32_t)ceil(sqrt(numDrops));
+	for(uint32_t i=0;i<numDrops;i++){
+		int32_t q = i%cols, r = i/cols;
+		for(uint8_t k=0;k<6;k++){
+			int32_t nq = q+dq[k], nr = r+dr[k];
+			int32_t j = nr*(int32_t)cols+nq;
+			drops[i].neighbour[k] = (nq>=0 && nq<(int32_t)cols && nr>=0 && j<(int32_t)numDrops) ? j : -1;
+		}
+	}
+}
+
+//As in avr-libc's util/crc16.h.
+static uint16_t crc16_update(uint16_t crc, uint8_t a){
+	crc ^= a;
+	for(uint8_t i=0;i<8;i++) crc = (crc&1) ? (crc>>1)^0xA001 : (crc>>1);
+	return crc;
+}
+
+//bloom_hash, bloom_add and bloom_check, from gossip.c.
+static uint16_t bloom_hash(uint16_t id, uint8_t version){
+	uint16_t hash = 0xFFFF;
+	hash = crc16_update(hash, (uint8_t)(id&0xFF));
+	hash = crc16_update(hash, (uint8_t)(id>>8));
+	hash = crc16_update(hash, version);
+	return hash;
+}
+
+static void bloom_add(uint8_t* bloom, uint16_t id, uint8_t version){
+	uint16_t hash = bloom_hash(id, version);
+	uint8_t a = hash&0x7F;
+	uint8_t b = ((hash>>7)&0x7F)|1;
+	for(uint8_t i=0;i<GOSSIP_BLOOM_HASHES;i++){
+		uint8_t bit = (a+i*b)&0x7F;
+		bloom[bit>>3] |= (1<<(bit&0x07));
+	}
+}
+
+static uint8_t bloom_check(uint8_t* bloom, uint16_t id, uint8_t version){
+	uint16_t hash = bloom_hash(id, version);
+	uint8_t a = hash&0x7F;
+	uint8_t b = ((hash>>7)&0x7F)|1;
+	for(uint8_t i=0;i<GOSSIP_BLOOM_HASHES;i++){
+		uint8_t bit = (a+i*b)&0x7F;
+		if(!(bloom[bit>>3]&(1<<(bit&0x07)))) return 0;
+	}
+	return 1;
+}
+
+static uint8_t bloom_has_newer(uint8_t* bloom, uint16_t id, uint8_t version){
+	for(uint8_t i=1;i<=GOSSIP_NEWER_LOOKAHEAD;i++){
+		if(bloom_check(bloom, id, version+i)) return 1;
+	}
+	return 0;
+}
+
+//Moves the Droplet's off times on until the one it's in or waiting for hasn't finished by 't'.
+static uint8_t is_off(Droplet* d, double t){
+	if(offFraction<=0) return 0;
+	while(d->offEnd<=t){
+		d->offStart = d->offEnd-log(1-uniform())*OFF_MS*(1-offFraction)/offFraction;
+		d->offEnd = d->offStart+OFF_MS;
+	}
+	return d->offStart<=t;
+}
+
+/*
+ * Starts a frame out of 'from' on 'dirs'. Each neighbour gets its own copy, which ends up lost if it
+ * overlaps anything else that neighbour hears on that side. Returns '0' if 'from' was still sending, or is off.
+ */
+static uint8_t send(uint32_t from, uint8_t dirs, double t, uint8_t len, Frame* proto){
+	Droplet* d = &(drops[from]);
+	if(d->txEnd>t || is_off(d, t)) return 0;
+	double end = t+(HEADER_LEN+len)*MS_PER_BYTE;
+	d->txEnd = end;
+	txTime += end-t;
+	for(uint8_t k=0;k<6;k++){
+		if(!(dirs&(1<<k)) || d->neighbour[k]<0) continue;
+		Droplet* n = &(drops[d->neighbour[k]]);
+		uint8_t side = (k+3)%6;
+		if(numFrames==framesCap){
+			framesCap = framesCap ? 2*framesCap : 1024;
+			frames = realloc(frames, framesCap*sizeof(Frame));
+		}
+		Frame* f = &(frames[numFrames]);
+		*f = *proto;
+		f->to = d->neighbour[k];
+		f->dir = side;
+		f->lost = (uniform()<loss) || n->txEnd>t;
+		if(n->rxEnd[side]>t){
+			f->lost = 1;
+			frames[n->rxFrame[side]].lost = 1;
+		}
+		if(end>n->rxEnd[side]){
+			n->rxEnd[side] = end;
+			n->rxFrame[side] = numFrames;
+		}
+		push_event(end, EV_RX_END, f->to, numFrames);
+		numFrames++;
+	}
+	return 1;
+}
+
+static uint8_t send_items(uint32_t from, uint8_t dirs, double t, uint8_t* which, uint8_t count){
+	Frame f;
+	memset(&f, 0, sizeof(f));
+	for(uint8_t i=0;i<count;i++){
+		f.ids[f.numItems] = which[i];
+		f.versions[f.numItems++] = drops[from].version[which[i]];
+	}
+	return send(from, dirs, t, count*(GOSSIP_ITEM_HEADER_LEN+ITEM_LEN), &f);
+}
+
+//A new version: flooding passes it on, and gossip cancels a push of the one we're replacing.
+static void take_item(uint32_t node, uint8_t id, uint8_t version, double t, uint8_t mode){
+	Droplet* d = &(drops[node]);
+	if(d->pushIdx==id && d->version[id]==version){ //Someone else answered the digest first.
+		d->pushIdx = 0xFF;
+	}
+	if(d->has[id] && ((int8_t)(version-d->version[id]))<=0) return;
+	d->has[id] = 1;
+	d->version[id] = version;
+	if(mode==FLOOD && !(d->floodPending&(1<<id))){
+		d->floodPending |= (1<<id);
+		push_event(t+10+rand()%GOSSIP_MAX_PUSH_DELAY, EV_FLOOD, node, id);
+	}
+}
+
+//handle_digest, from gossip.c.
+static void hear_digest(uint32_t node, Frame* f, double t, uint8_t mode){
+	Droplet* d = &(drops[node]);
+	if(d->pushIdx!=0xFF) return;
+	uint8_t missing[MAX_ITEMS], numMissing = 0;
+	for(uint8_t i=0;i<numItems;i++){
+		if(!d->has[i] || bloom_check(f->bloom, i, d->version[i])) continue;
+		if(mode==GOSSIP && bloom_has_newer(f->bloom, i, d->version[i])) continue;
+		missing[numMissing++] = i;
+	}
+	if(!numMissing) return;
+	d->pushIdx = missing[rand()%numMissing];
+	d->pushDir = f->dir;
+	push_event(t+10+rand()%GOSSIP_MAX_PUSH_DELAY, EV_PUSH, node, 0);
+}
+
+static void handle(Event* e, uint8_t mode, uint32_t period){
+	Droplet* d = &(drops[e->node]);
+	switch(e->type){
+		case EV_PUBLISH:{
+			uint8_t id = rand()%numItems;
+			latest[id]++;
+			take_item(writer[id], id, latest[id], e->t, mode);
+			for(uint8_t m=0;m<NUM_MARKS;m++) push_event(e->t+1000*marks[m], EV_MARK, id, (m<<8)|latest[id]);
+			break;
+		}
+		case EV_PERIOD:
+			push_event(e->t+period+e->arg, EV_PERIOD, e->node, e->arg);
+			if(mode==REPEAT){
+				push_event(e->t, EV_REPEAT, e->node, 0);
+			}else if(mode==GOSSIP || mode==STALE){
+				Frame f;
+				memset(&f, 0, sizeof(f));
+				f.isDigest = 1;
+				for(uint8_t i=0;i<numItems;i++) if(d->has[i]) bloom_add(f.bloom, i, d->version[i]);
+				send(e->node, 0x3F, e->t, GOSSIP_DIGEST_LEN, &f);
+			}
+			break;
+		case EV_REPEAT:{ //As many items as fit in a frame, then the rest once it's gone.
+			uint8_t which[MAX_ITEMS], count = 0, next = e->arg;
+			for(;next<numItems && count<ITEMS_PER_FRAME;next++) if(d->has[next]) which[count++] = next;
+			if(count && send_items(e->node, 0x3F, e->t, which, count) && next<numItems){
+				push_event(d->txEnd, EV_REPEAT, e->node, next);
+			}
+			break;
+		}
+		case EV_PUSH:{
+			if(d->pushIdx==0xFF) break;
+			uint8_t id = d->pushIdx;
+			d->pushIdx = 0xFF;
+			int32_t to = d->neighbour[d->pushDir];
+			if(to>=0 && drops[to].has[id] && ((int8_t)(d->version[id]-drops[to].version[id]))<0) stalePushes++;
+			send_items(e->node, 1<<d->pushDir, e->t, &id, 1);
+			break;
+		}
+		case EV_FLOOD:{
+			uint8_t id = (uint8_t)e->arg;
+			d->floodPending &= ~(1<<id);
+			send_items(e->node, 0x3F, e->t, &id, 1);
+			break;
+		}
+		case EV_RX_END:{
+			Frame* f = &(frames[e->arg]);
+			if(f->lost || is_off(d, e->t)) break;
+			if(f->isDigest) hear_digest(e->node, f, e->t, mode);
+			else for(uint8_t i=0;i<f->numItems;i++) take_item(e->node, f->ids[i], f->versions[i], e->t, mode);
+			break;
+		}
+		case EV_MARK:{
+			uint8_t id = (uint8_t)e->node, version = e->arg&0xFF, m = e->arg>>8;
+			uint32_t have = 0;
+			for(uint32_t i=0;i<numDrops;i++){
+				if(drops[i].has[id] && ((int8_t)(drops[i].version[id]-version))>=0) have++;
+			}
+			coverage[m] += (double)have/numDrops;
+			if(m==0) updates++;
+			break;
+		}
+	}
+}
+
+static void run(uint8_t mode, uint32_t period, double seconds, double updatePeriod){
+	memset(drops, 0, sizeof(drops));
+	build_grid();
+	heapLen = numFrames = 0;
+	txTime = 0;
+	stalePushes = updates = 0;
+	memset(coverage, 0, sizeof(coverage));
+	for(uint32_t i=0;i<numDrops;i++){
+		drops[i].pushIdx = 0xFF;
+		if(mode!=FLOOD) push_event(uniform()*period, EV_PERIOD, i, rand()%128); //gossip_init's jitter.
+	}
+	//Everyone starts with version 0 of everything, so only updates are measured.
+	for(uint8_t id=0;id<numItems;id++){
+		latest[id] = 0;
+		writer[id] = rand()%numDrops;
+		for(uint32_t i=0;i<numDrops;i++) drops[i].has[id] = 1;
+	}
+	double end = seconds*1000;
+	for(double t=updatePeriod*1000;t<end-1000*marks[NUM_MARKS-1];t+=updatePeriod*1000) push_event(t, EV_PUBLISH, 0, 0);
+	while(heapLen && heap[0].t<end){
+		Event e = pop_event();
+		handle(&e, mode, period);
+	}
+	printf("%-7s %6.1f %8.2f%%", mode_names[mode], mode==FLOOD ? 0.0 : period/1000.0, 100*txTime/(end*numDrops));
+	for(uint8_t m=0;m<NUM_MARKS;m++) printf(" %6.1f%%", updates ? 100*coverage[m]/updates : 0.0);
+	printf(" %7u\n", stalePushes);
+}
+
+int main(int argc, char** argv){
+	double seconds = 1800, updatePeriod = 30;
+	unsigned seed = 1;
+	numDrops = 100;
+	int opt;
+	while((opt = getopt(argc, argv, "n:s:i:u:q:o:r:"))!=-1){
+		switch(opt){
+			case 'n': numDrops		= atoi(optarg); break;
+			case 's': seconds		= atof(optarg); break;
+			case 'i': numItems		= atoi(optarg); break;
+			case 'u': updatePeriod	= atof(optarg); break;
+			case 'q': loss			= atof(optarg); break;
+			case 'o': offFraction	= atof(optarg); break;
+			case 'r': seed			= atoi(optarg); break;
+			default:
+				fprintf(stderr, "Usage: %s [-n droplets] [-s seconds] [-i items] [-u update period] [-q loss] [-o off] [-r seed]\n", argv[0]);
+				return 2;
+		}
+	}
+	if(numDrops<2 || numDrops>MAX_DROPLETS || numItems<1 || numItems>MAX_ITEMS || seconds<=updatePeriod+marks[NUM_MARKS-1]){
+		fprintf(stderr, "Need 2 to %u droplets, 1 to %u items, and a run longer than an update period plus %.0fs.\n",
+			MAX_DROPLETS, MAX_ITEMS, marks[NUM_MARKS-1]);
+		return 2;
+	}
+	srand(seed);
+	printf("%u Droplets, %u items, one updated every %.0fs, %.0f%% loss, %.0f%% off, for %.0fs.\n", numDrops,
+		numItems, updatePeriod, 100*loss, 100*offFraction, seconds);
+	printf("sender  period  airtime   after 2s     5s     10s     30s  stale pushes\n");
+	run(FLOOD, 0, seconds, updatePeriod);
+	const uint32_t periods[] = {2000, 4000, 8000};
+	for(uint8_t mode=REPEAT;mode<=STALE;mode++){
+		for(uint8_t p=0;p<sizeof(periods)/sizeof(periods[0]);p++) run(mode, periods[p], seconds, updatePeriod);
+	}
+	free(heap);
+	free(frames);
+	return 0;
+}
@@ -0,0 +1,6 @@
+/*
+ * Stand-in for avr-libc's io.h, so mesh.c builds on a PC for mesh_sim. mesh.c doesn't touch any registers.
+ */
+#pragma once
+
+#include <stdint.h>
@@ -0,0 +1,16 @@
+/*
+ * Stand-in for avr-libc's pgmspace.h, so rnb_math.c and mesh.c build on a PC for rnb_replay and mesh_sim.
+ * There's only one address space there, so program memory reads are plain reads.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s)				(s)
+#define pgm_read_byte(addr)	(*(const uint8_t*)(addr))
+#define pgm_read_word(addr)	(*(const uint16_t*)(addr))
+#define pgm_read_dword(addr)	(*(const uint32_t*)(addr))
+#define memcpy_P			memcpy
+#define printf_P			printf
@@ -0,0 +1,35 @@
+/*
+ * Stand-in for droplet_init.h, so mesh.c builds on a PC for mesh_sim: just the types and calls it uses.
+ * mesh_sim provides the calls, for whichever Droplet it's running at the time.
+ */
+#pragma once
+
+//glibc has an id_t of its own, so it's renamed while the system headers come in. Include this before them.
+#define id_t glibc_id_t
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/pgmspace.h>
+#undef id_t
+
+#define ALL_DIRS	((uint8_t)0x3F)
+
+typedef uint16_t id_t;
+
+typedef struct ir_msg_struct
+{
+	uint32_t arrival_time;
+	uint16_t sender_ID;
+	char* msg;
+	uint8_t dir_received;
+	uint8_t length;
+	uint8_t wasTargeted;
+	int16_t strength[6];
+	int16_t bearing;
+} ir_msg;
+
+uint8_t	get_droplet_ord(id_t id);
+id_t	get_droplet_id();
+id_t	get_id_from_ord(uint8_t ord);
+uint8_t	rand_byte();
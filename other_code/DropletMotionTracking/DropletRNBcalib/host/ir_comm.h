@@ -0,0 +1,10 @@
+/*
+ * Stand-in for ir_comm.h, so mesh.c builds on a PC for mesh_sim, which puts ir_send's frames on its grid.
+ */
+#pragma once
+
+#include "droplet_init.h"
+
+#define IR_BUFFER_SIZE			40u //bytes
+
+uint8_t ir_send(uint8_t dirs, char *data, uint8_t data_length);
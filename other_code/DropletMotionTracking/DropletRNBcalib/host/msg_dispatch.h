@@ -0,0 +1,12 @@
+/*
+ * Stand-in for msg_dispatch.h, so mesh.c builds on a PC for mesh_sim, which hands each frame that gets through
+ * to the handler registered for its type.
+ */
+#pragma once
+
+#include "droplet_init.h"
+
+typedef void (*MsgHandler)(ir_msg* msg_struct);
+
+uint8_t	register_msg_handler(char type, uint8_t min_length, uint8_t max_length, MsgHandler handler);
+void	unregister_msg_handler(char type);
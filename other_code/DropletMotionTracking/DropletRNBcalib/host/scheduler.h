@@ -0,0 +1,22 @@
+/*
+ * Stand-in for scheduler.h, so mesh.c builds on a PC for mesh_sim. mesh_sim runs the tasks as events, and
+ * only ever hands back a Task_t to say the task was scheduled.
+ */
+#pragma once
+
+#include "droplet_init.h"
+
+#define MIN_TASK_TIME_IN_FUTURE 20
+
+typedef struct task
+{
+	uint32_t scheduled_time;
+	uint32_t period;
+} Task_t;
+
+volatile Task_t* schedule_task(uint32_t time, void (*function)(), void* arg);
+volatile Task_t* schedule_periodic_task(uint32_t period, void (*function)(), void* arg);
+
+static inline void* myMalloc(size_t size){
+	return malloc(size);
+}
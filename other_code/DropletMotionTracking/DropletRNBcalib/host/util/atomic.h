@@ -0,0 +1,8 @@
+/*
+ * Stand-in for avr-libc's util/atomic.h, so sensor_snapshot.c builds on a PC for snapshot_check.
+ * There are no interrupts there, so an atomic block is just a block.
+ */
+#pragma once
+
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(type)	for(int atomicOnce=1;atomicOnce;atomicOnce=0)
@@ -0,0 +1,286 @@
+/*
+ * Simulates two Droplets running droplet_code/src/ir_baud.c's rate negotiation while one sends the other a
+ * stream of messages, and measures the throughput at each candidate rate as its bit error rate goes up.
+ *
+ * Build, from this directory:
+ *   gcc -O2 -std=gnu99 -Wall -Wextra ir_baud_sim.c -lm -o ir_baud_sim
+ *
+ * Usage:
+ *   ./ir_baud_sim [-n sessions] [-s seconds] [-l length] [-j lateness] [-r seed]
+ *
+ * ir_baud.c sits on the USARTs and the scheduler, so it can't be built here; this follows it step for step,
+ * with its constants. Droplet A sends B messages of 'length' bytes (default 32); B answers each with 4 bytes,
+ * 0 to 62.5ms later as perform_ir_upkeep gets to it, and A sends the next one once the answer is in, or 250ms
+ * after the last went out if it isn't. Before each message A calls ir_negotiate_baud, which probes for the
+ * next rate up, or re-opens the best one that worked. A frame takes 10 bits a byte, header included, at the sender's rate. It gets through if the
+ * receiver is at the same rate and none of its bits is flipped; a frame at the wrong rate counts as a receive
+ * error. Commands are handled 20ms after they arrive, the least the scheduler allows, and every scheduled task
+ * runs up to 'lateness' ms (default 20, one such tick) late.
+ * For each candidate rate, rates below it are taken to be clean, rates above it not to work at all, and its own
+ * bit error rate is swept. Each cell is the mean over 'sessions' (default 200) pairs of Droplets meeting for
+ * 'seconds' (default 30) each, starting with empty link tables: the payload delivered per second, the share of
+ * the time spent at the candidate rate, and the share of the probes that first tried it that failed. Once the
+ * candidate has failed the pair carries on at the rate below it, so past some error rate every column heads back
+ * towards what that rate gets on its own.
+ * Then, with no bit errors at all, it compares how often a probe for 4800 baud gets through with the handshake
+ * as it was (the switch 3*(HEADER_LEN+len)+5ms after the probe is sent and the ack as soon as the probe is
+ * handled, with 200ms to wait for it) and as it is now (the switch held off until the probe is out, and the ack
+ * held back IR_BAUD_ACK_DELAY_MS, with IR_BAUD_ACK_TIMEOUT_MS to wait), as the lateness goes up.
+ * It exits nonzero if the new handshake ever loses a probe with no bit errors.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+
+//As in ir_comm.h, ir_baud.h and scheduler.h.
+#define HEADER_LEN				8
+#define IR_NUM_BAUDS			5
+#define IR_DEFAULT_BAUD			0
+#define IR_BAUD_WINDOW_MS		2000
+#define IR_BAUD_ACK_DELAY_MS	40
+#define IR_BAUD_ACK_TIMEOUT_MS	250
+#define IR_BAUD_MAX_ERRS		2
+#define IR_BAUD_UPKEEP_MS		100
+#define IR_UPKEEP_MS			62.5
+#define MIN_TASK_TIME_IN_FUTURE	20
+
+#define PROBE_LEN		8		//"baud_p 1", and the same for the ack.
+#define ANSWER_LEN		4
+#define RETRY_MS		250
+#define OLD_TIMEOUT_MS	200
+
+enum{ OLD, NEW };
+
+static const double bauds[IR_NUM_BAUDS] = {3200, 4800, 6400, 8000, 9600};
+static const double errRates[] = {0, 1e-5, 1e-4, 3e-4, 1e-3, 3e-3, 1e-2};
+#define NUM_ERR_RATES	(sizeof(errRates)/sizeof(errRates[0]))
+
+typedef struct side_struct{
+	uint8_t	curr;			//curr_baud
+	uint8_t	windowOpen;		//window_peer is set
+	double	windowEnd;
+	uint8_t	errs;
+	uint8_t	best, fail;		//The link table's entry for the other Droplet.
+	double	nextUpkeep;
+	double	retryAt;		//probe_retry_at
+} Side;
+
+static double ber[IR_NUM_BAUDS];
+static double lateness = 20;
+
+static double uniform(){
+	return rand()/(double)RAND_MAX;
+}
+
+static double late(){
+	return uniform()*lateness;
+}
+
+static double frame_ms(uint8_t len, uint8_t baud){
+	return (HEADER_LEN+len)*10*1000/bauds[baud];
+}
+
+static uint8_t bits_ok(uint8_t len, uint8_t baud){
+	return uniform()<pow(1-ber[baud], 10*(HEADER_LEN+len));
+}
+
+static void open_window(Side* s, uint8_t baud, double t){
+	s->curr = baud;
+	s->windowOpen = 1;
+	s->windowEnd = t+IR_BAUD_WINDOW_MS;
+	s->errs = 0;
+}
+
+static void close_window(Side* s){
+	s->curr = IR_DEFAULT_BAUD;
+	s->windowOpen = 0;
+	s->errs = 0;
+}
+
+//ir_baud_upkeep, for every tick up to 't'.
+static void upkeep(Side* s, double t){
+	for(;s->nextUpkeep<=t;s->nextUpkeep+=IR_BAUD_UPKEEP_MS){
+		if(!s->windowOpen) continue;
+		if(s->errs>=IR_BAUD_MAX_ERRS){
+			if(s->curr!=IR_DEFAULT_BAUD){
+				s->fail = s->curr;
+				if(s->best>=s->fail) s->best = s->fail-1;
+			}
+			close_window(s);
+		}else if(s->nextUpkeep>s->windowEnd){
+			close_window(s);
+		}
+	}
+}
+
+//A frame from 'from' to 'to', ending at 't', and ir_baud_rx_ok or ir_baud_rx_error at the other end.
+static uint8_t deliver(Side* from, Side* to, uint8_t len, double t){
+	if(from->curr==to->curr && bits_ok(len, from->curr)){
+		if(to->windowOpen){
+			to->windowEnd = t+IR_BAUD_WINDOW_MS;
+			to->errs = 0;
+		}
+		return 1;
+	}
+	if(to->windowOpen) to->errs++;
+	return 0;
+}
+
+//The rate ir_negotiate_baud would probe for, or IR_DEFAULT_BAUD if it wouldn't.
+static uint8_t probe_for(Side* a, double t){
+	if(t<a->retryAt) return IR_DEFAULT_BAUD;
+	uint8_t next = a->best+1;
+	if(next>=a->fail || next>=IR_NUM_BAUDS) next = a->best;
+	if(a->windowOpen && a->curr==next) return IR_DEFAULT_BAUD;
+	return next;
+}
+
+/*
+ * ir_negotiate_baud on A, handle_baud_probe and handle_baud_ack, start_probe_window and probe_timeout. Returns
+ * the time it's all over, and whether the probe got through in 'ok'.
+ */
+static double negotiate(Side* a, Side* b, uint8_t next, double t, uint8_t version, uint8_t* ok){
+	double probeEnd = t+frame_ms(PROBE_LEN, a->curr);
+	double sw = t+3*(HEADER_LEN+PROBE_LEN)+5+late();
+	if(version==NEW){
+		while(sw<probeEnd) sw += MIN_TASK_TIME_IN_FUTURE+late();
+	}
+	double timeout = sw+(version==NEW ? IR_BAUD_ACK_TIMEOUT_MS : OLD_TIMEOUT_MS);
+	*ok = 0;
+	if(next<b->fail && deliver(a, b, PROBE_LEN, probeEnd)){
+		double handled = probeEnd+MIN_TASK_TIME_IN_FUTURE+late();
+		upkeep(b, handled);
+		open_window(b, next, handled);
+		b->windowEnd = handled+IR_BAUD_ACK_DELAY_MS+IR_BAUD_ACK_TIMEOUT_MS;
+		double ackStart = handled;
+		if(version==NEW) ackStart += IR_BAUD_ACK_DELAY_MS+late();
+		double ackEnd = ackStart+frame_ms(PROBE_LEN, next);
+		//Switching part way through the ack garbles it.
+		if(sw<=ackStart && ackEnd<=timeout && bits_ok(PROBE_LEN, next)){
+			a->best = next;
+			open_window(a, next, ackEnd);
+			*ok = 1;
+			return ackEnd;
+		}
+		if(sw<=ackStart && a->windowOpen) a->errs++;
+	}
+	a->fail = next;
+	if(a->best>=a->fail) a->best = a->fail-1;
+	close_window(a);
+	a->retryAt = timeout+IR_BAUD_ACK_DELAY_MS+IR_BAUD_ACK_TIMEOUT_MS;
+	upkeep(b, timeout);
+	return timeout;
+}
+
+typedef struct result_struct{
+	double	delivered, atCandidate;
+	uint32_t	probes, failed;
+} Result;
+
+// One pair of Droplets, meeting for 'seconds'.
+static void session(double seconds, uint8_t length, uint8_t candidate, uint8_t version, Result* res){
+	Side a = {IR_DEFAULT_BAUD, 0, 0, 0, IR_DEFAULT_BAUD, IR_NUM_BAUDS, uniform()*IR_BAUD_UPKEEP_MS, 0};
+	Side b = {IR_DEFAULT_BAUD, 0, 0, 0, IR_DEFAULT_BAUD, IR_NUM_BAUDS, uniform()*IR_BAUD_UPKEEP_MS, 0};
+	double t = 0, end = seconds*1000;
+	while(t<end){
+		upkeep(&a, t);
+		upkeep(&b, t);
+		uint8_t next = probe_for(&a, t);
+		if(next!=IR_DEFAULT_BAUD){
+			uint8_t ok, raise = next>a.best;
+			double done = negotiate(&a, &b, next, t, version, &ok);
+			if(next==candidate && raise){
+				res->probes++;
+				if(!ok) res->failed++;
+			}
+			t = done;
+			continue;
+		}
+		uint8_t baud = a.curr;
+		double sent = t+frame_ms(length, baud);
+		double retry = t+RETRY_MS;
+		upkeep(&b, sent);
+		if(deliver(&a, &b, length, sent)){
+			double answer = sent+uniform()*IR_UPKEEP_MS;
+			upkeep(&b, answer);
+			double answered = answer+frame_ms(ANSWER_LEN, b.curr);
+			upkeep(&a, answered);
+			if(deliver(&b, &a, ANSWER_LEN, answered)){
+				if(answered<end) res->delivered += length;
+				if(baud==candidate) res->atCandidate += answered-t;
+				t = answered;
+				continue;
+			}
+		}
+		if(baud==candidate) res->atCandidate += retry-t;
+		t = retry;
+	}
+}
+
+int main(int argc, char** argv){
+	uint32_t sessions = 200;
+	double seconds = 30;
+	uint8_t length = 32;
+	unsigned seed = 1;
+	int opt;
+	while((opt = getopt(argc, argv, "n:s:l:j:r:"))!=-1){
+		switch(opt){
+			case 'n': sessions	= atoi(optarg); break;
+			case 's': seconds	= atof(optarg); break;
+			case 'l': length	= atoi(optarg); break;
+			case 'j': lateness	= atof(optarg); break;
+			case 'r': seed		= atoi(optarg); break;
+			default:
+				fprintf(stderr, "Usage: %s [-n sessions] [-s seconds] [-l length] [-j lateness] [-r seed]\n", argv[0]);
+				return 2;
+		}
+	}
+	if(length<1 || length>32 || sessions<1){
+		fprintf(stderr, "Messages need 1 to 32 bytes, and there has to be a session.\n");
+		return 2;
+	}
+	srand(seed);
+	double userLateness = lateness;
+
+	printf("%u byte messages, %u sessions of %.0fs, tasks up to %.0fms late.\n", length, sessions, seconds, lateness);
+	printf("Payload delivered (bytes/s) / share of time at the rate / share of its probes that failed:\n");
+	printf("bit errors");
+	for(uint8_t c=1;c<IR_NUM_BAUDS;c++) printf(" %19.0f", bauds[c]);
+	printf("\n");
+	for(uint8_t e=0;e<NUM_ERR_RATES;e++){
+		printf("%10g", errRates[e]);
+		for(uint8_t c=1;c<IR_NUM_BAUDS;c++){
+			for(uint8_t r=0;r<IR_NUM_BAUDS;r++) ber[r] = r<c ? 0 : (r==c ? errRates[e] : 1);
+			Result res = {0, 0, 0, 0};
+			for(uint32_t i=0;i<sessions;i++) session(seconds, length, c, NEW, &res);
+			printf(" %6.0f %5.1f%% %5.1f%%", res.delivered/(sessions*seconds), 100*res.atCandidate/(sessions*seconds*1000),
+				res.probes ? 100.0*res.failed/res.probes : 0.0);
+		}
+		printf("\n");
+	}
+	for(uint8_t r=0;r<IR_NUM_BAUDS;r++) ber[r] = r==IR_DEFAULT_BAUD ? 0 : 1;
+	Result base = {0, 0, 0, 0};
+	for(uint32_t i=0;i<sessions;i++) session(seconds, length, 1, NEW, &base);
+	printf("At %.0f baud alone: %.0f bytes/s.\n\n", bauds[IR_DEFAULT_BAUD], base.delivered/(sessions*seconds));
+
+	printf("Probes for %.0f baud lost with no bit errors:\n", bauds[1]);
+	printf("lateness (ms)      old      new\n");
+	static const double latenesses[] = {0, 5, 10, 20, 40};
+	uint8_t ok = 1;
+	for(uint8_t r=0;r<IR_NUM_BAUDS;r++) ber[r] = r<=1 ? 0 : 1;
+	for(uint8_t j=0;j<sizeof(latenesses)/sizeof(latenesses[0]);j++){
+		lateness = latenesses[j];
+		printf("%13.0f", lateness);
+		for(uint8_t version=OLD;version<=NEW;version++){
+			Result res = {0, 0, 0, 0};
+			for(uint32_t i=0;i<sessions*10;i++) session(1, length, 1, version, &res);
+			printf(" %7.1f%%", res.probes ? 100.0*res.failed/res.probes : 0.0);
+			if(version==NEW && res.failed) ok = 0;
+		}
+		printf("\n");
+	}
+	lateness = userLateness;
+	return !ok;
+}
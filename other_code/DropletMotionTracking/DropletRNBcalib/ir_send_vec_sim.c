@@ -0,0 +1,163 @@
+/*
+ * Times a round of six different messages, one out of each direction, sent with ir_send_vec from
+ * droplet_code/src/ir_comm.c, against six ir_sends to 1<<dir, one after the other.
+ *
+ * Build, from this directory:
+ *   gcc -O2 -std=gnu99 -Wall -Wextra ir_send_vec_sim.c -lm -o ir_send_vec_sim
+ *
+ * Usage:
+ *   ./ir_send_vec_sim [-n rounds] [-l length] [-p poll] [-u setup] [-r seed]
+ *
+ * ir_comm.c sits on the USARTs, so it can't be built here; this follows its rules, with its constants. A frame
+ * takes 10 bits a byte, header included, at the sender's rate, and a direction can't be sent on again until its
+ * frame is out (ir_is_available). ir_send_vec needs all six free at once; an ir_send only needs its own. Each
+ * round's payloads are 1 to 'length' bytes (default 32), except in the "equal" rows, where they're all
+ * 'length'. The caller tries again every 'poll' ms (default 20, a scheduler tick) until its send goes out.
+ * Every call costs 'setup' us of CPU time (default 0: it hasn't been measured on a Droplet) before its frame
+ * starts, so six ir_sends start one after the other, and an ir_send_vec's six start together, after six
+ * setups' worth of CRCs and buffer loads.
+ * Three ways of sending a round are compared, over 'rounds' (default 10000) of them:
+ *   vec:		one ir_send_vec.
+ *   back to back:	six ir_sends in a row, each as soon as its own direction is free.
+ *   one at a time:	six ir_sends, each waiting for the last to finish, as a caller who only checks whether
+ *			the IR is busy at all has to.
+ * "latency" is how long a lone round takes, from the first call until every frame is out, starting with every
+ * direction free. "period" is the mean time per round when they're sent as fast as they'll go, so a direction
+ * whose frame was short can start its next while the others are still sending.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+
+//As in ir_comm.h and ir_baud.h.
+#define HEADER_LEN		8
+#define IR_NUM_BAUDS	5
+
+enum{ VEC, BACK_TO_BACK, ONE_AT_A_TIME, NUM_WAYS };
+
+static const double bauds[IR_NUM_BAUDS] = {3200, 4800, 6400, 8000, 9600};
+
+static double pollMs = 20;
+static double setupMs = 0;
+
+static double frame_ms(uint8_t len, double baud){
+	return (HEADER_LEN+len)*10*1000.0/baud;
+}
+
+//The first time the caller's task runs at or after t.
+static double next_poll(double t){
+	return ceil(t/pollMs - 1e-9)*pollMs;
+}
+
+/*
+ * Sends one round, with free[] the time each direction is next free, and now the time of the first call.
+ * Updates free[], sets *lastCall to when the last of the round's calls returned, and returns when the last
+ * frame is out.
+ */
+static double send_round(uint8_t way, double* free, double now, const uint8_t* len, double baud, double* lastCall){
+	double done = 0;
+	if(way==VEC){
+		double allFree = now;
+		for(uint8_t d=0;d<6;d++) if(free[d]>allFree) allFree = free[d];
+		double start = next_poll(allFree)+6*setupMs;
+		for(uint8_t d=0;d<6;d++){
+			free[d] = start+frame_ms(len[d], baud);
+			if(free[d]>done) done = free[d];
+		}
+		*lastCall = start;
+	}else if(way==BACK_TO_BACK){
+		//Each poll goes through the six in order; the ones still busy wait for the next.
+		uint8_t sent = 0;
+		double t = next_poll(now);
+		for(;;){
+			double cpu = t;
+			for(uint8_t d=0;d<6;d++){
+				if((sent&(1<<d)) || free[d]>cpu) continue;
+				cpu += setupMs;
+				free[d] = cpu+frame_ms(len[d], baud);
+				if(free[d]>done) done = free[d];
+				sent |= 1<<d;
+			}
+			*lastCall = cpu;
+			if(sent==0x3F) break;
+			double soonest = INFINITY;
+			for(uint8_t d=0;d<6;d++) if(!(sent&(1<<d)) && free[d]<soonest) soonest = free[d];
+			t = next_poll(fmax(t+pollMs, soonest));
+		}
+	}else{
+		double t = now;
+		for(uint8_t d=0;d<6;d++){
+			double busy = t;
+			for(uint8_t e=0;e<6;e++) if(free[e]>busy) busy = free[e];
+			double start = next_poll(busy)+setupMs;
+			free[d] = start+frame_ms(len[d], baud);
+			t = free[d];
+			*lastCall = start;
+		}
+		done = t;
+	}
+	return done;
+}
+
+static void random_lengths(uint8_t* len, uint8_t maxLen, uint8_t equal){
+	for(uint8_t d=0;d<6;d++) len[d] = equal ? maxLen : 1+rand()%maxLen;
+}
+
+int main(int argc, char** argv){
+	uint32_t rounds = 10000;
+	uint8_t maxLen = 32;
+	unsigned seed = 1;
+	int opt;
+	while((opt = getopt(argc, argv, "n:l:p:u:r:"))!=-1){
+		switch(opt){
+			case 'n': rounds	= atoi(optarg); break;
+			case 'l': maxLen	= atoi(optarg); break;
+			case 'p': pollMs	= atof(optarg); break;
+			case 'u': setupMs	= atof(optarg)/1000.0; break;
+			case 'r': seed		= atoi(optarg); break;
+			default:
+				fprintf(stderr, "Usage: %s [-n rounds] [-l length] [-p poll] [-u setup] [-r seed]\n", argv[0]);
+				return 2;
+		}
+	}
+	if(!rounds || !maxLen || maxLen>40 || pollMs<=0 || setupMs<0){ //IR_BUFFER_SIZE
+		fprintf(stderr, "Need rounds>0, 1<=length<=40, poll>0 and setup>=0.\n");
+		return 2;
+	}
+	printf("Payloads of 1 to %u bytes (equal: all %u), polling every %.1fms, %.0fus setup per call.\n",
+		maxLen, maxLen, pollMs, setupMs*1000.0);
+	printf("  baud  payloads |            latency (ms)             |             period (ms)\n");
+	printf("                 |     vec  back to back  one at a time |     vec  back to back  one at a time\n");
+	for(uint8_t b=0;b<IR_NUM_BAUDS;b++){
+		for(uint8_t equal=0;equal<2;equal++){
+			double latency[NUM_WAYS] = {0}, period[NUM_WAYS] = {0};
+			for(uint8_t way=0;way<NUM_WAYS;way++){
+				srand(seed);
+				uint8_t len[6];
+				double free[6];
+				double lastCall;
+				for(uint32_t r=0;r<rounds;r++){
+					for(uint8_t d=0;d<6;d++) free[d] = 0;
+					random_lengths(len, maxLen, equal);
+					latency[way] += send_round(way, free, 0, len, bauds[b], &lastCall);
+				}
+				latency[way] /= rounds;
+				srand(seed);
+				for(uint8_t d=0;d<6;d++) free[d] = 0;
+				double now = 0, done = 0;
+				for(uint32_t r=0;r<rounds;r++){
+					random_lengths(len, maxLen, equal);
+					done = send_round(way, free, now, len, bauds[b], &lastCall);
+					now = lastCall; //The next round's first call is as soon as this one's are all made.
+				}
+				period[way] = done/rounds;
+			}
+			printf("%6.0f  %8s | %7.1f %13.1f %14.1f | %7.1f %13.1f %14.1f\n", bauds[b], equal ? "equal" : "random",
+				latency[VEC], latency[BACK_TO_BACK], latency[ONE_AT_A_TIME],
+				period[VEC], period[BACK_TO_BACK], period[ONE_AT_A_TIME]);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * Checks droplet_code/src/median.c, unmodified, against the exchange sort it replaced, and times both.
+ *
+ * Build, from this directory:
+ *   gcc -O2 -std=gnu99 -I ../../../droplet_code/include median_check.c ../../../droplet_code/src/median.c -o median_check
+ *
+ * Usage:
+ *   ./median_check [-n trials] [-r seed]
+ *
+ * For each size from 1 to 13, it tries every permutation of distinct values (up to 8), every input of 0s and
+ * 1s (which, for a sorting network, covers every input), and 'trials' (default 1000000) random ones drawn from
+ * the 12-bit signed range the ADCs give, from the whole int16_t range, from a handful of values so there are
+ * lots of ties, or from the extremes, where a compare-exchange that subtracts would overflow. Then it times each
+ * size the Droplets use. The times are for this PC, not an xmega; they only say which is faster.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "median.h"
+
+#define MAX_LEN		13
+#define TIME_REPS	2000000
+
+//The old meas_find_median, from rgb_sensor.c.
+static int16_t reference_median(int16_t* meas, uint8_t arr_len){
+	if(arr_len==1) return meas[0];
+	else if(arr_len==2) return (meas[0]+meas[1])/2;
+
+	for(uint8_t i=0; i<arr_len ; i++){
+		for(uint8_t j=i+1 ; j<arr_len ; j++){
+			if(meas[j] < meas[i]){
+				int16_t temp = meas[i];
+				meas[i] = meas[j];
+				meas[j] = temp;
+			}
+		}
+	}
+	if(arr_len%2==0) return (meas[arr_len/2-1]+meas[arr_len/2])/2;
+	else return meas[arr_len/2];
+}
+
+static uint32_t checked, failed;
+
+static void check(const int16_t* in, uint8_t n){
+	int16_t a[MAX_LEN], b[MAX_LEN];
+	memcpy(a, in, n*sizeof(int16_t));
+	memcpy(b, in, n*sizeof(int16_t));
+	int16_t want = reference_median(a, n);
+	int16_t got = meas_find_median(b, n);
+	checked++;
+	if(got!=want){
+		if(failed++<10){
+			printf("n=%u: got %d, want %d for", n, got, want);
+			for(uint8_t i=0;i<n;i++) printf(" %d", in[i]);
+			printf("\n");
+		}
+	}
+}
+
+static void permutations(int16_t* a, uint8_t k, uint8_t n){
+	if(k==n){
+		check(a, n);
+		return;
+	}
+	for(uint8_t i=k;i<n;i++){
+		int16_t t = a[k]; a[k] = a[i]; a[i] = t;
+		permutations(a, k+1, n);
+		t = a[k]; a[k] = a[i]; a[i] = t;
+	}
+}
+
+static const int16_t extremes[5] = {INT16_MIN, INT16_MIN+1, 0, INT16_MAX-1, INT16_MAX};
+
+//kind 0 is a 12-bit reading, 1 anything an int16_t can hold, 2 one of a few small values and 3 an extreme.
+static int16_t random_reading(uint8_t kind){
+	switch(kind){
+		case 0:		return (int16_t)(rand()%4096) - 2048;
+		case 1:		return (int16_t)(rand()&0xFFFF);
+		case 2:		return (int16_t)(rand()%5) - 2;
+		default:	return extremes[rand()%5];
+	}
+}
+
+static double time_median(int16_t (*f)(int16_t*, uint8_t), int16_t (*inputs)[MAX_LEN], uint8_t n, volatile int32_t* sink){
+	int16_t a[MAX_LEN];
+	int32_t sum = 0;
+	clock_t start = clock();
+	for(uint32_t r=0;r<TIME_REPS;r++){
+		memcpy(a, inputs[r&1023], n*sizeof(int16_t));
+		sum += f(a, n);
+	}
+	clock_t end = clock();
+	*sink = sum;
+	return 1e9*(end-start)/CLOCKS_PER_SEC/TIME_REPS;
+}
+
+int main(int argc, char** argv){
+	uint32_t trials = 1000000;
+	unsigned seed = 1;
+	int opt;
+	while((opt = getopt(argc, argv, "n:r:"))!=-1){
+		switch(opt){
+			case 'n': trials	= atoi(optarg); break;
+			case 'r': seed		= atoi(optarg); break;
+			default:
+				fprintf(stderr, "Usage: %s [-n trials] [-r seed]\n", argv[0]);
+				return 2;
+		}
+	}
+	srand(seed);
+	int16_t a[MAX_LEN];
+	for(uint8_t n=1;n<=MAX_LEN;n++){
+		uint32_t before = failed;
+		if(n<=8){
+			for(uint8_t i=0;i<n;i++) a[i] = 100*i - 350;
+			permutations(a, 0, n);
+		}
+		for(uint32_t bits=0;bits<(1UL<<n);bits++){
+			for(uint8_t i=0;i<n;i++) a[i] = (bits>>i)&1;
+			check(a, n);
+		}
+		for(uint32_t t=0;t<trials;t++){
+			for(uint8_t i=0;i<n;i++) a[i] = random_reading(t&3);
+			check(a, n);
+		}
+		printf("n=%2u: %s\n", n, failed==before ? "ok" : "MISMATCH");
+	}
+	printf("%u inputs checked, %u mismatches.\n", checked, failed);
+
+	static int16_t inputs[1024][MAX_LEN];
+	for(uint16_t r=0;r<1024;r++){
+		for(uint8_t i=0;i<MAX_LEN;i++) inputs[r][i] = random_reading(0);
+	}
+	volatile int32_t sink;
+	const uint8_t sizes[] = {3, 5, 7, 11};
+	printf("   n   old (ns)   new (ns)\n");
+	for(uint8_t s=0;s<sizeof(sizes);s++){
+		double tOld = time_median(reference_median, inputs, sizes[s], &sink);
+		double tNew = time_median(meas_find_median, inputs, sizes[s], &sink);
+		printf("%4u %10.1f %10.1f\n", sizes[s], tOld, tNew);
+	}
+	return failed!=0;
+}
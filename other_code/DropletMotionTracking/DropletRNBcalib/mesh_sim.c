@@ -0,0 +1,493 @@
+/*
+ * Runs droplet_code/src/mesh.c, unmodified, on a simulated swarm of Droplets, and measures how long the tables
+ * take to converge, what the adverts cost, how stable the routes stay, and how long a dead Droplet lingers in
+ * everyone's tables.
+ *
+ * Build, from this directory:
+ *   gcc -O2 -std=gnu99 -Wall -Wextra -I- -I host -I ../../../droplet_code/include -I ../../../droplet_code/src mesh_sim.c -lm -o mesh_sim
+ * (-I- stops mesh.h finding the real droplet_init.h and co. next to it, so host/'s stand-ins are used instead.
+ * gcc calls it obsolete, but there's nothing else that does this.)
+ *
+ * Usage:
+ *   ./mesh_sim [-n droplets] [-s seconds] [-k kill time] [-d data period] [-q loss] [-r seed] [-t]
+ *
+ * mesh.c is #included, so its state can be swapped in and out: there's one copy of its statics, and each
+ * Droplet's are loaded in to them before anything of mesh.c's runs on its behalf, and saved after. The headers
+ * in host/ stand in for the rest of the firmware. Its tasks run as events at the time they're scheduled for,
+ * ir_send puts frames on the grid, and the frames that get through go to the handler registered for their type.
+ * The 'droplets' (default 100, at most MESH_NUM_ORDS) sit on a hexagonal grid, so each has up to six
+ * neighbours, one per direction, and ordinals are handed out along the rows. Each calls mesh_init at a random
+ * time in its first advert period. Frames take 3.125ms a byte, header included, as they do at 3200 baud. A
+ * side can't send while it's still sending its last frame; ir_send refuses. A frame is lost if the receiver
+ * is sending on that side when it starts, or is already hearing another frame on it (which is then lost too),
+ * and otherwise with chance 'loss' (default 0.1). With -t, a frame is also lost if the receiver starts
+ * sending on that side before it's over, as ir_send turns that USART's receiver off. Every 'data period'
+ * seconds (default 30) each Droplet mesh_sends a packet to another, picked at random. At 'kill time' (default
+ * 400s into a 600s run) the Droplet in the middle of the grid is switched off.
+ * It prints when every Droplet first had a route to every other within reach; in the half of the run before
+ * the kill, when nothing was changing, the share of those routes that were there, the share of those that were
+ * shortest paths, and how many routes expired per Droplet per minute; the share of each side's time spent
+ * sending adverts; how many packets got through, and how many hops they took against the shortest path; and,
+ * after the kill, how long until nobody had a usable route to the dead Droplet, and the most hops anyone
+ * thought it was. It exits nonzero if fewer than 95% of the routes were there, or the dead Droplet was never
+ * forgotten.
+ */
+#include "mesh.c"	//First, for host/droplet_init.h's sake.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+//As in ir_comm.h.
+#define HEADER_LEN		8
+
+#define ID_BASE			0x1000	//Droplet i's ID is ID_BASE+i, and its ordinal is i.
+#define MESH_DATA_LEN	10		//Payload of the test packets.
+#define MAX_HANDLERS	8
+#define MS_PER_BYTE		3.125
+#define NO_TIME			-1.0
+
+enum{ EV_INIT, EV_TASK, EV_DATA, EV_RX_END, EV_KILL, EV_CHECK };
+
+typedef struct event_struct{
+	double		t;
+	uint8_t		type;
+	uint32_t	node, arg;
+	uint32_t	period;		//For EV_TASK. 0 if it only runs once.
+	void		(*task)();
+} Event;
+
+typedef struct frame_struct{	//One frame, as one neighbour hears it.
+	uint8_t		dir;		//Which of the receiver's sides it arrives on.
+	uint8_t		lost;
+	uint8_t		sender;
+	uint8_t		length;
+	char		data[IR_BUFFER_SIZE];
+} Frame;
+
+typedef struct mesh_state_struct{	//mesh.c's statics, for one Droplet.
+	MeshRoute*	routes;
+	uint8_t		seen_cache[MESH_SEEN_CACHE_SIZE][2];
+	uint8_t		seen_idx, my_ord, my_seq, advert_cursor, mesh_enabled;
+	MeshStats	stats;
+} MeshState;
+
+typedef struct handler_struct{
+	char		type;
+	uint8_t		min_length, max_length;
+	MsgHandler	handler;
+} Handler;
+
+typedef struct droplet_struct{
+	int32_t		neighbour[6];
+	uint8_t		dead;
+	double		txEnd[6];
+	double		rxEnd[6];
+	int32_t		rxFrame[6];
+	MeshState	mesh;
+	Handler		handlers[MAX_HANDLERS];	//What msg_dispatch would hold.
+	uint8_t		numHandlers;
+} Droplet;
+
+static Droplet drops[MESH_NUM_ORDS];
+static uint8_t dist[MESH_NUM_ORDS][MESH_NUM_ORDS];
+static uint32_t numDrops;
+static double loss = 0.1;
+static uint8_t deafWhileSending;
+
+static uint32_t current;	//Whose state mesh.c's statics hold.
+static double now;
+static Task_t task;
+static uint8_t heardTtl;	//Of the data packet being handled.
+
+static Event* heap;
+static size_t heapLen, heapCap;
+static Frame* frames;
+static size_t numFrames, framesCap;
+
+static uint8_t victim;
+static double killTime, advertTime, connectedAt, goneAt, routedShare, shortestShare;
+static uint32_t numChecks, expired, sent, delivered, hopsTaken, hopsShortest;
+static uint8_t maxVictimHops;
+
+static double uniform(){
+	return rand()/(double)RAND_MAX;
+}
+
+static void push_event(double t, uint8_t type, uint32_t node, uint32_t arg, uint32_t period, void (*fn)()){
+	if(heapLen==heapCap){
+		heapCap = heapCap ? 2*heapCap : 1024;
+		heap = realloc(heap, heapCap*sizeof(Event));
+	}
+	size_t i = heapLen++;
+	while(i>0 && heap[(i-1)/2].t>t){
+		heap[i] = heap[(i-1)/2];
+		i = (i-1)/2;
+	}
+	heap[i] = (Event){t, type, node, arg, period, fn};
+}
+
+static Event pop_event(){
+	Event top = heap[0], last = heap[--heapLen];
+	size_t i = 0;
+	for(;;){
+		size_t c = 2*i+1;
+		if(c>=heapLen) break;
+		if(c+1<heapLen && heap[c+1].t<heap[c].t) c++;
+		if(heap[c].t>=last.t) break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	heap[i] = last;
+	return top;
+}
+
+//Loads node's state in to mesh.c's statics. Everything mesh.c does until leave() is on node's behalf.
+static void enter(uint32_t node){
+	MeshState* s = &(drops[node].mesh);
+	routes			= s->routes;
+	memcpy(seen_cache, s->seen_cache, sizeof(seen_cache));
+	seen_idx		= s->seen_idx;
+	my_ord			= s->my_ord;
+	my_seq			= s->my_seq;
+	advert_cursor	= s->advert_cursor;
+	mesh_enabled	= s->mesh_enabled;
+	mesh_stats		= s->stats;
+	current			= node;
+}
+
+static void leave(){
+	MeshState* s = &(drops[current].mesh);
+	s->routes			= routes;
+	memcpy(s->seen_cache, seen_cache, sizeof(seen_cache));
+	s->seen_idx			= seen_idx;
+	s->my_ord			= my_ord;
+	s->my_seq			= my_seq;
+	s->advert_cursor	= advert_cursor;
+	s->mesh_enabled		= mesh_enabled;
+	s->stats			= mesh_stats;
+}
+
+//The hops in node's route to ord, or MESH_NO_ROUTE if it hasn't started yet.
+static uint8_t hops_to(uint32_t node, uint32_t ord){
+	MeshRoute* r = drops[node].mesh.routes;
+	return r ? r[ord].hops : MESH_NO_ROUTE;
+}
+
+/*
+ * Rows are shifted back and forth by half a Droplet, so the swarm is a rectangle rather than a rhombus; across a
+ * rhombus of 100 there are 18 hops, more than MESH_MAX_HOPS. Also works out every shortest path, by
+ * breadth-first search from each Droplet.
+ */
+static void build_grid(){
+	static const int8_t dq[6] = {1, 1, 0, -1, -1, 0}, dr[6] = {0, -1, -1, 0, 1, 1};
+	uint32_t cols = (uint32_t)ceil(sqrt(numDrops));
+	for(uint32_t i=0;i<numDrops;i++){
+		int32_t r = i/cols, q = i%cols-r/2;
+		for(uint8_t k=0;k<6;k++){
+			int32_t nq = q+dq[k], nr = r+dr[k], nc = nq+nr/2;
+			int32_t j = nr*(int32_t)cols+nc;
+			drops[i].neighbour[k] = (nc>=0 && nc<(int32_t)cols && nr>=0 && j<(int32_t)numDrops) ? j : -1;
+		}
+	}
+	victim = (uint8_t)((numDrops/cols/2)*cols+cols/2);
+	for(uint32_t s=0;s<numDrops;s++){
+		uint8_t queue[MESH_NUM_ORDS], head = 0, tail = 0;
+		memset(dist[s], MESH_NO_ROUTE, sizeof(dist[s]));
+		dist[s][s] = 0;
+		queue[tail++] = s;
+		while(head<tail){
+			uint8_t u = queue[head++];
+			for(uint8_t k=0;k<6;k++){
+				int32_t v = drops[u].neighbour[k];
+				if(v>=0 && dist[s][v]==MESH_NO_ROUTE){
+					dist[s][v] = dist[s][u]+1;
+					queue[tail++] = v;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Starts a frame out of each of 'from''s sides in 'dirs'. Each neighbour gets its own copy, which ends up lost
+ * if it overlaps anything else that neighbour hears on that side. Returns '0' if any of those sides was still
+ * sending.
+ */
+static uint8_t transmit(uint32_t from, uint8_t dirs, char* data, uint8_t len){
+	Droplet* d = &(drops[from]);
+	if(d->dead || len>IR_BUFFER_SIZE) return 0;
+	for(uint8_t k=0;k<6;k++){
+		if((dirs&(1<<k)) && d->txEnd[k]>now) return 0;
+	}
+	double end = now+(HEADER_LEN+len)*MS_PER_BYTE;
+	uint8_t sides = 0;
+	for(uint8_t k=0;k<6;k++){
+		if(!(dirs&(1<<k))) continue;
+		sides++;
+		d->txEnd[k] = end;
+		if(deafWhileSending && d->rxEnd[k]>now) frames[d->rxFrame[k]].lost = 1;
+		if(d->neighbour[k]<0) continue;
+		Droplet* n = &(drops[d->neighbour[k]]);
+		uint8_t side = (k+3)%6;
+		if(numFrames==framesCap){
+			framesCap = framesCap ? 2*framesCap : 1024;
+			frames = realloc(frames, framesCap*sizeof(Frame));
+		}
+		Frame* f = &(frames[numFrames]);
+		f->dir		= side;
+		f->sender	= from;
+		f->length	= len;
+		memcpy(f->data, data, len);
+		f->lost = (uniform()<loss) || n->txEnd[side]>now || n->dead;
+		if(n->rxEnd[side]>now){
+			f->lost = 1;
+			frames[n->rxFrame[side]].lost = 1;
+		}
+		if(end>n->rxEnd[side]){
+			n->rxEnd[side] = end;
+			n->rxFrame[side] = numFrames;
+		}
+		push_event(end, EV_RX_END, d->neighbour[k], numFrames, 0, NULL);
+		numFrames++;
+	}
+	if(data[0]==MESH_ADVERT_FLAG) advertTime += (HEADER_LEN+len)*MS_PER_BYTE*sides/6;
+	return 1;
+}
+
+uint8_t get_droplet_ord(id_t id){
+	return (id>=ID_BASE && id<ID_BASE+numDrops) ? id-ID_BASE : 0xFF;
+}
+
+id_t get_droplet_id(){
+	return ID_BASE+current;
+}
+
+id_t get_id_from_ord(uint8_t ord){
+	return ID_BASE+ord;
+}
+
+uint8_t rand_byte(){
+	return rand()&0xFF;
+}
+
+volatile Task_t* schedule_task(uint32_t time, void (*function)(), void* arg){
+	(void)arg;
+	time += MIN_TASK_TIME_IN_FUTURE*(time<MIN_TASK_TIME_IN_FUTURE);
+	push_event(now+time, EV_TASK, current, 0, 0, function);
+	return &task;
+}
+
+volatile Task_t* schedule_periodic_task(uint32_t period, void (*function)(), void* arg){
+	(void)arg;
+	push_event(now+period, EV_TASK, current, 0, period, function);
+	return &task;
+}
+
+uint8_t register_msg_handler(char type, uint8_t min_length, uint8_t max_length, MsgHandler handler){
+	Droplet* d = &(drops[current]);
+	for(uint8_t i=0;i<d->numHandlers;i++){
+		if(d->handlers[i].type==type) return 0;
+	}
+	if(d->numHandlers==MAX_HANDLERS) return 0;
+	d->handlers[d->numHandlers++] = (Handler){type, min_length, max_length, handler};
+	return 1;
+}
+
+void unregister_msg_handler(char type){
+	Droplet* d = &(drops[current]);
+	for(uint8_t i=0;i<d->numHandlers;i++){
+		if(d->handlers[i].type!=type) continue;
+		d->handlers[i] = d->handlers[--d->numHandlers];
+		return;
+	}
+}
+
+uint8_t ir_send(uint8_t dirs, char *data, uint8_t data_length){
+	return transmit(current, dirs, data, data_length);
+}
+
+void user_handle_mesh_msg(id_t src_id, char* data, uint8_t data_length){
+	(void)data;
+	(void)data_length;
+	delivered++;
+	hopsTaken += MESH_DEFAULT_TTL-heardTtl+1;
+	hopsShortest += dist[get_droplet_ord(src_id)][current];
+}
+
+//As msg_dispatch does. The frame's copied out first, as handlers can send, and a send can move 'frames'.
+static void hear(uint32_t node, Frame* f){
+	char buf[IR_BUFFER_SIZE];
+	memcpy(buf, f->data, f->length);
+	ir_msg msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.arrival_time	= (uint32_t)now;
+	msg.sender_ID		= ID_BASE+f->sender;
+	msg.msg				= buf;
+	msg.dir_received	= f->dir;
+	msg.length			= f->length;
+	for(uint8_t i=0;i<drops[node].numHandlers;i++){
+		Handler* h = &(drops[node].handlers[i]);
+		if(h->type!=buf[0]) continue;
+		if(msg.length<h->min_length || msg.length>h->max_length) return;
+		if(buf[0]==MESH_DATA_FLAG) heardTtl = ((MeshData*)buf)->ttl;
+		enter(node);
+		h->handler(&msg);
+		leave();
+		return;
+	}
+}
+
+static uint32_t usable_routes(){
+	uint32_t n = 0;
+	for(uint8_t i=0;i<MESH_NUM_ORDS;i++) n += (routes[i].hops<MESH_MAX_HOPS);
+	return n;
+}
+
+/*
+ * Notes the first time every live Droplet had a usable route to every other it's close enough to reach. In the
+ * half of the run before the kill, adds up how many had a route, and how many of those were shortest paths.
+ * After the kill, notes when the last usable route to the dead Droplet went, and how long any got.
+ */
+static void check_tables(){
+	uint32_t pairs = 0, routed = 0, shortest = 0;
+	for(uint32_t i=0;i<numDrops;i++){
+		for(uint32_t j=0;j<numDrops;j++){
+			if(i==j || drops[i].dead || drops[j].dead || dist[i][j]>=MESH_MAX_HOPS) continue;
+			uint8_t hops = hops_to(i, j);
+			pairs++;
+			if(hops>=MESH_MAX_HOPS) continue;
+			routed++;
+			if(hops==dist[i][j]) shortest++;
+		}
+	}
+	if(routed==pairs && connectedAt==NO_TIME) connectedAt = now;
+	if(now>=killTime/2 && now<killTime){
+		routedShare		+= (double)routed/pairs;
+		shortestShare	+= routed ? (double)shortest/routed : 0;
+		numChecks++;
+	}
+	if(now<killTime) return;
+	uint8_t anyone = 0;
+	for(uint32_t i=0;i<numDrops;i++){
+		uint8_t hops = hops_to(i, victim);
+		if(i==victim || hops>=MESH_MAX_HOPS) continue;
+		anyone = 1;
+		if(hops>maxVictimHops) maxVictimHops = hops;
+	}
+	if(anyone)	goneAt = NO_TIME;
+	else if(goneAt==NO_TIME) goneAt = now;
+}
+
+static void handle(Event* e, double dataPeriod){
+	Droplet* d = &(drops[e->node]);
+	now = e->t;
+	switch(e->type){
+		case EV_INIT:
+			enter(e->node);
+			mesh_init();
+			leave();
+			break;
+		case EV_TASK:{
+			if(d->dead) break;
+			if(e->period) push_event(e->t+e->period, EV_TASK, e->node, 0, e->period, e->task);
+			enter(e->node);
+			//Only mesh_upkeep takes routes away, so what's gone is what expired.
+			uint32_t before = usable_routes();
+			e->task();
+			uint32_t after = usable_routes();
+			leave();
+			if(now>=killTime/2 && now<killTime && after<before) expired += before-after;
+			break;
+		}
+		case EV_DATA:{
+			push_event(e->t+dataPeriod*1000, EV_DATA, e->node, 0, 0, NULL);
+			if(d->dead) break;
+			uint32_t dest = rand()%(numDrops-1);
+			if(dest>=e->node) dest++;
+			if(drops[dest].dead) break;
+			char payload[MESH_DATA_LEN] = {0};
+			enter(e->node);
+			if(mesh_send(ID_BASE+dest, payload, MESH_DATA_LEN)) sent++;
+			leave();
+			break;
+		}
+		case EV_RX_END:{
+			Frame* f = &(frames[e->arg]);
+			if(f->lost || d->dead) break;
+			hear(e->node, f);
+			break;
+		}
+		case EV_KILL:
+			drops[victim].dead = 1;
+			break;
+		case EV_CHECK:
+			push_event(e->t+100, EV_CHECK, 0, 0, 0, NULL);
+			check_tables();
+			break;
+	}
+}
+
+// Returns '0' if fewer than 95% of the routes were there when nothing was changing, or the dead Droplet was never forgotten.
+static uint8_t run(double seconds, double dataPeriod){
+	memset(drops, 0, sizeof(drops));
+	build_grid();
+	for(uint32_t i=0;i<numDrops;i++){
+		push_event(uniform()*MESH_ADVERT_PERIOD_MS, EV_INIT, i, 0, 0, NULL);
+		push_event(uniform()*dataPeriod*1000, EV_DATA, i, 0, 0, NULL);
+	}
+	push_event(killTime, EV_KILL, 0, 0, 0, NULL);
+	push_event(100, EV_CHECK, 0, 0, 0, NULL);
+	connectedAt = goneAt = NO_TIME;
+	double end = seconds*1000;
+	while(heapLen && heap[0].t<end){
+		Event e = pop_event();
+		handle(&e, dataPeriod);
+	}
+	printf("%8.1f %7.1f%% %7.1f%% %7.2f %6.2f%% %8.1f%% %6.2f %8.1f %5u\n",
+		connectedAt==NO_TIME ? NAN : connectedAt/1000, 100*routedShare/numChecks, 100*shortestShare/numChecks,
+		expired/(killTime/2/60000*numDrops), 100*advertTime/(end*numDrops),
+		sent ? 100.0*delivered/sent : 0.0, hopsShortest ? (double)hopsTaken/hopsShortest : 0.0,
+		goneAt==NO_TIME ? NAN : (goneAt-killTime)/1000, maxVictimHops);
+	for(uint32_t i=0;i<numDrops;i++) free(drops[i].mesh.routes);
+	return routedShare>=0.95*numChecks && goneAt!=NO_TIME;
+}
+
+int main(int argc, char** argv){
+	double seconds = 600, kill = 400, dataPeriod = 30;
+	unsigned seed = 1;
+	numDrops = 100;
+	int opt;
+	while((opt = getopt(argc, argv, "n:s:k:d:q:r:t"))!=-1){
+		switch(opt){
+			case 'n': numDrops		= atoi(optarg); break;
+			case 's': seconds		= atof(optarg); break;
+			case 'k': kill			= atof(optarg); break;
+			case 'd': dataPeriod	= atof(optarg); break;
+			case 'q': loss			= atof(optarg); break;
+			case 'r': seed			= atoi(optarg); break;
+			case 't': deafWhileSending	= 1; break;
+			default:
+				fprintf(stderr, "Usage: %s [-n droplets] [-s seconds] [-k kill time] [-d data period] [-q loss] [-r seed] [-t]\n", argv[0]);
+				return 2;
+		}
+	}
+	if(numDrops<4 || numDrops>MESH_NUM_ORDS || kill>=seconds){
+		fprintf(stderr, "Need 4 to %u droplets, and to kill one before the end.\n", MESH_NUM_ORDS);
+		return 2;
+	}
+	killTime = kill*1000;
+	srand(seed);
+	printf("%u Droplets, %.0f%% loss, a packet from each every %.0fs, one killed at %.0fs of %.0fs%s.\n", numDrops,
+		100*loss, dataPeriod, kill, seconds, deafWhileSending ? ", deaf while sending" : "");
+	printf("all      routed   shortest expired advert  packets   stretch dead     max\n");
+	printf("routed                     /min    airtime delivered         gone     hops\n");
+	printf("(s)                                                          (s)\n");
+	uint8_t ok = run(seconds, dataPeriod);
+	free(heap);
+	free(frames);
+	return !ok;
+}
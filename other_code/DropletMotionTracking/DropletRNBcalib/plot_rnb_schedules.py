@@ -0,0 +1,76 @@
+from __future__ import print_function
+import subprocess
+import glob
+import sys
+
+# Plots how long an rnb broadcast takes against how accurate it is, for a range of measurement schedules,
+# by replaying the rnbCalibData logs through rnb_replay (build that first; see rnb_replay.c):
+#   python plot_rnb_schedules.py [output image]
+# Also prints the numbers, so it still works without matplotlib.
+
+# As in range_algs.h.
+POST_BROADCAST_DELAY = 30
+TIME_FOR_SET_IR_POWERS = 2
+RNB_FACING_SPREAD = 180
+# As in rnb_params.h.
+RNB_SLOT_GUARD = 2
+RNB_FULL_MEAS_TIME = 5
+RNB_FAST_MEAS_TIME = 3
+
+# What the logs were taken with: 16ms slots with 10ms between them, and every pair measured.
+LOGGED_BROADCAST_MS = POST_BROADCAST_DELAY + TIME_FOR_SET_IR_POWERS + 6*(16 + 10)
+
+def broadcast_ms(meas_time):
+    return POST_BROADCAST_DELAY + TIME_FOR_SET_IR_POWERS + 6*(2*RNB_SLOT_GUARD + meas_time)
+
+def replay(args):
+    out = subprocess.check_output(['./rnb_replay', '-c'] + args + sorted(glob.glob('rnbCalibData_*.txt')))
+    fields = out.decode().strip().split(',')
+    return {'valid': int(fields[1]), 'rmse': float(fields[2]), 'range': float(fields[3]),
+            'bearing': float(fields[4]), 'heading': float(fields[5])}
+
+def run_all():
+    results = [('logged', LOGGED_BROADCAST_MS, replay([]))]
+    for spread in (360, RNB_FACING_SPREAD):
+        for meas_time in range(1, 9):
+            results.append(('spread {0}'.format(spread), broadcast_ms(meas_time),
+                            replay(['-m', str(meas_time), '-s', str(spread)])))
+    return results
+
+def print_results(results):
+    print('{0:12s} {1:>5s} {2:>6s} {3:>6s} {4:>6s} {5:>7s} {6:>7s}'.format(
+        'schedule', 'ms', 'valid', 'rmse', 'range', 'bearing', 'heading'))
+    for name, ms, r in results:
+        print('{0:12s} {1:5d} {2:6d} {3:6.1f} {4:6.1f} {5:7.1f} {6:7.1f}'.format(
+            name, ms, r['valid'], r['rmse'], r['range'], r['bearing'], r['heading']))
+
+def plot_results(results, filename):
+    import matplotlib
+    matplotlib.use('Agg')
+    import matplotlib.pyplot as plt
+    fig, axes = plt.subplots(1, 3, figsize=(15, 4.5))
+    for ax, key, label in zip(axes, ('range', 'bearing', 'heading'),
+                              ('median range error (mm)', 'median bearing error (deg)', 'median heading error (deg)')):
+        for name, marker in (('spread 360', 'o-'), ('spread {0}'.format(RNB_FACING_SPREAD), 's-')):
+            pts = [(ms, r[key]) for n, ms, r in results if n == name]
+            ax.plot([p[0] for p in pts], [p[1] for p in pts], marker, label=name)
+        logged = [(ms, r[key]) for n, ms, r in results if n == 'logged'][0]
+        ax.plot([logged[0]], [logged[1]], 'k*', markersize=12, label='logged schedule')
+        for meas_time, name in ((RNB_FULL_MEAS_TIME, 'full'), (RNB_FAST_MEAS_TIME, 'fast')):
+            ax.axvline(broadcast_ms(meas_time), color='gray', linestyle=':')
+            ax.text(broadcast_ms(meas_time), ax.get_ylim()[1], name, ha='center', va='bottom')
+        ax.set_xlabel('broadcast time (ms)')
+        ax.set_ylabel(label)
+        ax.grid(True)
+    axes[0].legend()
+    fig.tight_layout()
+    fig.savefig(filename)
+    print('Wrote {0}.'.format(filename))
+
+if __name__ == '__main__':
+    results = run_all()
+    print_results(results)
+    try:
+        plot_results(results, sys.argv[1] if len(sys.argv) > 1 else 'rnb_schedules.png')
+    except ImportError:
+        print('No matplotlib, so no plot.')
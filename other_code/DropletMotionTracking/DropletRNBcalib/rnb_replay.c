@@ -0,0 +1,632 @@
+/*
+ * Replays the brightness matrices in rnbCalibData_*.txt through droplet_code/src/rnb_math.c, unmodified,
+ * and compares what it makes of them against the camera's poses from the same log. Run it before and after
+ * changing anything in the rnb math; it's the check that a change didn't make things worse.
+ *
+ * Build, from this directory:
+ *   gcc -O2 -std=gnu99 -I host -I ../../../droplet_code/include rnb_replay.c ../../../droplet_code/src/rnb_math.c -lm -o rnb_replay
+ * (add -DRNB_JOINT_SOLVER to replay with the joint solver on, and -DRNB_CODED_BROADCASTS for -k.)
+ *
+ * Usage:
+ *   ./rnb_replay [-r max range RMSE] [-b max median bearing err] [-h max median heading err]
+ *                [-n samples | -m ms [-a]] [-s spread] [-k senders [-j jitter]] [-p power [-u]] [-g] [-c] rnbCalibData_*.txt
+ * Each -r/-b/-h given is a gate: if the total over all the files is worse, it says so and exits with 1.
+ *
+ * -n, -m, and -s replay cheaper measurement schedules than the one the logs were taken with:
+ *   -n simulates taking the median of 'samples' conversions per sensor, instead of the 7 ir_range_meas used
+ *      then, by adding the extra noise that would have. The per-conversion noise, SAMPLE_NOISE, is the spread
+ *      of the pairs in the logs which faced away from each other, so it's on the high side.
+ *   -m instead works out the samples the way ir_range_meas does, from 'ms' of sampling time per emitter
+ *      (RNB_FULL_MEAS_TIME or RNB_FAST_MEAS_TIME) and the number of sensors -s leaves it.
+ *   -a, with -m, shares each slot's conversions out the way rnb_sample does now, instead of evenly: see
+ *      adaptive_samples. The summary gives the conversions each schedule took.
+ *   -s only keeps the emitter/sensor pairs rnb_facing_pairs picks with that spread, and zeroes the rest. The
+ *      prior it's given is the previous estimate for the same two Droplets in the log, if there's one from the
+ *      last PRIOR_MAX_AGE seconds, like the neighbor table would have. Otherwise it's the coarse_bearing of
+ *      the matrix's column sums, standing in for the strength of the sync message.
+ * -k replays coded broadcasts (build with -DRNB_CODED_BROADCASTS), with 'senders' Droplets broadcasting at
+ *   once. Each record's light is mixed, chip by chip, with that of up to senders-1 others: the records for
+ *   the same receiver nearest in time, from other senders, so real light from real neighbours. Every
+ *   sender gets its own code, and its own sync error, uniform up to 'jitter' ms either way (default 1).
+ *   Each chip's reading gets the noise of the conversions RNB_CODED_MEAS_TIME allows, and is clipped where
+ *   the ADC saturates. Then the record's code is separated out with rnb_correlate_chip, and estimated as
+ *   usual. It also decodes a code nobody used, to check RNB_CODED_MIN_TOTAL keeps those out.
+ * -p replays the logs as if the sender had been at that IR power setting (1 to 256) instead of full power.
+ *   Each reading is scaled by rnb_power_gain, and given back the noise the scaling took off it, so the
+ *   noise stays what a median of that many conversions has. The estimate is told the power, as use_rnb_data
+ *   would be by the sync message; -u tells it full power instead, which is what it assumed before. This
+ *   only checks the plumbing: the logs are dimmed with the same powerGainLUT the estimate undoes, so it
+ *   can't say whether the table is right. Until it's fit to logs taken at each power, broadcasts stay at
+ *   full power; see ir_range_blast.
+ * -g throws out the estimates rnb_confidence gives 0, like use_rnb_data does, and counts them as rejected.
+ *   The previous estimate it's given is the last one it kept for the same two Droplets, if it's from the last
+ *   PRIOR_MAX_AGE seconds. The summary also counts gross errors, over 100mm or 90 degrees of bearing, kept.
+ * -c prints just the totals, as one line of CSV: records, valid, range RMSE, median range/bearing/heading error.
+ * plot_rnb_schedules.py uses these to plot the time each schedule takes against how accurate it is.
+ *
+ * Each record in the logs is
+ *   {"TX ID", "RX ID", {{6x6 brightness, [emitter][sensor]}}, time, {"ID"->{x, y, orientation}, ...}},
+ * with positions in mm and orientations in degrees. Records where the TX or RX ID shows up more than once in
+ * the poses are skipped, since we can't tell which one it was. So are those with the Droplets more than
+ * MAX_TRUE_RANGE apart, where the brightness is mostly noise, except as other senders' light for -k.
+ * (results.csv has the same matrices, but its pose columns don't line up with them, so it isn't replayed.)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rnb_math.h"
+#include "rnb_params.h"
+
+#define MAX_TRUE_RANGE	300.0	//mm
+#define TIMING_REPEATS	200
+#define LOGGED_SAMPLES	7		//Conversions per sensor ir_range_meas took the median of, when the logs were taken.
+#define SAMPLE_NOISE	51.0	//Std. dev. of a single conversion.
+#define ADC_SATURATION	2452	//Largest reading in the logs, less the baseline.
+#define PRIOR_MAX_AGE	10.0	//s. NEIGHBOR_TIMEOUT_MS.
+#define MAX_PRIORS		256
+
+typedef struct replay_record_struct{
+	char	txID[5];
+	char	rxID[5];
+	double	time;		//s
+	int16_t	bm[6][6];
+	double	range;		//mm
+	double	bearing;	//degrees
+	double	heading;	//degrees
+	uint8_t	scored;		//'0' if it's only here to be mixed in with -k.
+} ReplayRecord;
+
+typedef struct replay_stats_struct{
+	uint32_t	records;
+	uint32_t	valid;
+	double		rangeSqSum;
+	double*		rangeErr;	//All of these are absolute errors, one per valid estimate.
+	double*		bearingErr;
+	double*		headingErr;
+	double		seconds;	//Spent in rnb_sum_matrix and rnb_estimate.
+	uint32_t	senders;	//With -k, the total number of senders mixed in to the records, including their own.
+	uint32_t	emptyPassed;//With -k, how many unused codes got past RNB_CODED_MIN_TOTAL and gave an estimate.
+	double		sepSqSum;	//With -k, squared error of the separated brightnesses, over every pair.
+	uint32_t	rejected;	//With -g, estimates rnb_confidence threw out.
+	uint32_t	gross;		//Estimates kept which were off by more than 100mm or 90 degrees of bearing.
+	uint32_t	conversions;//ADC conversions the schedule took, over every record.
+} ReplayStats;
+
+typedef struct replay_prior_struct{
+	char	txID[5];
+	char	rxID[5];
+	double	time;
+	int32_t	range;		//Q4 mm
+	int16_t	bearing;
+	int16_t	heading;
+} ReplayPrior;
+
+static uint8_t	numSamples = LOGGED_SAMPLES;
+static uint8_t	measTime = 0;
+static uint16_t	facingSpread = 360;
+static ReplayPrior	priors[MAX_PRIORS];
+static uint16_t		numPriors;
+static uint8_t	numSenders = 0;
+static double	syncJitter = 1.0;
+static uint8_t	gate = 0;
+static uint16_t	replayPower = RNB_FULL_POWER;
+static uint8_t	uncorrected = 0;
+static uint8_t	adaptive = 0;
+
+static double wrap_deg(double a){
+	a = fmod(a+180.0, 360.0);
+	if(a<0) a += 360.0;
+	return a-180.0;
+}
+
+static int cmp_double(const void* a, const void* b){
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x>y) - (x<y);
+}
+
+//q in [0,1]. Sorts v.
+static double percentile(double* v, uint32_t n, double q){
+	if(!n) return NAN;
+	qsort(v, n, sizeof(double), cmp_double);
+	uint32_t i = (uint32_t)(q*n);
+	return v[i<n ? i : n-1];
+}
+
+/*
+ * Reads the next record from *pos into rec. Returns 1 if rec is usable, 0 if the record was skipped, and
+ * -1 at the end of the file.
+ */
+static int8_t parse_record(char** pos, ReplayRecord* rec){
+	char* txID = rec->txID;
+	char* rxID = rec->rxID;
+	char* p = strstr(*pos, "{\"");
+	if(!p) return -1;
+	if(sscanf(p, "{\"%4[0-9A-F]\", \"%4[0-9A-F]\", {{", txID, rxID)!=2){
+		*pos = p+2;
+		return 0;
+	}
+	p = strstr(p, "{{")+1;
+	for(uint8_t e=0;e<6;e++){
+		int v[6];
+		if(sscanf(p, "{%d,%d,%d,%d,%d,%d}", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5])!=6){
+			*pos = p;
+			return 0;
+		}
+		for(uint8_t s=0;s<6;s++) rec->bm[e][s] = (int16_t)v[s];
+		p = strchr(p, '}')+1;
+		if(*p==',') p++;
+	}
+	char* end = strstr(p, "}},");
+	if(!end) end = strstr(p, "}}");
+	if(!end) return -1;
+	*pos = end+2;
+	if(sscanf(p, "}, %lf", &(rec->time))!=1) return 0;
+
+	uint8_t txCount = 0, rxCount = 0;
+	double tx[3] = {0}, rx[3] = {0};
+	for(char* q = strchr(p, '"'); q && q<end; q = strchr(q, '"')){
+		char id[5];
+		double pose[3];
+		if(sscanf(q, "\"%4[0-9A-F]\"->{%lf, %lf, %lf}", id, &pose[0], &pose[1], &pose[2])!=4) return 0;
+		if(!strcmp(id, txID)){
+			txCount++;
+			memcpy(tx, pose, sizeof(pose));
+		}
+		if(!strcmp(id, rxID)){
+			rxCount++;
+			memcpy(rx, pose, sizeof(pose));
+		}
+		q = strchr(q, '}');
+		if(!q) break;
+	}
+	if(txCount!=1 || rxCount!=1) return 0;
+	double dX = tx[0]-rx[0];
+	double dY = tx[1]-rx[1];
+	rec->range		= hypot(dX, dY);
+	rec->bearing	= wrap_deg(atan2(dY, dX)*180.0/M_PI - rx[2] + 180.0);
+	rec->heading	= wrap_deg(tx[2] - rx[2] - 90.0);
+	rec->scored		= rec->range<MAX_TRUE_RANGE;
+	return 1;
+}
+
+static double gaussian(){
+	double u = (rand()+1.0)/(RAND_MAX+2.0);
+	double v = (rand()+1.0)/(RAND_MAX+2.0);
+	return sqrt(-2.0*log(u))*cos(2.0*M_PI*v);
+}
+
+static ReplayPrior* find_prior(ReplayRecord* rec){
+	for(uint16_t i=0;i<numPriors;i++){
+		if(!strcmp(priors[i].txID, rec->txID) && !strcmp(priors[i].rxID, rec->rxID)) return &(priors[i]);
+	}
+	return NULL;
+}
+
+//How much noise to add to a logged reading, the median of LOGGED_SAMPLES, to make it the median of 'samples'.
+//The median of n samples has a variance of about pi*sigma^2/(2n).
+static double median_noise(uint8_t samples){
+	if(samples>=LOGGED_SAMPLES) return 0;
+	return SAMPLE_NOISE*sqrt(M_PI/2.0*(1.0/samples - 1.0/LOGGED_SAMPLES));
+}
+
+/*
+ * Works out how many conversions rnb_sample would give each sensor during emitter e's slot, the way
+ * rnb_plan_sensor does: the dimmest first (order), each getting an even share of what's left, and cut short
+ * if its first usable reading is saturated. Returns the conversions used.
+ */
+static uint16_t adaptive_samples(ReplayRecord* rec, uint8_t e, uint8_t* order, uint8_t numSensors, uint8_t samples[6]){
+	uint16_t left = (measTime*1000U)/RNB_CONVERSION_US;
+	uint16_t used = 0;
+	for(uint8_t k=0;k<numSensors;k++){
+		uint8_t s = order[k];
+		uint16_t n = left/(numSensors-k);
+		if(n>RNB_MAX_MEAS_PER_CH) n = RNB_MAX_MEAS_PER_CH;
+		if(n<RNB_MIN_MEAS_PER_CH) n = RNB_MIN_MEAS_PER_CH;
+		if(n>RNB_SATURATED_MEAS_PER_CH){
+			double first = rec->bm[e][s] + SAMPLE_NOISE*sqrt(1.0 - M_PI/(2.0*LOGGED_SAMPLES))*gaussian();
+			if(first>=RNB_SATURATED) n = RNB_SATURATED_MEAS_PER_CH;
+		}
+		left -= n<left ? n : left;
+		used += n;
+		samples[s] = n>2 ? n-2 : 1; //ir_sensor_result throws the first ones away.
+	}
+	return used;
+}
+
+/*
+ * Turns the logged matrix into what the schedule set by -n, -m, -s and -a would have measured. Returns the
+ * conversions that took.
+ */
+static uint16_t apply_schedule(ReplayRecord* rec, int16_t bm[6][6]){
+	ReplayPrior* prior = find_prior(rec);
+	uint8_t havePrior = prior && (rec->time - prior->time)<PRIOR_MAX_AGE;
+	int16_t colSums[6] = {0};
+	for(uint8_t e=0;e<6;e++){
+		for(uint8_t s=0;s<6;s++) colSums[s] += rec->bm[e][s];
+	}
+	uint8_t emitters, sensors;
+	rnb_facing_pairs(havePrior ? prior->bearing : coarse_bearing(colSums), havePrior ? prior->heading : RNB_NO_HEADING,
+		facingSpread, &emitters, &sensors);
+	//Dimmest first, by the column sums standing in for the sync message's strength, as ir_range_meas orders them.
+	uint8_t order[6], numSensors = 0;
+	for(uint8_t s=0;s<6;s++){
+		if(!(sensors&(1<<s))) continue;
+		uint8_t k = numSensors++;
+		while(k>0 && colSums[order[k-1]]>colSums[s]){
+			order[k] = order[k-1];
+			k--;
+		}
+		order[k] = s;
+	}
+	uint8_t samples = numSamples;
+	uint16_t measPerCh = LOGGED_SAMPLES+2;
+	if(measTime){
+		measPerCh = (measTime*1000U)/(numSensors*RNB_CONVERSION_US);
+		if(measPerCh>RNB_MAX_MEAS_PER_CH) measPerCh = RNB_MAX_MEAS_PER_CH;
+		if(measPerCh<RNB_MIN_MEAS_PER_CH) measPerCh = RNB_MIN_MEAS_PER_CH;
+		samples = measPerCh>2 ? measPerCh-2 : 1; //get_ir_sensors_dirs throws the first ones away.
+	}
+	//A dimmer sender scales the light and the noise alike, but the noise is the sensors', so it's put back.
+	double gain = rnb_power_gain(replayPower)/256.0;
+	uint16_t used = 0;
+	for(uint8_t e=0;e<6;e++){
+		uint8_t pairSamples[6];
+		if(!(emitters&(1<<e))){
+			for(uint8_t s=0;s<6;s++) bm[e][s] = 0;
+			continue;
+		}
+		if(adaptive){
+			used += adaptive_samples(rec, e, order, numSensors, pairSamples);
+		}else{
+			for(uint8_t s=0;s<6;s++) pairSamples[s] = samples;
+			used += numSensors*measPerCh;
+		}
+		for(uint8_t s=0;s<6;s++){
+			if(sensors&(1<<s)){
+				double val = gain*(rec->bm[e][s] + median_noise(pairSamples[s])*gaussian());
+				if(gain<1.0){
+					uint8_t n = pairSamples[s]<LOGGED_SAMPLES ? pairSamples[s] : LOGGED_SAMPLES;
+					val += SAMPLE_NOISE*sqrt(M_PI/(2.0*n))*sqrt(1.0 - gain*gain)*gaussian();
+				}
+				if(val>ADC_SATURATION) val = ADC_SATURATION;
+				bm[e][s] = (int16_t)lround(val);
+			}else{
+				bm[e][s] = 0;
+			}
+		}
+	}
+	return used;
+}
+
+#ifdef RNB_CODED_BROADCASTS
+/*
+ * Fills 'others' with up to 'max' records for the same receiver as recs[idx], from other senders, nearest in
+ * time first. Returns how many it found.
+ */
+static uint8_t find_interferers(ReplayRecord* recs, uint32_t numRecs, uint32_t idx, ReplayRecord** others, uint8_t max){
+	uint8_t found = 0;
+	while(found<max){
+		ReplayRecord* best = NULL;
+		for(uint32_t i=0;i<numRecs;i++){
+			if(strcmp(recs[i].rxID, recs[idx].rxID) || !strcmp(recs[i].txID, recs[idx].txID)) continue;
+			uint8_t dup = 0;
+			for(uint8_t k=0;k<found;k++) dup |= !strcmp(others[k]->txID, recs[i].txID);
+			if(dup) continue;
+			if(!best || fabs(recs[i].time-recs[idx].time)<fabs(best->time-recs[idx].time)) best = &(recs[i]);
+		}
+		if(!best) break;
+		others[found++] = best;
+	}
+	return found;
+}
+
+/*
+ * The light the receiver sees from 'sender' on 'chip' of emitter slot 'emitter'. With a sync error of
+ * 'offset' ms, part of the receiver's sampling window can fall in the sender's chip before or after.
+ */
+static double coded_light(ReplayRecord* sender, uint8_t code, double offset, uint8_t emitter, uint8_t chip, uint8_t s){
+	const double chipTime = 2*RNB_SLOT_GUARD+RNB_CODED_MEAS_TIME;
+	double before = (offset-RNB_SLOT_GUARD)/RNB_CODED_MEAS_TIME;
+	double after = (RNB_SLOT_GUARD+RNB_CODED_MEAS_TIME-(offset+chipTime))/RNB_CODED_MEAS_TIME;
+	before = before<0 ? 0 : (before>1 ? 1 : before);
+	after = after<0 ? 0 : (after>1 ? 1 : after);
+	double light = 0;
+	int16_t t = emitter*RNB_CODE_LENGTH+chip;
+	int16_t neighbours[3] = {t-1, t, t+1};
+	double fracs[3] = {before, 1-before-after, after};
+	for(uint8_t i=0;i<3;i++){
+		if(neighbours[i]<0 || neighbours[i]>=6*RNB_CODE_LENGTH || fracs[i]<=0) continue;
+		uint8_t e = neighbours[i]/RNB_CODE_LENGTH;
+		if(rnb_code_chip(code, neighbours[i]%RNB_CODE_LENGTH)) light += fracs[i]*sender->bm[e][s];
+	}
+	return light;
+}
+
+/*
+ * Mixes recs[idx] with up to numSenders-1 others, then separates out the code it was given in to bm, and
+ * a code nobody was given in to empty. Returns how many senders were mixed.
+ */
+static uint8_t apply_coded(ReplayRecord* recs, uint32_t numRecs, uint32_t idx, int16_t bm[6][6], int16_t empty[6][6]){
+	ReplayRecord* senders[RNB_NUM_CODES];
+	uint8_t codes[RNB_NUM_CODES];
+	double offsets[RNB_NUM_CODES];
+	senders[0] = &(recs[idx]);
+	uint8_t count = 1+find_interferers(recs, numRecs, idx, senders+1, numSenders-1);
+	//Hand out the codes in a random order.
+	for(uint8_t k=0;k<RNB_NUM_CODES;k++) codes[k] = k;
+	for(uint8_t k=RNB_NUM_CODES-1;k>0;k--){
+		uint8_t j = rand()%(k+1);
+		uint8_t tmp = codes[k];
+		codes[k] = codes[j];
+		codes[j] = tmp;
+	}
+	for(uint8_t k=0;k<count;k++) offsets[k] = syncJitter*(2.0*rand()/RAND_MAX-1.0);
+
+	uint8_t usedPerCh = RNB_CODED_MEAS_PER_CH>2 ? RNB_CODED_MEAS_PER_CH-2 : 1;
+	double noise = SAMPLE_NOISE*sqrt(usedPerCh>1 ? M_PI/(2.0*usedPerCh) : 1.0);
+	int16_t sums[RNB_NUM_CODES][6][6];
+	memset(sums, 0, sizeof(sums));
+	for(uint8_t e=0;e<6;e++){
+		for(uint8_t chip=0;chip<RNB_CODE_LENGTH;chip++){
+			int16_t meas[6];
+			for(uint8_t s=0;s<6;s++){
+				double light = noise*gaussian();
+				for(uint8_t k=0;k<count;k++){
+					light += coded_light(senders[k], codes[k], offsets[k], e, chip, s);
+				}
+				if(light>ADC_SATURATION) light = ADC_SATURATION;
+				meas[s] = (int16_t)lround(light);
+			}
+			rnb_correlate_chip(sums, e, chip, meas);
+		}
+	}
+	rnb_decode_code(sums[codes[0]]);
+	rnb_decode_code(sums[codes[RNB_NUM_CODES-1]]);
+	memcpy(bm, sums[codes[0]], sizeof(sums[0]));
+	memcpy(empty, sums[codes[RNB_NUM_CODES-1]], sizeof(sums[0]));
+	return count;
+}
+#endif
+
+static void replay_one(ReplayRecord* recs, uint32_t numRecs __attribute__ ((unused)), uint32_t idx, ReplayStats* stats){
+	ReplayRecord* rec = &(recs[idx]);
+	RnbMatrixSums sums;
+	RnbEstimate est;
+	int16_t bm[6][6];
+	uint8_t ok = 0;
+#ifdef RNB_CODED_BROADCASTS
+	if(numSenders){
+		int16_t empty[6][6];
+		stats->senders += apply_coded(recs, numRecs, idx, bm, empty);
+		for(uint8_t e=0;e<6;e++){
+			for(uint8_t s=0;s<6;s++){
+				double diff = bm[e][s]-rec->bm[e][s];
+				stats->sepSqSum += diff*diff;
+			}
+		}
+		rnb_sum_matrix(empty, &sums);
+		if(sums.total>=RNB_CODED_MIN_TOTAL && rnb_estimate(empty, &sums, RNB_FULL_POWER, &est)) stats->emptyPassed++;
+	}else
+#endif
+	stats->conversions += apply_schedule(rec, bm);
+	clock_t start = clock();
+	for(uint16_t i=0;i<TIMING_REPEATS;i++){
+		rnb_sum_matrix(bm, &sums);
+		ok = rnb_estimate(bm, &sums, uncorrected ? RNB_FULL_POWER : replayPower, &est);
+	}
+	stats->seconds += (double)(clock()-start)/CLOCKS_PER_SEC/TIMING_REPEATS;
+	stats->records++;
+	if(numSenders && sums.total<RNB_CODED_MIN_TOTAL) ok = 0;
+	if(!ok) return;
+	ReplayPrior* prior = find_prior(rec);
+	if(gate){
+		RnbEstimate prev;
+		uint8_t havePrior = prior && (rec->time - prior->time)<PRIOR_MAX_AGE;
+		if(havePrior){
+			prev.range		= prior->range;
+			prev.bearing	= prior->bearing;
+			prev.heading	= prior->heading;
+		}
+		if(!rnb_confidence(&sums, &est, havePrior ? &prev : NULL, havePrior ? (uint32_t)(1000*(rec->time - prior->time)) : 0)){
+			stats->rejected++;
+			return;
+		}
+	}
+	if(!prior && numPriors<MAX_PRIORS) prior = &(priors[numPriors++]);
+	if(prior){
+		strcpy(prior->txID, rec->txID);
+		strcpy(prior->rxID, rec->rxID);
+		prior->time		= rec->time;
+		prior->range	= est.range;
+		prior->bearing	= est.bearing;
+		prior->heading	= est.heading;
+	}
+	double rangeErr = est.range/16.0 - rec->range;
+	stats->rangeSqSum += rangeErr*rangeErr;
+	stats->rangeErr[stats->valid]	= fabs(rangeErr);
+	stats->bearingErr[stats->valid]	= fabs(wrap_deg(est.bearing - rec->bearing));
+	stats->headingErr[stats->valid]	= fabs(wrap_deg(est.heading - rec->heading));
+	stats->gross += fabs(rangeErr)>100 || stats->bearingErr[stats->valid]>90;
+	stats->valid++;
+}
+
+static void print_stats(const char* name, ReplayStats* stats){
+	uint32_t n = stats->valid;
+	printf("%s\n", name);
+	printf("\t%u records, %u with an estimate. %.2f us per estimate.\n", stats->records, n, stats->records ? 1e6*stats->seconds/stats->records : 0.0);
+	if(stats->senders){
+		printf("\t%.2f senders per record. Separated brightness RMS error %.1f. %u unused codes gave an estimate.\n",
+			(double)stats->senders/stats->records, sqrt(stats->sepSqSum/(36.0*stats->records)), stats->emptyPassed);
+	}
+	if(measTime){
+		printf("\t%.1f conversions per record.\n", stats->records ? (double)stats->conversions/stats->records : 0.0);
+	}
+	if(gate){
+		printf("\t%u rejected by rnb_confidence (%.1f%% of the estimates).\n", stats->rejected,
+			(n+stats->rejected) ? 100.0*stats->rejected/(n+stats->rejected) : 0.0);
+	}
+	if(!n) return;
+	printf("\t%u gross errors (over 100mm or 90 degrees of bearing).\n", stats->gross);
+	printf("\trange (mm):   RMSE %6.1f | median %5.1f  p90 %5.1f  max %6.1f\n", sqrt(stats->rangeSqSum/n),
+		percentile(stats->rangeErr, n, 0.5), percentile(stats->rangeErr, n, 0.9), percentile(stats->rangeErr, n, 1.0));
+	printf("\tbearing (deg):             median %5.1f  p90 %5.1f  max %6.1f\n",
+		percentile(stats->bearingErr, n, 0.5), percentile(stats->bearingErr, n, 0.9), percentile(stats->bearingErr, n, 1.0));
+	printf("\theading (deg):             median %5.1f  p90 %5.1f  max %6.1f\n",
+		percentile(stats->headingErr, n, 0.5), percentile(stats->headingErr, n, 0.9), percentile(stats->headingErr, n, 1.0));
+}
+
+static char* read_file(const char* path){
+	FILE* f = fopen(path, "rb");
+	if(!f) return NULL;
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char* buf = malloc(len+1);
+	if(buf){
+		buf[fread(buf, 1, len, f)] = '\0';
+	}
+	fclose(f);
+	return buf;
+}
+
+static void append_stats(ReplayStats* total, ReplayStats* part){
+	memcpy(total->rangeErr+total->valid, part->rangeErr, part->valid*sizeof(double));
+	memcpy(total->bearingErr+total->valid, part->bearingErr, part->valid*sizeof(double));
+	memcpy(total->headingErr+total->valid, part->headingErr, part->valid*sizeof(double));
+	total->records		+= part->records;
+	total->valid		+= part->valid;
+	total->rangeSqSum	+= part->rangeSqSum;
+	total->seconds		+= part->seconds;
+	total->senders		+= part->senders;
+	total->emptyPassed	+= part->emptyPassed;
+	total->sepSqSum		+= part->sepSqSum;
+	total->rejected		+= part->rejected;
+	total->gross		+= part->gross;
+	total->conversions	+= part->conversions;
+}
+
+int main(int argc, char** argv){
+	double maxRangeRMSE = INFINITY, maxBearing = INFINITY, maxHeading = INFINITY;
+	uint8_t csv = 0;
+	int opt;
+	while((opt = getopt(argc, argv, "r:b:h:n:m:s:k:j:p:uagc"))!=-1){
+		switch(opt){
+			case 'r': maxRangeRMSE	= atof(optarg); break;
+			case 'b': maxBearing	= atof(optarg); break;
+			case 'h': maxHeading	= atof(optarg); break;
+			case 'n': numSamples	= atoi(optarg); break;
+			case 'm': measTime		= atoi(optarg); break;
+			case 's': facingSpread	= atoi(optarg); break;
+			case 'k': numSenders	= atoi(optarg); break;
+			case 'j': syncJitter	= atof(optarg); break;
+			case 'p': replayPower	= atoi(optarg); break;
+			case 'u': uncorrected = 1; break;
+			case 'a': adaptive = 1; break;
+			case 'g': gate = 1; break;
+			case 'c': csv = 1; break;
+			default:
+				fprintf(stderr, "Usage: %s [-r max range RMSE] [-b max median bearing err] [-h max median heading err] [-n samples | -m ms] [-s spread] [-k senders [-j jitter]] [-p power [-u]] [-a] [-g] [-c] rnbCalibData_*.txt\n", argv[0]);
+				return 2;
+		}
+	}
+	if(!numSamples){
+		fprintf(stderr, "-n needs at least 1 sample.\n");
+		return 2;
+	}
+	if(adaptive && !measTime){
+		fprintf(stderr, "-a needs -m.\n");
+		return 2;
+	}
+	if(replayPower<1 || replayPower>RNB_FULL_POWER){
+		fprintf(stderr, "-p needs a power from 1 to %u.\n", RNB_FULL_POWER);
+		return 2;
+	}
+	if(numSenders && replayPower<RNB_FULL_POWER){
+		fprintf(stderr, "-p doesn't go with -k.\n");
+		return 2;
+	}
+#ifdef RNB_CODED_BROADCASTS
+	if(numSenders>RNB_NUM_CODES-1){
+		fprintf(stderr, "-k can be at most %u, leaving a code unused.\n", RNB_NUM_CODES-1);
+		return 2;
+	}
+#else
+	if(numSenders){
+		fprintf(stderr, "-k needs rnb_replay built with -DRNB_CODED_BROADCASTS.\n");
+		return 2;
+	}
+#endif
+	srand(1);
+	if(optind>=argc){
+		fprintf(stderr, "No logs given.\n");
+		return 2;
+	}
+
+	ReplayStats total = {0};
+	ReplayStats file;
+	for(int i=optind;i<argc;i++){
+		char* buf = read_file(argv[i]);
+		if(!buf){
+			fprintf(stderr, "Couldn't read %s.\n", argv[i]);
+			return 2;
+		}
+		//Records are one to a line.
+		size_t maxRecords = 1;
+		for(char* c = buf; *c; c++) maxRecords += (*c=='\n');
+		memset(&file, 0, sizeof(file));
+		numPriors = 0;
+		file.rangeErr	= malloc(maxRecords*sizeof(double));
+		file.bearingErr	= malloc(maxRecords*sizeof(double));
+		file.headingErr	= malloc(maxRecords*sizeof(double));
+		total.rangeErr		= realloc(total.rangeErr, (total.valid+maxRecords)*sizeof(double));
+		total.bearingErr	= realloc(total.bearingErr, (total.valid+maxRecords)*sizeof(double));
+		total.headingErr	= realloc(total.headingErr, (total.valid+maxRecords)*sizeof(double));
+
+		ReplayRecord* recs = malloc(maxRecords*sizeof(ReplayRecord));
+		uint32_t numRecs = 0;
+		char* pos = buf;
+		int8_t result;
+		while((result = parse_record(&pos, &(recs[numRecs])))>=0){
+			if(result) numRecs++;
+		}
+		for(uint32_t r=0;r<numRecs;r++){
+			if(recs[r].scored) replay_one(recs, numRecs, r, &file);
+		}
+		free(recs);
+		append_stats(&total, &file);
+		if(!csv) print_stats(argv[i], &file);
+		free(file.rangeErr);
+		free(file.bearingErr);
+		free(file.headingErr);
+		free(buf);
+	}
+	if(csv){
+		printf("%u,%u,%.2f,%.2f,%.2f,%.2f\n", total.records, total.valid, total.valid ? sqrt(total.rangeSqSum/total.valid) : NAN,
+			percentile(total.rangeErr, total.valid, 0.5), percentile(total.bearingErr, total.valid, 0.5), percentile(total.headingErr, total.valid, 0.5));
+	}else if(argc-optind>1){
+		print_stats("Total", &total);
+	}
+
+	uint8_t failed = 0;
+	double rangeRMSE = total.valid ? sqrt(total.rangeSqSum/total.valid) : INFINITY;
+	double bearingMed = percentile(total.bearingErr, total.valid, 0.5);
+	double headingMed = percentile(total.headingErr, total.valid, 0.5);
+	if(!(rangeRMSE<=maxRangeRMSE)){
+		printf("FAIL: range RMSE %.1fmm is over %.1fmm.\n", rangeRMSE, maxRangeRMSE);
+		failed = 1;
+	}
+	if(!(bearingMed<=maxBearing)){
+		printf("FAIL: median bearing error %.1f degrees is over %.1f.\n", bearingMed, maxBearing);
+		failed = 1;
+	}
+	if(!(headingMed<=maxHeading)){
+		printf("FAIL: median heading error %.1f degrees is over %.1f.\n", headingMed, maxHeading);
+		failed = 1;
+	}
+	return failed;
+}
@@ -0,0 +1,268 @@
+/*
+ * Simulates pairs of Droplets wandering about, and runs droplet_code/src/rnb_track.c, unmodified, on noisy RNB
+ * results between them, to check the tracker does better than the results it's given.
+ *
+ * Build, from this directory:
+ *   gcc -O2 -std=gnu99 -I host -I ../../../droplet_code/include rnb_track_sim.c ../../../droplet_code/src/rnb_track.c ../../../droplet_code/src/rnb_math.c -lm -o rnb_track_sim
+ *
+ * Usage:
+ *   ./rnb_track_sim [-t trials] [-d seconds] [-p period] [-q outliers] [-o] [-r seed] [-e min,max]
+ *
+ * Each trial puts a neighbour somewhere from 60 to 250mm away, facing anywhere. Every so often each Droplet
+ * walks up to 60mm in one of its six directions, or spins up to 90 degrees, at about the speed a Droplet
+ * does; the neighbour is kept from wandering closer than 50mm or further than 300mm. Every 'period' seconds
+ * (default 2) the receiver gets an RNB result, with the noise rnb_track.h assumes at a random confidence,
+ * except that 'outliers' of them (default 0.1) are nonsense: any bearing, any heading, and a range off by up
+ * to half. The receiver's own moves are passed to rnb_track_move, with the real move off from what it was
+ * told by 10% or so, as odometry would be. -o turns that off, so the tracker only sees its own moves as the
+ * neighbour moving. As in neighbor_rnb, a result which comes in while the receiver is moving only moves the
+ * track on in time: the move isn't passed on until it's over.
+ *
+ * It prints the median and 90th percentile errors of the raw results and the tracker, right after each
+ * update, and how well the tracker's covariance covers its position error: the mean of e'P^-1e, the NEES
+ * (2.0 if it's right), and how often the truth is inside the 95% ellipse. It exits with 1 if the mean NEES is
+ * outside min,max (default 1.4,2.6), so a change to the noise model that makes the tracker overconfident,
+ * or much too cautious, fails. With -o it's expected to.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "rnb_track.h"
+
+#define TICK			0.1		//s
+#define WALK_SPEED		15.0	//mm/s
+#define SPIN_SPEED		30.0	//degrees/s
+#define MOVE_CHANCE		0.02	//Per tick, for an idle Droplet.
+#define MIN_RANGE		50.0	//mm
+#define MAX_RANGE		300.0
+#define ODOM_ERROR		0.1		//Fraction of each move.
+#define CHI2_95_2DOF	5.991
+
+typedef struct sim_droplet_struct{
+	double	x, y;		//mm, world frame.
+	double	theta;		//degrees, counter-clockwise. Bearing 0 points along theta.
+	double	moveLeft;	//s
+	double	vx, vy, spin;
+	double	odomX, odomY, odomTurn; //What the Droplet thinks this move is, in its own frame.
+} SimDroplet;
+
+typedef struct err_list_struct{
+	double*	vals;
+	uint32_t n;
+} ErrList;
+
+static double wrap_deg(double a){
+	a = fmod(a+180.0, 360.0);
+	if(a<0) a += 360.0;
+	return a-180.0;
+}
+
+static double uniform(double lo, double hi){
+	return lo + (hi-lo)*rand()/(double)RAND_MAX;
+}
+
+static double gaussian(){
+	double u = (rand()+1.0)/(RAND_MAX+2.0);
+	double v = (rand()+1.0)/(RAND_MAX+2.0);
+	return sqrt(-2.0*log(u))*cos(2.0*M_PI*v);
+}
+
+static int cmp_double(const void* a, const void* b){
+	double da = *(const double*)a, db = *(const double*)b;
+	return (da>db) - (da<db);
+}
+
+static double percentile(ErrList* l, double p){
+	if(!l->n) return 0;
+	qsort(l->vals, l->n, sizeof(double), cmp_double);
+	uint32_t i = (uint32_t)(p*(l->n-1) + 0.5);
+	return l->vals[i];
+}
+
+static void push(ErrList* l, double v){
+	l->vals[l->n++] = v;
+}
+
+//Where 'other' is, as seen from 'me': range (mm), bearing and heading (degrees).
+static void relative(SimDroplet* me, SimDroplet* other, double* range, double* bearing, double* heading){
+	double dx = other->x - me->x;
+	double dy = other->y - me->y;
+	*range		= sqrt(dx*dx + dy*dy);
+	*bearing	= wrap_deg(atan2(dy, dx)*180.0/M_PI - me->theta);
+	*heading	= wrap_deg(other->theta - me->theta);
+}
+
+//Maybe starts a move. The world-frame velocity is the real one, off from what odometry will say.
+static void maybe_move(SimDroplet* d, SimDroplet* other, uint8_t keepRange){
+	if(d->moveLeft>0 || uniform(0, 1)>MOVE_CHANCE) return;
+	uint8_t dir = rand()%8;
+	double real = 1.0 + ODOM_ERROR*gaussian();
+	if(dir<6){
+		double dist = uniform(10, 60);
+		double angle = -60.0*dir; //NORTH is bearing 0, and the directions go clockwise.
+		double worldAngle = (d->theta + angle)*M_PI/180.0;
+		if(keepRange){
+			double ex = d->x + dist*cos(worldAngle) - other->x;
+			double ey = d->y + dist*sin(worldAngle) - other->y;
+			double r = sqrt(ex*ex + ey*ey);
+			if(r<MIN_RANGE || r>MAX_RANGE) return;
+		}
+		d->moveLeft	= dist/WALK_SPEED;
+		d->vx		= real*WALK_SPEED*cos(worldAngle);
+		d->vy		= real*WALK_SPEED*sin(worldAngle);
+		d->spin		= 0;
+		d->odomX	= dist*cos(angle*M_PI/180.0);
+		d->odomY	= dist*sin(angle*M_PI/180.0);
+		d->odomTurn	= 0;
+	}else{
+		double turn = uniform(15, 90)*(dir==6 ? -1 : 1);
+		d->moveLeft	= fabs(turn)/SPIN_SPEED;
+		d->vx		= 0;
+		d->vy		= 0;
+		d->spin		= real*turn/d->moveLeft;
+		d->odomX	= 0;
+		d->odomY	= 0;
+		d->odomTurn	= turn;
+	}
+}
+
+//Returns '1' when a move finishes.
+static uint8_t step(SimDroplet* d){
+	if(d->moveLeft<=0) return 0;
+	double dt = d->moveLeft<TICK ? d->moveLeft : TICK;
+	d->x		+= d->vx*dt;
+	d->y		+= d->vy*dt;
+	d->theta	= wrap_deg(d->theta + d->spin*dt);
+	d->moveLeft	-= dt;
+	return d->moveLeft<=0;
+}
+
+int main(int argc, char** argv){
+	uint32_t trials = 200;
+	double duration = 120.0;
+	double period = 2.0;
+	double outliers = 0.1;
+	uint8_t useOdometry = 1;
+	unsigned seed = 1;
+	double neesMin = 1.4, neesMax = 2.6;
+	int opt;
+	while((opt = getopt(argc, argv, "t:d:p:q:or:e:"))!=-1){
+		switch(opt){
+			case 't': trials		= atoi(optarg); break;
+			case 'd': duration		= atof(optarg); break;
+			case 'p': period		= atof(optarg); break;
+			case 'q': outliers		= atof(optarg); break;
+			case 'o': useOdometry	= 0; break;
+			case 'r': seed			= atoi(optarg); break;
+			case 'e':
+				if(sscanf(optarg, "%lf,%lf", &neesMin, &neesMax)==2) break;
+				//Fall through.
+			default:
+				fprintf(stderr, "Usage: %s [-t trials] [-d seconds] [-p period] [-q outliers] [-o] [-r seed] [-e min,max]\n", argv[0]);
+				return 2;
+		}
+	}
+	srand(seed);
+	uint32_t maxResults = trials*(uint32_t)(duration/period + 2);
+	ErrList raw[4], trk[4]; //position, range, bearing, heading
+	for(uint8_t i=0;i<4;i++){
+		raw[i].vals = malloc(maxResults*sizeof(double));
+		trk[i].vals = malloc(maxResults*sizeof(double));
+		raw[i].n = trk[i].n = 0;
+	}
+	double neesSum = 0;
+	uint32_t inside = 0, rejected = 0, skipped = 0;
+
+	for(uint32_t trial=0;trial<trials;trial++){
+		SimDroplet me = {0}, nbr = {0};
+		double r0 = uniform(60, 250), a0 = uniform(-M_PI, M_PI);
+		nbr.x		= r0*cos(a0);
+		nbr.y		= r0*sin(a0);
+		nbr.theta	= uniform(-180, 180);
+		RnbTrack track;
+		uint8_t started = 0;
+		double lastUpdate = 0;
+		double nextResult = uniform(0, period);
+		for(double now=0;now<duration;now+=TICK){
+			maybe_move(&me, &nbr, 1);
+			maybe_move(&nbr, &me, 1);
+			if(step(&me) && started && useOdometry){
+				rnb_track_move(&track, (int16_t)lround(me.odomX), (int16_t)lround(me.odomY), (int16_t)lround(me.odomTurn));
+			}
+			step(&nbr);
+			if(now<nextResult) continue;
+			nextResult += period;
+
+			double range, bearing, heading;
+			relative(&me, &nbr, &range, &bearing, &heading);
+			uint8_t conf = 64 + rand()%192;
+			double scale = sqrt(255.0/conf);
+			double mRange, mBearing, mHeading;
+			if(uniform(0, 1)<outliers){
+				mRange		= range*uniform(0.5, 1.5);
+				mBearing	= uniform(-180, 180);
+				mHeading	= uniform(-180, 180);
+			}else{
+				mRange		= range + scale*(RNB_TRACK_RANGE_SD + range/RNB_TRACK_RANGE_SD_DIV)*gaussian();
+				mBearing	= bearing + scale*(RNB_TRACK_BEARING_SD + range/RNB_TRACK_BEARING_SD_DIV)*gaussian();
+				mHeading	= heading + scale*(RNB_TRACK_HEADING_SD + range/RNB_TRACK_HEADING_SD_DIV)*gaussian();
+			}
+			if(mRange<0) mRange = 0;
+			uint16_t r = (uint16_t)lround(mRange);
+			int16_t b = (int16_t)lround(wrap_deg(mBearing));
+			int16_t h = (int16_t)lround(wrap_deg(mHeading));
+			if(!started){
+				rnb_track_init(&track, r, b, h, conf);
+				started = 1;
+			}else{
+				rnb_track_predict(&track, (uint32_t)lround(1000*(now-lastUpdate)));
+				if(me.moveLeft>0) skipped++;
+				else rejected += !rnb_track_update(&track, r, b, h, conf);
+			}
+			lastUpdate = now;
+
+			RnbTrackPolar est;
+			rnb_track_polar(&track, &est);
+			double tx = range*cos(bearing*M_PI/180.0), ty = range*sin(bearing*M_PI/180.0);
+			push(&raw[0], hypot(r*cos(b*M_PI/180.0) - tx, r*sin(b*M_PI/180.0) - ty));
+			push(&raw[1], fabs(r - range));
+			push(&raw[2], fabs(wrap_deg(b - bearing)));
+			push(&raw[3], fabs(wrap_deg(h - heading)));
+			double ex = track.x/16.0 - tx, ey = track.y/16.0 - ty;
+			push(&trk[0], hypot(ex, ey));
+			push(&trk[1], fabs(est.range - range));
+			push(&trk[2], fabs(wrap_deg(est.bearing - bearing)));
+			push(&trk[3], fabs(wrap_deg(est.heading - heading)));
+
+			double det = (double)track.pxx*track.pyy - (double)track.pxy*track.pxy;
+			double nees = (ex*ex*track.pyy - 2*ex*ey*track.pxy + ey*ey*track.pxx)/det;
+			neesSum += nees;
+			inside += nees<CHI2_95_2DOF;
+		}
+	}
+
+	uint32_t n = raw[0].n;
+	printf("%u trials of %.0fs, a result every %.1fs, %.0f%% outliers, odometry %s.\n", trials, duration, period,
+		100*outliers, useOdometry ? "on" : "off");
+	printf("%u results, %u (%.1f%%) gated out by the tracker, %u (%.1f%%) while moving.\n", n, rejected,
+		n ? 100.0*rejected/n : 0.0, skipped, n ? 100.0*skipped/n : 0.0);
+	const char* names[4] = {"position (mm)", "range (mm)", "bearing (deg)", "heading (deg)"};
+	printf("                 raw median    p90 | tracked median    p90\n");
+	for(uint8_t i=0;i<4;i++){
+		printf("%-16s %10.1f %6.1f | %14.1f %6.1f\n", names[i], percentile(&raw[i], 0.5), percentile(&raw[i], 0.9),
+			percentile(&trk[i], 0.5), percentile(&trk[i], 0.9));
+	}
+	double nees = n ? neesSum/n : 0.0;
+	uint8_t ok = nees>=neesMin && nees<=neesMax;
+	printf("Position covariance: mean NEES %.2f (2.0 is consistent), %.1f%% inside the 95%% ellipse.\n",
+		nees, n ? 100.0*inside/n : 0.0);
+	printf("%s: NEES %s %.2f to %.2f.\n", ok ? "PASS" : "FAIL", ok ? "within" : "outside", neesMin, neesMax);
+	for(uint8_t i=0;i<4;i++){
+		free(raw[i].vals);
+		free(trk[i].vals);
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+/*
+ * Runs droplet_code/src/sensor_snapshot.c, unmodified, against a simulated ADC, the way ir_sensor's
+ * background sampler drives it, and checks every snapshot it publishes.
+ *
+ * Build, from this directory:
+ *   gcc -O2 -std=gnu99 -I host -I ../../../droplet_code/include snapshot_check.c ../../../droplet_code/src/sensor_snapshot.c ../../../droplet_code/src/median.c -o snapshot_check
+ *
+ * Usage:
+ *   ./snapshot_check [-s seconds] [-q spikes] [-i interruptions] [-r seed]
+ *
+ * Each sensor's light level wanders slowly, with a little noise on every reading, and a 'spikes' (default
+ * 0.02) chance of a reading being way off. Two samplers are run for 'seconds' (default 600) each:
+ *	muxed:	a non-audio Droplet. One channel is moved between the six IR sensors, and the first reading
+ *			after each move is still partly the last sensor's. The color sensor's three channels are
+ *			read every tick.
+ *	swept:	an audio Droplet. All six IR sensors are read every tick.
+ * Every so often ('interruptions' per second, default 2) something else takes the sensors for a few ticks,
+ * as ir_strength_sample or get_ir_sensors would, moving the mux to some other sensor, and the sampler
+ * starts again as ir_sampler_start does.
+ *
+ * Every snapshot must be exactly the median of the right readings, with none of the settling ones, and be
+ * stamped with the time of the last of them. It prints how often each mode has a reading far from the true
+ * level, against taking single readings, and how old the snapshots get.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sensor_snapshot.h"
+
+#define IR_CHANNELS		6
+#define NOISE			8		//Readings are the level, plus or minus this.
+#define SPIKE			1500	//How far off a spike is.
+#define FAR				200		//A snapshot this far from the level is counted as wrong.
+#define MAX_PAUSE		20		//Ticks something else can hold the sensors for.
+
+typedef struct sim_channel_struct{
+	int32_t		level;
+	int16_t		shadow[SNAPSHOT_SETTLE+SNAPSHOT_KEEP+1];	//Readings since the last reset, as we expect the filter has them.
+	uint8_t		tainted[SNAPSHOT_SETTLE+SNAPSHOT_KEEP+1];	//Which of those were taken before the mux settled.
+	uint8_t		count;
+	uint32_t	lastTime;
+	uint32_t	maxAge;
+	uint64_t	ageSum;
+	uint32_t	ageCount;
+} SimChannel;
+
+static SimChannel chans[SNAPSHOT_CHANNELS];
+static double spikes = 0.02;
+static uint32_t mismatches, published, farSnapshots, farReadings, readings;
+
+static double uniform(){
+	return rand()/(double)RAND_MAX;
+}
+
+static void wander(SimChannel* c){
+	c->level += (rand()%5)-2;
+	if(c->level<0) c->level = 0;
+	if(c->level>2000) c->level = 2000;
+}
+
+static int16_t reading(int32_t level){
+	int32_t r = level+(rand()%(2*NOISE+1))-NOISE;
+	if(uniform()<spikes) r += (rand()&1) ? SPIKE : -SPIKE;
+	return (int16_t)r;
+}
+
+static void reset(uint8_t ch){
+	snapshot_reset(ch);
+	chans[ch].count = 0;
+}
+
+static int cmp_int16(const void* a, const void* b){
+	return *(const int16_t*)a - *(const int16_t*)b;
+}
+
+//Feeds a reading to the filter and our shadow of it, and checks anything it publishes.
+static uint8_t add(uint8_t ch, int16_t raw, uint8_t tainted, uint32_t now, uint8_t muxed){
+	SimChannel* c = &(chans[ch]);
+	const uint8_t full = SNAPSHOT_SETTLE+SNAPSHOT_KEEP;
+	if(c->count==full){
+		memmove(&(c->shadow[SNAPSHOT_SETTLE]), &(c->shadow[SNAPSHOT_SETTLE+1]), (SNAPSHOT_KEEP-1)*sizeof(int16_t));
+		memmove(&(c->tainted[SNAPSHOT_SETTLE]), &(c->tainted[SNAPSHOT_SETTLE+1]), SNAPSHOT_KEEP-1);
+		c->count--;
+	}
+	c->shadow[c->count] = raw;
+	c->tainted[c->count] = tainted;
+	c->count++;
+	readings++;
+	if(abs(raw-c->level)>FAR) farReadings++;
+
+	uint8_t dir = snapshot_muxed_dir();
+	uint8_t done = muxed ? (snapshot_add_muxed(raw, now)!=dir) : snapshot_add(ch, raw, now);
+	int16_t val;
+	uint32_t time = snapshot_get(ch, &val);
+	uint8_t expect = (c->count==full);
+	if(done!=expect || (time!=c->lastTime)!=expect){
+		if(mismatches++<10) printf("ch %u at %ums: published %u, expected %u\n", ch, now, done, expect);
+		return done;
+	}
+	if(!done) return 0;
+	published++;
+	int16_t kept[SNAPSHOT_KEEP];
+	memcpy(kept, &(c->shadow[SNAPSHOT_SETTLE]), sizeof(kept));
+	qsort(kept, SNAPSHOT_KEEP, sizeof(int16_t), cmp_int16);
+	int16_t want = (SNAPSHOT_KEEP%2) ? kept[SNAPSHOT_KEEP/2] : (kept[SNAPSHOT_KEEP/2-1]+kept[SNAPSHOT_KEEP/2])/2;
+	uint8_t anyTainted = 0;
+	for(uint8_t i=SNAPSHOT_SETTLE;i<full;i++) anyTainted |= c->tainted[i];
+	if(val!=want || time!=(now ? now : 1) || anyTainted){
+		if(mismatches++<10) printf("ch %u at %ums: got %d at %u, want %d at %u%s\n", ch, now, val, time, want, now,
+			anyTainted ? ", from an unsettled reading" : "");
+	}
+	if(abs(val-c->level)>FAR) farSnapshots++;
+	c->lastTime = time;
+	return done;
+}
+
+static void age(uint32_t now){
+	for(uint8_t ch=0;ch<SNAPSHOT_CHANNELS;ch++){
+		SimChannel* c = &(chans[ch]);
+		if(!c->lastTime) continue;
+		uint32_t a = now-c->lastTime;
+		if(a>c->maxAge) c->maxAge = a;
+		c->ageSum += a;
+		c->ageCount++;
+	}
+}
+
+static void run(uint8_t muxed, double seconds, double interruptions){
+	snapshot_init();
+	memset(chans, 0, sizeof(chans));
+	for(uint8_t ch=0;ch<SNAPSHOT_CHANNELS;ch++) chans[ch].level = 100+rand()%1500;
+	mismatches = published = farSnapshots = farReadings = readings = 0;
+	uint32_t ticks = (uint32_t)(seconds*1e6/SNAPSHOT_TICK_US);
+	uint8_t mux = snapshot_muxed_dir(), lastMux = mux, sinceMove = 0;
+	uint32_t paused = 0;
+	for(uint32_t t=0;t<ticks;t++){
+		uint32_t now = (uint32_t)(((uint64_t)t*SNAPSHOT_TICK_US)/1000);
+		for(uint8_t ch=0;ch<SNAPSHOT_CHANNELS;ch++) wander(&(chans[ch]));
+		if(paused){ //Someone else has the IR sensors, and the mux.
+			if(--paused==0){
+				for(uint8_t ch=0;ch<(muxed ? SNAPSHOT_CHANNELS : IR_CHANNELS);ch++){
+					if(!muxed || ch>=IR_CHANNELS || ch==snapshot_muxed_dir()) reset(ch);
+				}
+				mux = snapshot_muxed_dir();
+			}
+			age(now);
+			continue;
+		}
+		if(uniform()<interruptions*SNAPSHOT_TICK_US/1e6){
+			paused = 1+rand()%MAX_PAUSE;
+			mux = lastMux = rand()%IR_CHANNELS;
+			age(now);
+			continue;
+		}
+		if(muxed){
+			//The conversion sees whatever the mux was set to; right after a move, it's still partly the last sensor.
+			if(mux!=lastMux) sinceMove = 0;
+			uint8_t tainted = (sinceMove==0);
+			int32_t level = tainted ? (chans[mux].level+chans[lastMux].level)/2 : chans[mux].level;
+			lastMux = mux;
+			if(sinceMove<255) sinceMove++;
+			int16_t raw = reading(level);
+			uint8_t dir = mux;
+			if(add(dir, raw, tainted, now, 1)) chans[snapshot_muxed_dir()].count = 0; //snapshot_add_muxed resets it.
+			mux = snapshot_muxed_dir();
+			for(uint8_t ch=IR_CHANNELS;ch<SNAPSHOT_CHANNELS;ch++) add(ch, reading(chans[ch].level), 0, now, 0);
+		}else{
+			for(uint8_t ch=0;ch<IR_CHANNELS;ch++) add(ch, reading(chans[ch].level), 0, now, 0);
+		}
+		age(now);
+	}
+	uint32_t maxAge = 0;
+	uint64_t ageSum = 0, ageCount = 0;
+	for(uint8_t ch=0;ch<IR_CHANNELS;ch++){
+		if(chans[ch].maxAge>maxAge) maxAge = chans[ch].maxAge;
+		ageSum += chans[ch].ageSum;
+		ageCount += chans[ch].ageCount;
+	}
+	printf("%-6s %9u %10u %9.3f%% %9.3f%% %8.1f %8u\n", muxed ? "muxed" : "swept", published, mismatches,
+		100.0*farReadings/readings, published ? 100.0*farSnapshots/published : 0.0,
+		ageCount ? (double)ageSum/ageCount : 0.0, maxAge);
+}
+
+int main(int argc, char** argv){
+	double seconds = 600, interruptions = 2;
+	unsigned seed = 1;
+	int opt;
+	while((opt = getopt(argc, argv, "s:q:i:r:"))!=-1){
+		switch(opt){
+			case 's': seconds		= atof(optarg); break;
+			case 'q': spikes		= atof(optarg); break;
+			case 'i': interruptions	= atof(optarg); break;
+			case 'r': seed			= atoi(optarg); break;
+			default:
+				fprintf(stderr, "Usage: %s [-s seconds] [-q spikes] [-i interruptions] [-r seed]\n", argv[0]);
+				return 2;
+		}
+	}
+	srand(seed);
+	printf("%.0fs each, %.1f%% spikes, %.1f interruptions/s, a tick every %uus.\n", seconds, 100*spikes,
+		interruptions, SNAPSHOT_TICK_US);
+	printf("mode   snapshots mismatches  far reads  far snaps  IR age (ms) mean, max\n");
+	uint32_t bad = 0;
+	run(1, seconds, interruptions);
+	bad += mismatches;
+	run(0, seconds, interruptions);
+	bad += mismatches;
+	return bad!=0;
+}